@@ -0,0 +1,356 @@
+/* archive.c -- packed assets archive mounted under the file hooks
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#define _GNU_SOURCE
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <SDL2/SDL.h>
+#include <zlib.h>
+
+#include "main.h"
+#include "archive.h"
+#include "cookie.h"
+#include "hash.h"
+#include "iosched.h"
+#include "vfs.h"
+
+#define ARCHIVE_BUFFER_SIZE (16 * 1024)
+#define ARCHIVE_QUEUE_SIZE 32
+
+typedef struct {
+	int entry;
+	uint32_t pos;
+	int cls;
+
+	// Compressed entries only
+	uint32_t *index;
+	uint32_t num_chunks;
+	uint8_t *chunk_buf[2];
+	int chunk_id[2];
+	int cur;
+	int pending; // Chunk the worker is decoding into the spare buffer, -1 if idle
+	uint8_t *scratch;
+} archive_stream;
+
+typedef struct {
+	archive_stream *s;
+	int slot;
+	int chunk;
+} archive_job;
+
+static SceUID archive_fd = -1;
+static archive_entry *entries = NULL;
+static char *names = NULL;
+static uint32_t num_entries = 0;
+
+static pthread_mutex_t worker_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static archive_job queue[ARCHIVE_QUEUE_SIZE];
+static int queue_head = 0, queue_tail = 0;
+
+static int decode_chunk(archive_stream *s, int chunk, uint8_t *dst, uint8_t *scratch) {
+	archive_entry *e = &entries[s->entry];
+	uint32_t raw_len = e->size - chunk * ARCHIVE_CHUNK_SIZE;
+	if (raw_len > ARCHIVE_CHUNK_SIZE)
+		raw_len = ARCHIVE_CHUNK_SIZE;
+	uint32_t stored_len = s->index[chunk + 1] - s->index[chunk];
+	uint32_t offset = e->offset + s->index[chunk];
+
+	if (stored_len == raw_len)
+		return iosched_read(archive_fd, dst, raw_len, offset, s->cls) == raw_len ? 0 : -1;
+
+	if (stored_len > ARCHIVE_CHUNK_SIZE || iosched_read(archive_fd, scratch, stored_len, offset, s->cls) != stored_len)
+		return -1;
+	uLongf dst_len = raw_len;
+	if (uncompress(dst, &dst_len, scratch, stored_len) != Z_OK || dst_len != raw_len)
+		return -1;
+	return 0;
+}
+
+static int worker_thread(SceSize args, void *argp) {
+	uint8_t *scratch = malloc(ARCHIVE_CHUNK_SIZE);
+	for (;;) {
+		pthread_mutex_lock(&worker_mtx);
+		while (queue_head == queue_tail)
+			pthread_cond_wait(&worker_cond, &worker_mtx);
+		archive_job job = queue[queue_tail];
+		queue_tail = (queue_tail + 1) % ARCHIVE_QUEUE_SIZE;
+		pthread_mutex_unlock(&worker_mtx);
+
+		int res = decode_chunk(job.s, job.chunk, job.s->chunk_buf[job.slot], scratch);
+
+		pthread_mutex_lock(&worker_mtx);
+		job.s->chunk_id[job.slot] = res < 0 ? -1 : job.chunk;
+		job.s->pending = -1;
+		pthread_cond_broadcast(&done_cond);
+		pthread_mutex_unlock(&worker_mtx);
+	}
+	return 0;
+}
+
+// Caller must hold worker_mtx
+static void wait_pending(archive_stream *s) {
+	while (s->pending >= 0)
+		pthread_cond_wait(&done_cond, &worker_mtx);
+}
+
+// Makes the requested chunk current and queues the next one on the worker core
+static uint8_t *get_chunk(archive_stream *s, int chunk) {
+	pthread_mutex_lock(&worker_mtx);
+	if (s->chunk_id[s->cur] != chunk) {
+		int spare = s->cur ^ 1;
+		if (s->pending == chunk || s->chunk_id[spare] == chunk) {
+			wait_pending(s);
+			s->cur = spare;
+		} else {
+			wait_pending(s);
+			pthread_mutex_unlock(&worker_mtx);
+			int res = decode_chunk(s, chunk, s->chunk_buf[s->cur], s->scratch);
+			pthread_mutex_lock(&worker_mtx);
+			s->chunk_id[s->cur] = res < 0 ? -1 : chunk;
+		}
+	}
+
+	uint8_t *buf = s->chunk_id[s->cur] == chunk ? s->chunk_buf[s->cur] : NULL;
+	int next = chunk + 1, spare = s->cur ^ 1;
+	if (buf && next < s->num_chunks && s->pending < 0 && s->chunk_id[spare] != next
+		&& (queue_head + 1) % ARCHIVE_QUEUE_SIZE != queue_tail) {
+		s->pending = next;
+		s->chunk_id[spare] = -1;
+		queue[queue_head] = (archive_job){s, spare, next};
+		queue_head = (queue_head + 1) % ARCHIVE_QUEUE_SIZE;
+		pthread_cond_signal(&worker_cond);
+	}
+	pthread_mutex_unlock(&worker_mtx);
+	return buf;
+}
+
+int archive_init(void) {
+	SceUID fd = sceIoOpen(DATA_PATH "/" ARCHIVE_NAME, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return 0;
+
+	archive_header hdr;
+	if (sceIoRead(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != ARCHIVE_MAGIC || hdr.version != ARCHIVE_VERSION) {
+		sceIoClose(fd);
+		return 0;
+	}
+
+	// The whole central directory is loaded with a single read
+	uint32_t dir_size = hdr.num_entries * sizeof(archive_entry) + hdr.names_size;
+	uint8_t *dir = malloc(dir_size);
+	if (!dir || sceIoPread(fd, dir, dir_size, hdr.dir_offset) != dir_size) {
+		free(dir);
+		sceIoClose(fd);
+		return 0;
+	}
+
+	entries = (archive_entry *)dir;
+	names = (char *)dir + hdr.num_entries * sizeof(archive_entry);
+	num_entries = hdr.num_entries;
+	archive_fd = fd;
+
+	int compressed = 0;
+	for (uint32_t i = 0; i < num_entries; i++) {
+		if (entries[i].flags & ARCHIVE_COMPRESSED)
+			compressed++;
+	}
+	if (compressed) {
+		SceUID thid = sceKernelCreateThread("archive_worker", worker_thread, 0x10000100, 0x4000, 0, SCE_KERNEL_CPU_MASK_USER_2, NULL);
+		sceKernelStartThread(thid, 0, NULL);
+	}
+
+	debugPrintf("archive: mounted %u files (%d compressed)\n", num_entries, compressed);
+	return num_entries;
+}
+
+int archive_count(void) {
+	return num_entries;
+}
+
+const char *archive_entry_name(int entry, uint32_t *size) {
+	if (size)
+		*size = entries[entry].size;
+	return names + entries[entry].name;
+}
+
+int archive_lookup(const char *path) {
+	char rel[512];
+	if (archive_fd < 0 || !vfs_relpath(path, rel, sizeof(rel)))
+		return -1;
+
+	uint32_t hash = path_hash(rel);
+	uint32_t lo = 0, hi = num_entries;
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (entries[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < num_entries && entries[lo].hash == hash; lo++) {
+		if (!strcasecmp(names + entries[lo].name, rel))
+			return lo;
+	}
+	return -1;
+}
+
+static archive_stream *stream_open(int entry, int cls) {
+	archive_stream *s = calloc(1, sizeof(archive_stream));
+	if (!s)
+		return NULL;
+	s->entry = entry;
+	s->cls = cls;
+	s->pending = -1;
+
+	archive_entry *e = &entries[entry];
+	if (e->flags & ARCHIVE_COMPRESSED) {
+		s->num_chunks = (e->size + ARCHIVE_CHUNK_SIZE - 1) / ARCHIVE_CHUNK_SIZE;
+		uint32_t index_size = (s->num_chunks + 1) * sizeof(uint32_t);
+		s->index = malloc(index_size);
+		s->chunk_buf[0] = malloc(ARCHIVE_CHUNK_SIZE);
+		s->chunk_buf[1] = malloc(ARCHIVE_CHUNK_SIZE);
+		s->scratch = malloc(ARCHIVE_CHUNK_SIZE);
+		s->chunk_id[0] = s->chunk_id[1] = -1;
+		if (!s->index || !s->chunk_buf[0] || !s->chunk_buf[1] || !s->scratch
+			|| iosched_read(archive_fd, s->index, index_size, e->offset, cls) != index_size) {
+			free(s->index);
+			free(s->chunk_buf[0]);
+			free(s->chunk_buf[1]);
+			free(s->scratch);
+			free(s);
+			return NULL;
+		}
+	}
+	return s;
+}
+
+static int stream_close(void *stream) {
+	archive_stream *s = (archive_stream *)stream;
+	if (s->index) {
+		// The worker may still be writing to the spare buffer
+		pthread_mutex_lock(&worker_mtx);
+		wait_pending(s);
+		pthread_mutex_unlock(&worker_mtx);
+		free(s->index);
+		free(s->chunk_buf[0]);
+		free(s->chunk_buf[1]);
+		free(s->scratch);
+	}
+	free(s);
+	return 0;
+}
+
+static int stream_read(void *stream, void *dst, uint32_t size) {
+	archive_stream *s = (archive_stream *)stream;
+	archive_entry *e = &entries[s->entry];
+	if (s->pos >= e->size)
+		return 0;
+	if (size > e->size - s->pos)
+		size = e->size - s->pos;
+
+	if (!s->index) {
+		int r = iosched_read(archive_fd, dst, size, e->offset + s->pos, s->cls);
+		if (r > 0)
+			s->pos += r;
+		return r;
+	}
+
+	uint32_t done = 0;
+	while (done < size) {
+		uint8_t *chunk = get_chunk(s, s->pos / ARCHIVE_CHUNK_SIZE);
+		if (!chunk)
+			return done ? done : -1;
+		uint32_t chunk_pos = s->pos % ARCHIVE_CHUNK_SIZE;
+		uint32_t len = ARCHIVE_CHUNK_SIZE - chunk_pos;
+		if (len > size - done)
+			len = size - done;
+		memcpy((uint8_t *)dst + done, chunk + chunk_pos, len);
+		done += len;
+		s->pos += len;
+	}
+	return done;
+}
+
+int archive_read(int entry, void *dst, uint32_t offset, uint32_t size, int cls) {
+	archive_entry *e = &entries[entry];
+	if (offset >= e->size)
+		return 0;
+	if (size > e->size - offset)
+		size = e->size - offset;
+	if (!(e->flags & ARCHIVE_COMPRESSED))
+		return iosched_read(archive_fd, dst, size, e->offset + offset, cls);
+
+	archive_stream *s = stream_open(entry, cls);
+	if (!s)
+		return -1;
+	s->pos = offset;
+	int r = stream_read(s, dst, size);
+	stream_close(s);
+	return r;
+}
+
+static int64_t stream_seek(void *stream, int64_t offset, int whence) {
+	archive_stream *s = (archive_stream *)stream;
+	int64_t pos;
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = s->pos + offset;
+		break;
+	case SEEK_END:
+		pos = entries[s->entry].size + offset;
+		break;
+	default:
+		return -1;
+	}
+	if (pos < 0)
+		return -1;
+	s->pos = pos;
+	return pos;
+}
+
+static int64_t stream_size(void *stream) {
+	return entries[((archive_stream *)stream)->entry].size;
+}
+
+static const cookie_funcs funcs = {stream_read, NULL, stream_seek, stream_size, stream_close};
+
+FILE *archive_fopen(int entry) {
+	archive_stream *s = stream_open(entry, iosched_class(names + entries[entry].name));
+	if (!s)
+		return NULL;
+
+	FILE *f = cookie_fopen(s, &funcs, "r");
+	if (!f) {
+		stream_close(s);
+		return NULL;
+	}
+	setvbuf(f, NULL, _IOFBF, ARCHIVE_BUFFER_SIZE);
+	return f;
+}
+
+SDL_RWops *archive_rwops(int entry) {
+	archive_stream *s = stream_open(entry, iosched_class(names + entries[entry].name));
+	if (!s)
+		return NULL;
+	SDL_RWops *ctx = cookie_rwops(s, &funcs);
+	if (!ctx)
+		stream_close(s);
+	return ctx;
+}
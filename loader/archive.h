@@ -0,0 +1,55 @@
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define ARCHIVE_MAGIC 0x4B505652 // RVPK
+#define ARCHIVE_VERSION 2
+#define ARCHIVE_NAME "assets.rvp"
+#define ARCHIVE_ALIGN 16
+#define ARCHIVE_CHUNK_SIZE (64 * 1024)
+
+#define ARCHIVE_COMPRESSED 1
+
+/*
+ * Layout: header, file data grouped by level/car folder, central directory sorted by hash, names.
+ * All offsets are absolute and every file path is relative to DATA_PATH.
+ *
+ * Compressed entries start with a table of num_chunks + 1 offsets relative to the entry, followed by
+ * the chunks themselves. Each chunk holds ARCHIVE_CHUNK_SIZE bytes of the file (less for the last one)
+ * as an independent zlib stream, or raw when its stored length matches its uncompressed length.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_entries;
+	uint32_t dir_offset;
+	uint32_t names_size;
+	uint32_t reserved[3];
+} archive_header;
+
+typedef struct {
+	uint32_t hash;
+	uint32_t name; // Offset in the names table
+	uint32_t offset;
+	uint32_t size;
+	uint32_t stored_size; // Including the chunk table for compressed entries
+	uint32_t flags;
+} archive_entry;
+
+#ifdef __vita__
+struct SDL_RWops;
+
+int archive_init(void);
+int archive_count(void);
+const char *archive_entry_name(int entry, uint32_t *size);
+
+int archive_lookup(const char *path);
+int archive_read(int entry, void *dst, uint32_t offset, uint32_t size, int cls);
+
+FILE *archive_fopen(int entry);
+struct SDL_RWops *archive_rwops(int entry);
+#endif
+
+#endif
@@ -0,0 +1,583 @@
+/* batch.c -- merges consecutive fixed function client array draws into one
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "batch.h"
+#include "glstate.h"
+#include "stream.h"
+#include "meshopt.h"
+#include "vertfmt.h"
+#include "lightvar.h"
+
+/*
+ * HUD, fonts and menus come as many small GL_TRIANGLES draws with client arrays and no program.
+ * Their vertices are copied into the pending batch and indices rebased, the batch is drawn as one
+ * call when anything else happens: every hook that changes state calls batch_flush first.
+ * Batches and the client array draws that can't be batched are drawn from the streaming ring,
+ * so vitaGL doesn't allocate and copy GPU memory for each of them.
+ */
+
+#define MAX_VERTICES 4096
+#define MAX_INDICES 12288
+#define MAX_VERTEX_SIZE 16 // Four floats
+
+enum {
+	ARRAY_VERTEX,
+	ARRAY_COLOR,
+	ARRAY_TEXCOORD,
+	NUM_ARRAYS,
+};
+
+typedef struct {
+	GLint size;
+	GLenum type;
+	GLsizei stride;
+	const void *pointer;
+	int client; // Set while no GL_ARRAY_BUFFER was bound
+} client_array;
+
+// Only touched by the GL thread
+static client_array arrays[NUM_ARRAYS];
+static int enabled = 0; // Bits of the arrays above
+static int enabled_other = 0;
+static GLuint array_buffer = 0, element_buffer = 0;
+
+static int batch_mask = 0;
+static GLint batch_size[NUM_ARRAYS];
+static GLenum batch_type[NUM_ARRAYS];
+static uint8_t batch_data[NUM_ARRAYS][MAX_VERTICES * MAX_VERTEX_SIZE];
+static uint16_t batch_indices[MAX_INDICES];
+static int num_vertices = 0, num_indices = 0;
+
+static uint32_t stat_draws, stat_issued, stat_streamed;
+static uint64_t stat_stream_bytes;
+
+static int type_size(GLenum type) {
+	switch (type) {
+	case GL_FLOAT:
+	case GL_FIXED:
+		return 4;
+	case GL_SHORT:
+	case GL_UNSIGNED_SHORT:
+		return 2;
+	case GL_BYTE:
+	case GL_UNSIGNED_BYTE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void set_pointer(int array, GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	switch (array) {
+	case ARRAY_VERTEX:
+		glVertexPointer(size, type, stride, pointer);
+		break;
+	case ARRAY_COLOR:
+		glColorPointer(size, type, stride, pointer);
+		break;
+	default:
+		glTexCoordPointer(size, type, stride, pointer);
+		break;
+	}
+}
+
+static void restore_pointers(int mask) {
+	for (int i = 0; i < NUM_ARRAYS; i++) {
+		client_array *a = &arrays[i];
+		if (mask & (1 << i))
+			set_pointer(i, a->size, a->type, a->stride, a->pointer);
+	}
+}
+
+static void copy_vertices(const client_array *a, uint32_t lo, uint32_t verts, uint8_t *dst) {
+	int elem = a->size * type_size(a->type);
+	int stride = a->stride ? a->stride : elem;
+	const uint8_t *src = (const uint8_t *)a->pointer + lo * stride;
+	if (stride == elem) {
+		memcpy(dst, src, verts * elem);
+	} else {
+		for (uint32_t v = 0; v < verts; v++, src += stride, dst += elem)
+			memcpy(dst, src, elem);
+	}
+}
+
+// Copies vertices lo to lo + verts - 1 of the arrays in mask and the rebased indices into the ring and draws from there.
+// Only called with no buffer bound and client pointers for every array in mask, returns 0 when the ring is full.
+static int draw_streamed(int mask, const client_array *src, uint32_t lo, uint32_t verts, GLenum mode, GLsizei count,
+	GLenum type, const void *indices) {
+	uint32_t offsets[NUM_ARRAYS], total = 0;
+	for (int i = 0; i < NUM_ARRAYS; i++) {
+		if (mask & (1 << i)) {
+			offsets[i] = total;
+			total += (verts * src[i].size * type_size(src[i].type) + 15) & ~15;
+		}
+	}
+	uint32_t index_offset = total;
+	if (indices)
+		total += count * sizeof(uint16_t);
+
+	GLuint buffer;
+	uint32_t base;
+	uint8_t *dst = stream_alloc(total, &buffer, &base);
+	if (!dst)
+		return 0;
+	for (int i = 0; i < NUM_ARRAYS; i++) {
+		if (mask & (1 << i))
+			copy_vertices(&src[i], lo, verts, dst + offsets[i]);
+	}
+	if (indices) {
+		uint16_t *out = (uint16_t *)(dst + index_offset);
+		if (type == GL_UNSIGNED_SHORT) {
+			const uint16_t *in = indices;
+			for (GLsizei i = 0; i < count; i++)
+				out[i] = in[i] - lo;
+		} else {
+			const uint8_t *in = indices;
+			for (GLsizei i = 0; i < count; i++)
+				out[i] = in[i] - lo;
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	for (int i = 0; i < NUM_ARRAYS; i++) {
+		if (mask & (1 << i))
+			set_pointer(i, src[i].size, src[i].type, 0, (void *)(uintptr_t)(base + offsets[i]));
+	}
+	if (indices) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+		glDrawElements(mode, count, GL_UNSIGNED_SHORT, (void *)(uintptr_t)(base + index_offset));
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	} else {
+		glDrawArrays(mode, 0, count);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	restore_pointers(mask);
+	stat_issued++;
+	stat_streamed++;
+	stat_stream_bytes += total;
+	return 1;
+}
+
+void batch_flush(void) {
+	if (!num_indices)
+		return;
+
+	client_array src[NUM_ARRAYS];
+	for (int i = 0; i < NUM_ARRAYS; i++) {
+		src[i].size = batch_size[i];
+		src[i].type = batch_type[i];
+		src[i].stride = 0;
+		src[i].pointer = batch_data[i];
+	}
+	if (!draw_streamed(batch_mask, src, 0, num_vertices, GL_TRIANGLES, num_indices, GL_UNSIGNED_SHORT, batch_indices)) {
+		for (int i = 0; i < NUM_ARRAYS; i++) {
+			if (batch_mask & (1 << i))
+				set_pointer(i, batch_size[i], batch_type[i], 0, batch_data[i]);
+		}
+		glDrawElements(GL_TRIANGLES, num_indices, GL_UNSIGNED_SHORT, batch_indices);
+		stat_issued++;
+
+		// Nothing changed the buffer bindings since the game set these, they all flush first
+		restore_pointers(batch_mask);
+	}
+	num_vertices = num_indices = 0;
+}
+
+// Fixed function draws sourcing every enabled array from client memory
+static int client_draw(void) {
+	if (array_buffer || enabled_other || !(enabled & (1 << ARRAY_VERTEX)) || glstate_program())
+		return 0;
+	for (int i = 0; i < NUM_ARRAYS; i++) {
+		client_array *a = &arrays[i];
+		if ((enabled & (1 << i)) && (!a->client || !a->pointer || a->size > 4
+			|| a->size * type_size(a->type) > MAX_VERTEX_SIZE || !type_size(a->type)))
+			return 0;
+	}
+	return 1;
+}
+
+static void index_range(GLsizei count, GLenum type, const void *indices, uint32_t *lo, uint32_t *hi) {
+	*lo = 0xFFFF;
+	*hi = 0;
+	for (GLsizei i = 0; i < count; i++) {
+		uint32_t idx = type == GL_UNSIGNED_SHORT ? ((const uint16_t *)indices)[i] : ((const uint8_t *)indices)[i];
+		if (idx < *lo)
+			*lo = idx;
+		if (idx > *hi)
+			*hi = idx;
+	}
+}
+
+// Returns 0 when the draw has to be issued on its own
+static int append(GLsizei count, GLenum type, const void *indices) {
+	if (count <= 0 || count > MAX_INDICES)
+		return 0;
+	uint32_t lo, hi;
+	index_range(count, type, indices, &lo, &hi);
+	int verts = hi - lo + 1;
+	if (verts > MAX_VERTICES)
+		return 0;
+
+	int same = batch_mask == enabled;
+	for (int i = 0; i < NUM_ARRAYS && same; i++) {
+		if (enabled & (1 << i))
+			same = batch_size[i] == arrays[i].size && batch_type[i] == arrays[i].type;
+	}
+	if (!same || num_vertices + verts > MAX_VERTICES || num_indices + count > MAX_INDICES)
+		batch_flush();
+	if (!num_indices) {
+		batch_mask = enabled;
+		for (int i = 0; i < NUM_ARRAYS; i++) {
+			batch_size[i] = arrays[i].size;
+			batch_type[i] = arrays[i].type;
+		}
+	}
+
+	for (int i = 0; i < NUM_ARRAYS; i++) {
+		if (batch_mask & (1 << i))
+			copy_vertices(&arrays[i], lo, verts, batch_data[i] + num_vertices * arrays[i].size * type_size(arrays[i].type));
+	}
+
+	uint16_t *out = batch_indices + num_indices;
+	int base = num_vertices - lo;
+	if (type == GL_UNSIGNED_SHORT) {
+		const uint16_t *in = indices;
+		for (GLsizei i = 0; i < count; i++)
+			out[i] = in[i] + base;
+	} else {
+		const uint8_t *in = indices;
+		for (GLsizei i = 0; i < count; i++)
+			out[i] = in[i] + base;
+	}
+	num_vertices += verts;
+	num_indices += count;
+	return 1;
+}
+
+static void pointer_hook(int array, GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	client_array *a = &arrays[array];
+	a->size = size;
+	a->type = type;
+	a->stride = stride;
+	a->pointer = pointer;
+	a->client = !array_buffer;
+	set_pointer(array, size, type, stride, pointer);
+}
+
+void glVertexPointer_hook(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	pointer_hook(ARRAY_VERTEX, size, type, stride, pointer);
+}
+
+void glColorPointer_hook(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	pointer_hook(ARRAY_COLOR, size, type, stride, pointer);
+}
+
+void glTexCoordPointer_hook(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	pointer_hook(ARRAY_TEXCOORD, size, type, stride, pointer);
+}
+
+// Client states that can't be batched land in enabled_other
+static int client_state_bit(GLenum array, int **mask) {
+	*mask = &enabled;
+	switch (array) {
+	case GL_VERTEX_ARRAY:
+		return 1 << ARRAY_VERTEX;
+	case GL_COLOR_ARRAY:
+		return 1 << ARRAY_COLOR;
+	case GL_TEXTURE_COORD_ARRAY:
+		return 1 << ARRAY_TEXCOORD;
+	default:
+		*mask = &enabled_other;
+		return 1 << ((array - GL_VERTEX_ARRAY) & 31);
+	}
+}
+
+void glEnableClientState_hook(GLenum array) {
+	int *mask;
+	int bit = client_state_bit(array, &mask);
+	if (*mask & bit)
+		return;
+	batch_flush();
+	*mask |= bit;
+	glEnableClientState(array);
+}
+
+void glDisableClientState_hook(GLenum array) {
+	int *mask;
+	int bit = client_state_bit(array, &mask);
+	if (!(*mask & bit))
+		return;
+	batch_flush();
+	*mask &= ~bit;
+	glDisableClientState(array);
+}
+
+void glBindBuffer_hook(GLenum target, GLuint buffer) {
+	batch_flush();
+	if (target == GL_ARRAY_BUFFER)
+		array_buffer = buffer;
+	else if (target == GL_ELEMENT_ARRAY_BUFFER)
+		element_buffer = buffer;
+	glBindBuffer(target, buffer);
+}
+
+GLuint batch_element_buffer(void) {
+	return element_buffer;
+}
+
+GLuint batch_array_buffer(void) {
+	return array_buffer;
+}
+
+// Deleting a bound buffer unbinds it
+void batch_forget_buffer(GLuint buffer) {
+	if (array_buffer == buffer)
+		array_buffer = 0;
+	if (element_buffer == buffer)
+		element_buffer = 0;
+}
+
+void glDrawElements_hook(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+	stat_draws++;
+	int client = client_draw() && !element_buffer && count > 0 && (type == GL_UNSIGNED_SHORT || type == GL_UNSIGNED_BYTE);
+	if (client && mode == GL_TRIANGLES && append(count, type, indices))
+		return;
+	batch_flush();
+	if (client) {
+		uint32_t lo, hi;
+		index_range(count, type, indices, &lo, &hi);
+		if (draw_streamed(enabled, arrays, lo, hi - lo + 1, mode, count, type, indices))
+			return;
+	}
+	vertfmt_apply(count);
+	int lit = lightvar_apply(count);
+	stat_issued++;
+	if (!element_buffer || !meshopt_draw(mode, count, type, indices, element_buffer))
+		glDrawElements(mode, count, type, indices);
+	if (lit)
+		lightvar_restore();
+}
+
+void glDrawArrays_hook(GLenum mode, GLint first, GLsizei count) {
+	stat_draws++;
+	batch_flush();
+	if (client_draw() && first >= 0 && count > 0 && draw_streamed(enabled, arrays, first, count, mode, count, 0, NULL))
+		return;
+	vertfmt_apply(count);
+	int lit = lightvar_apply(count);
+	glDrawArrays(mode, first, count);
+	if (lit)
+		lightvar_restore();
+	stat_issued++;
+}
+
+void glMatrixMode_hook(GLenum mode) {
+	batch_flush();
+	glMatrixMode(mode);
+}
+
+void glLoadIdentity_hook(void) {
+	batch_flush();
+	glLoadIdentity();
+}
+
+void glScalef_hook(GLfloat x, GLfloat y, GLfloat z) {
+	batch_flush();
+	glScalef(x, y, z);
+}
+
+void glOrthof_hook(GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat nearVal, GLfloat farVal) {
+	batch_flush();
+	glOrthof(left, right, bottom, top, nearVal, farVal);
+}
+
+void glClear_hook(GLbitfield mask) {
+	batch_flush();
+	glClear(mask);
+}
+
+void glTexParameteri_hook(GLenum target, GLenum pname, GLint param) {
+	batch_flush();
+	glTexParameteri(target, pname, param);
+}
+
+void glTexParameterf_hook(GLenum target, GLenum pname, GLfloat param) {
+	batch_flush();
+	glTexParameterf(target, pname, param);
+}
+
+void glTexEnvi_hook(GLenum target, GLenum pname, GLint param) {
+	batch_flush();
+	glTexEnvi(target, pname, param);
+}
+
+void glColor4f_hook(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) {
+	batch_flush();
+	glColor4f(red, green, blue, alpha);
+}
+
+void glColor4ub_hook(GLubyte red, GLubyte green, GLubyte blue, GLubyte alpha) {
+	batch_flush();
+	glColor4ub(red, green, blue, alpha);
+}
+
+void glAlphaFunc_hook(GLenum func, GLfloat ref) {
+	batch_flush();
+	glAlphaFunc(func, ref);
+}
+
+void glDepthFunc_hook(GLenum func) {
+	batch_flush();
+	glDepthFunc(func);
+}
+
+void glDepthMask_hook(GLboolean flag) {
+	batch_flush();
+	glDepthMask(flag);
+}
+
+void glColorMask_hook(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha) {
+	batch_flush();
+	glColorMask(red, green, blue, alpha);
+}
+
+void glCullFace_hook(GLenum mode) {
+	batch_flush();
+	glCullFace(mode);
+}
+
+void glPolygonOffset_hook(GLfloat factor, GLfloat units) {
+	batch_flush();
+	glPolygonOffset(factor, units);
+}
+
+void glBindFramebuffer_hook(GLenum target, GLuint framebuffer) {
+	batch_flush();
+	glBindFramebuffer(target, framebuffer);
+}
+
+void glReadPixels_hook(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void *data) {
+	batch_flush();
+	glReadPixels(x, y, width, height, format, type, data);
+}
+
+void glFinish_hook(void) {
+	batch_flush();
+	glFinish();
+}
+
+void glPushMatrix_hook(void) {
+	batch_flush();
+	glPushMatrix();
+}
+
+void glPopMatrix_hook(void) {
+	batch_flush();
+	glPopMatrix();
+}
+
+void glLoadMatrixf_hook(const GLfloat *m) {
+	batch_flush();
+	glLoadMatrixf(m);
+}
+
+void glMultMatrixf_hook(const GLfloat *m) {
+	batch_flush();
+	glMultMatrixf(m);
+}
+
+void glTranslatef_hook(GLfloat x, GLfloat y, GLfloat z) {
+	batch_flush();
+	glTranslatef(x, y, z);
+}
+
+void glRotatef_hook(GLfloat angle, GLfloat x, GLfloat y, GLfloat z) {
+	batch_flush();
+	glRotatef(angle, x, y, z);
+}
+
+void glTexEnvf_hook(GLenum target, GLenum pname, GLfloat param) {
+	batch_flush();
+	glTexEnvf(target, pname, param);
+}
+
+void glTexEnvfv_hook(GLenum target, GLenum pname, const GLfloat *params) {
+	batch_flush();
+	glTexEnvfv(target, pname, params);
+}
+
+void glClientActiveTexture_hook(GLenum texture) {
+	batch_flush();
+	glClientActiveTexture(texture);
+}
+
+void glFrontFace_hook(GLenum mode) {
+	batch_flush();
+	glFrontFace(mode);
+}
+
+void glBlendEquation_hook(GLenum mode) {
+	batch_flush();
+	glBlendEquation(mode);
+}
+
+void glStencilFunc_hook(GLenum func, GLint ref, GLuint mask) {
+	batch_flush();
+	glStencilFunc(func, ref, mask);
+}
+
+void glStencilOp_hook(GLenum sfail, GLenum dpfail, GLenum dppass) {
+	batch_flush();
+	glStencilOp(sfail, dpfail, dppass);
+}
+
+void glStencilMask_hook(GLuint mask) {
+	batch_flush();
+	glStencilMask(mask);
+}
+
+void glLineWidth_hook(GLfloat width) {
+	batch_flush();
+	glLineWidth(width);
+}
+
+void glDepthRangef_hook(GLfloat nearVal, GLfloat farVal) {
+	batch_flush();
+	glDepthRangef(nearVal, farVal);
+}
+
+void glFogf_hook(GLenum pname, GLfloat param) {
+	batch_flush();
+	glFogf(pname, param);
+}
+
+void glFogfv_hook(GLenum pname, const GLfloat *params) {
+	batch_flush();
+	glFogfv(pname, params);
+}
+
+void glFogi_hook(GLenum pname, GLint param) {
+	batch_flush();
+	glFogi(pname, param);
+}
+
+void batch_report(uint32_t frames) {
+	if (stat_draws) {
+		debugPrintf("batch: %u draws per frame, %u after batching, %u streamed (%llu KB)\n", stat_draws / frames,
+			stat_issued / frames, stat_streamed / frames, (unsigned long long)(stat_stream_bytes / frames / 1024));
+	}
+	stat_draws = stat_issued = stat_streamed = 0;
+	stat_stream_bytes = 0;
+}
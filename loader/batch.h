@@ -0,0 +1,61 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <vitaGL.h>
+
+void batch_flush(void);
+void batch_report(uint32_t frames);
+GLuint batch_element_buffer(void);
+GLuint batch_array_buffer(void);
+void batch_forget_buffer(GLuint buffer);
+
+void glVertexPointer_hook(GLint size, GLenum type, GLsizei stride, const void *pointer);
+void glColorPointer_hook(GLint size, GLenum type, GLsizei stride, const void *pointer);
+void glTexCoordPointer_hook(GLint size, GLenum type, GLsizei stride, const void *pointer);
+void glEnableClientState_hook(GLenum array);
+void glDisableClientState_hook(GLenum array);
+void glBindBuffer_hook(GLenum target, GLuint buffer);
+void glDrawElements_hook(GLenum mode, GLsizei count, GLenum type, const void *indices);
+void glDrawArrays_hook(GLenum mode, GLint first, GLsizei count);
+
+// Everything else the pending draws depend on, these only flush them first
+void glMatrixMode_hook(GLenum mode);
+void glLoadIdentity_hook(void);
+void glScalef_hook(GLfloat x, GLfloat y, GLfloat z);
+void glOrthof_hook(GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat nearVal, GLfloat farVal);
+void glClear_hook(GLbitfield mask);
+void glTexParameteri_hook(GLenum target, GLenum pname, GLint param);
+void glTexParameterf_hook(GLenum target, GLenum pname, GLfloat param);
+void glTexEnvi_hook(GLenum target, GLenum pname, GLint param);
+void glColor4f_hook(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+void glColor4ub_hook(GLubyte red, GLubyte green, GLubyte blue, GLubyte alpha);
+void glAlphaFunc_hook(GLenum func, GLfloat ref);
+void glDepthFunc_hook(GLenum func);
+void glDepthMask_hook(GLboolean flag);
+void glColorMask_hook(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+void glCullFace_hook(GLenum mode);
+void glPolygonOffset_hook(GLfloat factor, GLfloat units);
+void glBindFramebuffer_hook(GLenum target, GLuint framebuffer);
+void glReadPixels_hook(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void *data);
+void glFinish_hook(void);
+void glPushMatrix_hook(void);
+void glPopMatrix_hook(void);
+void glLoadMatrixf_hook(const GLfloat *m);
+void glMultMatrixf_hook(const GLfloat *m);
+void glTranslatef_hook(GLfloat x, GLfloat y, GLfloat z);
+void glRotatef_hook(GLfloat angle, GLfloat x, GLfloat y, GLfloat z);
+void glTexEnvf_hook(GLenum target, GLenum pname, GLfloat param);
+void glTexEnvfv_hook(GLenum target, GLenum pname, const GLfloat *params);
+void glClientActiveTexture_hook(GLenum texture);
+void glFrontFace_hook(GLenum mode);
+void glBlendEquation_hook(GLenum mode);
+void glStencilFunc_hook(GLenum func, GLint ref, GLuint mask);
+void glStencilOp_hook(GLenum sfail, GLenum dpfail, GLenum dppass);
+void glStencilMask_hook(GLuint mask);
+void glLineWidth_hook(GLfloat width);
+void glDepthRangef_hook(GLfloat nearVal, GLfloat farVal);
+void glFogf_hook(GLenum pname, GLfloat param);
+void glFogfv_hook(GLenum pname, const GLfloat *params);
+void glFogi_hook(GLenum pname, GLint param);
+
+#endif
@@ -0,0 +1,256 @@
+/* blit.c -- fast paths for the SDL surface conversions and blits the game relies on
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "main.h"
+#include "blit.h"
+#include "glstate.h"
+#include "batch.h"
+#include "pixconv.h"
+#include "texcache.h"
+
+typedef struct {
+	Uint32 format;
+	int bpp;
+	int swap; // Red and blue stored in B, G, R order
+	int alpha;
+} pix_kind;
+
+static const pix_kind kinds[] = {
+	{SDL_PIXELFORMAT_ABGR8888, 4, 0, 1},
+	{SDL_PIXELFORMAT_BGR888, 4, 0, 0},
+	{SDL_PIXELFORMAT_ARGB8888, 4, 1, 1},
+	{SDL_PIXELFORMAT_RGB888, 4, 1, 0},
+	{SDL_PIXELFORMAT_RGB24, 3, 0, 0},
+	{SDL_PIXELFORMAT_BGR24, 3, 1, 0},
+	{SDL_PIXELFORMAT_INDEX8, 1, 0, 0},
+};
+
+static const pix_kind *find_kind(Uint32 format) {
+	for (int i = 0; i < sizeof(kinds) / sizeof(*kinds); i++) {
+		if (kinds[i].format == format)
+			return &kinds[i];
+	}
+	return NULL;
+}
+
+#ifdef DEBUG
+// Logs every pair that still goes through SDL once, these are the candidates for new fast paths
+static void note_slow(const char *func, SDL_Surface *src, Uint32 dst_format) {
+	static struct {
+		const char *func;
+		Uint32 src, dst;
+	} seen[64];
+	static int num_seen = 0;
+	Uint32 src_format = src && src->format ? src->format->format : SDL_PIXELFORMAT_UNKNOWN;
+	for (int i = 0; i < num_seen; i++) {
+		if (seen[i].func == func && seen[i].src == src_format && seen[i].dst == dst_format)
+			return;
+	}
+	if (num_seen < sizeof(seen) / sizeof(*seen)) {
+		seen[num_seen].func = func;
+		seen[num_seen].src = src_format;
+		seen[num_seen++].dst = dst_format;
+	}
+	debugPrintf("blit: %s %s -> %s goes through SDL\n", func, SDL_GetPixelFormatName(src_format), SDL_GetPixelFormatName(dst_format));
+}
+#else
+#define note_slow(func, src, dst_format)
+#endif
+
+// Sources without RLE, color key or color/alpha modulation, blending as they are or not at all
+static int plain_source(SDL_Surface *s, SDL_BlendMode *mode) {
+	Uint8 r, g, b, a;
+	Uint32 key;
+	if (SDL_MUSTLOCK(s) || s->locked || SDL_GetColorKey(s, &key) == 0)
+		return 0;
+	SDL_GetSurfaceColorMod(s, &r, &g, &b);
+	SDL_GetSurfaceAlphaMod(s, &a);
+	SDL_GetSurfaceBlendMode(s, mode);
+	return (r & g & b & a) == 255 && (*mode == SDL_BLENDMODE_NONE || *mode == SDL_BLENDMODE_BLEND);
+}
+
+static int palette_has_alpha(SDL_Palette *palette) {
+	for (int i = 0; i < palette->ncolors; i++) {
+		if (palette->colors[i].a != 255)
+			return 1;
+	}
+	return 0;
+}
+
+static void copy_rect(SDL_Surface *src, const pix_kind *sk, int sx, int sy, SDL_Surface *dst, const pix_kind *dk,
+	int dx, int dy, int w, int h, int blend) {
+	uint32_t lut[256];
+	if (sk->bpp == 1) {
+		SDL_Palette *palette = src->format->palette;
+		memset(lut, 0, sizeof(lut));
+		for (int i = 0; i < palette->ncolors && i < 256; i++) {
+			SDL_Color *c = &palette->colors[i];
+			lut[i] = SDL_MapRGBA(dst->format, c->r, c->g, c->b, c->a);
+		}
+	}
+
+	const uint8_t *s = (const uint8_t *)src->pixels + sy * src->pitch + sx * sk->bpp;
+	uint8_t *d = (uint8_t *)dst->pixels + dy * dst->pitch + dx * 4;
+	int swap = sk->swap ^ dk->swap;
+	int opaque = dk->alpha && !sk->alpha;
+	for (int y = 0; y < h; y++, s += src->pitch, d += dst->pitch) {
+		if (blend)
+			pixconv_blend32(s, d, w, swap);
+		else if (sk->bpp == 1)
+			pixconv_8to32(s, (uint32_t *)d, w, lut);
+		else if (sk->bpp == 3)
+			pixconv_24to32(s, d, w, swap);
+		else if (!swap && !opaque)
+			memcpy(d, s, w * 4);
+		else
+			pixconv_32to32(s, d, w, swap, opaque);
+	}
+}
+
+SDL_Surface *SDL_ConvertSurfaceFormat_hook(SDL_Surface *src, Uint32 pixel_format, Uint32 flags) {
+	SDL_BlendMode mode;
+	const pix_kind *sk = src && src->format ? find_kind(src->format->format) : NULL;
+	const pix_kind *dk = find_kind(pixel_format);
+	if (!sk || !dk || dk->bpp != 4 || flags || !plain_source(src, &mode) || (sk->bpp == 1 && !src->format->palette)) {
+		note_slow("SDL_ConvertSurfaceFormat", src, pixel_format);
+		SDL_Surface *dst = SDL_ConvertSurfaceFormat(src, pixel_format, flags);
+		texcache_converted(src, dst);
+		return dst;
+	}
+
+	SDL_Surface *dst = SDL_CreateRGBSurfaceWithFormat(0, src->w, src->h, 32, pixel_format);
+	if (!dst)
+		return NULL;
+	copy_rect(src, sk, 0, 0, dst, dk, 0, 0, src->w, src->h, 0);
+	SDL_SetClipRect(dst, &src->clip_rect);
+
+	// Same as SDL_ConvertSurface, blending is only kept on when alpha survives the conversion
+	int alpha = sk->alpha || (sk->bpp == 1 && palette_has_alpha(src->format->palette));
+	SDL_SetSurfaceBlendMode(dst, dk->alpha && alpha ? SDL_BLENDMODE_BLEND : SDL_BLENDMODE_NONE);
+	texcache_converted(src, dst);
+	return dst;
+}
+
+int SDL_UpperBlit_hook(SDL_Surface *src, const SDL_Rect *srcrect, SDL_Surface *dst, SDL_Rect *dstrect) {
+	SDL_BlendMode mode;
+	const pix_kind *sk = src && src->format ? find_kind(src->format->format) : NULL;
+	const pix_kind *dk = dst && dst->format ? find_kind(dst->format->format) : NULL;
+	if (!sk || !dk || dk->bpp != 4 || src == dst || dst->locked || SDL_MUSTLOCK(dst) || !plain_source(src, &mode)
+		|| (sk->bpp == 1 && (mode == SDL_BLENDMODE_BLEND || !src->format->palette))) {
+		note_slow("SDL_UpperBlit", src, dst && dst->format ? dst->format->format : SDL_PIXELFORMAT_UNKNOWN);
+		return SDL_UpperBlit(src, srcrect, dst, dstrect);
+	}
+
+	// Clipping follows SDL_UpperBlit, including the updates to dstrect
+	SDL_Rect fulldst;
+	int srcx, srcy, w, h;
+	if (!dstrect) {
+		fulldst.x = fulldst.y = 0;
+		fulldst.w = dst->w;
+		fulldst.h = dst->h;
+		dstrect = &fulldst;
+	}
+	if (srcrect) {
+		srcx = srcrect->x;
+		w = srcrect->w;
+		if (srcx < 0) {
+			w += srcx;
+			dstrect->x -= srcx;
+			srcx = 0;
+		}
+		if (src->w - srcx < w)
+			w = src->w - srcx;
+		srcy = srcrect->y;
+		h = srcrect->h;
+		if (srcy < 0) {
+			h += srcy;
+			dstrect->y -= srcy;
+			srcy = 0;
+		}
+		if (src->h - srcy < h)
+			h = src->h - srcy;
+	} else {
+		srcx = srcy = 0;
+		w = src->w;
+		h = src->h;
+	}
+
+	SDL_Rect *clip = &dst->clip_rect;
+	int dx = clip->x - dstrect->x;
+	if (dx > 0) {
+		w -= dx;
+		dstrect->x += dx;
+		srcx += dx;
+	}
+	dx = dstrect->x + w - clip->x - clip->w;
+	if (dx > 0)
+		w -= dx;
+	int dy = clip->y - dstrect->y;
+	if (dy > 0) {
+		h -= dy;
+		dstrect->y += dy;
+		srcy += dy;
+	}
+	dy = dstrect->y + h - clip->y - clip->h;
+	if (dy > 0)
+		h -= dy;
+
+	if (w <= 0 || h <= 0) {
+		dstrect->w = dstrect->h = 0;
+		return 0;
+	}
+	dstrect->w = w;
+	dstrect->h = h;
+	copy_rect(src, sk, srcx, srcy, dst, dk, dstrect->x, dstrect->y, w, h, mode == SDL_BLENDMODE_BLEND && sk->alpha);
+	return 0;
+}
+
+int SDL_FillRect_hook(SDL_Surface *dst, const SDL_Rect *rect, Uint32 color) {
+	SDL_Rect clipped;
+	if (!dst || !dst->pixels || dst->format->BytesPerPixel != 4 || SDL_MUSTLOCK(dst))
+		return SDL_FillRect(dst, rect, color);
+
+	if (!rect)
+		clipped = dst->clip_rect;
+	else if (!SDL_IntersectRect(rect, &dst->clip_rect, &clipped))
+		return 0;
+	uint8_t *row = (uint8_t *)dst->pixels + clipped.y * dst->pitch + clipped.x * 4;
+	for (int y = 0; y < clipped.h; y++, row += dst->pitch)
+		pixconv_fill32((uint32_t *)row, clipped.w, color);
+	return 0;
+}
+
+// 8 and 24 bpp surfaces are converted by SDL before the upload anyway, this does it through the fast path instead
+static SDL_Texture *create_texture(SDL_Renderer *renderer, SDL_Surface *surface) {
+	SDL_BlendMode mode;
+	const pix_kind *sk = surface && surface->format ? find_kind(surface->format->format) : NULL;
+	if (!sk || sk->bpp == 4 || !plain_source(surface, &mode) || (sk->bpp == 1 && !surface->format->palette))
+		return SDL_CreateTextureFromSurface(renderer, surface);
+
+	SDL_Surface *tmp = SDL_ConvertSurfaceFormat_hook(surface, SDL_PIXELFORMAT_ABGR8888, 0);
+	if (!tmp)
+		return SDL_CreateTextureFromSurface(renderer, surface);
+	SDL_SetSurfaceBlendMode(tmp, mode);
+	SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, tmp);
+	SDL_FreeSurface(tmp);
+	return texture;
+}
+
+SDL_Texture *SDL_CreateTextureFromSurface_hook(SDL_Renderer *renderer, SDL_Surface *surface) {
+	batch_flush();
+	SDL_Texture *texture = create_texture(renderer, surface);
+	glstate_invalidate(); // The upload binds the texture behind the GL state filter
+	return texture;
+}
@@ -0,0 +1,11 @@
+#ifndef __BLIT_H__
+#define __BLIT_H__
+
+#include <SDL2/SDL.h>
+
+SDL_Surface *SDL_ConvertSurfaceFormat_hook(SDL_Surface *src, Uint32 pixel_format, Uint32 flags);
+int SDL_UpperBlit_hook(SDL_Surface *src, const SDL_Rect *srcrect, SDL_Surface *dst, SDL_Rect *dstrect);
+int SDL_FillRect_hook(SDL_Surface *dst, const SDL_Rect *rect, Uint32 color);
+SDL_Texture *SDL_CreateTextureFromSurface_hook(SDL_Renderer *renderer, SDL_Surface *surface);
+
+#endif
@@ -0,0 +1,301 @@
+/* catalog.c -- boot time cache of the content metadata files
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <SDL2/SDL.h>
+
+#include "main.h"
+#include "catalog.h"
+#include "hash.h"
+#include "iosched.h"
+#include "vfs.h"
+
+#define CATALOG_MAGIC 0x54435652 // RVCT
+#define CATALOG_VERSION 1
+#define CATALOG_FILE DATA_PATH "/catalog.bin"
+#define CATALOG_MAX_FILE_SIZE (64 * 1024)
+#define CATALOG_MAX_ENTRIES 4096
+#define CATALOG_BUILD_DELAY_US (15 * 1000000) // Stay out of the way of the boot itself
+
+enum {
+	ROOT_CARS,
+	ROOT_LEVELS,
+	ROOT_PACKS,
+	NUM_ROOTS,
+};
+
+static const char *root_names[NUM_ROOTS] = {"cars", "levels", "packs"};
+
+/*
+ * Layout: header, entries sorted by hash, names, data.
+ * Adding or removing a car, level or pack changes the mtime of its root folder and triggers a rebuild.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_entries;
+	uint32_t names_size;
+	uint32_t data_size;
+	uint32_t reserved;
+	uint64_t root_mtime[NUM_ROOTS];
+} catalog_header;
+
+typedef struct {
+	uint32_t hash;
+	uint32_t name; // Offset in the names table, relative to DATA_PATH
+	uint32_t size;
+	uint32_t data; // Offset in the data block
+	uint64_t dir_mtime;
+} catalog_entry;
+
+typedef struct {
+	char *path;
+	uint32_t size;
+	uint64_t dir_mtime;
+	uint8_t *data;
+} build_file;
+
+static uint8_t *blob = NULL;
+static catalog_entry *entries = NULL;
+static char *names = NULL;
+static uint8_t *data = NULL;
+static uint8_t *valid = NULL;
+static uint32_t num_entries = 0;
+
+static uint64_t parent_mtime(const char *rel) {
+	char abs[512];
+	const char *slash = strrchr(rel, '/');
+	snprintf(abs, sizeof(abs), DATA_PATH "/%.*s", slash ? (int)(slash - rel) : 0, rel);
+	return vfs_dir_mtime(abs);
+}
+
+static uint64_t root_mtime(int root) {
+	char abs[64];
+	snprintf(abs, sizeof(abs), DATA_PATH "/%s", root_names[root]);
+	return vfs_dir_mtime(abs);
+}
+
+static int has_ext(const char *name, const char *ext) {
+	const char *dot = strrchr(name, '.');
+	return dot && !strcasecmp(dot + 1, ext);
+}
+
+// cars/<car>/parameters.txt, levels/<level>/*.inf and packs/*.txt
+static int is_catalogued(int root, int depth, const char *name) {
+	switch (root) {
+	case ROOT_CARS:
+		return depth == 2 && !strcasecmp(name, "parameters.txt");
+	case ROOT_LEVELS:
+		return depth == 2 && has_ext(name, "inf");
+	default:
+		return depth == 1 && has_ext(name, "txt");
+	}
+}
+
+static void collect(int root, int depth, const char *rel, build_file *files, int *num_files) {
+	char abs[512], child[512], name[256];
+	int dir, cursor = -1, is_dir;
+	snprintf(abs, sizeof(abs), DATA_PATH "/%s", rel);
+	if (vfs_opendir(abs, &dir) != VFS_FOUND)
+		return;
+
+	while (vfs_readdir(dir, &cursor, name, &is_dir) && *num_files < CATALOG_MAX_ENTRIES) {
+		snprintf(child, sizeof(child), "%s/%s", rel, name);
+		if (is_dir) {
+			if (depth < 2)
+				collect(root, depth + 1, child, files, num_files);
+			continue;
+		}
+		if (!is_catalogued(root, depth, name))
+			continue;
+
+		uint32_t size;
+		snprintf(abs, sizeof(abs), DATA_PATH "/%s", child);
+		if (vfs_lookup(abs, &size, NULL) != VFS_FOUND || !size || size > CATALOG_MAX_FILE_SIZE)
+			continue;
+		build_file *f = &files[(*num_files)++];
+		f->path = strdup(child);
+		f->size = size;
+		f->dir_mtime = parent_mtime(child);
+		f->data = NULL;
+	}
+}
+
+static int cmp_hash(const void *a, const void *b) {
+	const catalog_entry *ea = (const catalog_entry *)a, *eb = (const catalog_entry *)b;
+	if (ea->hash != eb->hash)
+		return ea->hash < eb->hash ? -1 : 1;
+	return ea->name < eb->name ? -1 : 1;
+}
+
+static int build_thread(SceSize args, void *argp) {
+	sceKernelDelayThread(CATALOG_BUILD_DELAY_US);
+
+	build_file *files = calloc(CATALOG_MAX_ENTRIES, sizeof(build_file));
+	catalog_entry *out = calloc(CATALOG_MAX_ENTRIES, sizeof(catalog_entry));
+	int num_files = 0;
+	catalog_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	for (int i = 0; i < NUM_ROOTS; i++) {
+		collect(i, 1, root_names[i], files, &num_files);
+		hdr.root_mtime[i] = root_mtime(i);
+	}
+
+	for (int i = 0; i < num_files; i++) {
+		char abs[512];
+		build_file *f = &files[i];
+		snprintf(abs, sizeof(abs), DATA_PATH "/%s", f->path);
+		SceUID fd = sceIoOpen(abs, SCE_O_RDONLY, 0);
+		if (fd < 0)
+			continue;
+		f->data = malloc(f->size);
+		if (f->data && iosched_read(fd, f->data, f->size, 0, IO_PREFETCH) != f->size) {
+			free(f->data);
+			f->data = NULL;
+		}
+		sceIoClose(fd);
+		if (!f->data)
+			continue;
+
+		catalog_entry *e = &out[hdr.num_entries++];
+		e->hash = path_hash(f->path);
+		e->name = hdr.names_size;
+		e->size = f->size;
+		e->data = hdr.data_size;
+		e->dir_mtime = f->dir_mtime;
+		hdr.names_size += strlen(f->path) + 1;
+		hdr.data_size += f->size;
+	}
+	qsort(out, hdr.num_entries, sizeof(catalog_entry), cmp_hash);
+
+	hdr.magic = CATALOG_MAGIC;
+	hdr.version = CATALOG_VERSION;
+	SceUID fd = sceIoOpen(CATALOG_FILE, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd >= 0) {
+		sceIoWrite(fd, &hdr, sizeof(hdr));
+		sceIoWrite(fd, out, hdr.num_entries * sizeof(catalog_entry));
+		for (int i = 0; i < num_files; i++) {
+			if (files[i].data)
+				sceIoWrite(fd, files[i].path, strlen(files[i].path) + 1);
+		}
+		for (int i = 0; i < num_files; i++) {
+			if (files[i].data)
+				sceIoWrite(fd, files[i].data, files[i].size);
+		}
+		sceIoClose(fd);
+		vfs_refresh(CATALOG_FILE, 1);
+		debugPrintf("catalog: stored %u files (%u bytes)\n", hdr.num_entries, hdr.data_size);
+	}
+
+	for (int i = 0; i < num_files; i++) {
+		free(files[i].path);
+		free(files[i].data);
+	}
+	free(files);
+	free(out);
+	return sceKernelExitDeleteThread(0);
+}
+
+static int load_catalog(void) {
+	SceUID fd = sceIoOpen(CATALOG_FILE, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return 0;
+
+	// The whole catalogue comes in with a single read
+	SceIoStat st;
+	if (sceIoGetstatByFd(fd, &st) < 0 || st.st_size < sizeof(catalog_header) || !(blob = malloc(st.st_size))
+		|| sceIoRead(fd, blob, st.st_size) != st.st_size) {
+		sceIoClose(fd);
+		free(blob);
+		blob = NULL;
+		return 0;
+	}
+	sceIoClose(fd);
+
+	catalog_header *hdr = (catalog_header *)blob;
+	if (hdr->magic != CATALOG_MAGIC || hdr->version != CATALOG_VERSION
+		|| sizeof(catalog_header) + hdr->num_entries * sizeof(catalog_entry) + hdr->names_size + hdr->data_size != st.st_size) {
+		free(blob);
+		blob = NULL;
+		return 0;
+	}
+	entries = (catalog_entry *)(blob + sizeof(catalog_header));
+	names = (char *)(entries + hdr->num_entries);
+	data = (uint8_t *)names + hdr->names_size;
+	num_entries = hdr->num_entries;
+	valid = malloc(num_entries);
+
+	int up_to_date = 1;
+	for (int i = 0; i < NUM_ROOTS; i++) {
+		if (hdr->root_mtime[i] != root_mtime(i))
+			up_to_date = 0;
+	}
+	for (uint32_t i = 0; i < num_entries; i++) {
+		char abs[512];
+		uint32_t size;
+		snprintf(abs, sizeof(abs), DATA_PATH "/%s", names + entries[i].name);
+		valid[i] = vfs_lookup(abs, &size, NULL) == VFS_FOUND && size == entries[i].size
+			&& parent_mtime(names + entries[i].name) == entries[i].dir_mtime;
+		if (!valid[i])
+			up_to_date = 0;
+	}
+	debugPrintf("catalog: loaded %u files%s\n", num_entries, up_to_date ? "" : ", rebuilding");
+	return up_to_date;
+}
+
+void catalog_init(void) {
+	if (load_catalog())
+		return;
+	SceUID thid = sceKernelCreateThread("catalog_build", build_thread, 0x10000100, 0x4000, 0, SCE_KERNEL_CPU_MASK_USER_2, NULL);
+	if (thid >= 0)
+		sceKernelStartThread(thid, 0, NULL);
+}
+
+static catalog_entry *catalog_lookup(const char *path) {
+	char rel[512];
+	uint32_t size;
+	if (!num_entries || !vfs_relpath(path, rel, sizeof(rel)))
+		return NULL;
+
+	uint32_t hash = path_hash(rel);
+	uint32_t lo = 0, hi = num_entries;
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (entries[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < num_entries && entries[lo].hash == hash; lo++) {
+		if (!valid[lo] || strcasecmp(names + entries[lo].name, rel))
+			continue;
+		// Files the game wrote to since boot are no longer trusted
+		if (vfs_lookup(path, &size, NULL) != VFS_FOUND || size != entries[lo].size) {
+			valid[lo] = 0;
+			return NULL;
+		}
+		return &entries[lo];
+	}
+	return NULL;
+}
+
+FILE *catalog_fopen(const char *path) {
+	catalog_entry *e = catalog_lookup(path);
+	return e ? fmemopen(data + e->data, e->size, "r") : NULL;
+}
+
+SDL_RWops *catalog_rwops(const char *path) {
+	catalog_entry *e = catalog_lookup(path);
+	return e ? SDL_RWFromConstMem(data + e->data, e->size) : NULL;
+}
@@ -0,0 +1,13 @@
+#ifndef __CATALOG_H__
+#define __CATALOG_H__
+
+#include <stdio.h>
+
+struct SDL_RWops;
+
+void catalog_init(void);
+
+FILE *catalog_fopen(const char *path);
+struct SDL_RWops *catalog_rwops(const char *path);
+
+#endif
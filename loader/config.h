@@ -2,9 +2,25 @@
 #define __CONFIG_H__
 
 //#define DEBUG
+//#define TRACE_FILES // Records file accesses to DATA_PATH/trace.bin, see tools/tracereport.c
 
 #define MEMORY_NEWLIB_MB 160
 #define MEMORY_VITAGL_THRESHOLD_MB 8
+#define PREFETCH_CACHE_MB 24
+#define TEXTURE_REDUCE_PSNR 38.0 // Minimum quality in dB for textures to be stored as 16-bit
+#define STREAM_RING_KB 3072 // GPU visible ring for client array draws, split across three frames
+#define MESHOPT_CACHE_SIZE 16 // Post-transform cache entries static index ranges get reordered and measured for
+#define MESHOPT_KEEP_KB 2048 // Copies of static index buffers kept to build the reordered ranges from
+#define MESHOPT_FRAME_TRIANGLES 4096 // Triangles reordered per frame at most, the other ranges wait for the next frames and larger ones are left alone
+#define VERTFMT_KEEP_KB 8192 // Copies of static vertex buffers kept until their first draw packs them
+#define VERTFMT_FRAME_KB 1024 // Vertex data packed per frame at most, the other buffers wait for the next frames
+#define LIGHT_VARIANT_LIGHTS 4 // Lit shaders get unrolled variants for up to this many lights left after culling
+#define LIGHT_VARIANT_SHADOWS 2 // And this many shadow boxes, draws with more run the game's loops
+#define SHADER_FRAME_MS 4 // Compiles the game doesn't wait for start between frames until this much time went by
+#define SHADER_CACHE_MB 8 // Compiled shaders kept in DATA_PATH/shadercache.bin, least recently used ones go first
+//#define GL_RENDER_THREAD // Records GL calls on the game thread and replays them on a render thread, see loader/glcmd.c
+#define GL_RENDER_LIST_KB 4096 // Each of the two command lists, calls that don't fit run in place after a sync
+//#define GL_CAPTURE_FRAMES 120 // Writes the first frames of every level to DATA_PATH/capture_<level>.bin, see tools/glreplay.c
 
 #define DATA_PATH "ux0:data/rvgl"
 
@@ -0,0 +1,121 @@
+/* cookie.c -- stdio and SDL_RWops glue for the loader's own streams
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <SDL2/SDL.h>
+
+#include "cookie.h"
+
+#ifdef __LARGE64_FILES
+typedef _off64_t cookie_off_t;
+#else
+typedef off_t cookie_off_t;
+#endif
+
+typedef struct {
+	void *stream;
+	const cookie_funcs *funcs;
+} cookie;
+
+static ssize_t cookie_read(void *c, char *buf, size_t size) {
+	cookie *k = (cookie *)c;
+	return k->funcs->read(k->stream, buf, size);
+}
+
+static ssize_t cookie_write(void *c, const char *buf, size_t size) {
+	cookie *k = (cookie *)c;
+	return k->funcs->write(k->stream, buf, size);
+}
+
+static int cookie_seek(void *c, cookie_off_t *offset, int whence) {
+	cookie *k = (cookie *)c;
+	int64_t pos = k->funcs->seek(k->stream, *offset, whence);
+	if (pos < 0)
+		return -1;
+	*offset = pos;
+	return 0;
+}
+
+static int cookie_close(void *c) {
+	cookie *k = (cookie *)c;
+	int r = k->funcs->close(k->stream);
+	free(k);
+	if (r < 0) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+FILE *cookie_fopen(void *stream, const cookie_funcs *funcs, const char *mode) {
+	cookie *k = malloc(sizeof(cookie));
+	if (!k)
+		return NULL;
+	k->stream = stream;
+	k->funcs = funcs;
+
+	cookie_io_functions_t io = {cookie_read, funcs->write ? cookie_write : NULL, cookie_seek, cookie_close};
+	FILE *f = fopencookie(k, mode, io);
+	if (!f)
+		free(k);
+	return f;
+}
+
+static Sint64 rw_size(SDL_RWops *ctx) {
+	return ((const cookie_funcs *)ctx->hidden.unknown.data2)->size(ctx->hidden.unknown.data1);
+}
+
+static Sint64 rw_seek(SDL_RWops *ctx, Sint64 offset, int whence) {
+	return ((const cookie_funcs *)ctx->hidden.unknown.data2)->seek(ctx->hidden.unknown.data1, offset, whence);
+}
+
+static size_t rw_read(SDL_RWops *ctx, void *ptr, size_t size, size_t maxnum) {
+	if (!size)
+		return 0;
+	int r = ((const cookie_funcs *)ctx->hidden.unknown.data2)->read(ctx->hidden.unknown.data1, ptr, size * maxnum);
+	if (r <= 0)
+		return 0;
+	return r / size;
+}
+
+static size_t rw_write(SDL_RWops *ctx, const void *ptr, size_t size, size_t num) {
+	const cookie_funcs *funcs = (const cookie_funcs *)ctx->hidden.unknown.data2;
+	if (!size || !funcs->write)
+		return 0;
+	int r = funcs->write(ctx->hidden.unknown.data1, ptr, size * num);
+	if (r <= 0)
+		return 0;
+	return r / size;
+}
+
+static int rw_close(SDL_RWops *ctx) {
+	int r = ((const cookie_funcs *)ctx->hidden.unknown.data2)->close(ctx->hidden.unknown.data1);
+	SDL_FreeRW(ctx);
+	return r < 0 ? -1 : 0;
+}
+
+SDL_RWops *cookie_rwops(void *stream, const cookie_funcs *funcs) {
+	SDL_RWops *ctx = SDL_AllocRW();
+	if (!ctx)
+		return NULL;
+
+	ctx->size = rw_size;
+	ctx->seek = rw_seek;
+	ctx->read = rw_read;
+	ctx->write = rw_write;
+	ctx->close = rw_close;
+	ctx->type = SDL_RWOPS_UNKNOWN;
+	ctx->hidden.unknown.data1 = stream;
+	ctx->hidden.unknown.data2 = (void *)funcs;
+	return ctx;
+}
@@ -0,0 +1,22 @@
+#ifndef __COOKIE_H__
+#define __COOKIE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct SDL_RWops;
+
+// What a loader stream implements to be handed to the game as a FILE or as an SDL_RWops
+typedef struct {
+	int (*read)(void *stream, void *dst, uint32_t size);
+	int (*write)(void *stream, const void *src, uint32_t size); // NULL for read-only streams
+	int64_t (*seek)(void *stream, int64_t offset, int whence);
+	int64_t (*size)(void *stream);
+	int (*close)(void *stream); // Negative when data written to the stream got lost
+} cookie_funcs;
+
+// Both return NULL on failure, the stream is then still the caller's to close
+FILE *cookie_fopen(void *stream, const cookie_funcs *funcs, const char *mode);
+struct SDL_RWops *cookie_rwops(void *stream, const cookie_funcs *funcs);
+
+#endif
@@ -0,0 +1,374 @@
+/* fstream.c -- loader managed stdio streams for loose files
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#define _GNU_SOURCE
+#include <vitasdk.h>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <SDL2/SDL.h>
+
+#include "main.h"
+#include "cookie.h"
+#include "fstream.h"
+#include "iosched.h"
+#include "vfs.h"
+
+#define FSTREAM_SLURP_SIZE (64 * 1024) // Read-only files up to this size are loaded whole on open
+#define FSTREAM_BUFFER_SIZE (64 * 1024)
+#define FSTREAM_BUFFER_ALIGN 64
+#define FSTREAM_WRITE_CHUNK (16 * 1024)
+
+typedef struct {
+	SceUID fd;
+	uint8_t *data; // Whole file once slurped, pending output for streams written behind
+	uint32_t size;
+	uint32_t capacity;
+	uint32_t pos;
+	int cls;
+	int writing;
+	int behind; // Written by the writer thread once closed
+	int failed; // A write to the file went wrong
+	void *vbuf;
+	char path[256];
+} fstream;
+
+// Replays and the loader's own background files (opened in the prefetch class) are kept in memory and handed
+// over to the writer thread when closed. Everything else written (profiles, settings, times) is saves the
+// game has to hear about failing: they go to path.tmp as stdio hands them over, fflush included, and take the
+// place of the old file when closed. The old file stays around as path.old in between, so that a crash at
+// any point leaves one whole save.
+typedef struct write_job {
+	struct write_job *next;
+	fstream *s;
+} write_job;
+
+static pthread_mutex_t writer_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t written_cond = PTHREAD_COND_INITIALIZER;
+static write_job *jobs_head = NULL, *jobs_tail = NULL;
+static fstream *job_running = NULL;
+static int writer_running = 0;
+
+static void stream_free(fstream *s) {
+	if (s->fd >= 0)
+		sceIoClose(s->fd);
+	free(s->data);
+	free(s->vbuf);
+	free(s);
+}
+
+static int stream_flush(fstream *s) {
+	for (uint32_t pos = 0; pos < s->size;) {
+		uint32_t len = s->size - pos;
+		if (len > FSTREAM_WRITE_CHUNK)
+			len = FSTREAM_WRITE_CHUNK;
+		int r = sceIoWrite(s->fd, s->data + pos, len);
+		if (r <= 0) {
+			debugPrintf("fstream: failed to write %s (0x%X)\n", s->path, r);
+			return -1;
+		}
+		pos += r;
+	}
+	return 0;
+}
+
+static int writer_thread(SceSize args, void *argp) {
+	for (;;) {
+		pthread_mutex_lock(&writer_mtx);
+		while (!jobs_head)
+			pthread_cond_wait(&writer_cond, &writer_mtx);
+		write_job *job = jobs_head;
+		jobs_head = job->next;
+		if (!jobs_head)
+			jobs_tail = NULL;
+		job_running = job->s;
+		pthread_mutex_unlock(&writer_mtx);
+
+		stream_flush(job->s);
+
+		pthread_mutex_lock(&writer_mtx);
+		job_running = NULL;
+		stream_free(job->s);
+		free(job);
+		pthread_cond_broadcast(&written_cond);
+		pthread_mutex_unlock(&writer_mtx);
+	}
+	return 0;
+}
+
+void fstream_init(void) {
+	SceUID thid = sceKernelCreateThread("fstream_writer", writer_thread, 0x10000100, 0x4000, 0, SCE_KERNEL_CPU_MASK_USER_2, NULL);
+	if (thid >= 0 && sceKernelStartThread(thid, 0, NULL) >= 0)
+		writer_running = 1;
+}
+
+static int job_pending(const char *path) {
+	if (job_running && !strcasecmp(job_running->path, path))
+		return 1;
+	for (write_job *job = jobs_head; job; job = job->next) {
+		if (!strcasecmp(job->s->path, path))
+			return 1;
+	}
+	return 0;
+}
+
+void fstream_sync(const char *path) {
+	pthread_mutex_lock(&writer_mtx);
+	while ((jobs_head || job_running) && job_pending(path))
+		pthread_cond_wait(&written_cond, &writer_mtx);
+	pthread_mutex_unlock(&writer_mtx);
+}
+
+// Brings the previous save back when a crash came between the two renames of stream_close
+static void restore_save(const char *path) {
+	char old[256 + 4];
+	SceIoStat st;
+	snprintf(old, sizeof(old), "%s.old", path);
+	if (sceIoGetstat(path, &st) < 0 && sceIoGetstat(old, &st) >= 0) {
+		sceIoRename(old, path);
+		vfs_refresh(path, 1);
+	}
+}
+
+static int replace_save(const char *path) {
+	char tmp[256 + 4], old[256 + 4];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	snprintf(old, sizeof(old), "%s.old", path);
+	// Renames can't go over an existing file
+	sceIoRemove(old);
+	sceIoRename(path, old);
+	if (sceIoRename(tmp, path) < 0) {
+		sceIoRename(old, path);
+		sceIoRemove(tmp);
+		return -1;
+	}
+	sceIoRemove(old);
+	return 0;
+}
+
+static fstream *stream_open(const char *path, int writing, int cls) {
+	fstream_sync(path);
+
+	int behind = writing && (cls == IO_PREFETCH || strcasestr(path, "/replays/"));
+	SceUID fd;
+	if (writing && !behind) {
+		char tmp[256 + 4];
+		snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+		fd = sceIoOpen(tmp, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	} else if (writing) {
+		fd = sceIoOpen(path, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	} else {
+		restore_save(path);
+		fd = sceIoOpen(path, SCE_O_RDONLY, 0);
+	}
+	if (fd < 0)
+		return NULL;
+	fstream *s = calloc(1, sizeof(fstream));
+	if (!s) {
+		sceIoClose(fd);
+		return NULL;
+	}
+	s->fd = fd;
+	s->cls = cls;
+	s->writing = writing;
+	s->behind = behind;
+	strncpy(s->path, path, sizeof(s->path) - 1);
+	if (writing)
+		return s;
+
+	SceIoStat st;
+	if (sceIoGetstatByFd(fd, &st) < 0 || SCE_S_ISDIR(st.st_mode)) {
+		stream_free(s);
+		return NULL;
+	}
+	s->size = st.st_size;
+
+	if (s->size <= FSTREAM_SLURP_SIZE) {
+		s->data = malloc(s->size ? s->size : 1);
+		if (s->data && iosched_read(fd, s->data, s->size, 0, cls) == s->size) {
+			sceIoClose(fd);
+			s->fd = -1;
+		} else {
+			free(s->data);
+			s->data = NULL;
+		}
+	}
+	return s;
+}
+
+static int stream_close(void *stream) {
+	fstream *s = (fstream *)stream;
+	if (!s->writing) {
+		stream_free(s);
+		return 0;
+	}
+
+	if (!s->behind) {
+		int r = s->failed ? -1 : 0;
+		if (sceIoClose(s->fd) < 0)
+			r = -1;
+		s->fd = -1;
+		if (r == 0) {
+			r = replace_save(s->path);
+		} else {
+			char tmp[256 + 4];
+			snprintf(tmp, sizeof(tmp), "%s.tmp", s->path);
+			sceIoRemove(tmp);
+			debugPrintf("fstream: failed to write %s, the previous file is kept\n", s->path);
+		}
+		vfs_refresh(s->path, 1);
+		stream_free(s);
+		return r;
+	}
+
+	write_job *job = writer_running ? malloc(sizeof(write_job)) : NULL;
+	if (!job) {
+		int r = stream_flush(s);
+		if (sceIoClose(s->fd) < 0)
+			r = -1;
+		s->fd = -1;
+		stream_free(s);
+		return r;
+	}
+	job->s = s;
+	job->next = NULL;
+	pthread_mutex_lock(&writer_mtx);
+	if (jobs_tail)
+		jobs_tail->next = job;
+	else
+		jobs_head = job;
+	jobs_tail = job;
+	pthread_cond_signal(&writer_cond);
+	pthread_mutex_unlock(&writer_mtx);
+	return 0;
+}
+
+static int stream_read(void *stream, void *dst, uint32_t size) {
+	fstream *s = (fstream *)stream;
+	if (s->pos >= s->size)
+		return 0;
+	if (size > s->size - s->pos)
+		size = s->size - s->pos;
+
+	int r = size;
+	if (s->data)
+		memcpy(dst, s->data + s->pos, size);
+	else
+		r = iosched_read(s->fd, dst, size, s->pos, s->cls);
+	if (r > 0)
+		s->pos += r;
+	return r;
+}
+
+static int stream_write(void *stream, const void *src, uint32_t size) {
+	fstream *s = (fstream *)stream;
+	if (!s->behind) {
+		// stdio already gathered the small writes, what it hands over goes to the file right away
+		for (uint32_t done = 0; done < size;) {
+			uint32_t len = size - done;
+			if (len > FSTREAM_WRITE_CHUNK)
+				len = FSTREAM_WRITE_CHUNK;
+			int r = sceIoPwrite(s->fd, (const uint8_t *)src + done, len, s->pos);
+			if (r <= 0) {
+				s->failed = 1;
+				return done ? (int)done : -1;
+			}
+			done += r;
+			s->pos += r;
+			if (s->pos > s->size)
+				s->size = s->pos;
+		}
+		return size;
+	}
+	if (s->pos + size > s->capacity) {
+		uint32_t capacity = s->capacity ? s->capacity : FSTREAM_BUFFER_SIZE;
+		while (capacity < s->pos + size)
+			capacity *= 2;
+		uint8_t *data = realloc(s->data, capacity);
+		if (!data)
+			return -1;
+		s->data = data;
+		s->capacity = capacity;
+	}
+	if (s->pos > s->size)
+		memset(s->data + s->size, 0, s->pos - s->size);
+	memcpy(s->data + s->pos, src, size);
+	s->pos += size;
+	if (s->pos > s->size)
+		s->size = s->pos;
+	return size;
+}
+
+static int64_t stream_seek(void *stream, int64_t offset, int whence) {
+	fstream *s = (fstream *)stream;
+	int64_t pos;
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = s->pos + offset;
+		break;
+	case SEEK_END:
+		pos = s->size + offset;
+		break;
+	default:
+		return -1;
+	}
+	if (pos < 0)
+		return -1;
+	s->pos = pos;
+	return pos;
+}
+
+static int64_t stream_size(void *stream) {
+	return ((fstream *)stream)->size;
+}
+
+static const cookie_funcs read_funcs = {stream_read, NULL, stream_seek, stream_size, stream_close};
+static const cookie_funcs write_funcs = {stream_read, stream_write, stream_seek, stream_size, stream_close};
+
+// Only plain reads and truncating writes are handled, anything else is left to newlib
+FILE *fstream_fopen(const char *path, const char *mode, int cls) {
+	if (strchr(mode, '+') || (mode[0] != 'r' && mode[0] != 'w'))
+		return NULL;
+	fstream *s = stream_open(path, mode[0] == 'w', cls);
+	if (!s)
+		return NULL;
+
+	FILE *f = s->writing ? cookie_fopen(s, &write_funcs, "w") : cookie_fopen(s, &read_funcs, "r");
+	if (!f) {
+		stream_free(s);
+		return NULL;
+	}
+
+	// Slurped files already sit in memory, everything else gets a large aligned buffer
+	if (s->writing || !s->data) {
+		s->vbuf = memalign(FSTREAM_BUFFER_ALIGN, FSTREAM_BUFFER_SIZE);
+		if (s->vbuf)
+			setvbuf(f, s->vbuf, _IOFBF, FSTREAM_BUFFER_SIZE);
+	}
+	return f;
+}
+
+SDL_RWops *fstream_rwops(const char *path, int cls) {
+	fstream *s = stream_open(path, 0, cls);
+	if (!s)
+		return NULL;
+	SDL_RWops *ctx = cookie_rwops(s, &read_funcs);
+	if (!ctx)
+		stream_free(s);
+	return ctx;
+}
@@ -0,0 +1,15 @@
+#ifndef __FSTREAM_H__
+#define __FSTREAM_H__
+
+#include <stdio.h>
+
+struct SDL_RWops;
+
+void fstream_init(void);
+
+FILE *fstream_fopen(const char *path, const char *mode, int cls);
+struct SDL_RWops *fstream_rwops(const char *path, int cls);
+
+void fstream_sync(const char *path);
+
+#endif
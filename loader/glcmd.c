@@ -0,0 +1,1356 @@
+/* glcmd.c -- GL calls recorded on the game thread and replayed on a render thread
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef __vita__
+#include <vitasdk.h>
+#include <vitaGL.h>
+#include "main.h"
+#else
+#include <time.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "config.h"
+#define debugPrintf printf
+#endif
+
+#include "glcmd.h"
+
+/*
+ * Every wrapped call becomes a command in the list the game thread records into: its kind (how to call
+ * the function back), the wrapped function and the arguments, followed by a copy of whatever memory the
+ * call reads. SDL_GL_SwapWindow hands the list to the render thread and recording goes on in the other
+ * one, so the game runs at most a frame ahead. Client arrays are copied at draw time for the vertex range
+ * the draw uses and the arrays pointed at the copies around it. Anything else, calls returning data in
+ * particular, waits for the render thread to drain and runs in place: only one thread is ever inside
+ * vitaGL and the hooks underneath, and they keep assuming a single GL thread.
+ *
+ * A capture writes the lists out as they get submitted, with the calls running in place in between, so a
+ * frame can be replayed and looked at away from the device. The data copied along is what makes it work:
+ * uploads, uniforms and client arrays are all in there. Shader sources are kept around for the captures
+ * starting after the shaders got compiled, textures and buffers uploaded before are only known by name.
+ */
+
+#define LIST_SIZE (GL_RENDER_LIST_KB * 1024)
+#define LIST_WORDS (LIST_SIZE / sizeof(uintptr_t))
+#define MAX_ATTRIBS 16
+#define MAX_SOURCES 16
+#define SYNC_SLOTS 128
+#define REPORT_FRAMES 600
+
+#define UNKNOWN_SIZE 0xFFFFFFFF
+
+// Command header: kind, argument pointing into the data copied along, internal flag and size in words
+#define CMD_KIND(h) ((h) & 0x1F)
+#define CMD_PTR(i) (((i) + 1) << 5)
+#define CMD_PTR_ARG(h) ((int)(((h) >> 5) & 0xF) - 1)
+#define CMD_INTERNAL (1 << 9) // Issued by glcmd itself around client array draws
+#define CMD_WORDS(h) ((h) >> 10)
+
+typedef uintptr_t W;
+
+static const uint8_t kind_args[NUM_KINDS] = {0, 1, 2, 3, 4, 5, 6, 8, 9, 1, 2, 3, 4, 6, 2, 3, 4, 5, 3, 2};
+
+typedef void (*fn_v)(void);
+typedef void (*fn_i1)(W);
+typedef void (*fn_i2)(W, W);
+typedef void (*fn_i3)(W, W, W);
+typedef void (*fn_i4)(W, W, W, W);
+typedef void (*fn_i5)(W, W, W, W, W);
+typedef void (*fn_i6)(W, W, W, W, W, W);
+typedef void (*fn_i8)(W, W, W, W, W, W, W, W);
+typedef void (*fn_i9)(W, W, W, W, W, W, W, W, W);
+typedef void (*fn_f1)(float);
+typedef void (*fn_f2)(float, float);
+typedef void (*fn_f3)(float, float, float);
+typedef void (*fn_f4)(float, float, float, float);
+typedef void (*fn_f6)(float, float, float, float, float, float);
+typedef void (*fn_i1f1)(W, float);
+typedef void (*fn_i1f2)(W, float, float);
+typedef void (*fn_i1f3)(W, float, float, float);
+typedef void (*fn_i1f4)(W, float, float, float, float);
+typedef void (*fn_i2f1)(W, W, float);
+typedef void (*fn_source)(W, W, char **, const GLint *);
+
+enum {
+	ARRAY_VERTEX,
+	ARRAY_COLOR,
+	ARRAY_TEXCOORD,
+	NUM_FIXED,
+	NUM_ARRAYS = NUM_FIXED + MAX_ATTRIBS, // Generic vertex attributes follow the fixed function arrays
+};
+
+typedef struct {
+	W size, type, normalized, stride, pointer;
+	int client; // Set while no GL_ARRAY_BUFFER was bound, the pointer is game memory
+	int enabled;
+} client_array;
+
+typedef struct {
+	W *data;
+	uint32_t used; // Words
+} cmd_list;
+
+typedef struct {
+	W shader, count;
+	uint32_t size;
+	char *strings; // Laid out like K_SOURCE data
+} shader_source;
+
+static pthread_mutex_t glcmd_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+
+static int running = 0, threaded = 0;
+static cmd_list lists[2];
+static int recording = 0; // List the game thread records into, only touched by it
+static int pending = -1; // List handed to the render thread, -1 while it is idle
+
+// What the game has set up so far, only touched by the game thread
+static client_array arrays[NUM_ARRAYS];
+static shader_source *sources = NULL;
+static int num_sources = 0, max_sources = 0;
+static W array_buffer = 0, element_buffer = 0;
+
+static uintptr_t sync_targets[SYNC_SLOTS];
+static const char *sync_symbols[SYNC_SLOTS];
+static int num_sync_targets = 0;
+
+static uint32_t stat_frames, stat_commands, stat_syncs;
+static uint64_t stat_words, stat_stall_us, stat_busy_us;
+
+// Capture requests can come from any thread, the file is only written by the game thread
+static char capture_path[256];
+static int capture_request = 0; // Frames asked for
+static int capture_frames = 0;
+static FILE *capture_file = NULL;
+
+static void capture_write(int type, int flags, int symbol, int kind, int ptr, const W *args, int nargs,
+	const void *data, uint32_t size);
+static void capture_list(const cmd_list *l);
+static void capture_call(uint32_t hdr, uintptr_t func, const W *args, const void *data, uint32_t size);
+static void capture_frame(void);
+
+#ifdef __vita__
+static uint64_t now_us(void) {
+	return sceKernelGetProcessTimeWide();
+}
+#else
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+static inline W fw(float f) {
+	union {
+		float f;
+		uint32_t u;
+	} c = {f};
+	return c.u;
+}
+
+static inline float wf(W w) {
+	union {
+		uint32_t u;
+		float f;
+	} c = {(uint32_t)w};
+	return c.f;
+}
+
+static void execute(uint32_t kind, uintptr_t func, W *a) {
+	switch (kind) {
+	case K_V:
+		((fn_v)func)();
+		break;
+	case K_I1:
+		((fn_i1)func)(a[0]);
+		break;
+	case K_I2:
+		((fn_i2)func)(a[0], a[1]);
+		break;
+	case K_I3:
+		((fn_i3)func)(a[0], a[1], a[2]);
+		break;
+	case K_I4:
+		((fn_i4)func)(a[0], a[1], a[2], a[3]);
+		break;
+	case K_I5:
+		((fn_i5)func)(a[0], a[1], a[2], a[3], a[4]);
+		break;
+	case K_I6:
+		((fn_i6)func)(a[0], a[1], a[2], a[3], a[4], a[5]);
+		break;
+	case K_I8:
+		((fn_i8)func)(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+		break;
+	case K_I9:
+		((fn_i9)func)(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8]);
+		break;
+	case K_F1:
+		((fn_f1)func)(wf(a[0]));
+		break;
+	case K_F2:
+		((fn_f2)func)(wf(a[0]), wf(a[1]));
+		break;
+	case K_F3:
+		((fn_f3)func)(wf(a[0]), wf(a[1]), wf(a[2]));
+		break;
+	case K_F4:
+		((fn_f4)func)(wf(a[0]), wf(a[1]), wf(a[2]), wf(a[3]));
+		break;
+	case K_F6:
+		((fn_f6)func)(wf(a[0]), wf(a[1]), wf(a[2]), wf(a[3]), wf(a[4]), wf(a[5]));
+		break;
+	case K_I1F1:
+		((fn_i1f1)func)(a[0], wf(a[1]));
+		break;
+	case K_I1F2:
+		((fn_i1f2)func)(a[0], wf(a[1]), wf(a[2]));
+		break;
+	case K_I1F3:
+		((fn_i1f3)func)(a[0], wf(a[1]), wf(a[2]), wf(a[3]));
+		break;
+	case K_I1F4:
+		((fn_i1f4)func)(a[0], wf(a[1]), wf(a[2]), wf(a[3]), wf(a[4]));
+		break;
+	case K_I2F1:
+		((fn_i2f1)func)(a[0], a[1], wf(a[2]));
+		break;
+	default: {
+		char *strings[MAX_SOURCES];
+		char *s = (char *)(a + 2);
+		for (W i = 0; i < a[1]; i++) {
+			strings[i] = s;
+			s += strlen(s) + 1;
+		}
+		((fn_source)func)(a[0], a[1], strings, NULL);
+		break;
+	}
+	}
+}
+
+// Returns how long it took
+static uint64_t replay(const cmd_list *l) {
+	uint64_t start = now_us();
+	for (W *p = l->data, *end = l->data + l->used; p < end; p += CMD_WORDS(p[0]))
+		execute(CMD_KIND(p[0]), p[1], p + 2);
+	return now_us() - start;
+}
+
+static void *render_thread(void *arg) {
+	for (;;) {
+		pthread_mutex_lock(&glcmd_mtx);
+		while (pending < 0)
+			pthread_cond_wait(&work_cond, &glcmd_mtx);
+		cmd_list *l = &lists[pending];
+		pthread_mutex_unlock(&glcmd_mtx);
+
+		uint64_t busy_us = replay(l);
+
+		pthread_mutex_lock(&glcmd_mtx);
+		stat_busy_us += busy_us;
+		pending = -1;
+		pthread_cond_broadcast(&idle_cond);
+		pthread_mutex_unlock(&glcmd_mtx);
+	}
+	return NULL;
+}
+
+#ifdef __vita__
+static int render_thread_entry(SceSize args, void *argp) {
+	render_thread(NULL);
+	return 0;
+}
+#endif
+
+// Hands the recorded commands over, waiting for the render thread to be done with the previous ones.
+// Without the render thread they get replayed right away.
+static void submit(void) {
+	cmd_list *l = &lists[recording];
+	if (!l->used)
+		return;
+	if (capture_file)
+		capture_list(l);
+	if (!threaded) {
+		stat_busy_us += replay(l);
+		l->used = 0;
+		return;
+	}
+	pthread_mutex_lock(&glcmd_mtx);
+	if (pending >= 0) {
+		uint64_t start = now_us();
+		while (pending >= 0)
+			pthread_cond_wait(&idle_cond, &glcmd_mtx);
+		stat_stall_us += now_us() - start;
+	}
+	pending = recording;
+	pthread_cond_signal(&work_cond);
+	pthread_mutex_unlock(&glcmd_mtx);
+	recording ^= 1;
+	lists[recording].used = 0;
+}
+
+void glcmd_sync(void) {
+	submit();
+	pthread_mutex_lock(&glcmd_mtx);
+	while (pending >= 0)
+		pthread_cond_wait(&idle_cond, &glcmd_mtx);
+	pthread_mutex_unlock(&glcmd_mtx);
+	stat_syncs++;
+}
+
+static inline uint64_t cmd_words(uint32_t nargs, uint64_t size) {
+	return 2 + nargs + (size + sizeof(W) - 1) / sizeof(W);
+}
+
+// Makes room for the next commands in the same list, 0 when they can't fit any list
+static int reserve(uint64_t words) {
+	if (words > LIST_WORDS)
+		return 0;
+	if (lists[recording].used + words > LIST_WORDS)
+		submit();
+	return 1;
+}
+
+// Appends a command to the space reserved, blob gets size bytes for a copy of the memory it reads
+static W *emit(uint32_t hdr, uintptr_t func, uint32_t nargs, uint32_t size, void **blob) {
+	cmd_list *l = &lists[recording];
+	uint32_t words = cmd_words(nargs, size);
+	W *p = l->data + l->used;
+	l->used += words;
+	p[0] = hdr | (words << 10);
+	p[1] = func;
+	if (blob)
+		*blob = p + 2 + nargs;
+	stat_commands++;
+	stat_words += words;
+	return p + 2;
+}
+
+static W *record(uint32_t kind, uintptr_t func, uint32_t nargs) {
+	reserve(cmd_words(nargs, 0));
+	return emit(kind, func, nargs, 0, NULL);
+}
+
+// Records a call reading size bytes from args[ptr], the call runs in place when they don't fit
+static void record_copy(uint32_t kind, uintptr_t func, W *args, uint32_t nargs, uint32_t ptr, uint32_t size) {
+	const void *data = (const void *)args[ptr];
+	if (!data)
+		size = 0;
+	if (size == UNKNOWN_SIZE || !reserve(cmd_words(nargs, size))) {
+		glcmd_sync();
+		if (capture_file)
+			capture_call(kind | CMD_PTR(ptr), func, args, data, size == UNKNOWN_SIZE ? 0 : size);
+		execute(kind, func, args);
+		return;
+	}
+	void *blob;
+	W *a = emit(kind | (data ? CMD_PTR(ptr) : 0), func, nargs, size, &blob);
+	memcpy(a, args, nargs * sizeof(W));
+	if (data) {
+		memcpy(blob, data, size);
+		a[ptr] = (W)blob;
+	}
+}
+
+#define TARGET(name) static uintptr_t name##_target;
+
+#define REC_V(name) TARGET(name) \
+	static void name##_rec(void) { \
+		record(K_V, name##_target, 0); \
+	}
+#define REC_I1(name) TARGET(name) \
+	static void name##_rec(W a0) { \
+		W *a = record(K_I1, name##_target, 1); \
+		a[0] = a0; \
+	}
+#define REC_I2(name) TARGET(name) \
+	static void name##_rec(W a0, W a1) { \
+		W *a = record(K_I2, name##_target, 2); \
+		a[0] = a0; \
+		a[1] = a1; \
+	}
+#define REC_I3(name) TARGET(name) \
+	static void name##_rec(W a0, W a1, W a2) { \
+		W *a = record(K_I3, name##_target, 3); \
+		a[0] = a0; \
+		a[1] = a1; \
+		a[2] = a2; \
+	}
+#define REC_I4(name) TARGET(name) \
+	static void name##_rec(W a0, W a1, W a2, W a3) { \
+		W *a = record(K_I4, name##_target, 4); \
+		a[0] = a0; \
+		a[1] = a1; \
+		a[2] = a2; \
+		a[3] = a3; \
+	}
+#define REC_I5(name) TARGET(name) \
+	static void name##_rec(W a0, W a1, W a2, W a3, W a4) { \
+		W *a = record(K_I5, name##_target, 5); \
+		a[0] = a0; \
+		a[1] = a1; \
+		a[2] = a2; \
+		a[3] = a3; \
+		a[4] = a4; \
+	}
+#define REC_I8(name) TARGET(name) \
+	static void name##_rec(W a0, W a1, W a2, W a3, W a4, W a5, W a6, W a7) { \
+		W *a = record(K_I8, name##_target, 8); \
+		a[0] = a0; \
+		a[1] = a1; \
+		a[2] = a2; \
+		a[3] = a3; \
+		a[4] = a4; \
+		a[5] = a5; \
+		a[6] = a6; \
+		a[7] = a7; \
+	}
+#define REC_F1(name) TARGET(name) \
+	static void name##_rec(float f0) { \
+		W *a = record(K_F1, name##_target, 1); \
+		a[0] = fw(f0); \
+	}
+#define REC_F2(name) TARGET(name) \
+	static void name##_rec(float f0, float f1) { \
+		W *a = record(K_F2, name##_target, 2); \
+		a[0] = fw(f0); \
+		a[1] = fw(f1); \
+	}
+#define REC_F3(name) TARGET(name) \
+	static void name##_rec(float f0, float f1, float f2) { \
+		W *a = record(K_F3, name##_target, 3); \
+		a[0] = fw(f0); \
+		a[1] = fw(f1); \
+		a[2] = fw(f2); \
+	}
+#define REC_F4(name) TARGET(name) \
+	static void name##_rec(float f0, float f1, float f2, float f3) { \
+		W *a = record(K_F4, name##_target, 4); \
+		a[0] = fw(f0); \
+		a[1] = fw(f1); \
+		a[2] = fw(f2); \
+		a[3] = fw(f3); \
+	}
+#define REC_F6(name) TARGET(name) \
+	static void name##_rec(float f0, float f1, float f2, float f3, float f4, float f5) { \
+		W *a = record(K_F6, name##_target, 6); \
+		a[0] = fw(f0); \
+		a[1] = fw(f1); \
+		a[2] = fw(f2); \
+		a[3] = fw(f3); \
+		a[4] = fw(f4); \
+		a[5] = fw(f5); \
+	}
+#define REC_I1F1(name) TARGET(name) \
+	static void name##_rec(W a0, float f0) { \
+		W *a = record(K_I1F1, name##_target, 2); \
+		a[0] = a0; \
+		a[1] = fw(f0); \
+	}
+#define REC_I1F2(name) TARGET(name) \
+	static void name##_rec(W a0, float f0, float f1) { \
+		W *a = record(K_I1F2, name##_target, 3); \
+		a[0] = a0; \
+		a[1] = fw(f0); \
+		a[2] = fw(f1); \
+	}
+#define REC_I1F3(name) TARGET(name) \
+	static void name##_rec(W a0, float f0, float f1, float f2) { \
+		W *a = record(K_I1F3, name##_target, 4); \
+		a[0] = a0; \
+		a[1] = fw(f0); \
+		a[2] = fw(f1); \
+		a[3] = fw(f2); \
+	}
+#define REC_I1F4(name) TARGET(name) \
+	static void name##_rec(W a0, float f0, float f1, float f2, float f3) { \
+		W *a = record(K_I1F4, name##_target, 5); \
+		a[0] = a0; \
+		a[1] = fw(f0); \
+		a[2] = fw(f1); \
+		a[3] = fw(f2); \
+		a[4] = fw(f3); \
+	}
+#define REC_I2F1(name) TARGET(name) \
+	static void name##_rec(W a0, W a1, float f0) { \
+		W *a = record(K_I2F1, name##_target, 3); \
+		a[0] = a0; \
+		a[1] = a1; \
+		a[2] = fw(f0); \
+	}
+#define REC_UNIFORMV(name, n) TARGET(name) \
+	static void name##_rec(W location, W count, W value) { \
+		W args[3] = {location, count, value}; \
+		record_copy(K_I3, name##_target, args, 3, 2, (GLsizei)count > 0 ? count * n * 4 : 0); \
+	}
+#define REC_MATRIXV(name, n) TARGET(name) \
+	static void name##_rec(W location, W count, W transpose, W value) { \
+		W args[4] = {location, count, transpose, value}; \
+		record_copy(K_I4, name##_target, args, 4, 3, (GLsizei)count > 0 ? count * n * n * 4 : 0); \
+	}
+
+REC_V(glLoadIdentity)
+REC_I1(glActiveTexture)
+REC_I1(glEnable)
+REC_I1(glDisable)
+REC_I1(glMatrixMode)
+REC_I1(glClear)
+REC_I1(glGenerateMipmap)
+REC_I1(glLinkProgram)
+REC_I1(glUseProgram)
+REC_I1(glDeleteProgram)
+REC_I1(glCompileShader)
+REC_I1(glDepthFunc)
+REC_I1(glDepthMask)
+REC_I1(glCullFace)
+REC_I1(glFrontFace)
+REC_I1(glBlendEquation)
+REC_I2(glBindTexture)
+REC_I2(glBlendFunc)
+REC_I2(glBindFramebuffer)
+REC_I2(glAttachShader)
+REC_I2(glUniform1i)
+REC_I3(glTexParameteri)
+REC_I3(glTexEnvi)
+REC_I3(glUniform2i)
+REC_I4(glScissor)
+REC_I4(glViewport)
+REC_I4(glBlendFuncSeparate)
+REC_I4(glColorMask)
+REC_I4(glColor4ub)
+REC_I4(glUniform3i)
+REC_I5(glUniform4i)
+REC_I5(glFramebufferTexture2D)
+REC_I8(glCopyTexImage2D)
+REC_I8(glCopyTexSubImage2D)
+REC_F1(glLineWidth)
+REC_F1(glClearDepthf)
+REC_F2(glPolygonOffset)
+REC_F2(glDepthRangef)
+REC_F3(glScalef)
+REC_F4(glClearColor)
+REC_F4(glColor4f)
+REC_F6(glOrthof)
+REC_I1F1(glUniform1f)
+REC_I1F2(glUniform2f)
+REC_I1F3(glUniform3f)
+REC_I1F4(glUniform4f)
+REC_I1F1(glAlphaFunc)
+REC_I2F1(glTexParameterf)
+REC_UNIFORMV(glUniform1fv, 1)
+REC_UNIFORMV(glUniform2fv, 2)
+REC_UNIFORMV(glUniform3fv, 3)
+REC_UNIFORMV(glUniform4fv, 4)
+REC_UNIFORMV(glUniform1iv, 1)
+REC_UNIFORMV(glUniform2iv, 2)
+REC_UNIFORMV(glUniform3iv, 3)
+REC_UNIFORMV(glUniform4iv, 4)
+REC_MATRIXV(glUniformMatrix2fv, 2)
+REC_MATRIXV(glUniformMatrix3fv, 3)
+REC_MATRIXV(glUniformMatrix4fv, 4)
+
+TARGET(glBindBuffer)
+TARGET(glDeleteBuffers)
+TARGET(glBufferData)
+TARGET(glBufferSubData)
+TARGET(glDeleteTextures)
+TARGET(glTexImage2D)
+TARGET(glTexSubImage2D)
+TARGET(glCompressedTexImage2D)
+TARGET(glDeleteShader)
+TARGET(glShaderSource)
+TARGET(glVertexPointer)
+TARGET(glColorPointer)
+TARGET(glTexCoordPointer)
+TARGET(glVertexAttribPointer)
+TARGET(glEnableClientState)
+TARGET(glDisableClientState)
+TARGET(glEnableVertexAttribArray)
+TARGET(glDisableVertexAttribArray)
+TARGET(glDrawElements)
+TARGET(glDrawArrays)
+TARGET(SDL_GL_SwapWindow)
+
+static uintptr_t *const pointer_targets[NUM_FIXED] = {&glVertexPointer_target, &glColorPointer_target, &glTexCoordPointer_target};
+
+static uint32_t type_size(W type) {
+	switch (type) {
+	case GL_FLOAT:
+	case GL_FIXED:
+		return 4;
+	case GL_SHORT:
+	case GL_UNSIGNED_SHORT:
+		return 2;
+	case GL_BYTE:
+	case GL_UNSIGNED_BYTE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static uint32_t index_size(W type) {
+	switch (type) {
+	case GL_UNSIGNED_INT:
+		return 4;
+	case GL_UNSIGNED_SHORT:
+		return 2;
+	case GL_UNSIGNED_BYTE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Bytes read from pixels, same unpack alignment assumption as texupload.c
+static uint32_t image_size(W width, W height, W format, W type) {
+	uint32_t bpp;
+	switch (type) {
+	case GL_UNSIGNED_BYTE:
+		switch (format) {
+		case GL_RGBA:
+			bpp = 4;
+			break;
+		case GL_RGB:
+			bpp = 3;
+			break;
+		case GL_LUMINANCE_ALPHA:
+			bpp = 2;
+			break;
+		case GL_LUMINANCE:
+		case GL_ALPHA:
+			bpp = 1;
+			break;
+		default:
+			return UNKNOWN_SIZE;
+		}
+		break;
+	case GL_UNSIGNED_SHORT_5_6_5:
+	case GL_UNSIGNED_SHORT_4_4_4_4:
+	case GL_UNSIGNED_SHORT_5_5_5_1:
+		bpp = 2;
+		break;
+	default:
+		return UNKNOWN_SIZE;
+	}
+	if ((GLsizei)width <= 0 || (GLsizei)height <= 0)
+		return 0;
+	uint32_t row = (width * bpp + 3) & ~3;
+	return row * (height - 1) + width * bpp;
+}
+
+static void glBindBuffer_rec(W target, W buffer) {
+	if (target == GL_ARRAY_BUFFER)
+		array_buffer = buffer;
+	else if (target == GL_ELEMENT_ARRAY_BUFFER)
+		element_buffer = buffer;
+	W *a = record(K_I2, glBindBuffer_target, 2);
+	a[0] = target;
+	a[1] = buffer;
+}
+
+static void glDeleteBuffers_rec(W n, W buffers) {
+	for (GLsizei i = 0; i < (GLsizei)n; i++) {
+		GLuint name = ((const GLuint *)buffers)[i];
+		if (name && name == array_buffer)
+			array_buffer = 0;
+		if (name && name == element_buffer)
+			element_buffer = 0;
+	}
+	W args[2] = {n, buffers};
+	record_copy(K_I2, glDeleteBuffers_target, args, 2, 1, (GLsizei)n > 0 ? n * sizeof(GLuint) : 0);
+}
+
+static void glBufferData_rec(W target, W size, W data, W usage) {
+	W args[4] = {target, size, data, usage};
+	record_copy(K_I4, glBufferData_target, args, 4, 2, size);
+}
+
+static void glBufferSubData_rec(W target, W offset, W size, W data) {
+	W args[4] = {target, offset, size, data};
+	record_copy(K_I4, glBufferSubData_target, args, 4, 3, size);
+}
+
+static void glDeleteTextures_rec(W n, W textures) {
+	W args[2] = {n, textures};
+	record_copy(K_I2, glDeleteTextures_target, args, 2, 1, (GLsizei)n > 0 ? n * sizeof(GLuint) : 0);
+}
+
+static void glTexImage2D_rec(W target, W level, W internalformat, W width, W height, W border, W format, W type,
+	W pixels) {
+	W args[9] = {target, level, internalformat, width, height, border, format, type, pixels};
+	record_copy(K_I9, glTexImage2D_target, args, 9, 8, image_size(width, height, format, type));
+}
+
+static void glTexSubImage2D_rec(W target, W level, W xoffset, W yoffset, W width, W height, W format, W type,
+	W pixels) {
+	W args[9] = {target, level, xoffset, yoffset, width, height, format, type, pixels};
+	record_copy(K_I9, glTexSubImage2D_target, args, 9, 8, image_size(width, height, format, type));
+}
+
+static void glCompressedTexImage2D_rec(W target, W level, W internalformat, W width, W height, W border,
+	W imageSize, W data) {
+	W args[8] = {target, level, internalformat, width, height, border, imageSize, data};
+	record_copy(K_I8, glCompressedTexImage2D_target, args, 8, 7, imageSize);
+}
+
+static int find_source(W shader) {
+	for (int i = 0; i < num_sources; i++) {
+		if (sources[i].shader == shader)
+			return i;
+	}
+	return -1;
+}
+
+static void forget_source(W shader) {
+	int i = find_source(shader);
+	if (i < 0)
+		return;
+	free(sources[i].strings);
+	sources[i] = sources[--num_sources];
+}
+
+// Keeps the latest source of every shader for the captures to start with
+static void keep_source(W shader, W count, const char *strings, uint32_t size) {
+	char *copy = malloc(size);
+	if (!copy)
+		return;
+	memcpy(copy, strings, size);
+	forget_source(shader);
+	if (num_sources == max_sources) {
+		int max = max_sources ? max_sources * 2 : 64;
+		shader_source *grown = realloc(sources, max * sizeof(*sources));
+		if (!grown) {
+			free(copy);
+			return;
+		}
+		sources = grown;
+		max_sources = max;
+	}
+	sources[num_sources++] = (shader_source){shader, count, size, copy};
+}
+
+static void glDeleteShader_rec(W shader) {
+	forget_source(shader);
+	W *a = record(K_I1, glDeleteShader_target, 1);
+	a[0] = shader;
+}
+
+static void shader_source_in_place(W shader, W count, const char *const *string, const GLint *length) {
+	forget_source(shader);
+	glcmd_sync();
+	if (capture_file) {
+		W args[4] = {shader, count, (W)string, (W)length};
+		capture_call(K_I4, glShaderSource_target, args, NULL, 0);
+	}
+	((fn_i4)glShaderSource_target)(shader, count, (W)string, (W)length);
+}
+
+// glShaderSource_hook writes into the first string, so it gets a copy in any case
+static void glShaderSource_rec(W shader, W count, const char *const *string, const GLint *length) {
+	uint32_t lengths[MAX_SOURCES], size = 0;
+	if ((GLsizei)count < 0 || count > MAX_SOURCES) {
+		shader_source_in_place(shader, count, string, length);
+		return;
+	}
+	for (W i = 0; i < count; i++) {
+		lengths[i] = length && length[i] >= 0 ? length[i] : strlen(string[i]);
+		size += lengths[i] + 1;
+	}
+	if (!reserve(cmd_words(2, size))) {
+		shader_source_in_place(shader, count, string, length);
+		return;
+	}
+	void *blob;
+	W *a = emit(K_SOURCE, glShaderSource_target, 2, size, &blob);
+	a[0] = shader;
+	a[1] = count;
+	char *dst = blob;
+	for (W i = 0; i < count; i++) {
+		memcpy(dst, string[i], lengths[i]);
+		dst[lengths[i]] = 0;
+		dst += lengths[i] + 1;
+	}
+	keep_source(shader, count, blob, size);
+}
+
+static void set_array(int i, W size, W type, W normalized, W stride, W pointer) {
+	client_array *c = &arrays[i];
+	c->size = size;
+	c->type = type;
+	c->normalized = normalized;
+	c->stride = stride;
+	c->pointer = pointer;
+	c->client = !array_buffer;
+}
+
+static void glVertexPointer_rec(W size, W type, W stride, W pointer) {
+	set_array(ARRAY_VERTEX, size, type, 0, stride, pointer);
+	W *a = record(K_I4, glVertexPointer_target, 4);
+	a[0] = size;
+	a[1] = type;
+	a[2] = stride;
+	a[3] = pointer;
+}
+
+static void glColorPointer_rec(W size, W type, W stride, W pointer) {
+	set_array(ARRAY_COLOR, size, type, 0, stride, pointer);
+	W *a = record(K_I4, glColorPointer_target, 4);
+	a[0] = size;
+	a[1] = type;
+	a[2] = stride;
+	a[3] = pointer;
+}
+
+static void glTexCoordPointer_rec(W size, W type, W stride, W pointer) {
+	set_array(ARRAY_TEXCOORD, size, type, 0, stride, pointer);
+	W *a = record(K_I4, glTexCoordPointer_target, 4);
+	a[0] = size;
+	a[1] = type;
+	a[2] = stride;
+	a[3] = pointer;
+}
+
+static void glVertexAttribPointer_rec(W index, W size, W type, W normalized, W stride, W pointer) {
+	if (index < MAX_ATTRIBS)
+		set_array(NUM_FIXED + index, size, type, normalized, stride, pointer);
+	W *a = record(K_I6, glVertexAttribPointer_target, 6);
+	a[0] = index;
+	a[1] = size;
+	a[2] = type;
+	a[3] = normalized;
+	a[4] = stride;
+	a[5] = pointer;
+}
+
+static int fixed_array(W array) {
+	switch (array) {
+	case GL_VERTEX_ARRAY:
+		return ARRAY_VERTEX;
+	case GL_COLOR_ARRAY:
+		return ARRAY_COLOR;
+	case GL_TEXTURE_COORD_ARRAY:
+		return ARRAY_TEXCOORD;
+	default:
+		return -1;
+	}
+}
+
+static void glEnableClientState_rec(W array) {
+	int i = fixed_array(array);
+	if (i >= 0)
+		arrays[i].enabled = 1;
+	W *a = record(K_I1, glEnableClientState_target, 1);
+	a[0] = array;
+}
+
+static void glDisableClientState_rec(W array) {
+	int i = fixed_array(array);
+	if (i >= 0)
+		arrays[i].enabled = 0;
+	W *a = record(K_I1, glDisableClientState_target, 1);
+	a[0] = array;
+}
+
+static void glEnableVertexAttribArray_rec(W index) {
+	if (index < MAX_ATTRIBS)
+		arrays[NUM_FIXED + index].enabled = 1;
+	W *a = record(K_I1, glEnableVertexAttribArray_target, 1);
+	a[0] = index;
+}
+
+static void glDisableVertexAttribArray_rec(W index) {
+	if (index < MAX_ATTRIBS)
+		arrays[NUM_FIXED + index].enabled = 0;
+	W *a = record(K_I1, glDisableVertexAttribArray_target, 1);
+	a[0] = index;
+}
+
+// Enabled arrays sourced from game memory, -1 when one of them can't be copied
+static int client_arrays(int *out) {
+	int n = 0;
+	for (int i = 0; i < NUM_ARRAYS; i++) {
+		client_array *c = &arrays[i];
+		if (!c->enabled || !c->client || !c->pointer)
+			continue;
+		if (c->size < 1 || c->size > 4 || !type_size(c->type))
+			return -1;
+		out[n++] = i;
+	}
+	return n;
+}
+
+static inline uint32_t packed_size(const client_array *c) {
+	return (c->size * type_size(c->type) + 3) & ~3;
+}
+
+static inline uint64_t pointer_words(int i, uint64_t size) {
+	return cmd_words(i < NUM_FIXED ? 4 : 6, size);
+}
+
+// Room taken by the copies of verts vertices and by the commands pointing the arrays there and back
+static uint64_t arrays_words(const int *list, int n, uint32_t verts) {
+	uint64_t words = array_buffer ? 2 * cmd_words(2, 0) : 0;
+	for (int j = 0; j < n; j++)
+		words += pointer_words(list[j], (uint64_t)verts * packed_size(&arrays[list[j]])) + pointer_words(list[j], 0);
+	return words;
+}
+
+// Returns where the pointer argument goes
+static W *emit_pointer(int i, W stride, uint32_t size, void **blob) {
+	client_array *c = &arrays[i];
+	if (i < NUM_FIXED) {
+		W *a = emit(K_I4 | CMD_INTERNAL | (blob ? CMD_PTR(3) : 0), *pointer_targets[i], 4, size, blob);
+		a[0] = c->size;
+		a[1] = c->type;
+		a[2] = stride;
+		return &a[3];
+	}
+	W *a = emit(K_I6 | CMD_INTERNAL | (blob ? CMD_PTR(5) : 0), glVertexAttribPointer_target, 6, size, blob);
+	a[0] = i - NUM_FIXED;
+	a[1] = c->size;
+	a[2] = c->type;
+	a[3] = c->normalized;
+	a[4] = stride;
+	return &a[5];
+}
+
+static void emit_bind(W buffer) {
+	W *a = emit(K_I2 | CMD_INTERNAL, glBindBuffer_target, 2, 0, NULL);
+	a[0] = GL_ARRAY_BUFFER;
+	a[1] = buffer;
+}
+
+// Points the client arrays at copies of vertices lo to lo + verts - 1, for the draw emitted next
+static void emit_copies(const int *list, int n, uint32_t lo, uint32_t verts) {
+	if (array_buffer)
+		emit_bind(0);
+	for (int j = 0; j < n; j++) {
+		client_array *c = &arrays[list[j]];
+		uint32_t elem = c->size * type_size(c->type), packed = packed_size(c);
+		uint32_t stride = c->stride ? c->stride : elem;
+		void *blob;
+		W *pointer = emit_pointer(list[j], packed, verts * packed, &blob);
+		*pointer = (W)blob - lo * packed;
+		const uint8_t *src = (const uint8_t *)c->pointer + lo * stride;
+		uint8_t *dst = blob;
+		if (stride == packed) {
+			memcpy(dst, src, verts * packed);
+		} else {
+			for (uint32_t v = 0; v < verts; v++, src += stride, dst += packed)
+				memcpy(dst, src, elem);
+		}
+	}
+}
+
+// Gives the game's pointers back, calls running in place may still use them
+static void emit_restores(const int *list, int n) {
+	for (int j = 0; j < n; j++) {
+		client_array *c = &arrays[list[j]];
+		*emit_pointer(list[j], c->stride, 0, NULL) = c->pointer;
+	}
+	if (array_buffer)
+		emit_bind(array_buffer);
+}
+
+static void glDrawElements_rec(W mode, W count, W type, W indices) {
+	int list[NUM_ARRAYS];
+	int n = (GLsizei)count > 0 ? client_arrays(list) : 0;
+	uint32_t isize = index_size(type);
+	int copy = !element_buffer && indices && (GLsizei)count > 0;
+	uint64_t size = copy ? (uint64_t)count * isize : 0;
+	uint32_t lo = 0xFFFFFFFF, hi = 0;
+	if (n < 0 || (copy && !isize) || (n > 0 && !copy))
+		goto in_place;
+
+	if (n > 0) {
+		for (W i = 0; i < count; i++) {
+			uint32_t idx = isize == 4 ? ((const uint32_t *)indices)[i]
+				: isize == 2 ? ((const uint16_t *)indices)[i] : ((const uint8_t *)indices)[i];
+			if (idx < lo)
+				lo = idx;
+			if (idx > hi)
+				hi = idx;
+		}
+	}
+	uint64_t words = cmd_words(4, size) + (n > 0 ? arrays_words(list, n, hi - lo + 1) : 0);
+	if (!reserve(words))
+		goto in_place;
+
+	if (n > 0)
+		emit_copies(list, n, lo, hi - lo + 1);
+	void *blob;
+	W *a = emit(K_I4 | (copy ? CMD_PTR(3) : 0), glDrawElements_target, 4, size, &blob);
+	a[0] = mode;
+	a[1] = count;
+	a[2] = type;
+	a[3] = copy ? (W)blob : indices;
+	if (copy)
+		memcpy(blob, (const void *)indices, size);
+	if (n > 0)
+		emit_restores(list, n);
+	return;
+
+in_place:
+	glcmd_sync();
+	if (capture_file) {
+		W args[4] = {mode, count, type, indices};
+		capture_call(K_I4, glDrawElements_target, args, NULL, 0);
+	}
+	((fn_i4)glDrawElements_target)(mode, count, type, indices);
+}
+
+static void glDrawArrays_rec(W mode, W first, W count) {
+	int list[NUM_ARRAYS];
+	int n = (GLint)first >= 0 && (GLsizei)count > 0 ? client_arrays(list) : 0;
+	uint64_t words = cmd_words(3, 0) + (n > 0 ? arrays_words(list, n, count) : 0);
+	if (n < 0 || !reserve(words)) {
+		glcmd_sync();
+		if (capture_file) {
+			W args[3] = {mode, first, count};
+			capture_call(K_I3, glDrawArrays_target, args, NULL, 0);
+		}
+		((fn_i3)glDrawArrays_target)(mode, first, count);
+		return;
+	}
+
+	if (n > 0)
+		emit_copies(list, n, first, count);
+	W *a = emit(K_I3, glDrawArrays_target, 3, 0, NULL);
+	a[0] = mode;
+	a[1] = first;
+	a[2] = count;
+	if (n > 0)
+		emit_restores(list, n);
+}
+
+static void report(void) {
+	pthread_mutex_lock(&glcmd_mtx);
+	uint64_t busy_us = stat_busy_us;
+	stat_busy_us = 0;
+	pthread_mutex_unlock(&glcmd_mtx);
+	debugPrintf("glcmd: %u commands (%llu KB) per frame, %u syncs, game waited %llu us, render busy %llu us\n",
+		stat_commands / stat_frames, (unsigned long long)(stat_words * sizeof(W) / 1024 / stat_frames),
+		stat_syncs / stat_frames, (unsigned long long)(stat_stall_us / stat_frames),
+		(unsigned long long)(busy_us / stat_frames));
+	stat_frames = stat_commands = stat_syncs = 0;
+	stat_words = stat_stall_us = 0;
+}
+
+// The frame is done, the render thread gets it while the game goes on with the next one
+static void SDL_GL_SwapWindow_rec(W window) {
+	W *a = record(K_I1, SDL_GL_SwapWindow_target, 1);
+	a[0] = window;
+	submit();
+	capture_frame();
+	if (++stat_frames == REPORT_FRAMES)
+		report();
+}
+
+typedef struct {
+	const char *symbol;
+	uintptr_t rec;
+	uintptr_t *target;
+} rec_entry;
+
+#define REC(name) {#name, (uintptr_t)&name##_rec, &name##_target}
+
+static rec_entry recorded[] = {
+	REC(glLoadIdentity),
+	REC(glActiveTexture),
+	REC(glEnable),
+	REC(glDisable),
+	REC(glMatrixMode),
+	REC(glClear),
+	REC(glGenerateMipmap),
+	REC(glLinkProgram),
+	REC(glUseProgram),
+	REC(glDeleteProgram),
+	REC(glDeleteShader),
+	REC(glCompileShader),
+	REC(glDepthFunc),
+	REC(glDepthMask),
+	REC(glCullFace),
+	REC(glFrontFace),
+	REC(glBlendEquation),
+	REC(glBindTexture),
+	REC(glBlendFunc),
+	REC(glBindFramebuffer),
+	REC(glAttachShader),
+	REC(glUniform1i),
+	REC(glTexParameteri),
+	REC(glTexEnvi),
+	REC(glUniform2i),
+	REC(glScissor),
+	REC(glViewport),
+	REC(glBlendFuncSeparate),
+	REC(glColorMask),
+	REC(glColor4ub),
+	REC(glUniform3i),
+	REC(glUniform4i),
+	REC(glFramebufferTexture2D),
+	REC(glCopyTexImage2D),
+	REC(glCopyTexSubImage2D),
+	REC(glLineWidth),
+	REC(glClearDepthf),
+	REC(glPolygonOffset),
+	REC(glDepthRangef),
+	REC(glScalef),
+	REC(glClearColor),
+	REC(glColor4f),
+	REC(glOrthof),
+	REC(glUniform1f),
+	REC(glUniform2f),
+	REC(glUniform3f),
+	REC(glUniform4f),
+	REC(glAlphaFunc),
+	REC(glTexParameterf),
+	REC(glUniform1fv),
+	REC(glUniform2fv),
+	REC(glUniform3fv),
+	REC(glUniform4fv),
+	REC(glUniform1iv),
+	REC(glUniform2iv),
+	REC(glUniform3iv),
+	REC(glUniform4iv),
+	REC(glUniformMatrix2fv),
+	REC(glUniformMatrix3fv),
+	REC(glUniformMatrix4fv),
+	REC(glBindBuffer),
+	REC(glDeleteBuffers),
+	REC(glBufferData),
+	REC(glBufferSubData),
+	REC(glDeleteTextures),
+	REC(glTexImage2D),
+	REC(glTexSubImage2D),
+	REC(glCompressedTexImage2D),
+	REC(glShaderSource),
+	REC(glVertexPointer),
+	REC(glColorPointer),
+	REC(glTexCoordPointer),
+	REC(glVertexAttribPointer),
+	REC(glEnableClientState),
+	REC(glDisableClientState),
+	REC(glEnableVertexAttribArray),
+	REC(glDisableVertexAttribArray),
+	REC(glDrawElements),
+	REC(glDrawArrays),
+	REC(SDL_GL_SwapWindow),
+};
+
+#define NUM_RECORDED (sizeof(recorded) / sizeof(*recorded))
+
+// Symbol ids are indices into recorded, then the sync slots
+static uint8_t symbol_written[NUM_RECORDED + SYNC_SLOTS];
+
+static int symbol_id(uintptr_t func) {
+	for (size_t i = 0; i < NUM_RECORDED; i++) {
+		if (*recorded[i].target == func)
+			return i;
+	}
+	return -1;
+}
+
+static void capture_data(const void *data, uint32_t size) {
+	static const uint32_t padding = 0;
+	fwrite(data, size, 1, capture_file);
+	fwrite(&padding, -size & 3, 1, capture_file);
+}
+
+static void capture_write(int type, int flags, int symbol, int kind, int ptr, const W *args, int nargs,
+	const void *data, uint32_t size) {
+	if (symbol >= 0 && !symbol_written[symbol]) {
+		const char *name = symbol < (int)NUM_RECORDED ? recorded[symbol].symbol : sync_symbols[symbol - NUM_RECORDED];
+		capture_record r = {CAPTURE_SYMBOL, 0, CAPTURE_NO_PTR, 0, symbol, 0, strlen(name) + 1};
+		fwrite(&r, sizeof(r), 1, capture_file);
+		capture_data(name, r.size);
+		symbol_written[symbol] = 1;
+	}
+	capture_record r = {type, kind, ptr, flags, symbol, nargs, size};
+	uint32_t words[16];
+	for (int i = 0; i < nargs; i++)
+		words[i] = i == ptr ? (uint32_t)((intptr_t)args[i] - (intptr_t)data) : (uint32_t)args[i];
+	fwrite(&r, sizeof(r), 1, capture_file);
+	fwrite(words, sizeof(uint32_t), nargs, capture_file);
+	if (size)
+		capture_data(data, size);
+}
+
+static void capture_call(uint32_t hdr, uintptr_t func, const W *args, const void *data, uint32_t size) {
+	uint32_t kind = CMD_KIND(hdr);
+	int ptr = data ? CMD_PTR_ARG(hdr) : -1;
+	capture_write(CAPTURE_CALL, hdr & CMD_INTERNAL ? CAPTURE_INTERNAL : 0, symbol_id(func), kind,
+		ptr < 0 ? CAPTURE_NO_PTR : ptr, args, kind_args[kind], data, data ? size : 0);
+}
+
+static void capture_list(const cmd_list *l) {
+	for (W *p = l->data, *end = l->data + l->used; p < end; p += CMD_WORDS(p[0])) {
+		uint32_t nargs = kind_args[CMD_KIND(p[0])];
+		uint32_t size = (CMD_WORDS(p[0]) - 2 - nargs) * sizeof(W);
+		capture_call(p[0], p[1], p + 2, p + 2 + nargs, size);
+	}
+}
+
+static void capture_start(const char *path, int frames) {
+	capture_file = fopen(path, "wb");
+	if (!capture_file) {
+		debugPrintf("glcmd: can't write a capture to %s\n", path);
+		return;
+	}
+	capture_header h = {CAPTURE_MAGIC, CAPTURE_VERSION};
+	fwrite(&h, sizeof(h), 1, capture_file);
+	memset(symbol_written, 0, sizeof(symbol_written));
+	capture_frames = frames;
+	for (int i = 0; i < num_sources; i++) {
+		W args[2] = {sources[i].shader, sources[i].count};
+		capture_write(CAPTURE_CALL, CAPTURE_PREAMBLE, symbol_id(glShaderSource_target), K_SOURCE, CAPTURE_NO_PTR,
+			args, 2, sources[i].strings, sources[i].size);
+	}
+	debugPrintf("glcmd: capturing %d frames to %s\n", frames, path);
+}
+
+// Called once the frame got submitted
+static void capture_frame(void) {
+	if (capture_file) {
+		capture_write(CAPTURE_FRAME, 0, -1, K_V, CAPTURE_NO_PTR, NULL, 0, NULL, 0);
+		if (--capture_frames == 0) {
+			fclose(capture_file);
+			capture_file = NULL;
+			debugPrintf("glcmd: capture done\n");
+		}
+		return;
+	}
+	char path[sizeof(capture_path)];
+	pthread_mutex_lock(&glcmd_mtx);
+	int request = capture_request;
+	capture_request = 0;
+	strcpy(path, capture_path);
+	pthread_mutex_unlock(&glcmd_mtx);
+	if (request)
+		capture_start(path, request);
+}
+
+void glcmd_capture(const char *path, int frames) {
+	pthread_mutex_lock(&glcmd_mtx);
+	snprintf(capture_path, sizeof(capture_path), "%s", path);
+	capture_request = frames;
+	pthread_mutex_unlock(&glcmd_mtx);
+}
+
+/*
+ * Everything else touching GL goes through a sync slot: it waits for the render thread and jumps to the
+ * function with the arguments untouched. Everything is built for softfp, so every argument, floats and
+ * doubles included, is passed as words in r0-r3 and then on the stack. The eight words of a slot are r0-r3
+ * and the first four stack words, enough for every GL and SDL call made through a slot. The eight doubles
+ * after them only copy the next sixteen stack words along unread. A capture records the eight words, so a
+ * call made through a slot with more than eight words of arguments can't be replayed.
+ */
+#define ANY_PARAMS W a0, W a1, W a2, W a3, W a4, W a5, W a6, W a7, \
+	double d0, double d1, double d2, double d3, double d4, double d5, double d6, double d7
+#define ANY_ARGS a0, a1, a2, a3, a4, a5, a6, a7, d0, d1, d2, d3, d4, d5, d6, d7
+
+typedef W (*any_fn)(ANY_PARAMS);
+
+static W synced_call(int slot, ANY_PARAMS) {
+	glcmd_sync();
+	W res = ((any_fn)sync_targets[slot])(ANY_ARGS);
+	if (capture_file) {
+		W args[9] = {a0, a1, a2, a3, a4, a5, a6, a7, res};
+		capture_write(CAPTURE_SYNC, 0, NUM_RECORDED + slot, K_V, CAPTURE_NO_PTR, args, 9, NULL, 0);
+	}
+	return res;
+}
+
+#define SYNC_SLOT(n) static W sync_slot_##n(ANY_PARAMS) { return synced_call(n, ANY_ARGS); }
+#define SYNC_SLOTS_16(h) SYNC_SLOT(0x##h##0) SYNC_SLOT(0x##h##1) SYNC_SLOT(0x##h##2) SYNC_SLOT(0x##h##3) \
+	SYNC_SLOT(0x##h##4) SYNC_SLOT(0x##h##5) SYNC_SLOT(0x##h##6) SYNC_SLOT(0x##h##7) SYNC_SLOT(0x##h##8) \
+	SYNC_SLOT(0x##h##9) SYNC_SLOT(0x##h##A) SYNC_SLOT(0x##h##B) SYNC_SLOT(0x##h##C) SYNC_SLOT(0x##h##D) \
+	SYNC_SLOT(0x##h##E) SYNC_SLOT(0x##h##F)
+#define SLOT(n) (uintptr_t)&sync_slot_##n,
+#define SLOTS_16(h) SLOT(0x##h##0) SLOT(0x##h##1) SLOT(0x##h##2) SLOT(0x##h##3) SLOT(0x##h##4) SLOT(0x##h##5) \
+	SLOT(0x##h##6) SLOT(0x##h##7) SLOT(0x##h##8) SLOT(0x##h##9) SLOT(0x##h##A) SLOT(0x##h##B) SLOT(0x##h##C) \
+	SLOT(0x##h##D) SLOT(0x##h##E) SLOT(0x##h##F)
+
+SYNC_SLOTS_16(0)
+SYNC_SLOTS_16(1)
+SYNC_SLOTS_16(2)
+SYNC_SLOTS_16(3)
+SYNC_SLOTS_16(4)
+SYNC_SLOTS_16(5)
+SYNC_SLOTS_16(6)
+SYNC_SLOTS_16(7)
+
+static const uintptr_t sync_slots[SYNC_SLOTS] = {
+	SLOTS_16(0) SLOTS_16(1) SLOTS_16(2) SLOTS_16(3) SLOTS_16(4) SLOTS_16(5) SLOTS_16(6) SLOTS_16(7)
+};
+
+static int touches_gl(const char *symbol) {
+	if (!strncmp(symbol, "gl", 2))
+		return 1;
+	if (strncmp(symbol, "SDL_", 4) || !strcmp(symbol, "SDL_GL_GetProcAddress"))
+		return 0;
+	return !strncmp(symbol, "SDL_GL_", 7) || strstr(symbol, "Render") || strstr(symbol, "Texture");
+}
+
+uintptr_t glcmd_wrap(const char *symbol, uintptr_t func) {
+	if (!running || !func || !touches_gl(symbol))
+		return func;
+
+	for (size_t i = 0; i < sizeof(recorded) / sizeof(*recorded); i++) {
+		rec_entry *e = &recorded[i];
+		if (!strcmp(symbol, e->symbol)) {
+			if (*e->target && *e->target != func)
+				break;
+			*e->target = func;
+			return e->rec;
+		}
+	}
+
+	for (int i = 0; i < num_sync_targets; i++) {
+		if (sync_targets[i] == func)
+			return sync_slots[i];
+	}
+	if (num_sync_targets == SYNC_SLOTS) {
+		debugPrintf("glcmd: out of sync slots, %s is left unwrapped\n", symbol);
+		return func;
+	}
+	sync_targets[num_sync_targets] = func;
+	sync_symbols[num_sync_targets] = symbol;
+	return sync_slots[num_sync_targets++];
+}
+
+int glcmd_init(int with_thread) {
+	for (int i = 0; i < 2; i++) {
+		lists[i].data = malloc(LIST_SIZE);
+		if (!lists[i].data)
+			return 0;
+	}
+	if (!with_thread) {
+		running = 1;
+		return 1;
+	}
+#ifdef __vita__
+	SceUID thid = sceKernelCreateThread("glcmd_render", render_thread_entry, 0x10000100, 0x40000, 0,
+		SCE_KERNEL_CPU_MASK_USER_1, NULL);
+	if (thid < 0 || sceKernelStartThread(thid, 0, NULL) < 0)
+		return 0;
+#else
+	pthread_t t;
+	if (pthread_create(&t, NULL, render_thread, NULL))
+		return 0;
+#endif
+	running = threaded = 1;
+	return 1;
+}
@@ -0,0 +1,85 @@
+#ifndef __GLCMD_H__
+#define __GLCMD_H__
+
+#include <stdint.h>
+
+/*
+ * Split-thread renderer, enabled by GL_RENDER_THREAD in config.h. The GL entry points handed to the game
+ * get wrapped: calls are recorded into one of two command lists and a render thread replays them into the
+ * wrapped functions. Calls that return something wait for the render thread to drain and run in place.
+ *
+ * The recorded commands can also be written to a capture file, enabled by GL_CAPTURE_FRAMES in config.h.
+ * Without the render thread the lists are replayed right away on the game thread. See tools/glreplay.c.
+ */
+
+#define CAPTURE_MAGIC 0x43475652 // RVGC
+#define CAPTURE_VERSION 1
+#define CAPTURE_NO_PTR 0xFF
+
+// How a command calls its function back, I for integer and pointer arguments, F for floats
+enum {
+	K_V,
+	K_I1,
+	K_I2,
+	K_I3,
+	K_I4,
+	K_I5,
+	K_I6,
+	K_I8,
+	K_I9,
+	K_F1,
+	K_F2,
+	K_F3,
+	K_F4,
+	K_F6,
+	K_I1F1,
+	K_I1F2,
+	K_I1F3,
+	K_I1F4,
+	K_I2F1,
+	K_SOURCE, // glShaderSource, the strings follow one after the other
+	NUM_KINDS,
+};
+
+enum {
+	CAPTURE_SYMBOL, // Names the symbol id the next records use, size bytes of null terminated name follow
+	CAPTURE_CALL, // A call with its arguments and the memory it reads
+	CAPTURE_SYNC, // A call that ran in place, the return value follows the arguments
+	CAPTURE_FRAME, // SDL_GL_SwapWindow went through
+};
+
+#define CAPTURE_INTERNAL 1 // Issued by glcmd itself to point client arrays at their copies and back
+#define CAPTURE_PREAMBLE 2 // State from before the capture started, shader sources for now
+
+/*
+ * Layout: header, then records each followed by nargs 32-bit arguments and size bytes of data, padded to
+ * a multiple of 4 bytes.
+ * The argument numbered ptr is an offset into the data, negative for client arrays copied from the
+ * first vertex a draw uses. Floats keep their bits.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+} capture_header;
+
+typedef struct {
+	uint8_t type;
+	uint8_t kind;
+	uint8_t ptr;
+	uint8_t flags;
+	uint16_t symbol;
+	uint16_t nargs;
+	uint32_t size;
+} capture_record;
+
+// Starts the command lists, with the render thread when threaded, returns 0 when the calls have to keep
+// going straight through
+int glcmd_init(int threaded);
+// What to hand out instead of func, func itself when the symbol doesn't touch GL
+uintptr_t glcmd_wrap(const char *symbol, uintptr_t func);
+// Returns once every recorded call went through
+void glcmd_sync(void);
+// Writes the next frames to path, starting at the next SDL_GL_SwapWindow, safe from any thread
+void glcmd_capture(const char *path, int frames);
+
+#endif
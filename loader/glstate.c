@@ -0,0 +1,318 @@
+/* glstate.c -- shadow copy of the GL state RVGL sets before every draw, redundant calls are dropped
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "main.h"
+#include "glstate.h"
+#include "uniform.h"
+#include "batch.h"
+#include "stream.h"
+#include "meshopt.h"
+#include "vertfmt.h"
+#include "lightvar.h"
+#include "shaderpack.h"
+
+#define MAX_UNITS 16
+#define MAX_CAPS 32
+#define REPORT_FRAMES 600
+
+#define UNKNOWN -1
+
+enum {
+	CALL_BIND_TEXTURE,
+	CALL_ENABLE,
+	CALL_BLEND_FUNC,
+	CALL_USE_PROGRAM,
+	CALL_SCISSOR,
+	CALL_VIEWPORT,
+	NUM_CALLS,
+};
+
+static const char *call_names[NUM_CALLS] = {
+	"glBindTexture",
+	"glEnable/glDisable",
+	"glBlendFunc",
+	"glUseProgram",
+	"glScissor",
+	"glViewport",
+};
+
+// Everything is only touched by the GL thread, UNKNOWN forces the next call through
+static int active_unit = 0;
+static GLint textures[MAX_UNITS];
+static struct {
+	GLenum cap;
+	int enabled;
+} caps[MAX_CAPS];
+static int num_caps = 0;
+static GLenum blend_src, blend_dst;
+static int blend_known = 0;
+static GLint program = UNKNOWN;
+static GLint scissor[4], viewport[4];
+static int scissor_known = 0, viewport_known = 0;
+
+static uint32_t stat_seen[NUM_CALLS], stat_filtered[NUM_CALLS];
+static uint32_t stat_frames = 0;
+
+void glstate_invalidate(void) {
+	for (int i = 0; i < MAX_UNITS; i++)
+		textures[i] = UNKNOWN;
+	for (int i = 0; i < num_caps; i++)
+		caps[i].enabled = UNKNOWN;
+	// SDL may have left another unit active, binds go through unfiltered until the game picks one again
+	active_unit = UNKNOWN;
+	blend_known = scissor_known = viewport_known = 0;
+	program = UNKNOWN;
+	vertfmt_invalidate();
+}
+
+void glstate_forget_textures(GLsizei n, const GLuint *names) {
+	for (int i = 0; i < MAX_UNITS; i++) {
+		for (GLsizei j = 0; j < n; j++) {
+			if (textures[i] == names[j])
+				textures[i] = UNKNOWN;
+		}
+	}
+}
+
+void glActiveTexture_hook(GLenum texture) {
+	batch_flush();
+	active_unit = texture - GL_TEXTURE0;
+	glActiveTexture(texture);
+}
+
+void glBindTexture_hook(GLenum target, GLuint texture) {
+	stat_seen[CALL_BIND_TEXTURE]++;
+	if (target != GL_TEXTURE_2D || active_unit < 0 || active_unit >= MAX_UNITS) {
+		batch_flush();
+		glBindTexture(target, texture);
+		return;
+	}
+	if (textures[active_unit] == texture) {
+		stat_filtered[CALL_BIND_TEXTURE]++;
+		return;
+	}
+	batch_flush();
+	textures[active_unit] = texture;
+	glBindTexture(target, texture);
+}
+
+// 1 or 0 as the game last set it, UNKNOWN before that
+int glstate_enabled(GLenum cap) {
+	for (int i = 0; i < num_caps; i++) {
+		if (caps[i].cap == cap)
+			return caps[i].enabled;
+	}
+	return UNKNOWN;
+}
+
+static void set_cap(GLenum cap, int enabled) {
+	stat_seen[CALL_ENABLE]++;
+	int i;
+	for (i = 0; i < num_caps; i++) {
+		if (caps[i].cap == cap)
+			break;
+	}
+	if (i < num_caps && caps[i].enabled == enabled) {
+		stat_filtered[CALL_ENABLE]++;
+		return;
+	}
+	batch_flush();
+	if (i == num_caps && num_caps < MAX_CAPS)
+		caps[num_caps++].cap = cap;
+	if (i < num_caps)
+		caps[i].enabled = enabled;
+	if (enabled)
+		glEnable(cap);
+	else
+		glDisable(cap);
+}
+
+void glEnable_hook(GLenum cap) {
+	set_cap(cap, 1);
+}
+
+void glDisable_hook(GLenum cap) {
+	set_cap(cap, 0);
+}
+
+void glBlendFunc_hook(GLenum sfactor, GLenum dfactor) {
+	stat_seen[CALL_BLEND_FUNC]++;
+	if (blend_known && blend_src == sfactor && blend_dst == dfactor) {
+		stat_filtered[CALL_BLEND_FUNC]++;
+		return;
+	}
+	batch_flush();
+	blend_src = sfactor;
+	blend_dst = dfactor;
+	blend_known = 1;
+	glBlendFunc(sfactor, dfactor);
+}
+
+void glBlendFuncSeparate_hook(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha) {
+	batch_flush();
+	blend_known = 0;
+	glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+}
+
+void glUseProgram_hook(GLuint prog) {
+	stat_seen[CALL_USE_PROGRAM]++;
+	if (program == prog) {
+		stat_filtered[CALL_USE_PROGRAM]++;
+		return;
+	}
+	batch_flush();
+	program = prog;
+	glUseProgram(prog);
+}
+
+GLuint glstate_program(void) {
+	if (program == UNKNOWN)
+		glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	return program;
+}
+
+// The name can come back from glCreateProgram right away
+void glDeleteProgram_hook(GLuint prog) {
+	if (program == prog)
+		program = UNKNOWN;
+	uniform_delete_program(prog);
+	lightvar_forget_program(prog);
+	glDeleteProgram(prog);
+}
+
+void glScissor_hook(GLint x, GLint y, GLsizei width, GLsizei height) {
+	stat_seen[CALL_SCISSOR]++;
+	if (scissor_known && scissor[0] == x && scissor[1] == y && scissor[2] == width && scissor[3] == height) {
+		stat_filtered[CALL_SCISSOR]++;
+		return;
+	}
+	batch_flush();
+	scissor[0] = x;
+	scissor[1] = y;
+	scissor[2] = width;
+	scissor[3] = height;
+	scissor_known = 1;
+	glScissor(x, y, width, height);
+}
+
+void glViewport_hook(GLint x, GLint y, GLsizei width, GLsizei height) {
+	stat_seen[CALL_VIEWPORT]++;
+	if (viewport_known && viewport[0] == x && viewport[1] == y && viewport[2] == width && viewport[3] == height) {
+		stat_filtered[CALL_VIEWPORT]++;
+		return;
+	}
+	batch_flush();
+	viewport[0] = x;
+	viewport[1] = y;
+	viewport[2] = width;
+	viewport[3] = height;
+	viewport_known = 1;
+	glViewport(x, y, width, height);
+}
+
+void SDL_GL_SwapWindow_hook(SDL_Window *window) {
+	batch_flush();
+	SDL_GL_SwapWindow(window);
+	stream_frame();
+	meshopt_frame();
+	vertfmt_frame();
+	shaderpack_frame();
+	lightvar_frame();
+	if (++stat_frames < REPORT_FRAMES)
+		return;
+
+	uint32_t seen = 0, filtered = 0;
+	for (int i = 0; i < NUM_CALLS; i++) {
+		seen += stat_seen[i];
+		filtered += stat_filtered[i];
+	}
+	debugPrintf("glstate: %u calls per frame, %u filtered\n", seen / stat_frames, filtered / stat_frames);
+	for (int i = 0; i < NUM_CALLS; i++) {
+		if (stat_seen[i])
+			debugPrintf("glstate:   %-20s %5u seen %5u filtered\n", call_names[i], stat_seen[i] / stat_frames,
+				stat_filtered[i] / stat_frames);
+	}
+	uniform_report(stat_frames);
+	batch_report(stat_frames);
+	stream_report(stat_frames);
+	meshopt_report(stat_frames);
+	vertfmt_report(stat_frames);
+	lightvar_report(stat_frames);
+	memset(stat_seen, 0, sizeof(stat_seen));
+	memset(stat_filtered, 0, sizeof(stat_filtered));
+	stat_frames = 0;
+}
+
+SDL_GLContext SDL_GL_CreateContext_hook(SDL_Window *window) {
+	SDL_GLContext ctx = SDL_GL_CreateContext(window);
+	glstate_invalidate();
+	return ctx;
+}
+
+int SDL_GL_BindTexture_hook(SDL_Texture *texture, float *texw, float *texh) {
+	batch_flush();
+	int res = SDL_GL_BindTexture(texture, texw, texh);
+	glstate_invalidate();
+	return res;
+}
+
+SDL_Texture *SDL_CreateTexture_hook(SDL_Renderer *renderer, Uint32 format, int access, int w, int h) {
+	batch_flush();
+	SDL_Texture *texture = SDL_CreateTexture(renderer, format, access, w, h);
+	glstate_invalidate();
+	return texture;
+}
+
+int SDL_UpdateTexture_hook(SDL_Texture *texture, const SDL_Rect *rect, const void *pixels, int pitch) {
+	batch_flush();
+	int res = SDL_UpdateTexture(texture, rect, pixels, pitch);
+	glstate_invalidate();
+	return res;
+}
+
+void SDL_DestroyTexture_hook(SDL_Texture *texture) {
+	batch_flush();
+	SDL_DestroyTexture(texture);
+	glstate_invalidate();
+}
+
+int SDL_RenderClear_hook(SDL_Renderer *renderer) {
+	batch_flush();
+	int res = SDL_RenderClear(renderer);
+	glstate_invalidate();
+	return res;
+}
+
+int SDL_RenderCopy_hook(SDL_Renderer *renderer, SDL_Texture *texture, const SDL_Rect *srcrect, const SDL_Rect *dstrect) {
+	batch_flush();
+	int res = SDL_RenderCopy(renderer, texture, srcrect, dstrect);
+	glstate_invalidate();
+	return res;
+}
+
+int SDL_RenderFillRect_hook(SDL_Renderer *renderer, const SDL_Rect *rect) {
+	batch_flush();
+	int res = SDL_RenderFillRect(renderer, rect);
+	glstate_invalidate();
+	return res;
+}
+
+void SDL_RenderPresent_hook(SDL_Renderer *renderer) {
+	batch_flush();
+	SDL_RenderPresent(renderer);
+	stream_frame();
+	glstate_invalidate();
+}
@@ -0,0 +1,36 @@
+#ifndef __GLSTATE_H__
+#define __GLSTATE_H__
+
+#include <vitaGL.h>
+#include <SDL2/SDL.h>
+
+void glstate_invalidate(void);
+void glstate_forget_textures(GLsizei n, const GLuint *textures);
+GLuint glstate_program(void);
+int glstate_enabled(GLenum cap);
+
+void glActiveTexture_hook(GLenum texture);
+void glBindTexture_hook(GLenum target, GLuint texture);
+void glEnable_hook(GLenum cap);
+void glDisable_hook(GLenum cap);
+void glBlendFunc_hook(GLenum sfactor, GLenum dfactor);
+void glBlendFuncSeparate_hook(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+void glUseProgram_hook(GLuint program);
+void glDeleteProgram_hook(GLuint program);
+void glScissor_hook(GLint x, GLint y, GLsizei width, GLsizei height);
+void glViewport_hook(GLint x, GLint y, GLsizei width, GLsizei height);
+
+void SDL_GL_SwapWindow_hook(SDL_Window *window);
+SDL_GLContext SDL_GL_CreateContext_hook(SDL_Window *window);
+
+// The SDL renderer drives the same GL state behind the filter
+int SDL_GL_BindTexture_hook(SDL_Texture *texture, float *texw, float *texh);
+SDL_Texture *SDL_CreateTexture_hook(SDL_Renderer *renderer, Uint32 format, int access, int w, int h);
+int SDL_UpdateTexture_hook(SDL_Texture *texture, const SDL_Rect *rect, const void *pixels, int pitch);
+void SDL_DestroyTexture_hook(SDL_Texture *texture);
+int SDL_RenderClear_hook(SDL_Renderer *renderer);
+int SDL_RenderCopy_hook(SDL_Renderer *renderer, SDL_Texture *texture, const SDL_Rect *srcrect, const SDL_Rect *dstrect);
+int SDL_RenderFillRect_hook(SDL_Renderer *renderer, const SDL_Rect *rect);
+void SDL_RenderPresent_hook(SDL_Renderer *renderer);
+
+#endif
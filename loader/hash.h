@@ -0,0 +1,19 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stdint.h>
+
+// FNV-1a over the lowercase path, the memory card filesystem is case insensitive
+static inline uint32_t path_hash(const char *s) {
+	uint32_t h = 2166136261u;
+	while (*s) {
+		uint8_t c = (uint8_t)*s++;
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		h ^= c;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+#endif
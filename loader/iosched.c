@@ -0,0 +1,302 @@
+/* iosched.c -- prioritized I/O scheduler underneath the file hooks
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#ifdef __vita__
+#include <vitasdk.h>
+#include "main.h"
+#else
+#include <unistd.h>
+#include <time.h>
+#define debugPrintf printf
+#endif
+
+#include "iosched.h"
+
+#define IO_SLICE_SIZE (64 * 1024) // Longest read a higher priority request may have to wait for
+#define IO_COALESCE_MAX (256 * 1024)
+#define IO_COALESCE_REQUESTS 16
+#define IO_HIST_BUCKETS 16 // Bucket i counts latencies below 128 << i microseconds
+#define IO_REPORT_INTERVAL_US (60 * 1000000)
+
+typedef struct io_request {
+	struct io_request *next;
+	int fd;
+	uint8_t *buf;
+	uint32_t size;
+	uint32_t done;
+	uint64_t offset;
+	int cls;
+	int result;
+	int finished;
+	uint64_t submit_us;
+} io_request;
+
+typedef struct {
+	uint32_t count;
+	uint64_t bytes;
+	uint64_t total_us;
+	uint32_t max_us;
+	uint32_t hist[IO_HIST_BUCKETS];
+} io_stats;
+
+static const char *class_names[IO_NUM_CLASSES] = {"audio", "critical", "texture", "prefetch"};
+
+static pthread_mutex_t io_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static int io_running = 0;
+
+static io_request *queue_head[IO_NUM_CLASSES], *queue_tail[IO_NUM_CLASSES];
+static io_stats stats[IO_NUM_CLASSES];
+static uint32_t coalesced = 0;
+static uint64_t last_report_us = 0;
+
+#ifdef __vita__
+static int io_pread(int fd, void *buf, uint32_t size, uint64_t offset) {
+	return sceIoPread(fd, buf, size, offset);
+}
+
+static uint64_t io_time_us(void) {
+	return sceKernelGetProcessTimeWide();
+}
+#else
+static int io_pread(int fd, void *buf, uint32_t size, uint64_t offset) {
+	return pread(fd, buf, size, offset);
+}
+
+static uint64_t io_time_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+#endif
+
+// Sounds are loaded whole while the game waits on them, only music is streamed as it plays
+int iosched_class(const char *path) {
+	static const char *audio_exts[] = {"ogg", "mp3", "flac", "mod", "xm", "s3m", "it", NULL};
+	static const char *texture_exts[] = {"bmp", "png", "jpg", "jpeg", "webp", "tga", "dds", NULL};
+	const char *ext = strrchr(path, '.');
+	if (!ext || strchr(ext, '/'))
+		return IO_CRITICAL;
+	ext++;
+	for (int i = 0; audio_exts[i]; i++) {
+		if (!strcasecmp(ext, audio_exts[i]))
+			return IO_AUDIO;
+	}
+	for (int i = 0; texture_exts[i]; i++) {
+		if (!strcasecmp(ext, texture_exts[i]))
+			return IO_TEXTURE;
+	}
+	return IO_CRITICAL;
+}
+
+static void unlink_request(io_request *r) {
+	io_request **p = &queue_head[r->cls], *prev = NULL;
+	while (*p != r) {
+		prev = *p;
+		p = &(*p)->next;
+	}
+	*p = r->next;
+	if (queue_tail[r->cls] == r)
+		queue_tail[r->cls] = prev;
+	r->next = NULL;
+}
+
+// Caller must hold io_mtx
+static void finish_request(io_request *r, int result) {
+	uint32_t latency = io_time_us() - r->submit_us;
+	io_stats *s = &stats[r->cls];
+	int bucket = 0;
+	while (bucket < IO_HIST_BUCKETS - 1 && latency >= (128u << bucket))
+		bucket++;
+	s->hist[bucket]++;
+	s->count++;
+	s->bytes += r->done;
+	s->total_us += latency;
+	if (latency > s->max_us)
+		s->max_us = latency;
+
+	r->result = result;
+	r->finished = 1;
+}
+
+// Percentile upper bound taken from the histogram buckets
+static uint32_t percentile_us(io_stats *s, uint32_t pct) {
+	uint32_t target = (s->count * pct + 99) / 100, seen = 0;
+	for (int i = 0; i < IO_HIST_BUCKETS - 1; i++) {
+		seen += s->hist[i];
+		if (seen >= target)
+			return 128u << i;
+	}
+	return s->max_us;
+}
+
+void iosched_report(void) {
+	pthread_mutex_lock(&io_mtx);
+	for (int i = 0; i < IO_NUM_CLASSES; i++) {
+		io_stats *s = &stats[i];
+		if (!s->count)
+			continue;
+		debugPrintf("iosched: %s: %u reads, %llu KB, avg %llu us, p50 < %u us, p99 < %u us, max %u us\n",
+			class_names[i], s->count, (unsigned long long)(s->bytes / 1024), (unsigned long long)(s->total_us / s->count),
+			percentile_us(s, 50), percentile_us(s, 99), s->max_us);
+	}
+	debugPrintf("iosched: %u reads coalesced\n", coalesced);
+	pthread_mutex_unlock(&io_mtx);
+}
+
+static void *io_thread(void *arg) {
+	static uint8_t bounce[IO_COALESCE_MAX];
+	io_request *run[IO_COALESCE_REQUESTS];
+	uint32_t want[IO_COALESCE_REQUESTS];
+
+	for (;;) {
+		pthread_mutex_lock(&io_mtx);
+		io_request *r = NULL;
+		for (;;) {
+			for (int i = 0; i < IO_NUM_CLASSES && !r; i++)
+				r = queue_head[i];
+			if (r)
+				break;
+			pthread_cond_wait(&work_cond, &io_mtx);
+		}
+
+		// Large reads are served one slice at a time so higher classes can get in between
+		uint64_t base = r->offset + r->done;
+		uint32_t len = r->size - r->done;
+		if (len > IO_SLICE_SIZE)
+			len = IO_SLICE_SIZE;
+		unlink_request(r);
+		run[0] = r;
+		want[0] = len;
+		int num_run = 1;
+
+		// Pull in queued reads that continue exactly where this one ends
+		int merged = len == r->size - r->done;
+		while (merged && num_run < IO_COALESCE_REQUESTS) {
+			io_request *q = NULL;
+			for (int i = 0; i < IO_NUM_CLASSES && !q; i++) {
+				for (q = queue_head[i]; q; q = q->next) {
+					if (q->fd == r->fd && q->offset + q->done == base + len && len + q->size - q->done <= IO_COALESCE_MAX)
+						break;
+				}
+			}
+			if (!q)
+				break;
+			unlink_request(q);
+			run[num_run] = q;
+			want[num_run++] = q->size - q->done;
+			len += q->size - q->done;
+		}
+		pthread_mutex_unlock(&io_mtx);
+
+		int n;
+		if (num_run == 1) {
+			n = io_pread(r->fd, r->buf + r->done, len, base);
+		} else {
+			n = io_pread(r->fd, bounce, len, base);
+			uint32_t pos = 0;
+			for (int i = 0; i < num_run && n > 0; i++) {
+				uint32_t got = pos < n ? n - pos : 0;
+				if (got > want[i])
+					got = want[i];
+				memcpy(run[i]->buf + run[i]->done, bounce + pos, got);
+				pos += want[i];
+			}
+		}
+
+		pthread_mutex_lock(&io_mtx);
+		uint32_t pos = 0;
+		for (int i = 0; i < num_run; i++) {
+			io_request *q = run[i];
+			if (n < 0) {
+				finish_request(q, -1);
+				continue;
+			}
+			uint32_t got = pos < n ? n - pos : 0;
+			if (got > want[i])
+				got = want[i];
+			pos += want[i];
+			q->done += got;
+			if (got < want[i] || q->done == q->size) {
+				finish_request(q, q->done);
+			} else {
+				q->next = queue_head[q->cls];
+				queue_head[q->cls] = q;
+				if (!queue_tail[q->cls])
+					queue_tail[q->cls] = q;
+			}
+		}
+		if (num_run > 1)
+			coalesced += num_run - 1;
+		pthread_cond_broadcast(&done_cond);
+
+		uint64_t now = io_time_us();
+		int report = now - last_report_us > IO_REPORT_INTERVAL_US;
+		if (report)
+			last_report_us = now;
+		pthread_mutex_unlock(&io_mtx);
+		if (report)
+			iosched_report();
+	}
+	return NULL;
+}
+
+#ifdef __vita__
+static int io_thread_entry(SceSize args, void *argp) {
+	io_thread(NULL);
+	return 0;
+}
+#endif
+
+void iosched_init(void) {
+	last_report_us = io_time_us();
+#ifdef __vita__
+	SceUID thid = sceKernelCreateThread("iosched", io_thread_entry, 0x10000100, 0x4000, 0, SCE_KERNEL_CPU_MASK_USER_1, NULL);
+	if (thid < 0 || sceKernelStartThread(thid, 0, NULL) < 0)
+		return;
+#else
+	pthread_t t;
+	if (pthread_create(&t, NULL, io_thread, NULL))
+		return;
+#endif
+	io_running = 1;
+}
+
+int iosched_read(int fd, void *buf, uint32_t size, uint64_t offset, int cls) {
+	if (!io_running || !size)
+		return io_pread(fd, buf, size, offset);
+
+	io_request r;
+	memset(&r, 0, sizeof(r));
+	r.fd = fd;
+	r.buf = buf;
+	r.size = size;
+	r.offset = offset;
+	r.cls = cls;
+	r.submit_us = io_time_us();
+
+	pthread_mutex_lock(&io_mtx);
+	if (queue_tail[cls])
+		queue_tail[cls]->next = &r;
+	else
+		queue_head[cls] = &r;
+	queue_tail[cls] = &r;
+	pthread_cond_signal(&work_cond);
+	while (!r.finished)
+		pthread_cond_wait(&done_cond, &io_mtx);
+	pthread_mutex_unlock(&io_mtx);
+	return r.result;
+}
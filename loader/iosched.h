@@ -0,0 +1,22 @@
+#ifndef __IOSCHED_H__
+#define __IOSCHED_H__
+
+#include <stdint.h>
+
+// Priority classes, lower values are served first
+enum {
+	IO_AUDIO,     // Music streaming
+	IO_CRITICAL,  // Anything the game thread is blocked on
+	IO_TEXTURE,
+	IO_PREFETCH,  // Speculative reads nobody is waiting for yet
+	IO_NUM_CLASSES,
+};
+
+void iosched_init(void);
+
+int iosched_class(const char *path);
+int iosched_read(int fd, void *buf, uint32_t size, uint64_t offset, int cls);
+
+void iosched_report(void);
+
+#endif
@@ -0,0 +1,69 @@
+/* level.c -- level change events for the modules keeping per level state
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "level.h"
+
+#define MAX_HANDLERS 8
+
+static level_handler handlers[LEVEL_NUM_EVENTS][MAX_HANDLERS];
+static int num_handlers[LEVEL_NUM_EVENTS];
+
+static pthread_mutex_t idle_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static char idle_level[64] = ""; // Last level ended and not handled by the level thread yet
+
+static void run(int event, const char *level) {
+	for (int i = 0; i < num_handlers[event]; i++)
+		handlers[event][i](level);
+}
+
+static int level_thread(SceSize args, void *argp) {
+	char level[64];
+	for (;;) {
+		pthread_mutex_lock(&idle_mtx);
+		while (!idle_level[0])
+			pthread_cond_wait(&idle_cond, &idle_mtx);
+		strcpy(level, idle_level);
+		idle_level[0] = 0;
+		pthread_mutex_unlock(&idle_mtx);
+
+		// Levels ending while this runs are folded into one more pass
+		run(LEVEL_END_IDLE, level);
+	}
+	return 0;
+}
+
+void level_init(void) {
+	SceUID thid = sceKernelCreateThread("level", level_thread, 0x10000100, 0x4000, 0, SCE_KERNEL_CPU_MASK_USER_2, NULL);
+	sceKernelStartThread(thid, 0, NULL);
+}
+
+// Handlers are registered at boot, before the game runs
+void level_listen(int event, level_handler handler) {
+	if (num_handlers[event] < MAX_HANDLERS)
+		handlers[event][num_handlers[event]++] = handler;
+}
+
+void level_changed(const char *prev, const char *next) {
+	if (prev[0]) {
+		run(LEVEL_END, prev);
+		pthread_mutex_lock(&idle_mtx);
+		snprintf(idle_level, sizeof(idle_level), "%s", prev);
+		pthread_cond_signal(&idle_cond);
+		pthread_mutex_unlock(&idle_mtx);
+	}
+	if (next[0])
+		run(LEVEL_BEGIN, next);
+}
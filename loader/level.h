@@ -0,0 +1,23 @@
+#ifndef __LEVEL_H__
+#define __LEVEL_H__
+
+/*
+ * Level changes are spotted by the prefetcher from the files the game opens, the modules keeping per level
+ * statistics or state listen for them here instead of being driven from prefetch.c.
+ */
+enum {
+	LEVEL_BEGIN, // On the game thread, as the first file of the level is opened
+	LEVEL_END, // On the game thread, right before the next level begins
+	LEVEL_END_IDLE, // On the level thread after LEVEL_END, for disk upkeep the game must not wait for
+	LEVEL_NUM_EVENTS,
+};
+
+typedef void (*level_handler)(const char *level);
+
+void level_init(void);
+void level_listen(int event, level_handler handler);
+
+// Either level may be empty
+void level_changed(const char *prev, const char *next);
+
+#endif
@@ -0,0 +1,663 @@
+/* lightvar.c -- lit shaders specialised for the lights each draw actually gets
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "main.h"
+#include "lightvar.h"
+#include "glstate.h"
+#include "uniform.h"
+#include "vertfmt.h"
+#include "shaderpack.h"
+
+/*
+ * ProcessLights in lights_vs.glsl walks the lights with a loop bounded by the numLights uniform, and the
+ * shadow boxes with one bounded by numShadows, for every vertex. The light uniforms of lit programs are
+ * kept here instead of going to GL, and every draw tests them against the box around its positions:
+ * lights whose reach doesn't get to the box and shadow boxes away from it are dropped, the others are
+ * uploaded packed at the front of the arrays. The draw then runs on a variant of the program built with
+ * LIGHT_COUNT and SHADOW_COUNT defined to what is left, where the loops unroll. Variants get queued the
+ * first time a count is seen and compiled through the shader cache between frames, within the time
+ * shaderpack.c leaves of SHADER_FRAME_MS, then linked with the program's fragment shader; the program's
+ * other uniforms are replayed into them out of the uniform cache. Until a
+ * variant is ready, and for counts past LIGHT_VARIANT_LIGHTS and LIGHT_VARIANT_SHADOWS, the game's program
+ * draws with the culled lights. Draws whose positions aren't in a buffer vertfmt.c knows the bounds of
+ * keep every light that reaches anywhere.
+ */
+
+#define MAX_LIT 128 // Lit programs
+#define MAX_ATTACHED 256 // Programs with shaders attached, until they get deleted
+#define MAX_SOURCES 64 // Lit vertex shaders
+#define CAPTURE_LIGHTS 32 // Elements kept of the light arrays, programs asking for more are left alone
+#define CAPTURE_SHADOWS 16
+#define MAX_ELEMENTS 64 // Locations of light uniforms per program
+#define MAX_NAMED 64 // Locations of other uniforms per program
+#define RETRY_FRAMES 60 // Variants whose uniforms couldn't be brought up to date sit out this long
+
+enum {
+	U_NUM_LIGHTS,
+	U_LIGHT_POS,
+	U_LIGHT_PARAMS,
+	U_LIGHT_DIR,
+	U_NUM_SHADOWS,
+	U_SHADOW_POS,
+	U_SHADOW_PARAMS,
+	U_SHADOW_DIR,
+	NUM_LIGHT_UNIFORMS,
+};
+
+static const char *light_names[NUM_LIGHT_UNIFORMS] = {
+	"numLights",
+	"lightPos",
+	"lightParams",
+	"lightDir",
+	"numShadows",
+	"shadowPos",
+	"shadowParams",
+	"shadowDir",
+};
+
+enum {
+	VARIANT_NONE,
+	VARIANT_QUEUED,
+	VARIANT_READY,
+	VARIANT_FAILED,
+};
+
+typedef struct {
+	int state;
+	GLuint program, shader;
+	GLint lights[NUM_LIGHT_UNIFORMS];
+	GLint *remap; // Locations of the named uniforms of the game's program
+	int num_remapped;
+	uint32_t retry_frame; // Not used before then
+} light_variant;
+
+typedef struct {
+	GLuint program;
+	uint32_t generation;
+	char *source; // Vertex source as compiled, NULL when it has no LIGHT_COUNT branches
+	GLuint fragment;
+	int fragment_deleted; // By the game, variants keep it until the program goes
+	int overflow; // More lights or locations than kept, uploads go through as they come from then on
+	int passthrough;
+	int no_variants;
+	GLint lights[NUM_LIGHT_UNIFORMS];
+	struct {
+		GLint location;
+		uint8_t uniform;
+		uint8_t element;
+	} elements[MAX_ELEMENTS];
+	int num_elements;
+	struct {
+		GLint location;
+		char *name;
+	} named[MAX_NAMED];
+	int num_named;
+	GLint num_lights, num_shadows;
+	int filled[NUM_LIGHT_UNIFORMS]; // Elements uploaded so far
+	float light_pos[CAPTURE_LIGHTS][4], light_params[CAPTURE_LIGHTS][4], light_dir[CAPTURE_LIGHTS][4];
+	float shadow_pos[CAPTURE_SHADOWS][4], shadow_params[CAPTURE_SHADOWS][4], shadow_dir[CAPTURE_SHADOWS][9];
+	light_variant variants[LIGHT_VARIANT_LIGHTS + 1][LIGHT_VARIANT_SHADOWS + 1];
+} lit_program;
+
+typedef struct compile_job {
+	GLuint program;
+	uint32_t generation;
+	int lights, shadows;
+	char *text;
+	struct compile_job *next;
+} compile_job;
+
+// Everything is only touched by the GL thread
+static compile_job *queued_head = NULL, *queued_tail = NULL;
+static uint32_t frame = 0;
+
+static lit_program *lit[MAX_LIT];
+static int num_lit = 0;
+static GLuint last_program = 0;
+static lit_program *last_lit = NULL;
+static uint32_t generation = 0;
+
+static struct {
+	GLuint program;
+	GLuint shaders[2];
+} attached[MAX_ATTACHED];
+static int num_attached = 0;
+
+static struct {
+	GLuint shader;
+	char *text;
+} sources[MAX_SOURCES];
+static int num_sources = 0;
+
+static uint32_t stat_draws, stat_variant_draws, stat_variants;
+static uint64_t stat_lights_before, stat_lights_after, stat_shadows_before, stat_shadows_after, stat_loop_elements;
+
+static lit_program *find_lit(GLuint program) {
+	if (program == last_program)
+		return last_lit;
+	last_program = program;
+	last_lit = NULL;
+	for (int i = 0; i < num_lit; i++) {
+		if (lit[i]->program == program) {
+			last_lit = lit[i];
+			break;
+		}
+	}
+	return last_lit;
+}
+
+static void *storage(lit_program *p, int u, int *floats, int *max) {
+	switch (u) {
+	case U_NUM_LIGHTS:
+		*floats = *max = 1;
+		return &p->num_lights;
+	case U_LIGHT_POS:
+		*floats = 4;
+		*max = CAPTURE_LIGHTS;
+		return p->light_pos;
+	case U_LIGHT_PARAMS:
+		*floats = 4;
+		*max = CAPTURE_LIGHTS;
+		return p->light_params;
+	case U_LIGHT_DIR:
+		*floats = 4;
+		*max = CAPTURE_LIGHTS;
+		return p->light_dir;
+	case U_NUM_SHADOWS:
+		*floats = *max = 1;
+		return &p->num_shadows;
+	case U_SHADOW_POS:
+		*floats = 4;
+		*max = CAPTURE_SHADOWS;
+		return p->shadow_pos;
+	case U_SHADOW_PARAMS:
+		*floats = 4;
+		*max = CAPTURE_SHADOWS;
+		return p->shadow_params;
+	default:
+		*floats = 9;
+		*max = CAPTURE_SHADOWS;
+		return p->shadow_dir;
+	}
+}
+
+static int fragment_used(GLuint shader) {
+	for (int i = 0; i < num_lit; i++) {
+		if (lit[i]->fragment == shader)
+			return 1;
+	}
+	return 0;
+}
+
+static void drop_lit(lit_program *p) {
+	if (!p)
+		return;
+	for (int n = 0; n <= LIGHT_VARIANT_LIGHTS; n++) {
+		for (int m = 0; m <= LIGHT_VARIANT_SHADOWS; m++) {
+			light_variant *v = &p->variants[n][m];
+			if (v->state == VARIANT_READY) {
+				uniform_delete_program(v->program);
+				glDeleteProgram(v->program);
+				glDeleteShader(v->shader);
+				stat_variants--;
+			}
+			free(v->remap);
+		}
+	}
+	for (int i = 0; i < p->num_named; i++)
+		free(p->named[i].name);
+	free(p->source);
+
+	for (int i = 0; i < num_lit; i++) {
+		if (lit[i] == p) {
+			lit[i] = lit[--num_lit];
+			break;
+		}
+	}
+	last_program = 0;
+	last_lit = NULL;
+	GLuint fragment = p->fragment;
+	int deleted = p->fragment_deleted;
+	free(p);
+	if (deleted && !fragment_used(fragment))
+		glDeleteShader(fragment);
+}
+
+void glAttachShader_hook(GLuint program, GLuint shader) {
+	int i;
+	for (i = 0; i < num_attached && attached[i].program != program; i++);
+	if (i == num_attached && num_attached < MAX_ATTACHED) {
+		attached[num_attached].program = program;
+		attached[num_attached].shaders[0] = attached[num_attached].shaders[1] = 0;
+		num_attached++;
+	}
+	if (i < num_attached) {
+		for (int j = 0; j < 2; j++) {
+			if (!attached[i].shaders[j] || attached[i].shaders[j] == shader) {
+				attached[i].shaders[j] = shader;
+				break;
+			}
+		}
+	}
+	glAttachShader(program, shader);
+}
+
+static int find_source(GLuint shader) {
+	for (int i = 0; i < num_sources; i++) {
+		if (sources[i].shader == shader)
+			return i;
+	}
+	return -1;
+}
+
+static void forget_source(GLuint shader) {
+	int i = find_source(shader);
+	if (i >= 0) {
+		free(sources[i].text);
+		sources[i] = sources[--num_sources];
+	}
+}
+
+void glDeleteShader_hook(GLuint shader) {
+	forget_source(shader);
+	int kept = 0;
+	for (int i = 0; i < num_lit; i++) {
+		if (lit[i]->fragment == shader) {
+			lit[i]->fragment_deleted = 1;
+			kept = 1;
+		}
+	}
+	if (!kept)
+		glDeleteShader(shader);
+}
+
+void lightvar_source(GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length) {
+	forget_source(shader);
+	size_t total = 0;
+	for (GLsizei i = 0; i < count; i++)
+		total += length && length[i] >= 0 ? (size_t)length[i] : strlen(string[i]);
+	char *text = num_sources < MAX_SOURCES ? malloc(total + 1) : NULL;
+	if (!text)
+		return;
+	total = 0;
+	for (GLsizei i = 0; i < count; i++) {
+		size_t n = length && length[i] >= 0 ? (size_t)length[i] : strlen(string[i]);
+		memcpy(text + total, string[i], n);
+		total += n;
+	}
+	text[total] = 0;
+	// Shaders from before lights_vs.glsl had the branches still get their lights culled
+	if (!strstr(text, "ProcessLights(") || !strstr(text, "LIGHT_COUNT")) {
+		free(text);
+		return;
+	}
+	sources[num_sources].shader = shader;
+	sources[num_sources].text = text;
+	num_sources++;
+}
+
+static void add_element(lit_program *p, GLint location, int u, int element) {
+	for (int i = 0; i < p->num_elements; i++) {
+		if (p->elements[i].location == location)
+			return;
+	}
+	int floats, max;
+	storage(p, u, &floats, &max);
+	if (p->num_elements == MAX_ELEMENTS || element >= max) {
+		p->overflow = 1;
+		return;
+	}
+	p->elements[p->num_elements].location = location;
+	p->elements[p->num_elements].uniform = u;
+	p->elements[p->num_elements].element = element;
+	p->num_elements++;
+}
+
+void lightvar_link(GLuint program) {
+	drop_lit(find_lit(program));
+	if (glGetUniformLocation(program, light_names[U_NUM_LIGHTS]) < 0 || num_lit == MAX_LIT)
+		return;
+	lit_program *p = calloc(1, sizeof(lit_program));
+	if (!p)
+		return;
+	p->program = program;
+	p->generation = ++generation;
+	for (int u = 0; u < NUM_LIGHT_UNIFORMS; u++) {
+		p->lights[u] = glGetUniformLocation(program, light_names[u]);
+		if (p->lights[u] >= 0)
+			add_element(p, p->lights[u], u, 0);
+	}
+
+	for (int i = 0; i < num_attached; i++) {
+		if (attached[i].program != program)
+			continue;
+		for (int j = 0; j < 2; j++) {
+			int s = find_source(attached[i].shaders[j]);
+			if (s >= 0 && (p->source = strdup(sources[s].text)))
+				p->fragment = attached[i].shaders[!j];
+		}
+		break;
+	}
+	lit[num_lit++] = p;
+	last_program = 0;
+}
+
+void lightvar_forget_program(GLuint program) {
+	drop_lit(find_lit(program));
+	for (int i = 0; i < num_attached; i++) {
+		if (attached[i].program == program) {
+			attached[i] = attached[--num_attached];
+			break;
+		}
+	}
+}
+
+void lightvar_location(GLuint program, const GLchar *name, GLint location) {
+	lit_program *p = find_lit(program);
+	if (!p)
+		return;
+	const char *bracket = strchr(name, '[');
+	size_t len = bracket ? (size_t)(bracket - name) : strlen(name);
+	int element = bracket ? atoi(bracket + 1) : 0;
+	for (int u = 0; u < NUM_LIGHT_UNIFORMS; u++) {
+		if (strlen(light_names[u]) == len && !strncmp(name, light_names[u], len)) {
+			add_element(p, location, u, element);
+			return;
+		}
+	}
+
+	for (int i = 0; i < p->num_named; i++) {
+		if (p->named[i].location == location)
+			return;
+	}
+	// Uploads through later elements make uniform.c drop what it has of the program, there'd be nothing to replay
+	if (element > 0 || p->num_named == MAX_NAMED || !(p->named[p->num_named].name = strdup(name))) {
+		p->no_variants = 1;
+		return;
+	}
+	p->named[p->num_named++].location = location;
+}
+
+// Hands the light uniforms to GL as they are and stops keeping them, the program has to be bound
+static void leave(lit_program *p) {
+	p->passthrough = 1;
+	for (int u = 0; u < NUM_LIGHT_UNIFORMS; u++) {
+		int floats, max;
+		const void *data = storage(p, u, &floats, &max);
+		if (p->lights[u] < 0 || !p->filled[u])
+			continue;
+		if (u == U_NUM_LIGHTS || u == U_NUM_SHADOWS)
+			uniform_set_1i(p->program, p->lights[u], *(const GLint *)data);
+		else if (floats == 9)
+			uniform_set_matrix3fv(p->program, p->lights[u], p->filled[u], data);
+		else
+			uniform_set_4fv(p->program, p->lights[u], p->filled[u], data);
+	}
+}
+
+int lightvar_uniform(GLuint program, GLint location, const void *value, uint32_t size) {
+	lit_program *p = program ? find_lit(program) : NULL;
+	if (!p || p->passthrough)
+		return 0;
+	if (p->overflow) {
+		leave(p);
+		return 0;
+	}
+	int i;
+	for (i = 0; i < p->num_elements && p->elements[i].location != location; i++);
+	if (i == p->num_elements)
+		return 0;
+
+	int u = p->elements[i].uniform, floats, max;
+	uint8_t *data = storage(p, u, &floats, &max);
+	uint32_t stride = floats * sizeof(float);
+	uint32_t offset = p->elements[i].element * stride;
+	if (offset + size > max * stride) {
+		p->overflow = 1;
+		leave(p);
+		return 0;
+	}
+	memcpy(data + offset, value, size);
+	int filled = (offset + size + stride - 1) / stride;
+	if (filled > p->filled[u])
+		p->filled[u] = filled;
+	return 1;
+}
+
+static void queue_variant(lit_program *p, light_variant *v, int n, int m) {
+	size_t len = strlen(p->source);
+	compile_job *job = calloc(1, sizeof(compile_job));
+	char *text = job ? malloc(len + 64) : NULL;
+	if (!text) {
+		free(job);
+		v->state = VARIANT_FAILED;
+		return;
+	}
+	// The first two characters stay a comment, see shadercache_key
+	int head = snprintf(text, 64, "// Light variant\n#define LIGHT_COUNT %d\n#define SHADOW_COUNT %d\n", n, m);
+	memcpy(text + head, p->source, len + 1);
+	job->program = p->program;
+	job->generation = p->generation;
+	job->lights = n;
+	job->shadows = m;
+	job->text = text;
+	if (queued_tail)
+		queued_tail->next = job;
+	else
+		queued_head = job;
+	queued_tail = job;
+	v->state = VARIANT_QUEUED;
+}
+
+static void link_variant(lit_program *p, light_variant *v, const void *binary, uint32_t size) {
+	v->state = VARIANT_FAILED;
+	if (!binary || !p->fragment)
+		return;
+	GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderBinary(1, &shader, 0, binary, size);
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glAttachShader(program, p->fragment);
+	vertfmt_bind_attribs(program);
+	glLinkProgram(program);
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		glDeleteProgram(program);
+		glDeleteShader(shader);
+		return;
+	}
+	for (int u = 0; u < NUM_LIGHT_UNIFORMS; u++)
+		v->lights[u] = glGetUniformLocation(program, light_names[u]);
+	v->program = program;
+	v->shader = shader;
+	v->state = VARIANT_READY;
+	stat_variants++;
+}
+
+static light_variant *variant_for(lit_program *p, int n, int m) {
+	if (n > LIGHT_VARIANT_LIGHTS || m > LIGHT_VARIANT_SHADOWS || !p->source || !p->fragment || p->no_variants)
+		return NULL;
+	light_variant *v = &p->variants[n][m];
+	if (v->state == VARIANT_NONE)
+		queue_variant(p, v, n, m);
+	return v->state == VARIANT_READY && (int32_t)(frame - v->retry_frame) >= 0 ? v : NULL;
+}
+
+// Brings the variant, bound in GL, up to date with the uniforms the game set on its program
+static int sync_uniforms(lit_program *p, light_variant *v) {
+	if (v->num_remapped < p->num_named) {
+		GLint *remap = realloc(v->remap, p->num_named * sizeof(GLint));
+		if (!remap)
+			return 0;
+		v->remap = remap;
+		for (; v->num_remapped < p->num_named; v->num_remapped++)
+			remap[v->num_remapped] = glGetUniformLocation(v->program, p->named[v->num_remapped].name);
+	}
+	for (int i = 0; i < p->num_named; i++) {
+		if (v->remap[i] >= 0 && !uniform_replay(p->program, p->named[i].location, v->program, v->remap[i]))
+			return 0;
+	}
+	return 1;
+}
+
+static float box_distance_sq(const float *c, const float *bounds) {
+	float d2 = 0.0f;
+	for (int k = 0; k < 3; k++) {
+		float d = c[k] < bounds[k] ? bounds[k] - c[k] : c[k] > bounds[k + 3] ? c[k] - bounds[k + 3] : 0.0f;
+		d2 += d * d;
+	}
+	return d2;
+}
+
+// lightPos.w is the square of the reach, ProcessLight leaves vertices at least that far alone
+static int light_reaches(const float *pos, const float *bounds) {
+	if (!(pos[3] > 0.0f))
+		return 0;
+	return !bounds || box_distance_sq(pos, bounds) < pos[3];
+}
+
+// ProcessShadow takes the vertices for which dir * (pos - vertex) is within size on every axis. They are all
+// within |size| times the largest stretch of the inverse of dir from pos, bounded by its Frobenius norm,
+// which is 1 for the rotations the game passes. The margin only covers the rounding of the bound.
+static int shadow_reaches(const float *pos, const float *size, const float *dir, const float *bounds) {
+	if (!(size[0] > 0.0f && size[1] > 0.0f && size[2] > 0.0f))
+		return 0;
+	if (!bounds)
+		return 1;
+	float cof[9] = {
+		dir[4] * dir[8] - dir[5] * dir[7], dir[5] * dir[6] - dir[3] * dir[8], dir[3] * dir[7] - dir[4] * dir[6],
+		dir[2] * dir[7] - dir[1] * dir[8], dir[0] * dir[8] - dir[2] * dir[6], dir[1] * dir[6] - dir[0] * dir[7],
+		dir[1] * dir[5] - dir[2] * dir[4], dir[2] * dir[3] - dir[0] * dir[5], dir[0] * dir[4] - dir[1] * dir[3],
+	};
+	float det = dir[0] * cof[0] + dir[1] * cof[1] + dir[2] * cof[2];
+	if (fabsf(det) < 1e-6f)
+		return 1;
+	float inv_norm = 0.0f;
+	for (int i = 0; i < 9; i++)
+		inv_norm += cof[i] * cof[i];
+	float stretch_sq = inv_norm / (det * det);
+	float reach_sq = (size[0] * size[0] + size[1] * size[1] + size[2] * size[2]) * stretch_sq * 1.01f;
+	return box_distance_sq(pos, bounds) < reach_sq;
+}
+
+static void upload_array(GLuint program, GLint location, const float *src, int floats, const uint8_t *order, int n) {
+	if (location < 0 || !n)
+		return;
+	float packed[CAPTURE_LIGHTS * 9];
+	for (int i = 0; i < n; i++)
+		memcpy(packed + i * floats, src + order[i] * floats, floats * sizeof(float));
+	if (floats == 9)
+		uniform_set_matrix3fv(program, location, n, packed);
+	else
+		uniform_set_4fv(program, location, n, packed);
+}
+
+int lightvar_apply(uint32_t elements) {
+	GLuint program = glstate_program();
+	lit_program *p = program ? find_lit(program) : NULL;
+	if (!p || p->passthrough)
+		return 0;
+	if (p->overflow || p->num_lights > CAPTURE_LIGHTS || p->num_shadows > CAPTURE_SHADOWS) {
+		leave(p);
+		return 0;
+	}
+	float bounds[6];
+	const float *box = vertfmt_bounds(bounds) ? bounds : NULL;
+	int count = p->num_lights > 0 ? p->num_lights : 0;
+	int shadow_count = p->lights[U_NUM_SHADOWS] >= 0 && p->num_shadows > 0 ? p->num_shadows : 0;
+	uint8_t lights[CAPTURE_LIGHTS], shadows[CAPTURE_SHADOWS];
+	int n = 0, m = 0;
+	for (int i = 0; i < count; i++) {
+		if (light_reaches(p->light_pos[i], box))
+			lights[n++] = i;
+	}
+	for (int i = 0; i < shadow_count; i++) {
+		if (shadow_reaches(p->shadow_pos[i], p->shadow_params[i], p->shadow_dir[i], box))
+			shadows[m++] = i;
+	}
+	stat_draws++;
+	stat_lights_before += (uint64_t)elements * count;
+	stat_lights_after += (uint64_t)elements * n;
+	stat_shadows_before += (uint64_t)elements * shadow_count;
+	stat_shadows_after += (uint64_t)elements * m;
+
+	light_variant *v = variant_for(p, n, m);
+	if (v) {
+		glUseProgram(v->program);
+		// A full uniform cache or a failed allocation can clear up, the variant gets another go later
+		if (!sync_uniforms(p, v)) {
+			glUseProgram(p->program);
+			v->retry_frame = frame + RETRY_FRAMES;
+			v = NULL;
+		}
+	}
+	GLuint target = v ? v->program : p->program;
+	const GLint *locations = v ? v->lights : p->lights;
+	if (locations[U_NUM_LIGHTS] >= 0)
+		uniform_set_1i(target, locations[U_NUM_LIGHTS], n);
+	upload_array(target, locations[U_LIGHT_POS], p->light_pos[0], 4, lights, n);
+	upload_array(target, locations[U_LIGHT_PARAMS], p->light_params[0], 4, lights, n);
+	upload_array(target, locations[U_LIGHT_DIR], p->light_dir[0], 4, lights, n);
+	if (locations[U_NUM_SHADOWS] >= 0)
+		uniform_set_1i(target, locations[U_NUM_SHADOWS], m);
+	upload_array(target, locations[U_SHADOW_POS], p->shadow_pos[0], 4, shadows, m);
+	upload_array(target, locations[U_SHADOW_PARAMS], p->shadow_params[0], 4, shadows, m);
+	upload_array(target, locations[U_SHADOW_DIR], p->shadow_dir[0], 9, shadows, m);
+
+	if (!v) {
+		stat_loop_elements += elements;
+		return 0;
+	}
+	stat_variant_draws++;
+	return 1;
+}
+
+void lightvar_restore(void) {
+	glUseProgram(glstate_program());
+}
+
+void lightvar_frame(void) {
+	frame++;
+	while (queued_head && shaderpack_frame_budget()) {
+		compile_job *job = queued_head;
+		queued_head = job->next;
+		if (!queued_head)
+			queued_tail = NULL;
+		// The program may have been linked again or deleted meanwhile
+		lit_program *p = find_lit(job->program);
+		if (p && p->generation == job->generation) {
+			uint32_t size;
+			void *binary = shaderpack_compile(job->text, SHADERPACK_VERTEX, &size);
+			link_variant(p, &p->variants[job->lights][job->shadows], binary, size);
+			free(binary);
+		}
+		free(job->text);
+		free(job);
+	}
+}
+
+void lightvar_report(uint32_t frames) {
+	if (stat_draws) {
+		debugPrintf("lightvar: %u of %u lit draws per frame on %u unrolled variants, vertex work per frame counted per index drawn: %llu K of %llu K light and %llu K of %llu K shadow box evaluations left after culling, %llu K indices through the loops\n",
+			stat_variant_draws / frames, stat_draws / frames, stat_variants,
+			(unsigned long long)(stat_lights_after / frames / 1000), (unsigned long long)(stat_lights_before / frames / 1000),
+			(unsigned long long)(stat_shadows_after / frames / 1000), (unsigned long long)(stat_shadows_before / frames / 1000),
+			(unsigned long long)(stat_loop_elements / frames / 1000));
+	}
+	stat_draws = stat_variant_draws = 0;
+	stat_lights_before = stat_lights_after = stat_shadows_before = stat_shadows_after = stat_loop_elements = 0;
+}
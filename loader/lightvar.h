@@ -0,0 +1,26 @@
+#ifndef __LIGHTVAR_H__
+#define __LIGHTVAR_H__
+
+#include <stdint.h>
+#include <vitaGL.h>
+
+// Keeps vertex sources built with lights_vs.glsl, as glShaderSource_hook passes them on
+void lightvar_source(GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length);
+void lightvar_link(GLuint program);
+void lightvar_forget_program(GLuint program);
+void lightvar_location(GLuint program, const GLchar *name, GLint location);
+// Keeps the light uniforms of lit programs for the draws, returns 1 when the upload was one of them
+int lightvar_uniform(GLuint program, GLint location, const void *value, uint32_t size);
+// Culls the lights of the draw and uploads what is left, to the variant for that many lights when there
+// is one. Returns 1 when the variant got bound, lightvar_restore has to follow the draw then. elements is
+// the count of the draw, indices or vertices, and only goes into the stats.
+int lightvar_apply(uint32_t elements);
+void lightvar_restore(void);
+// Compiles the queued variants within what is left of the frame's SHADER_FRAME_MS
+void lightvar_frame(void);
+void lightvar_report(uint32_t frames);
+
+void glAttachShader_hook(GLuint program, GLuint shader);
+void glDeleteShader_hook(GLuint shader);
+
+#endif
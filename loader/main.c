@@ -56,6 +56,28 @@
 #include "dialog.h"
 #include "so_util.h"
 #include "sha1.h"
+#include "mman.h"
+#include "vfs.h"
+#include "archive.h"
+#include "prefetch.h"
+#include "iosched.h"
+#include "fstream.h"
+#include "catalog.h"
+#include "trace.h"
+#include "texcache.h"
+#include "texfmt.h"
+#include "texupload.h"
+#include "level.h"
+#include "glstate.h"
+#include "uniform.h"
+#include "batch.h"
+#include "meshopt.h"
+#include "vertfmt.h"
+#include "shaderpack.h"
+#include "shadercache.h"
+#include "lightvar.h"
+#include "glcmd.h"
+#include "blit.h"
 
 #include <enet/enet.h>
 
@@ -65,6 +87,12 @@
 #define dlog
 #endif
 
+#ifdef TRACE_FILES
+#define TRACED(func) func##_trace
+#else
+#define TRACED(func) func
+#endif
+
 extern const char *BIONIC_ctype_;
 extern const short *BIONIC_tolower_tab_;
 extern const short *BIONIC_toupper_tab_;
@@ -371,15 +399,26 @@ int GetEnv(void *vm, void **env, int r2) {
 }
 
 int CheckFileExists(const char *fname, int unk) {
-	FILE *f;
 	char real_fname[256];
 	dlog("CheckFileExists %s\n", fname);
 	if (strncmp(fname, "ux0:", 4)) {
 		sprintf(real_fname, "ux0:data/rvgl/%s", fname);
-		return file_exists(real_fname);
+		fname = real_fname;
 	}
-	return file_exists(fname);
+	int res = vfs_lookup(fname, NULL, NULL);
+	if (res == VFS_UNKNOWN)
+		return file_exists(fname);
+	return res != VFS_MISSING;
+}
+
+#ifdef TRACE_FILES
+int CheckFileExists_trace(const char *fname, int unk) {
+	uint64_t start = trace_begin();
+	int res = CheckFileExists(fname, unk);
+	trace_end(TRACE_EXISTS, fname, 0, !res, start);
+	return res;
 }
+#endif
 
 so_hook CreateConnectionMenu_orig, AddMenuItem_orig, CRD_SetDefaultControls_orig;
 void (*AddMenuItem) (int menu_index, void *menuitem);
@@ -485,8 +524,8 @@ void patch_game(void) {
 	menuitem_host_computer = (void *)so_symbol(&rvgl_mod, "menuitem_host_computer");
 	settings = (int *)so_symbol(&rvgl_mod, "settings");
 	
-	hook_addr(so_symbol(&rvgl_mod, "_Z15CheckFileExistsPKcb"), CheckFileExists);
-	hook_addr(so_symbol(&rvgl_mod, "_Z14CheckDirExistsPKcb"), CheckFileExists);
+	hook_addr(so_symbol(&rvgl_mod, "_Z15CheckFileExistsPKcb"), TRACED(CheckFileExists));
+	hook_addr(so_symbol(&rvgl_mod, "_Z14CheckDirExistsPKcb"), TRACED(CheckFileExists));
 	hook_addr(so_symbol(&rvgl_mod, "_Z18IsRedbookAvailablev"), ret1);
 	hook_addr(so_symbol(&rvgl_mod, "_Z13WriteLogEntryPKcz"), ret0);
 
@@ -513,6 +552,19 @@ static FILE __sF_fake[0x1000][3];
 
 int stat_hook(const char *pathname, void *statbuf) {
 	dlog("stat(%s)\n", pathname);
+	fstream_sync(pathname);
+	uint32_t size;
+	switch (vfs_lookup(pathname, &size, NULL)) {
+	case VFS_FOUND:
+	case VFS_ARCHIVED:
+		*(uint64_t *)(statbuf + 0x30) = size;
+		return 0;
+	case VFS_MISSING:
+		errno = ENOENT;
+		return -1;
+	default:
+		break;
+	}
 	struct stat st;
 	int res = stat(pathname, &st);
 	if (res == 0) {
@@ -521,15 +573,6 @@ int stat_hook(const char *pathname, void *statbuf) {
 	return res;
 }
 
-void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
-	return memalign(length, 0x1000);
-}
-
-int munmap(void *addr, size_t length) {
-	free(addr);
-	return 0;
-}
-
 int fstat_hook(int fd, void *statbuf) {
 	struct stat st;
 	int res = fstat(fd, &st);
@@ -609,10 +652,17 @@ struct android_dirent {
 
 typedef struct {
 	SceUID uid;
+	int vfs_dir, vfs_cursor;
 	struct android_dirent dir;
 } android_DIR;
 
 int closedir_fake(android_DIR *dirp) {
+	if (dirp && dirp->vfs_dir >= 0) {
+		free(dirp);
+		errno = 0;
+		return 0;
+	}
+
 	if (!dirp || dirp->uid < 0) {
 		errno = EBADF;
 		return -1;
@@ -634,6 +684,28 @@ int closedir_fake(android_DIR *dirp) {
 
 android_DIR *opendir_fake(const char *dirname) {
 	//dlog("opendir(%s)\n", dirname);
+	int vfs_dir;
+	switch (vfs_opendir(dirname, &vfs_dir)) {
+	case VFS_FOUND:
+	{
+		android_DIR *dirp = calloc(1, sizeof(android_DIR));
+		if (!dirp) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		dirp->uid = -1;
+		dirp->vfs_dir = vfs_dir;
+		dirp->vfs_cursor = -1;
+		errno = 0;
+		return dirp;
+	}
+	case VFS_MISSING:
+		errno = ENOENT;
+		return NULL;
+	default:
+		break;
+	}
+
 	SceUID uid = sceIoDopen(dirname);
 
 	if (uid < 0) {
@@ -650,6 +722,7 @@ android_DIR *opendir_fake(const char *dirname) {
 	}
 
 	dirp->uid = uid;
+	dirp->vfs_dir = -1;
 
 	errno = 0;
 	return dirp;
@@ -661,6 +734,15 @@ struct android_dirent *readdir_fake(android_DIR *dirp) {
 		return NULL;
 	}
 
+	if (dirp->vfs_dir >= 0) {
+		int is_dir;
+		errno = 0;
+		if (!vfs_readdir(dirp->vfs_dir, &dirp->vfs_cursor, dirp->dir.d_name, &is_dir))
+			return NULL;
+		dirp->dir.d_type = is_dir ? DT_DIR : DT_REG;
+		return &dirp->dir;
+	}
+
 	SceIoDirent sce_dir;
 	int res = sceIoDread(dirp->uid, &sce_dir);
 
@@ -684,7 +766,22 @@ SDL_Surface *IMG_Load_hook(const char *file) {
 	dlog("loading %s\n", file);
 	if (strncmp(file, "ux0:", 4)) {
 		sprintf(real_fname, "ux0:data/rvgl/assets/%s", file);
-		return IMG_Load(real_fname);
+		file = real_fname;
+	}
+	prefetch_access(file, 1);
+	SDL_Surface *surf = prefetch_surface(file);
+	if (surf)
+		return surf;
+	SDL_RWops *rw = prefetch_rwops(file);
+	if (!rw && vfs_lookup(file, NULL, NULL) == VFS_ARCHIVED)
+		rw = archive_rwops(archive_lookup(file));
+	if (!rw)
+		rw = fstream_rwops(file, IO_TEXTURE);
+	if (rw) {
+		const char *ext = strrchr(file, '.');
+		if (texcache_wanted(file))
+			return texcache_load(file, rw, ext + 1);
+		return IMG_LoadTyped_RW(rw, 1, ext ? ext + 1 : NULL);
 	}
 	return IMG_Load(file);
 }
@@ -696,10 +793,23 @@ SDL_RWops *SDL_RWFromFile_hook(const char *fname, const char *mode) {
 	if (strncmp(fname, "ux0:", 4)) {
 		sprintf(real_fname, "ux0:data/rvgl/assets/%s", fname);
 		//printf("SDL_RWFromFile patched to %s\n", real_fname);
-		f = SDL_RWFromFile(real_fname, mode);
+		fname = real_fname;
+	}
+	if (mode[0] == 'r' && !strchr(mode, '+')) {
+		prefetch_access(fname, 0);
+		if ((f = catalog_rwops(fname)))
+			return f;
+		if ((f = prefetch_rwops(fname)))
+			return f;
+		if (vfs_lookup(fname, NULL, NULL) == VFS_ARCHIVED)
+			return archive_rwops(archive_lookup(fname));
+		if ((f = fstream_rwops(fname, iosched_class(fname))))
+			return f;
 	} else {
-		f = SDL_RWFromFile(fname, mode);
+		prefetch_drop(fname);
+		fstream_sync(fname);
 	}
+	f = SDL_RWFromFile(fname, mode);
 	return f;
 }
 
@@ -709,24 +819,181 @@ FILE *fopen_hook(char *fname, char *mode) {
 	dlog("fopen(%s,%s)\n", fname, mode);
 	if (strncmp(fname, "ux0:", 4)) {
 		sprintf(real_fname, "ux0:data/rvgl/%s", fname);
-		f = fopen(real_fname, mode);
+		fname = real_fname;
+	}
+	if (mode[0] == 'r' && !strchr(mode, '+')) {
+		prefetch_access(fname, 0);
+		if ((f = catalog_fopen(fname)))
+			return f;
+		if ((f = prefetch_fopen(fname)))
+			return f;
+		if (vfs_lookup(fname, NULL, NULL) == VFS_ARCHIVED)
+			return archive_fopen(archive_lookup(fname));
+		if ((f = fstream_fopen(fname, mode, iosched_class(fname))))
+			return f;
 	} else {
-		f = fopen(fname, mode);
+		prefetch_drop(fname);
+		if ((f = fstream_fopen(fname, mode, IO_CRITICAL))) {
+			vfs_refresh(fname, 1);
+			return f;
+		}
+		fstream_sync(fname);
 	}
+	f = fopen(fname, mode);
+	if (f && strpbrk(mode, "wa+"))
+		vfs_refresh(fname, 1);
 	return f;
 }
 
+int remove_hook(const char *pathname) {
+	fstream_sync(pathname);
+	int res = remove(pathname);
+	vfs_refresh(pathname, 0);
+	return res;
+}
+
+int mkdir_hook(const char *pathname, mode_t mode) {
+	int res = mkdir(pathname, mode);
+	vfs_refresh(pathname, 0);
+	return res;
+}
+
+int rmdir_hook(const char *pathname) {
+	int res = rmdir(pathname);
+	vfs_refresh(pathname, 0);
+	return res;
+}
+
+#define BIONIC_O_ACCMODE 00000003
+#define BIONIC_O_CREAT   00000100
+#define BIONIC_O_EXCL    00000200
+#define BIONIC_O_TRUNC   00001000
+#define BIONIC_O_APPEND  00002000
+
+int open_hook(const char *fname, int flags, ...) {
+	char real_fname[256];
+	int mode = 0;
+	if (flags & BIONIC_O_CREAT) {
+		va_list list;
+		va_start(list, flags);
+		mode = va_arg(list, int);
+		va_end(list);
+	}
+	dlog("open(%s,%X)\n", fname, flags);
+	if (strncmp(fname, "ux0:", 4)) {
+		sprintf(real_fname, "ux0:data/rvgl/%s", fname);
+		fname = real_fname;
+	}
+
+	int newlib_flags = flags & BIONIC_O_ACCMODE;
+	if (flags & BIONIC_O_CREAT)
+		newlib_flags |= O_CREAT;
+	if (flags & BIONIC_O_EXCL)
+		newlib_flags |= O_EXCL;
+	if (flags & BIONIC_O_TRUNC)
+		newlib_flags |= O_TRUNC;
+	if (flags & BIONIC_O_APPEND)
+		newlib_flags |= O_APPEND;
+
+	fstream_sync(fname);
+	int fd = open(fname, newlib_flags, mode);
+	if (fd >= 0) {
+		mman_track_fd(fd, fname);
+		if (newlib_flags & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC)) {
+			prefetch_drop(fname);
+			vfs_refresh(fname, 1);
+		}
+	}
+	return fd;
+}
+
+int close_hook(int fd) {
+	mman_untrack_fd(fd);
+	return close(fd);
+}
+
+#ifdef TRACE_FILES
+FILE *fopen_hook_trace(char *fname, char *mode) {
+	uint64_t start = trace_begin();
+	FILE *f = fopen_hook(fname, mode);
+	uint32_t size = 0;
+	if (f && mode[0] == 'r') {
+		fseek(f, 0, SEEK_END);
+		size = ftell(f);
+		fseek(f, 0, SEEK_SET);
+	}
+	trace_end(TRACE_FOPEN, fname, size, !f, start);
+	return mode[0] == 'r' ? trace_wrap_file(f, fname) : f;
+}
+
+SDL_RWops *SDL_RWFromFile_hook_trace(const char *fname, const char *mode) {
+	uint64_t start = trace_begin();
+	SDL_RWops *f = SDL_RWFromFile_hook(fname, mode);
+	trace_end(TRACE_RWOPS, fname, f && mode[0] == 'r' ? SDL_RWsize(f) : 0, !f, start);
+	return mode[0] == 'r' ? trace_wrap_rwops(f, fname) : f;
+}
+
+SDL_Surface *IMG_Load_hook_trace(const char *file) {
+	uint64_t start = trace_begin();
+	SDL_Surface *s = IMG_Load_hook(file);
+	trace_end(TRACE_IMG_LOAD, file, s ? s->pitch * s->h : 0, !s, start);
+	return s;
+}
+
+int stat_hook_trace(const char *pathname, void *statbuf) {
+	uint64_t start = trace_begin();
+	int res = stat_hook(pathname, statbuf);
+	trace_end(TRACE_STAT, pathname, res == 0 ? *(uint64_t *)(statbuf + 0x30) : 0, res != 0, start);
+	return res;
+}
+
+int open_hook_trace(const char *fname, int flags, ...) {
+	int mode = 0;
+	if (flags & BIONIC_O_CREAT) {
+		va_list list;
+		va_start(list, flags);
+		mode = va_arg(list, int);
+		va_end(list);
+	}
+	uint64_t start = trace_begin();
+	int fd = open_hook(fname, flags, mode);
+	trace_end(TRACE_OPEN, fname, 0, fd < 0, start);
+	if ((flags & BIONIC_O_ACCMODE) != O_WRONLY)
+		trace_fd_open(fd, fname);
+	return fd;
+}
+
+ssize_t read_trace(int fd, void *buf, size_t count) {
+	uint64_t start = trace_begin();
+	ssize_t r = read(fd, buf, count);
+	trace_fd_read(fd, r, start);
+	return r;
+}
+
+int close_hook_trace(int fd) {
+	trace_fd_close(fd);
+	return close_hook(fd);
+}
+
+android_DIR *opendir_fake_trace(const char *dirname) {
+	uint64_t start = trace_begin();
+	android_DIR *dirp = opendir_fake(dirname);
+	trace_end(TRACE_OPENDIR, dirname, 0, !dirp, start);
+	return dirp;
+}
+#endif
+
 void glLinkProgram_hook(GLuint p) {
-	glBindAttribLocation(p, 0, "inPosition");
-	glBindAttribLocation(p, 1, "inColor");
-	glBindAttribLocation(p, 2, "inTexCoord");
-	glBindAttribLocation(p, 3, "inFogCoord");
-	glBindAttribLocation(p, 4, "inNormal");
+	vertfmt_bind_attribs(p);
 	glLinkProgram(p);
+	uniform_forget_program(p);
+	lightvar_link(p);
 }
 
 void glShaderSource_hook(GLuint shader, GLsizei count, GLchar **string, const GLint *length) {
+	shaderpack_remember(shader, count, (const GLchar *const *)string, length);
 	string[0][0] = string[0][1] = '/';
+	lightvar_source(shader, count, (const GLchar *const *)string, length);
 	glShaderSource(shader, count, string, length);
 }
 
@@ -738,6 +1005,99 @@ static so_default_dynlib gl_hook[] = {
 	{"glBindAttribLocation", (uintptr_t)&ret0},
 	{"glLinkProgram", (uintptr_t)&glLinkProgram_hook},
 	{"glShaderSource", (uintptr_t)&glShaderSource_hook},
+	{"glCompileShader", (uintptr_t)&glCompileShader_hook},
+	{"glAttachShader", (uintptr_t)&glAttachShader_hook},
+	{"glDeleteShader", (uintptr_t)&glDeleteShader_hook},
+	{"glTexImage2D", (uintptr_t)&glTexImage2D_hook},
+	{"glTexSubImage2D", (uintptr_t)&glTexSubImage2D_hook},
+	{"glDeleteTextures", (uintptr_t)&glDeleteTextures_hook},
+	{"glDrawElements", (uintptr_t)&glDrawElements_hook},
+	{"glDrawArrays", (uintptr_t)&glDrawArrays_hook},
+	{"glGenerateMipmap", (uintptr_t)&glGenerateMipmap_hook},
+	{"glCopyTexImage2D", (uintptr_t)&glCopyTexImage2D_hook},
+	{"glCopyTexSubImage2D", (uintptr_t)&glCopyTexSubImage2D_hook},
+	{"glCompressedTexImage2D", (uintptr_t)&glCompressedTexImage2D_hook},
+	{"glFramebufferTexture2D", (uintptr_t)&glFramebufferTexture2D_hook},
+	{"glActiveTexture", (uintptr_t)&glActiveTexture_hook},
+	{"glBindTexture", (uintptr_t)&glBindTexture_hook},
+	{"glEnable", (uintptr_t)&glEnable_hook},
+	{"glDisable", (uintptr_t)&glDisable_hook},
+	{"glBlendFunc", (uintptr_t)&glBlendFunc_hook},
+	{"glBlendFuncSeparate", (uintptr_t)&glBlendFuncSeparate_hook},
+	{"glUseProgram", (uintptr_t)&glUseProgram_hook},
+	{"glDeleteProgram", (uintptr_t)&glDeleteProgram_hook},
+	{"glScissor", (uintptr_t)&glScissor_hook},
+	{"glViewport", (uintptr_t)&glViewport_hook},
+	{"glGetUniformLocation", (uintptr_t)&glGetUniformLocation_hook},
+	{"glUniform1f", (uintptr_t)&glUniform1f_hook},
+	{"glUniform2f", (uintptr_t)&glUniform2f_hook},
+	{"glUniform3f", (uintptr_t)&glUniform3f_hook},
+	{"glUniform4f", (uintptr_t)&glUniform4f_hook},
+	{"glUniform1i", (uintptr_t)&glUniform1i_hook},
+	{"glUniform2i", (uintptr_t)&glUniform2i_hook},
+	{"glUniform3i", (uintptr_t)&glUniform3i_hook},
+	{"glUniform4i", (uintptr_t)&glUniform4i_hook},
+	{"glUniform1fv", (uintptr_t)&glUniform1fv_hook},
+	{"glUniform2fv", (uintptr_t)&glUniform2fv_hook},
+	{"glUniform3fv", (uintptr_t)&glUniform3fv_hook},
+	{"glUniform4fv", (uintptr_t)&glUniform4fv_hook},
+	{"glUniform1iv", (uintptr_t)&glUniform1iv_hook},
+	{"glUniform2iv", (uintptr_t)&glUniform2iv_hook},
+	{"glUniform3iv", (uintptr_t)&glUniform3iv_hook},
+	{"glUniform4iv", (uintptr_t)&glUniform4iv_hook},
+	{"glUniformMatrix2fv", (uintptr_t)&glUniformMatrix2fv_hook},
+	{"glUniformMatrix3fv", (uintptr_t)&glUniformMatrix3fv_hook},
+	{"glUniformMatrix4fv", (uintptr_t)&glUniformMatrix4fv_hook},
+	{"glVertexPointer", (uintptr_t)&glVertexPointer_hook},
+	{"glColorPointer", (uintptr_t)&glColorPointer_hook},
+	{"glTexCoordPointer", (uintptr_t)&glTexCoordPointer_hook},
+	{"glEnableClientState", (uintptr_t)&glEnableClientState_hook},
+	{"glDisableClientState", (uintptr_t)&glDisableClientState_hook},
+	{"glBindBuffer", (uintptr_t)&glBindBuffer_hook},
+	{"glBufferData", (uintptr_t)&glBufferData_hook},
+	{"glBufferSubData", (uintptr_t)&glBufferSubData_hook},
+	{"glDeleteBuffers", (uintptr_t)&glDeleteBuffers_hook},
+	{"glVertexAttribPointer", (uintptr_t)&glVertexAttribPointer_hook},
+	{"glEnableVertexAttribArray", (uintptr_t)&glEnableVertexAttribArray_hook},
+	{"glDisableVertexAttribArray", (uintptr_t)&glDisableVertexAttribArray_hook},
+	{"glMatrixMode", (uintptr_t)&glMatrixMode_hook},
+	{"glLoadIdentity", (uintptr_t)&glLoadIdentity_hook},
+	{"glScalef", (uintptr_t)&glScalef_hook},
+	{"glOrthof", (uintptr_t)&glOrthof_hook},
+	{"glClear", (uintptr_t)&glClear_hook},
+	{"glTexParameteri", (uintptr_t)&glTexParameteri_hook},
+	{"glTexParameterf", (uintptr_t)&glTexParameterf_hook},
+	{"glTexEnvi", (uintptr_t)&glTexEnvi_hook},
+	{"glColor4f", (uintptr_t)&glColor4f_hook},
+	{"glColor4ub", (uintptr_t)&glColor4ub_hook},
+	{"glAlphaFunc", (uintptr_t)&glAlphaFunc_hook},
+	{"glDepthFunc", (uintptr_t)&glDepthFunc_hook},
+	{"glDepthMask", (uintptr_t)&glDepthMask_hook},
+	{"glColorMask", (uintptr_t)&glColorMask_hook},
+	{"glCullFace", (uintptr_t)&glCullFace_hook},
+	{"glPolygonOffset", (uintptr_t)&glPolygonOffset_hook},
+	{"glBindFramebuffer", (uintptr_t)&glBindFramebuffer_hook},
+	{"glReadPixels", (uintptr_t)&glReadPixels_hook},
+	{"glFinish", (uintptr_t)&glFinish_hook},
+	{"glPushMatrix", (uintptr_t)&glPushMatrix_hook},
+	{"glPopMatrix", (uintptr_t)&glPopMatrix_hook},
+	{"glLoadMatrixf", (uintptr_t)&glLoadMatrixf_hook},
+	{"glMultMatrixf", (uintptr_t)&glMultMatrixf_hook},
+	{"glTranslatef", (uintptr_t)&glTranslatef_hook},
+	{"glRotatef", (uintptr_t)&glRotatef_hook},
+	{"glTexEnvf", (uintptr_t)&glTexEnvf_hook},
+	{"glTexEnvfv", (uintptr_t)&glTexEnvfv_hook},
+	{"glClientActiveTexture", (uintptr_t)&glClientActiveTexture_hook},
+	{"glFrontFace", (uintptr_t)&glFrontFace_hook},
+	{"glBlendEquation", (uintptr_t)&glBlendEquation_hook},
+	{"glStencilFunc", (uintptr_t)&glStencilFunc_hook},
+	{"glStencilOp", (uintptr_t)&glStencilOp_hook},
+	{"glStencilMask", (uintptr_t)&glStencilMask_hook},
+	{"glLineWidth", (uintptr_t)&glLineWidth_hook},
+	{"glDepthRangef", (uintptr_t)&glDepthRangef_hook},
+	{"glFogf", (uintptr_t)&glFogf_hook},
+	{"glFogfv", (uintptr_t)&glFogfv_hook},
+	{"glFogi", (uintptr_t)&glFogi_hook},
 };
 
 static size_t gl_numhook = sizeof(gl_hook) / sizeof(*gl_hook);
@@ -755,6 +1115,11 @@ void *SDL_GL_GetProcAddress_fake(const char *symbol) {
 		dlog("Cannot find symbol %s (Debug Address: 0x%X)\n", symbol, garbage_ptr);
 		r = garbage_ptr++;
 	}
+#if defined(GL_RENDER_THREAD) || defined(GL_CAPTURE_FRAMES)
+	else {
+		r = (void *)glcmd_wrap(symbol, (uintptr_t)r);
+	}
+#endif
 	return r;
 }
 
@@ -791,9 +1156,9 @@ void SDL_Delay_hook(uint32_t ms) {
 }
 
 static so_default_dynlib default_dynlib[] = {
-	{ "opendir", (uintptr_t)&opendir_fake },
+	{ "opendir", (uintptr_t)&TRACED(opendir_fake) },
 	{ "readdir", (uintptr_t)&readdir_fake },
-	{ "remove", (uintptr_t)&remove },
+	{ "remove", (uintptr_t)&remove_hook },
 	{ "closedir", (uintptr_t)&closedir_fake },
 	{ "readlink", (uintptr_t)&readlink },
 	{ "g_SDL_BufferGeometry_w", (uintptr_t)&g_SDL_BufferGeometry_w },
@@ -860,7 +1225,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "clearerr", (uintptr_t)&clearerr },
 	{ "clock", (uintptr_t)&clock },
 	{ "clock_gettime", (uintptr_t)&clock_gettime_hook },
-	{ "close", (uintptr_t)&close },
+	{ "close", (uintptr_t)&TRACED(close_hook) },
 	{ "cos", (uintptr_t)&cos },
 	{ "connect", (uintptr_t)&connect },
 	{ "cosf", (uintptr_t)&cosf },
@@ -892,7 +1257,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "freopen", (uintptr_t)&freopen },
 	{ "fmod", (uintptr_t)&fmod },
 	{ "fmodf", (uintptr_t)&fmodf },
-	{ "fopen", (uintptr_t)&fopen_hook },
+	{ "fopen", (uintptr_t)&TRACED(fopen_hook) },
 	{ "fprintf", (uintptr_t)&fprintf },
 	{ "fputc", (uintptr_t)&fputc },
 	// { "fputwc", (uintptr_t)&fputwc },
@@ -970,14 +1335,14 @@ static so_default_dynlib default_dynlib[] = {
 	{ "memcpy", (uintptr_t)&sceClibMemcpy },
 	{ "memmove", (uintptr_t)&sceClibMemmove },
 	{ "memset", (uintptr_t)&sceClibMemset },
-	{ "mkdir", (uintptr_t)&mkdir },
-	{ "rmdir", (uintptr_t)&rmdir },
-	// { "mmap", (uintptr_t)&mmap},
-	// { "munmap", (uintptr_t)&munmap},
+	{ "mkdir", (uintptr_t)&mkdir_hook },
+	{ "rmdir", (uintptr_t)&rmdir_hook },
+	{ "mmap", (uintptr_t)&mmap_hook },
+	{ "munmap", (uintptr_t)&munmap_hook },
 	{ "modf", (uintptr_t)&modf },
 	{ "modff", (uintptr_t)&modff },
 	{ "poll", (uintptr_t)&poll },
-	// { "open", (uintptr_t)&open },
+	{ "open", (uintptr_t)&TRACED(open_hook) },
 	{ "pow", (uintptr_t)&pow },
 	{ "powf", (uintptr_t)&powf },
 	{ "printf", (uintptr_t)&printf },
@@ -1018,7 +1383,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "putwc", (uintptr_t)&putwc },
 	{ "qsort", (uintptr_t)&qsort },
 	{ "rand", (uintptr_t)&rand },
-	{ "read", (uintptr_t)&read },
+	{ "read", (uintptr_t)&TRACED(read) },
 	{ "realpath", (uintptr_t)&realpath },
 	{ "realloc", (uintptr_t)&vglRealloc },
 	{ "rewind", (uintptr_t)&rewind },
@@ -1046,7 +1411,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "srand", (uintptr_t)&srand },
 	{ "srand48", (uintptr_t)&srand48 },
 	{ "sscanf", (uintptr_t)&sscanf },
-	{ "stat", (uintptr_t)&stat_hook },
+	{ "stat", (uintptr_t)&TRACED(stat_hook) },
 	{ "strcasecmp", (uintptr_t)&strcasecmp },
 	{ "strcasestr", (uintptr_t)&strstr },
 	{ "strcat", (uintptr_t)&strcat },
@@ -1109,29 +1474,29 @@ static so_default_dynlib default_dynlib[] = {
 	{ "write", (uintptr_t)&write },
 	// { "writev", (uintptr_t)&writev },
 	{ "glClearColor", (uintptr_t)&glClearColor },
-	{ "glTexSubImage2D", (uintptr_t)&glTexSubImage2D },
-	{ "glTexImage2D", (uintptr_t)&glTexImage2D },
-	{ "glDeleteTextures", (uintptr_t)&glDeleteTextures },
+	{ "glTexSubImage2D", (uintptr_t)&glTexSubImage2D_hook },
+	{ "glTexImage2D", (uintptr_t)&glTexImage2D_hook },
+	{ "glDeleteTextures", (uintptr_t)&glDeleteTextures_hook },
 	{ "glGenTextures", (uintptr_t)&glGenTextures },
-	{ "glBindTexture", (uintptr_t)&glBindTexture },
-	{ "glTexParameteri", (uintptr_t)&glTexParameteri },
+	{ "glBindTexture", (uintptr_t)&glBindTexture_hook },
+	{ "glTexParameteri", (uintptr_t)&glTexParameteri_hook },
 	{ "glGetError", (uintptr_t)&glGetError },
-	{ "glMatrixMode", (uintptr_t)&glMatrixMode },
-	{ "glLoadIdentity", (uintptr_t)&glLoadIdentity },
-	{ "glScalef", (uintptr_t)&glScalef },
-	{ "glClear", (uintptr_t)&glClear },
-	{ "glOrthof", (uintptr_t)&glOrthof },
-	{ "glViewport", (uintptr_t)&glViewport },
-	{ "glScissor", (uintptr_t)&glScissor },
-	{ "glEnable", (uintptr_t)&glEnable },
-	{ "glDisable", (uintptr_t)&glDisable },
-	{ "glEnableClientState", (uintptr_t)&glEnableClientState },
-	{ "glDisableClientState", (uintptr_t)&glDisableClientState },
-	{ "glBlendFunc", (uintptr_t)&glBlendFunc },
-	{ "glColorPointer", (uintptr_t)&glColorPointer },
-	{ "glVertexPointer", (uintptr_t)&glVertexPointer },
-	{ "glTexCoordPointer", (uintptr_t)&glTexCoordPointer },
-	{ "glDrawElements", (uintptr_t)&glDrawElements },
+	{ "glMatrixMode", (uintptr_t)&glMatrixMode_hook },
+	{ "glLoadIdentity", (uintptr_t)&glLoadIdentity_hook },
+	{ "glScalef", (uintptr_t)&glScalef_hook },
+	{ "glClear", (uintptr_t)&glClear_hook },
+	{ "glOrthof", (uintptr_t)&glOrthof_hook },
+	{ "glViewport", (uintptr_t)&glViewport_hook },
+	{ "glScissor", (uintptr_t)&glScissor_hook },
+	{ "glEnable", (uintptr_t)&glEnable_hook },
+	{ "glDisable", (uintptr_t)&glDisable_hook },
+	{ "glEnableClientState", (uintptr_t)&glEnableClientState_hook },
+	{ "glDisableClientState", (uintptr_t)&glDisableClientState_hook },
+	{ "glBlendFunc", (uintptr_t)&glBlendFunc_hook },
+	{ "glColorPointer", (uintptr_t)&glColorPointer_hook },
+	{ "glVertexPointer", (uintptr_t)&glVertexPointer_hook },
+	{ "glTexCoordPointer", (uintptr_t)&glTexCoordPointer_hook },
+	{ "glDrawElements", (uintptr_t)&glDrawElements_hook },
 	{ "SDL_IsTextInputActive", (uintptr_t)&SDL_IsTextInputActive },
 	{ "SDL_GameControllerEventState", (uintptr_t)&SDL_GameControllerEventState },
 	{ "SDL_WarpMouseInWindow", (uintptr_t)&SDL_WarpMouseInWindow },
@@ -1141,13 +1506,13 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_AddTimer", (uintptr_t)&SDL_AddTimer },
 	{ "SDL_CondSignal", (uintptr_t)&SDL_CondSignal },
 	{ "SDL_CondWait", (uintptr_t)&SDL_CondWait },
-	{ "SDL_ConvertSurfaceFormat", (uintptr_t)&SDL_ConvertSurfaceFormat },
+	{ "SDL_ConvertSurfaceFormat", (uintptr_t)&SDL_ConvertSurfaceFormat_hook },
 	{ "SDL_CreateCond", (uintptr_t)&SDL_CreateCond },
 	{ "SDL_CreateMutex", (uintptr_t)&SDL_CreateMutex },
 	{ "SDL_CreateRenderer", (uintptr_t)&SDL_CreateRenderer },
 	{ "SDL_CreateRGBSurface", (uintptr_t)&SDL_CreateRGBSurface },
-	{ "SDL_CreateTexture", (uintptr_t)&SDL_CreateTexture },
-	{ "SDL_CreateTextureFromSurface", (uintptr_t)&SDL_CreateTextureFromSurface },
+	{ "SDL_CreateTexture", (uintptr_t)&SDL_CreateTexture_hook },
+	{ "SDL_CreateTextureFromSurface", (uintptr_t)&SDL_CreateTextureFromSurface_hook },
 	{ "SDL_CreateSystemCursor", (uintptr_t)&SDL_CreateSystemCursor },
 	{ "SDL_CreateThread", (uintptr_t)&SDL_CreateThread },
 	{ "SDL_SetCursor", (uintptr_t)&SDL_SetCursor },
@@ -1155,10 +1520,10 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_Delay", (uintptr_t)&SDL_Delay_hook },
 	{ "SDL_DestroyMutex", (uintptr_t)&SDL_DestroyMutex },
 	{ "SDL_DestroyRenderer", (uintptr_t)&SDL_DestroyRenderer },
-	{ "SDL_DestroyTexture", (uintptr_t)&SDL_DestroyTexture },
+	{ "SDL_DestroyTexture", (uintptr_t)&SDL_DestroyTexture_hook },
 	{ "SDL_DestroyWindow", (uintptr_t)&SDL_DestroyWindow },
-	{ "SDL_FillRect", (uintptr_t)&SDL_FillRect },
-	{ "SDL_FreeSurface", (uintptr_t)&SDL_FreeSurface },
+	{ "SDL_FillRect", (uintptr_t)&SDL_FillRect_hook },
+	{ "SDL_FreeSurface", (uintptr_t)&SDL_FreeSurface_hook },
 	{ "SDL_GetCurrentDisplayMode", (uintptr_t)&SDL_GetCurrentDisplayMode },
 	{ "SDL_GetDisplayMode", (uintptr_t)&SDL_GetDisplayMode },
 	{ "SDL_GetDisplayMode", (uintptr_t)&SDL_GetDisplayMode },
@@ -1177,7 +1542,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_GetTextureColorMod", (uintptr_t)&SDL_GetTextureColorMod },
 	{ "SDL_GetTicks", (uintptr_t)&SDL_GetTicks },
 	{ "SDL_GetVersion", (uintptr_t)&SDL_GetVersion },
-	{ "SDL_GL_BindTexture", (uintptr_t)&SDL_GL_BindTexture },
+	{ "SDL_GL_BindTexture", (uintptr_t)&SDL_GL_BindTexture_hook },
 	{ "SDL_GL_GetCurrentContext", (uintptr_t)&SDL_GL_GetCurrentContext },
 	{ "SDL_GL_MakeCurrent", (uintptr_t)&SDL_GL_MakeCurrent },
 	{ "SDL_GL_SetAttribute", (uintptr_t)&SDL_GL_SetAttribute },
@@ -1235,11 +1600,11 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_QueryTexture", (uintptr_t)&SDL_QueryTexture },
 	{ "SDL_Quit", (uintptr_t)&SDL_Quit },
 	{ "SDL_RemoveTimer", (uintptr_t)&SDL_RemoveTimer },
-	{ "SDL_RenderClear", (uintptr_t)&SDL_RenderClear },
-	{ "SDL_RenderCopy", (uintptr_t)&SDL_RenderCopy },
-	{ "SDL_RenderFillRect", (uintptr_t)&SDL_RenderFillRect },
-	{ "SDL_RenderPresent", (uintptr_t)&SDL_RenderPresent },
-	{ "SDL_RWFromFile", (uintptr_t)&SDL_RWFromFile_hook },
+	{ "SDL_RenderClear", (uintptr_t)&SDL_RenderClear_hook },
+	{ "SDL_RenderCopy", (uintptr_t)&SDL_RenderCopy_hook },
+	{ "SDL_RenderFillRect", (uintptr_t)&SDL_RenderFillRect_hook },
+	{ "SDL_RenderPresent", (uintptr_t)&SDL_RenderPresent_hook },
+	{ "SDL_RWFromFile", (uintptr_t)&TRACED(SDL_RWFromFile_hook) },
 	{ "SDL_RWread", (uintptr_t)&SDL_RWread },
 	{ "SDL_RWwrite", (uintptr_t)&SDL_RWwrite },
 	{ "SDL_RWclose", (uintptr_t)&SDL_RWclose },
@@ -1261,8 +1626,8 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_strdup", (uintptr_t)&SDL_strdup },
 	{ "SDL_UnlockMutex", (uintptr_t)&SDL_UnlockMutex },
 	{ "SDL_UnlockSurface", (uintptr_t)&SDL_UnlockSurface },
-	{ "SDL_UpdateTexture", (uintptr_t)&SDL_UpdateTexture },
-	{ "SDL_UpperBlit", (uintptr_t)&SDL_UpperBlit },
+	{ "SDL_UpdateTexture", (uintptr_t)&SDL_UpdateTexture_hook },
+	{ "SDL_UpperBlit", (uintptr_t)&SDL_UpperBlit_hook },
 	{ "SDL_ThreadID", (uintptr_t)&SDL_ThreadID },
 	{ "SDL_WaitThread", (uintptr_t)&SDL_WaitThread },
 	{ "SDL_GetKeyFromScancode", (uintptr_t)&SDL_GetKeyFromScancode },
@@ -1282,7 +1647,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_ShowMessageBox", (uintptr_t)&SDL_ShowMessageBox },
 	{ "SDL_RaiseWindow", (uintptr_t)&SDL_RaiseWindow },
 	{ "SDL_GL_GetAttribute", (uintptr_t)&SDL_GL_GetAttribute },
-	{ "SDL_GL_CreateContext", (uintptr_t)&SDL_GL_CreateContext },
+	{ "SDL_GL_CreateContext", (uintptr_t)&SDL_GL_CreateContext_hook },
 	{ "SDL_GL_GetProcAddress", (uintptr_t)&SDL_GL_GetProcAddress_fake },
 	{ "SDL_GL_DeleteContext", (uintptr_t)&SDL_GL_DeleteContext },
 	{ "SDL_GetDesktopDisplayMode", (uintptr_t)&SDL_GetDesktopDisplayMode },
@@ -1305,7 +1670,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_JoystickGetDeviceGUID", (uintptr_t)&SDL_JoystickGetDeviceGUID },
 	{ "SDL_GameControllerNameForIndex", (uintptr_t)&SDL_GameControllerNameForIndex },
 	{ "SDL_GetWindowFromID", (uintptr_t)&SDL_GetWindowFromID },
-	{ "SDL_GL_SwapWindow", (uintptr_t)&SDL_GL_SwapWindow },
+	{ "SDL_GL_SwapWindow", (uintptr_t)&SDL_GL_SwapWindow_hook },
 	{ "SDL_SetMainReady", (uintptr_t)&SDL_SetMainReady },
 	{ "SDL_NumAccelerometers", (uintptr_t)&ret0 },
 	{ "SDL_AndroidGetJNIEnv", (uintptr_t)&Android_JNI_GetEnv },
@@ -1359,7 +1724,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "alcSuspendContext", (uintptr_t)&alcSuspendContext },
 	{ "alcIsExtensionPresent", (uintptr_t)&alcIsExtensionPresent },
 	{ "alcGetProcAddress", (uintptr_t)&alcGetProcAddress },
-	{ "IMG_Load", (uintptr_t)&IMG_Load_hook },
+	{ "IMG_Load", (uintptr_t)&TRACED(IMG_Load_hook) },
 	{ "IMG_Load_RW", (uintptr_t)&IMG_Load_RW },
 	{ "IMG_Init", (uintptr_t)&IMG_Init },
 	{ "IMG_Quit", (uintptr_t)&IMG_Quit },
@@ -1593,6 +1958,14 @@ float CallStaticFloatMethodV(void *env, void *obj, int methodID, uintptr_t *args
 	sceKernelExitProcess(0);
 }*/
 
+#ifdef GL_CAPTURE_FRAMES
+static void capture_level(const char *level) {
+	char fname[512];
+	snprintf(fname, sizeof(fname), DATA_PATH "/capture_%s.bin", level);
+	glcmd_capture(fname, GL_CAPTURE_FRAMES);
+}
+#endif
+
 int main(int argc, char *argv[]) {
 	//kuKernelRegisterAbortHandler(abort_handler, NULL);
 	//SceUID crasher_thread = sceKernelCreateThread("crasher", crasher, 0x40, 0x1000, 0, 0, NULL);
@@ -1612,6 +1985,24 @@ int main(int argc, char *argv[]) {
 	if (!file_exists("ur0:/data/libshacccg.suprx") && !file_exists("ur0:/data/external/libshacccg.suprx"))
 		fatal_error("Error libshacccg.suprx is not installed.");
 
+#if defined(GL_RENDER_THREAD) || defined(GL_CAPTURE_FRAMES)
+#ifdef GL_RENDER_THREAD
+	int gl_recorded = glcmd_init(1);
+#else
+	int gl_recorded = glcmd_init(0); // Only for the captures, the lists get replayed right away
+#endif
+	if (gl_recorded) {
+		for (size_t i = 0; i < numhooks; ++i) {
+			if (default_dynlib[i].func != (uintptr_t)&ret0)
+				default_dynlib[i].func = glcmd_wrap(default_dynlib[i].symbol, default_dynlib[i].func);
+		}
+		for (size_t i = 0; i < gl_numhook; ++i) {
+			if (gl_hook[i].func != (uintptr_t)&ret0)
+				gl_hook[i].func = glcmd_wrap(gl_hook[i].symbol, gl_hook[i].func);
+		}
+	}
+#endif
+
 	printf("Loading libunistring\n");
 	if (so_file_load(&unistring_mod, DATA_PATH "/libunistring.so", 0x98000000) < 0)
 		fatal_error("Error could not load %s.", DATA_PATH "/libunistring.so");
@@ -1685,6 +2076,26 @@ int main(int argc, char *argv[]) {
 		sceNetInit(&initparam);
 	}
 	
+#ifdef TRACE_FILES
+	trace_init();
+#endif
+	printf("Indexing data folder\n");
+	iosched_init();
+	fstream_init();
+	archive_init();
+	vfs_init();
+	catalog_init();
+	level_init();
+	level_listen(LEVEL_END, texfmt_report);
+	level_listen(LEVEL_END, texupload_report);
+#ifdef GL_CAPTURE_FRAMES
+	level_listen(LEVEL_BEGIN, capture_level);
+#endif
+	prefetch_init();
+	texcache_init();
+	shadercache_init();
+	shaderpack_init();
+	
 	int (* SDL_main)(int argc, char *args[]) = (void *) so_symbol(&rvgl_mod, "SDL_main");
 	SDL_main(1, args);
 	
@@ -0,0 +1,437 @@
+/* meshopt.c -- vertex cache friendly triangle order for the ranges of static index buffers
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __vita__
+#include <vitasdk.h>
+#include <vitaGL.h>
+#include "main.h"
+#include "glstate.h"
+#include "batch.h"
+#include "vertfmt.h"
+#endif
+
+#include "meshopt.h"
+
+/*
+ * Level and model geometry sits in index buffers uploaded once with GL_STATIC_DRAW, in the order the
+ * polygons come in the asset files. Those buffers are kept in memory and every triangle range drawn from
+ * them gets a copy with its triangles reordered for the post-transform cache, the first time it is drawn
+ * with blending off and depth testing on: there the order the triangles land in can't be seen. The
+ * original ranges stay untouched, so draws over overlapping ranges and blended draws still get exactly
+ * what the game uploaded. Vertices aren't reordered for fetch locality here, vertex buffers are shared
+ * by many ranges; tools/meshreport.c measures what that would add.
+ */
+
+#define VALENCE_SCORES 32
+
+static float cache_scores[MESHOPT_SCORE_CACHE + 3];
+static float valence_scores[VALENCE_SCORES];
+
+static void init_scores(void) {
+	if (valence_scores[1] > 0.0f)
+		return;
+	for (int i = 0; i < MESHOPT_SCORE_CACHE + 3; i++) {
+		if (i < 3)
+			cache_scores[i] = 0.75f; // The last triangle's vertices, no point in favouring one of them
+		else if (i < MESHOPT_SCORE_CACHE)
+			cache_scores[i] = powf(1.0f - (float)(i - 3) / (MESHOPT_SCORE_CACHE - 3), 1.5f);
+		else
+			cache_scores[i] = 0.0f;
+	}
+	valence_scores[0] = 0.0f;
+	for (int i = 1; i < VALENCE_SCORES; i++)
+		valence_scores[i] = 2.0f / sqrtf(i); // Vertices with few triangles left get finished first
+}
+
+static inline float vertex_score(int cache_pos, uint32_t remaining) {
+	if (!remaining)
+		return -1.0f;
+	float score = cache_pos >= 0 ? cache_scores[cache_pos] : 0.0f;
+	return score + valence_scores[remaining < VALENCE_SCORES ? remaining : VALENCE_SCORES - 1];
+}
+
+int meshopt_reorder(const uint32_t *indices, uint32_t count, uint32_t verts, uint32_t *out) {
+	uint32_t tris = count / 3;
+	uint32_t *offsets = calloc(verts + 1, sizeof(uint32_t));
+	uint32_t *remaining = calloc(verts, sizeof(uint32_t));
+	uint32_t *adjacent = malloc(tris * 3 * sizeof(uint32_t));
+	float *scores = malloc(verts * sizeof(float));
+	float *tri_scores = malloc(tris * sizeof(float));
+	uint8_t *emitted = calloc(tris, 1);
+	int ok = offsets && remaining && adjacent && scores && tri_scores && emitted;
+	if (!ok)
+		goto out;
+	init_scores();
+
+	// Triangles of every vertex, the ones still to emit come first in each list
+	for (uint32_t i = 0; i < tris * 3; i++)
+		remaining[indices[i]]++;
+	for (uint32_t v = 0; v < verts; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+	memset(remaining, 0, verts * sizeof(uint32_t));
+	for (uint32_t i = 0; i < tris * 3; i++) {
+		uint32_t v = indices[i];
+		adjacent[offsets[v] + remaining[v]++] = i / 3;
+	}
+	for (uint32_t v = 0; v < verts; v++)
+		scores[v] = vertex_score(-1, remaining[v]);
+	for (uint32_t t = 0; t < tris; t++)
+		tri_scores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+
+	uint32_t cache[MESHOPT_SCORE_CACHE + 3], next_cache[MESHOPT_SCORE_CACHE + 3];
+	int cache_size = 0;
+	uint32_t cursor = 0;
+	int32_t best = -1;
+	for (uint32_t n = 0; n < tris; n++) {
+		// Nothing in the cache has triangles left, go on with the first one not emitted yet
+		if (best < 0) {
+			while (emitted[cursor])
+				cursor++;
+			best = cursor;
+		}
+		const uint32_t *tri = &indices[best * 3];
+		memcpy(&out[n * 3], tri, 3 * sizeof(uint32_t));
+		emitted[best] = 1;
+
+		// The triangle's vertices go to the front of the cache, the rest move back
+		int next_size = 0;
+		for (int i = 0; i < 3; i++) {
+			uint32_t v = tri[i];
+			uint32_t *list = &adjacent[offsets[v]];
+			for (uint32_t j = 0; j < remaining[v]; j++) {
+				if (list[j] == (uint32_t)best) {
+					list[j] = list[remaining[v] - 1];
+					list[remaining[v] - 1] = best;
+					break;
+				}
+			}
+			remaining[v]--;
+			next_cache[next_size++] = v;
+		}
+		for (int i = 0; i < cache_size; i++) {
+			uint32_t v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				next_cache[next_size++] = v;
+		}
+
+		// Rescore what moved in the cache, the vertices pushed out included
+		for (int i = 0; i < next_size; i++) {
+			uint32_t v = next_cache[i];
+			int pos = i < MESHOPT_SCORE_CACHE ? i : -1;
+			float score = vertex_score(pos, remaining[v]);
+			float delta = score - scores[v];
+			scores[v] = score;
+			for (uint32_t j = 0; j < remaining[v]; j++)
+				tri_scores[adjacent[offsets[v] + j]] += delta;
+		}
+		cache_size = next_size < MESHOPT_SCORE_CACHE ? next_size : MESHOPT_SCORE_CACHE;
+		best = -1;
+		float best_score = -1.0f;
+		for (int i = 0; i < cache_size; i++) {
+			uint32_t v = next_cache[i];
+			for (uint32_t j = 0; j < remaining[v]; j++) {
+				uint32_t t = adjacent[offsets[v] + j];
+				if (tri_scores[t] > best_score) {
+					best_score = tri_scores[t];
+					best = t;
+				}
+			}
+		}
+		memcpy(cache, next_cache, cache_size * sizeof(uint32_t));
+	}
+
+out:
+	free(offsets);
+	free(remaining);
+	free(adjacent);
+	free(scores);
+	free(tri_scores);
+	free(emitted);
+	return ok;
+}
+
+uint32_t meshopt_misses(const uint32_t *indices, uint32_t count, uint32_t verts, uint32_t cache_size) {
+	// A vertex is in the FIFO when fewer than cache_size misses happened since its own
+	uint32_t *loaded = calloc(verts, sizeof(uint32_t));
+	if (!loaded)
+		return 0xFFFFFFFF;
+	uint32_t misses = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t v = indices[i];
+		if (!loaded[v] || misses - loaded[v] + 1 > cache_size)
+			loaded[v] = ++misses;
+	}
+	free(loaded);
+	return misses;
+}
+
+uint32_t meshopt_fetch_remap(const uint32_t *indices, uint32_t count, uint32_t verts, uint32_t *remap) {
+	uint32_t next = 0;
+	memset(remap, 0xFF, verts * sizeof(uint32_t));
+	for (uint32_t i = 0; i < count; i++) {
+		if (remap[indices[i]] == 0xFFFFFFFF)
+			remap[indices[i]] = next++;
+	}
+	uint32_t used = next;
+	for (uint32_t v = 0; v < verts; v++) {
+		if (remap[v] == 0xFFFFFFFF)
+			remap[v] = next++;
+	}
+	return used;
+}
+
+#ifdef __vita__
+
+#define MAX_BUFFERS 1024 // Power of two
+#define MAX_RANGES 4096 // Power of two
+#define MIN_TRIANGLES 16 // Smaller ranges fit the cache as they are
+
+enum {
+	RANGE_FREE,
+	RANGE_NEW, // Not optimized yet
+	RANGE_OPTIMIZED,
+	RANGE_KEPT, // Already as good as it gets, or not a triangle list
+};
+
+typedef struct {
+	GLuint name; // 0 for free slots, slots stay with their name once taken
+	uint32_t size;
+	uint8_t *data; // NULL while not kept
+} static_buffer;
+
+typedef struct {
+	GLuint buffer;
+	uint32_t offset, count;
+	GLenum type;
+	int state;
+	GLuint optimized;
+} index_range;
+
+// Only touched by the GL thread
+static static_buffer buffers[MAX_BUFFERS];
+static index_range ranges[MAX_RANGES];
+static int num_buffers = 0, num_ranges = 0;
+static uint32_t kept_bytes = 0;
+static uint32_t frame_triangles = 0;
+
+static uint32_t stat_draws, stat_optimized_draws;
+static uint32_t stat_ranges, stat_bytes;
+static uint64_t stat_triangles, stat_misses_before, stat_misses_after;
+
+static uint32_t index_size(GLenum type) {
+	switch (type) {
+	case GL_UNSIGNED_INT:
+		return 4;
+	case GL_UNSIGNED_SHORT:
+		return 2;
+	case GL_UNSIGNED_BYTE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static static_buffer *find_buffer(GLuint name, int add) {
+	for (uint32_t i = name * 2654435761u;; i++) {
+		static_buffer *b = &buffers[i & (MAX_BUFFERS - 1)];
+		if (b->name == name)
+			return b;
+		if (!b->name) {
+			if (!add || num_buffers >= MAX_BUFFERS * 3 / 4)
+				return NULL;
+			num_buffers++;
+			b->name = name;
+			return b;
+		}
+	}
+}
+
+static index_range *find_range(GLuint buffer, uint32_t offset, uint32_t count, GLenum type) {
+	for (uint32_t i = (buffer * 2654435761u) ^ (offset * 40503u) ^ count;; i++) {
+		index_range *r = &ranges[i & (MAX_RANGES - 1)];
+		if (r->buffer == buffer && r->offset == offset && r->count == count && r->type == type) {
+			if (r->state == RANGE_FREE)
+				r->state = RANGE_NEW;
+			return r;
+		}
+		if (!r->buffer) {
+			if (num_ranges >= MAX_RANGES * 3 / 4)
+				return NULL;
+			num_ranges++;
+			*r = (index_range){buffer, offset, count, type, RANGE_NEW, 0};
+			return r;
+		}
+	}
+}
+
+static void forget_buffer(GLuint name) {
+	static_buffer *b = find_buffer(name, 0);
+	if (!b || !b->data)
+		return;
+	for (int i = 0; i < MAX_RANGES; i++) {
+		index_range *r = &ranges[i];
+		if (r->buffer != name || r->state == RANGE_FREE)
+			continue;
+		if (r->state == RANGE_OPTIMIZED) {
+			glDeleteBuffers(1, &r->optimized);
+			stat_ranges--;
+			stat_bytes -= r->count * index_size(r->type);
+		}
+		r->state = RANGE_FREE;
+	}
+	kept_bytes -= b->size;
+	free(b->data);
+	b->data = NULL;
+}
+
+void glBufferData_hook(GLenum target, GLsizeiptr size, const void *data, GLenum usage) {
+	if (target == GL_ELEMENT_ARRAY_BUFFER) {
+		GLuint name = batch_element_buffer();
+		forget_buffer(name);
+		if (name && data && usage == GL_STATIC_DRAW && size > 0 && kept_bytes + size <= MESHOPT_KEEP_KB * 1024) {
+			static_buffer *b = find_buffer(name, 1);
+			if (b && (b->data = malloc(size))) {
+				memcpy(b->data, data, size);
+				b->size = size;
+				kept_bytes += size;
+			}
+		}
+	} else if (target == GL_ARRAY_BUFFER) {
+		vertfmt_buffer_data(batch_array_buffer(), size, data, usage);
+	}
+	glBufferData(target, size, data, usage);
+}
+
+// Static buffers don't get updated, the ones that do are simply left alone from then on. Vertex buffers
+// are vertfmt's.
+void glBufferSubData_hook(GLenum target, GLintptr offset, GLsizeiptr size, const void *data) {
+	if (target == GL_ELEMENT_ARRAY_BUFFER)
+		forget_buffer(batch_element_buffer());
+	else if (target == GL_ARRAY_BUFFER)
+		vertfmt_forget(batch_array_buffer());
+	glBufferSubData(target, offset, size, data);
+}
+
+void glDeleteBuffers_hook(GLsizei n, const GLuint *names) {
+	batch_flush();
+	for (GLsizei i = 0; i < n; i++) {
+		forget_buffer(names[i]);
+		vertfmt_forget(names[i]);
+		batch_forget_buffer(names[i]);
+	}
+	glDeleteBuffers(n, names);
+}
+
+static void optimize(const static_buffer *b, index_range *r) {
+	r->state = RANGE_KEPT;
+	uint32_t isize = index_size(r->type);
+	const uint8_t *src = b->data + r->offset;
+	uint32_t *local = malloc(r->count * 2 * sizeof(uint32_t));
+	if (!local)
+		return;
+	uint32_t *reordered = local + r->count;
+
+	uint32_t lo = 0xFFFFFFFF, hi = 0;
+	for (uint32_t i = 0; i < r->count; i++) {
+		uint32_t idx = isize == 4 ? ((const uint32_t *)src)[i] : isize == 2 ? ((const uint16_t *)src)[i] : src[i];
+		local[i] = idx;
+		if (idx < lo)
+			lo = idx;
+		if (idx > hi)
+			hi = idx;
+	}
+	for (uint32_t i = 0; i < r->count; i++)
+		local[i] -= lo;
+	uint32_t verts = hi - lo + 1;
+
+	uint32_t before = meshopt_misses(local, r->count, verts, MESHOPT_CACHE_SIZE);
+	if (before != 0xFFFFFFFF && meshopt_reorder(local, r->count, verts, reordered)) {
+		uint32_t after = meshopt_misses(reordered, r->count, verts, MESHOPT_CACHE_SIZE);
+		if (after < before) {
+			// Written back over local in the buffer's own index type
+			void *dst = local;
+			for (uint32_t i = 0; i < r->count; i++) {
+				uint32_t idx = reordered[i] + lo;
+				if (isize == 4)
+					((uint32_t *)dst)[i] = idx;
+				else if (isize == 2)
+					((uint16_t *)dst)[i] = idx;
+				else
+					((uint8_t *)dst)[i] = idx;
+			}
+			glGenBuffers(1, &r->optimized);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->optimized);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, r->count * isize, dst, GL_STATIC_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->buffer);
+			r->state = RANGE_OPTIMIZED;
+			stat_ranges++;
+			stat_bytes += r->count * isize;
+		}
+		stat_triangles += r->count / 3;
+		stat_misses_before += before;
+		stat_misses_after += after < before ? after : before;
+	}
+	free(local);
+}
+
+int meshopt_draw(GLenum mode, GLsizei count, GLenum type, const void *indices, GLuint buffer) {
+	if (mode != GL_TRIANGLES || count < MIN_TRIANGLES * 3)
+		return 0;
+	static_buffer *b = find_buffer(buffer, 0);
+	if (!b || !b->data)
+		return 0;
+	stat_draws++;
+	uint32_t isize = index_size(type), offset = (uintptr_t)indices;
+	if (!isize || offset % isize || offset + count * isize > b->size || count % 3)
+		return 0;
+	// Both have to be known, glstate only learns them from the game's own calls
+	if (glstate_enabled(GL_BLEND) != 0 || glstate_enabled(GL_DEPTH_TEST) != 1)
+		return 0;
+
+	index_range *r = find_range(buffer, offset, count, type);
+	if (!r)
+		return 0;
+	if (r->state == RANGE_NEW) {
+		// A range past the cap on its own would never fit in a frame
+		if (count / 3 > MESHOPT_FRAME_TRIANGLES)
+			r->state = RANGE_KEPT;
+		if (r->state == RANGE_KEPT || frame_triangles + count / 3 > MESHOPT_FRAME_TRIANGLES)
+			return 0;
+		frame_triangles += count / 3;
+		optimize(b, r);
+	}
+	if (r->state != RANGE_OPTIMIZED)
+		return 0;
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->optimized);
+	glDrawElements(mode, count, type, NULL);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+	stat_optimized_draws++;
+	return 1;
+}
+
+void meshopt_frame(void) {
+	frame_triangles = 0;
+}
+
+void meshopt_report(uint32_t frames) {
+	if (stat_draws) {
+		debugPrintf("meshopt: %u of %u static indexed draws per frame optimized, %u ranges (%u KB), ACMR %.3f -> %.3f\n",
+			stat_optimized_draws / frames, stat_draws / frames, stat_ranges, stat_bytes / 1024,
+			stat_triangles ? (double)stat_misses_before / stat_triangles : 0.0,
+			stat_triangles ? (double)stat_misses_after / stat_triangles : 0.0);
+	}
+	stat_draws = stat_optimized_draws = 0;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __MESHOPT_H__
+#define __MESHOPT_H__
+
+#include <stdint.h>
+
+#define MESHOPT_SCORE_CACHE 32 // Cache size the triangle order is scored against, larger than any real one
+
+/*
+ * Post-transform cache optimization of indexed triangle lists. Indices passed here are local: 0 to
+ * verts - 1. The triangle order comes from Tom Forsyth's linear-speed vertex cache optimization.
+ */
+
+// Writes the triangles of indices to out in cache friendly order, returns 0 when out of memory
+int meshopt_reorder(const uint32_t *indices, uint32_t count, uint32_t verts, uint32_t *out);
+// Vertices transformed with a FIFO post-transform cache of cache_size entries, ACMR is this over triangles.
+// Returns 0xFFFFFFFF when out of memory.
+uint32_t meshopt_misses(const uint32_t *indices, uint32_t count, uint32_t verts, uint32_t cache_size);
+// Numbers the vertices in the order the indices use them first, remap[old] = new. Returns how many are used,
+// the unused ones come after them.
+uint32_t meshopt_fetch_remap(const uint32_t *indices, uint32_t count, uint32_t verts, uint32_t *remap);
+
+#ifdef __vita__
+#include <vitaGL.h>
+
+// Static index buffers are kept to draw their triangle ranges from optimized copies
+void glBufferData_hook(GLenum target, GLsizeiptr size, const void *data, GLenum usage);
+void glBufferSubData_hook(GLenum target, GLintptr offset, GLsizeiptr size, const void *data);
+void glDeleteBuffers_hook(GLsizei n, const GLuint *buffers);
+
+// Draws from the optimized copy of the range when there is one, returns 0 when the caller has to draw
+int meshopt_draw(GLenum mode, GLsizei count, GLenum type, const void *indices, GLuint buffer);
+void meshopt_frame(void);
+void meshopt_report(uint32_t frames);
+#endif
+
+#endif
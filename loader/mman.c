@@ -0,0 +1,261 @@
+/* mman.c -- mmap/munmap emulation
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "mman.h"
+
+#define PAGE_SIZE 0x1000
+#define MAX_TRACKED_FDS 64
+
+enum {
+	MAPPING_BLOCK,
+	MAPPING_HEAP,
+};
+
+typedef struct mapping {
+	struct mapping *next;
+	void *addr;
+	size_t size;
+	int type;
+	SceUID block;
+	int refs;
+
+	// Only set for read-only file mappings, which can be shared
+	char *path;
+	long offset;
+	size_t length;
+	off_t file_size;
+	time_t mtime;
+} mapping;
+
+typedef struct {
+	int used;
+	int fd;
+	char path[256];
+} tracked_fd;
+
+static pthread_mutex_t mman_mutex = PTHREAD_MUTEX_INITIALIZER;
+static mapping *mappings = NULL;
+static tracked_fd tracked_fds[MAX_TRACKED_FDS];
+
+void mman_track_fd(int fd, const char *path) {
+	pthread_mutex_lock(&mman_mutex);
+	tracked_fd *slot = NULL;
+	for (int i = 0; i < MAX_TRACKED_FDS; i++) {
+		if (tracked_fds[i].used && tracked_fds[i].fd == fd) {
+			slot = &tracked_fds[i];
+			break;
+		}
+		if (!slot && !tracked_fds[i].used)
+			slot = &tracked_fds[i];
+	}
+	if (slot) {
+		slot->used = 1;
+		slot->fd = fd;
+		strncpy(slot->path, path, sizeof(slot->path) - 1);
+		slot->path[sizeof(slot->path) - 1] = 0;
+	}
+	pthread_mutex_unlock(&mman_mutex);
+}
+
+void mman_untrack_fd(int fd) {
+	pthread_mutex_lock(&mman_mutex);
+	for (int i = 0; i < MAX_TRACKED_FDS; i++) {
+		if (tracked_fds[i].used && tracked_fds[i].fd == fd) {
+			tracked_fds[i].used = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mman_mutex);
+}
+
+static const char *tracked_path(int fd) {
+	for (int i = 0; i < MAX_TRACKED_FDS; i++) {
+		if (tracked_fds[i].used && tracked_fds[i].fd == fd)
+			return tracked_fds[i].path;
+	}
+	return NULL;
+}
+
+static mapping *alloc_mapping(size_t size) {
+	mapping *m = calloc(1, sizeof(mapping));
+	if (!m)
+		return NULL;
+
+	// Memblocks are page aligned and don't eat newlib heap, fallback to it only when we run out of them
+	m->block = sceKernelAllocMemBlock("mmap", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, size, NULL);
+	if (m->block >= 0) {
+		sceKernelGetMemBlockBase(m->block, &m->addr);
+		m->type = MAPPING_BLOCK;
+	} else {
+		m->addr = memalign(PAGE_SIZE, size);
+		m->type = MAPPING_HEAP;
+	}
+	if (!m->addr) {
+		free(m);
+		return NULL;
+	}
+
+	m->size = size;
+	m->refs = 1;
+	return m;
+}
+
+static void free_mapping(mapping *m) {
+	if (m->type == MAPPING_BLOCK)
+		sceKernelFreeMemBlock(m->block);
+	else
+		free(m->addr);
+	free(m->path);
+	free(m);
+}
+
+static int read_range(int fd, void *dst, long offset, size_t length) {
+	off_t cur = lseek(fd, 0, SEEK_CUR);
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		return -1;
+
+	size_t done = 0;
+	while (done < length) {
+		ssize_t r = read(fd, (uint8_t *)dst + done, length - done);
+		if (r < 0) {
+			lseek(fd, cur, SEEK_SET);
+			return -1;
+		}
+		if (r == 0)
+			break;
+		done += r;
+	}
+
+	lseek(fd, cur, SEEK_SET);
+	return done;
+}
+
+static void *map_anonymous(size_t size) {
+	mapping *m = alloc_mapping(size);
+	if (!m) {
+		errno = ENOMEM;
+		return MMAP_FAILED;
+	}
+	sceClibMemset(m->addr, 0, size);
+
+	m->next = mappings;
+	mappings = m;
+	return m->addr;
+}
+
+static void *map_file(size_t length, size_t size, int prot, int fd, long offset) {
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		errno = EBADF;
+		return MMAP_FAILED;
+	}
+
+	// Writes are never propagated back to the file, so only read-only mappings can be safely shared
+	const char *path = tracked_path(fd);
+	int shareable = path && !(prot & MMAP_PROT_WRITE);
+	if (shareable) {
+		for (mapping *m = mappings; m; m = m->next) {
+			if (m->path && m->offset == offset && m->length == length &&
+				m->file_size == st.st_size && m->mtime == st.st_mtime && !strcmp(m->path, path)) {
+				m->refs++;
+				return m->addr;
+			}
+		}
+	}
+
+	mapping *m = alloc_mapping(size);
+	if (!m) {
+		errno = ENOMEM;
+		return MMAP_FAILED;
+	}
+
+	int read_size = read_range(fd, m->addr, offset, length);
+	if (read_size < 0) {
+		free_mapping(m);
+		errno = EACCES;
+		return MMAP_FAILED;
+	}
+
+	// Bytes past the end of the file read as zero
+	sceClibMemset((uint8_t *)m->addr + read_size, 0, size - read_size);
+
+	if (shareable) {
+		m->path = strdup(path);
+		m->offset = offset;
+		m->length = length;
+		m->file_size = st.st_size;
+		m->mtime = st.st_mtime;
+	}
+
+	m->next = mappings;
+	mappings = m;
+	return m->addr;
+}
+
+void *mmap_hook(void *addr, size_t length, int prot, int flags, int fd, long offset) {
+	if (length == 0 || (offset & (PAGE_SIZE - 1)) || (flags & MMAP_FIXED)) {
+		errno = EINVAL;
+		return MMAP_FAILED;
+	}
+
+	if ((flags & MMAP_SHARED) && (prot & MMAP_PROT_WRITE) && !(flags & MMAP_ANONYMOUS))
+		debugPrintf("mmap: writable shared mapping of fd %d won't be written back\n", fd);
+
+	size_t size = ALIGN_MEM(length, PAGE_SIZE);
+
+	pthread_mutex_lock(&mman_mutex);
+	void *r;
+	if (flags & MMAP_ANONYMOUS)
+		r = map_anonymous(size);
+	else
+		r = map_file(length, size, prot, fd, offset);
+	pthread_mutex_unlock(&mman_mutex);
+
+	return r;
+}
+
+int munmap_hook(void *addr, size_t length) {
+	pthread_mutex_lock(&mman_mutex);
+	mapping *prev = NULL, *m = mappings;
+	while (m) {
+		if ((uintptr_t)addr >= (uintptr_t)m->addr && (uintptr_t)addr < (uintptr_t)m->addr + m->size)
+			break;
+		prev = m;
+		m = m->next;
+	}
+
+	if (!m) {
+		pthread_mutex_unlock(&mman_mutex);
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Partially unmapping the tail of a mapping can't give any memory back, so we just keep it alive
+	if (addr == m->addr && --m->refs == 0) {
+		if (prev)
+			prev->next = m->next;
+		else
+			mappings = m->next;
+		free_mapping(m);
+	}
+
+	pthread_mutex_unlock(&mman_mutex);
+	return 0;
+}
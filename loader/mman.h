@@ -0,0 +1,22 @@
+#ifndef __MMAN_H__
+#define __MMAN_H__
+
+#include <stddef.h>
+
+// Android (bionic) values for mmap arguments
+#define MMAP_PROT_READ 0x1
+#define MMAP_PROT_WRITE 0x2
+#define MMAP_SHARED 0x01
+#define MMAP_PRIVATE 0x02
+#define MMAP_FIXED 0x10
+#define MMAP_ANONYMOUS 0x20
+
+#define MMAP_FAILED ((void *)-1)
+
+void mman_track_fd(int fd, const char *path);
+void mman_untrack_fd(int fd);
+
+void *mmap_hook(void *addr, size_t length, int prot, int flags, int fd, long offset);
+int munmap_hook(void *addr, size_t length);
+
+#endif
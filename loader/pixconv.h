@@ -0,0 +1,120 @@
+#ifndef __PIXCONV_H__
+#define __PIXCONV_H__
+
+#include <stdint.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * Row kernels for the 8, 24 and 32 bpp formats the game converts and blits between.
+ * Formats are described by their byte order in memory: swap is set when red and blue
+ * come in B, G, R order, and 32 bpp formats always keep alpha (or padding) in the last byte.
+ */
+
+// Rounded x / 255 for x up to 255 * 255 + 128
+static inline uint32_t pixconv_div255(uint32_t x) {
+	return (x + (x >> 8)) >> 8;
+}
+
+static inline void pixconv_24to32(const uint8_t *src, uint8_t *dst, int n, int swap) {
+	int i = 0;
+	int r = swap ? 2 : 0, b = swap ? 0 : 2;
+#ifdef __ARM_NEON
+	for (; i + 8 <= n; i += 8, src += 24, dst += 32) {
+		uint8x8x3_t s = vld3_u8(src);
+		uint8x8x4_t d;
+		d.val[0] = swap ? s.val[2] : s.val[0];
+		d.val[1] = s.val[1];
+		d.val[2] = swap ? s.val[0] : s.val[2];
+		d.val[3] = vdup_n_u8(255);
+		vst4_u8(dst, d);
+	}
+#endif
+	for (; i < n; i++, src += 3, dst += 4) {
+		dst[0] = src[r];
+		dst[1] = src[1];
+		dst[2] = src[b];
+		dst[3] = 255;
+	}
+}
+
+static inline void pixconv_32to32(const uint8_t *src, uint8_t *dst, int n, int swap, int opaque) {
+	int i = 0;
+	int r = swap ? 2 : 0, b = swap ? 0 : 2;
+#ifdef __ARM_NEON
+	for (; i + 8 <= n; i += 8, src += 32, dst += 32) {
+		uint8x8x4_t s = vld4_u8(src);
+		uint8x8x4_t d;
+		d.val[0] = swap ? s.val[2] : s.val[0];
+		d.val[1] = s.val[1];
+		d.val[2] = swap ? s.val[0] : s.val[2];
+		d.val[3] = opaque ? vdup_n_u8(255) : s.val[3];
+		vst4_u8(dst, d);
+	}
+#endif
+	for (; i < n; i++, src += 4, dst += 4) {
+		uint8_t a = opaque ? 255 : src[3];
+		uint8_t cr = src[r], cb = src[b];
+		dst[1] = src[1];
+		dst[0] = cr;
+		dst[2] = cb;
+		dst[3] = a;
+	}
+}
+
+// Palette expansion through a table already in the destination format
+static inline void pixconv_8to32(const uint8_t *src, uint32_t *dst, int n, const uint32_t *lut) {
+	int i = 0;
+	for (; i + 4 <= n; i += 4, src += 4, dst += 4) {
+		dst[0] = lut[src[0]];
+		dst[1] = lut[src[1]];
+		dst[2] = lut[src[2]];
+		dst[3] = lut[src[3]];
+	}
+	for (; i < n; i++)
+		*dst++ = lut[*src++];
+}
+
+// SDL_BLENDMODE_BLEND: dstRGB = srcRGB * srcA + dstRGB * (1 - srcA), dstA = srcA + dstA * (1 - srcA)
+static inline void pixconv_blend32(const uint8_t *src, uint8_t *dst, int n, int swap) {
+	int i = 0;
+	int r = swap ? 2 : 0, b = swap ? 0 : 2;
+#ifdef __ARM_NEON
+	uint16x8_t half = vdupq_n_u16(128);
+	for (; i + 8 <= n; i += 8, src += 32, dst += 32) {
+		uint8x8x4_t s = vld4_u8(src);
+		uint8x8x4_t d = vld4_u8(dst);
+		uint8x8_t a = s.val[3], ia = vmvn_u8(a);
+		uint8x8_t sc[4] = {swap ? s.val[2] : s.val[0], s.val[1], swap ? s.val[0] : s.val[2], vdup_n_u8(255)};
+		for (int c = 0; c < 4; c++) {
+			uint16x8_t t = vaddq_u16(vmlal_u8(vmull_u8(sc[c], a), d.val[c], ia), half);
+			d.val[c] = vshrn_n_u16(vsraq_n_u16(t, t, 8), 8);
+		}
+		vst4_u8(dst, d);
+	}
+#endif
+	for (; i < n; i++, src += 4, dst += 4) {
+		uint32_t a = src[3], ia = 255 - a;
+		uint8_t sr = src[r], sg = src[1], sb = src[b];
+		dst[0] = pixconv_div255(sr * a + dst[0] * ia + 128);
+		dst[1] = pixconv_div255(sg * a + dst[1] * ia + 128);
+		dst[2] = pixconv_div255(sb * a + dst[2] * ia + 128);
+		dst[3] = pixconv_div255(255 * a + dst[3] * ia + 128);
+	}
+}
+
+static inline void pixconv_fill32(uint32_t *dst, int n, uint32_t color) {
+	int i = 0;
+#ifdef __ARM_NEON
+	uint32x4_t c = vdupq_n_u32(color);
+	for (; i + 8 <= n; i += 8, dst += 8) {
+		vst1q_u32(dst, c);
+		vst1q_u32(dst + 4, c);
+	}
+#endif
+	for (; i < n; i++)
+		*dst++ = color;
+}
+
+#endif
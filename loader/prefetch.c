@@ -0,0 +1,609 @@
+/* prefetch.c -- per level asset prefetcher driven by recorded access logs
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#define _GNU_SOURCE
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+#include "main.h"
+#include "prefetch.h"
+#include "archive.h"
+#include "cookie.h"
+#include "hash.h"
+#include "iosched.h"
+#include "texcache.h"
+#include "level.h"
+#include "vfs.h"
+
+#define PREFETCH_DIR DATA_PATH "/prefetch"
+#define PREFETCH_MAX_FILES 1024
+#define PREFETCH_MAX_FILE_SIZE (PREFETCH_CACHE_SIZE / 4)
+#define PREFETCH_CACHE_SIZE (PREFETCH_CACHE_MB * 1024 * 1024)
+#define PREFETCH_WINDOW_US (30 * 1000000) // Accesses past this point are not part of the level load
+#define PREFETCH_DECODERS 2
+
+enum {
+	ENTRY_QUEUED,
+	ENTRY_LOADING,
+	ENTRY_READY,
+	ENTRY_DECODING,
+	ENTRY_DECODED,
+	ENTRY_TAKEN,
+	ENTRY_SKIPPED,
+};
+
+typedef struct {
+	uint32_t hash;
+	char *path; // Relative to DATA_PATH
+	int state;
+	int image; // Loaded through IMG_Load, decoded ahead of the game
+	uint8_t *buf;
+	SDL_Surface *surf;
+	uint32_t size; // Bytes charged to the cache, the surface size once decoded
+	uint32_t load_us;
+	uint32_t decode_us;
+} prefetch_entry;
+
+typedef struct {
+	uint8_t *buf;
+	uint32_t size;
+	uint32_t pos;
+} mem_stream;
+
+static pthread_mutex_t prefetch_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t state_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t decode_cond = PTHREAD_COND_INITIALIZER;
+
+static char cur_level[64] = "";
+static uint32_t session = 0;
+static SceUInt64 session_start;
+static int log_saved;
+
+// Files predicted by the previous load of the current level, in access order
+static prefetch_entry predicted[PREFETCH_MAX_FILES];
+static int num_predicted = 0, next_predicted = 0;
+static uint32_t cache_bytes = 0;
+
+// Loaded images waiting for a decoder, as indices in predicted
+static int decode_queue[PREFETCH_MAX_FILES];
+static int decode_head = 0, decode_tail = 0;
+
+// Files accessed during the current level load
+static char *recorded[PREFETCH_MAX_FILES];
+static uint32_t recorded_hash[PREFETCH_MAX_FILES];
+static uint8_t recorded_image[PREFETCH_MAX_FILES];
+static int num_recorded = 0;
+
+static int stat_requests, stat_hits, stat_claimed, stat_loaded, stat_decoded;
+static SceUInt64 stat_saved_us;
+
+static int level_of(const char *rel, char *level) {
+	if (!strncasecmp(rel, "assets/", 7))
+		rel += 7;
+	if (strncasecmp(rel, "levels/", 7))
+		return 0;
+	rel += 7;
+	const char *end = strchr(rel, '/');
+	if (!end || end == rel || end - rel >= sizeof(cur_level))
+		return 0;
+	memcpy(level, rel, end - rel);
+	level[end - rel] = 0;
+	return 1;
+}
+
+static prefetch_entry *find_entry(const char *rel) {
+	uint32_t hash = path_hash(rel);
+	for (int i = 0; i < num_predicted; i++) {
+		if (predicted[i].hash == hash && !strcasecmp(predicted[i].path, rel))
+			return &predicted[i];
+	}
+	return NULL;
+}
+
+static void load_log(void) {
+	char fname[256];
+	snprintf(fname, sizeof(fname), PREFETCH_DIR "/%s.txt", cur_level);
+	SceUID fd = sceIoOpen(fname, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return;
+
+	SceIoStat st;
+	char *data = NULL;
+	int len = -1;
+	if (sceIoGetstatByFd(fd, &st) >= 0 && (data = malloc(st.st_size + 1)))
+		len = sceIoRead(fd, data, st.st_size);
+	sceIoClose(fd);
+	if (len < 0) {
+		free(data);
+		return;
+	}
+	data[len] = 0;
+
+	char *line = data;
+	while (*line && num_predicted < PREFETCH_MAX_FILES) {
+		char *end = strchr(line, '\n');
+		if (end)
+			*end = 0;
+		if (*line) {
+			prefetch_entry *e = &predicted[num_predicted++];
+			memset(e, 0, sizeof(prefetch_entry));
+			e->image = *line == '*';
+			line += e->image;
+			e->path = strdup(line);
+			e->hash = path_hash(line);
+			e->state = ENTRY_QUEUED;
+		}
+		if (!end)
+			break;
+		line = end + 1;
+	}
+	free(data);
+}
+
+static void save_log(void) {
+	log_saved = 1;
+	if (!num_recorded)
+		return;
+
+	char fname[256];
+	snprintf(fname, sizeof(fname), PREFETCH_DIR "/%s.txt", cur_level);
+	sceIoMkdir(PREFETCH_DIR, 0777);
+	SceUID fd = sceIoOpen(fname, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd < 0)
+		return;
+	// Files only ever loaded through IMG_Load are marked with a leading '*'
+	for (int i = 0; i < num_recorded; i++) {
+		if (recorded_image[i])
+			sceIoWrite(fd, "*", 1);
+		sceIoWrite(fd, recorded[i], strlen(recorded[i]));
+		sceIoWrite(fd, "\n", 1);
+	}
+	sceIoClose(fd);
+	vfs_refresh(fname, 1);
+}
+
+static void end_session(void) {
+	if (!cur_level[0])
+		return;
+	if (!log_saved)
+		save_log();
+
+	debugPrintf("prefetch: %s: %d/%d hits, %d claimed, %d/%d files prefetched, %d images decoded ahead, %llu ms saved\n",
+		cur_level, stat_hits, stat_requests, stat_claimed, stat_loaded, num_predicted, stat_decoded, stat_saved_us / 1000);
+
+	for (int i = 0; i < num_predicted; i++) {
+		if (predicted[i].state == ENTRY_READY)
+			free(predicted[i].buf);
+		else if (predicted[i].state == ENTRY_DECODED)
+			SDL_FreeSurface_hook(predicted[i].surf);
+		free(predicted[i].path);
+	}
+	for (int i = 0; i < num_recorded; i++)
+		free(recorded[i]);
+	num_predicted = next_predicted = num_recorded = 0;
+	decode_head = decode_tail = 0;
+	cache_bytes = 0;
+	cur_level[0] = 0;
+	session++;
+	pthread_cond_broadcast(&state_cond);
+}
+
+static void start_session(const char *level) {
+	strcpy(cur_level, level);
+	session_start = sceKernelGetProcessTimeWide();
+	log_saved = 0;
+	stat_requests = stat_hits = stat_claimed = stat_loaded = stat_decoded = 0;
+	stat_saved_us = 0;
+	load_log();
+	pthread_cond_signal(&work_cond);
+}
+
+static int lookup_file(const char *fname, uint32_t *size, int *is_dir) {
+	int res = vfs_lookup(fname, size, is_dir);
+	if (res == VFS_UNKNOWN) {
+		SceIoStat st;
+		res = sceIoGetstat(fname, &st) < 0 ? VFS_MISSING : VFS_FOUND;
+		*size = st.st_size;
+		*is_dir = SCE_S_ISDIR(st.st_mode);
+	}
+	return res;
+}
+
+static uint8_t *read_file(const char *fname, int res, uint32_t size, int cls) {
+	uint8_t *buf = malloc(size ? size : 1);
+	int len = -1;
+	if (buf && res == VFS_ARCHIVED) {
+		len = archive_read(archive_lookup(fname), buf, 0, size, cls);
+	} else if (buf) {
+		SceUID fd = sceIoOpen(fname, SCE_O_RDONLY, 0);
+		if (fd >= 0) {
+			len = iosched_read(fd, buf, size, 0, cls);
+			sceIoClose(fd);
+		}
+	}
+	if (len != size) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+static int prefetch_thread(SceSize args, void *argp) {
+	char fname[512];
+	for (;;) {
+		pthread_mutex_lock(&prefetch_mtx);
+		while (next_predicted >= num_predicted)
+			pthread_cond_wait(&work_cond, &prefetch_mtx);
+		uint32_t gen = session;
+		prefetch_entry *e = &predicted[next_predicted++];
+		if (e->state != ENTRY_QUEUED) {
+			pthread_mutex_unlock(&prefetch_mtx);
+			continue;
+		}
+		snprintf(fname, sizeof(fname), DATA_PATH "/%s", e->path);
+		pthread_mutex_unlock(&prefetch_mtx);
+
+		uint32_t size = 0;
+		int is_dir = 0;
+		int res = lookup_file(fname, &size, &is_dir);
+
+		// Wait for the game to consume earlier files before going over budget
+		pthread_mutex_lock(&prefetch_mtx);
+		int skip = res == VFS_MISSING || is_dir || size > PREFETCH_MAX_FILE_SIZE;
+		while (!skip && gen == session && e->state == ENTRY_QUEUED && cache_bytes + size > PREFETCH_CACHE_SIZE)
+			pthread_cond_wait(&state_cond, &prefetch_mtx);
+		if (gen != session || e->state != ENTRY_QUEUED) {
+			pthread_mutex_unlock(&prefetch_mtx);
+			continue;
+		}
+		if (skip) {
+			e->state = ENTRY_SKIPPED;
+			pthread_mutex_unlock(&prefetch_mtx);
+			continue;
+		}
+		e->state = ENTRY_LOADING;
+		cache_bytes += size;
+		pthread_mutex_unlock(&prefetch_mtx);
+
+		SceUInt64 start = sceKernelGetProcessTimeWide();
+		uint8_t *buf = read_file(fname, res, size, IO_PREFETCH);
+		uint32_t load_us = sceKernelGetProcessTimeWide() - start;
+
+		pthread_mutex_lock(&prefetch_mtx);
+		if (gen == session && e->state == ENTRY_LOADING && buf) {
+			e->state = ENTRY_READY;
+			e->buf = buf;
+			e->size = size;
+			e->load_us = load_us;
+			stat_loaded++;
+			if (e->image) {
+				decode_queue[decode_tail++] = e - predicted;
+				pthread_cond_signal(&decode_cond);
+			}
+		} else {
+			free(buf);
+			if (gen == session) {
+				cache_bytes -= size;
+				e->state = ENTRY_SKIPPED;
+			}
+		}
+		pthread_cond_broadcast(&state_cond);
+		pthread_mutex_unlock(&prefetch_mtx);
+	}
+	return 0;
+}
+
+static SDL_Surface *decode_image(const char *path, uint8_t *buf, uint32_t size) {
+	const char *ext = strrchr(path, '.');
+	SDL_RWops *rw = SDL_RWFromConstMem(buf, size);
+	if (!rw)
+		return NULL;
+	if (texcache_wanted(path))
+		return texcache_load(path, rw, ext + 1);
+	return IMG_LoadTyped_RW(rw, 1, ext ? ext + 1 : NULL);
+}
+
+// Decodes loaded images on the otherwise idle cores while the game thread works through earlier files
+static int decode_thread(SceSize args, void *argp) {
+	char path[512];
+	for (;;) {
+		pthread_mutex_lock(&prefetch_mtx);
+		while (decode_head == decode_tail)
+			pthread_cond_wait(&decode_cond, &prefetch_mtx);
+		uint32_t gen = session;
+		prefetch_entry *e = &predicted[decode_queue[decode_head++]];
+		if (e->state != ENTRY_READY) {
+			pthread_mutex_unlock(&prefetch_mtx);
+			continue;
+		}
+		uint8_t *buf = e->buf;
+		uint32_t size = e->size;
+		e->buf = NULL;
+		e->state = ENTRY_DECODING;
+		snprintf(path, sizeof(path), DATA_PATH "/%s", e->path);
+		pthread_mutex_unlock(&prefetch_mtx);
+
+		SceUInt64 start = sceKernelGetProcessTimeWide();
+		SDL_Surface *surf = decode_image(path, buf, size);
+		uint32_t decode_us = sceKernelGetProcessTimeWide() - start;
+		free(buf);
+
+		pthread_mutex_lock(&prefetch_mtx);
+		if (gen == session && e->state == ENTRY_DECODING && surf) {
+			e->state = ENTRY_DECODED;
+			e->surf = surf;
+			e->size = surf->pitch * surf->h;
+			e->decode_us = decode_us;
+			cache_bytes += e->size - size;
+			stat_decoded++;
+		} else {
+			SDL_FreeSurface_hook(surf);
+			if (gen == session) {
+				cache_bytes -= size;
+				if (e->state == ENTRY_DECODING)
+					e->state = ENTRY_SKIPPED;
+			}
+		}
+		pthread_cond_broadcast(&state_cond);
+		pthread_mutex_unlock(&prefetch_mtx);
+	}
+	return 0;
+}
+
+void prefetch_init(void) {
+	SceUID thid = sceKernelCreateThread("prefetch", prefetch_thread, 0x10000100, 0x4000, 0, SCE_KERNEL_CPU_MASK_USER_2, NULL);
+	sceKernelStartThread(thid, 0, NULL);
+
+	// Image decoders need a lot more stack than the I/O threads
+	for (int i = 0; i < PREFETCH_DECODERS; i++) {
+		thid = sceKernelCreateThread("prefetch_decode", decode_thread, 0x10000100, 0x10000, 0,
+			i ? SCE_KERNEL_CPU_MASK_USER_2 : SCE_KERNEL_CPU_MASK_USER_1, NULL);
+		sceKernelStartThread(thid, 0, NULL);
+	}
+}
+
+void prefetch_access(const char *path, int image) {
+	char rel[512], level[64], prev[64] = "";
+	if (!vfs_relpath(path, rel, sizeof(rel)))
+		return;
+
+	pthread_mutex_lock(&prefetch_mtx);
+	int changed = level_of(rel, level) && strcasecmp(level, cur_level);
+	if (changed) {
+		strcpy(prev, cur_level);
+		end_session();
+		start_session(level);
+	}
+
+	if (cur_level[0] && !log_saved) {
+		if (sceKernelGetProcessTimeWide() - session_start > PREFETCH_WINDOW_US || num_recorded == PREFETCH_MAX_FILES) {
+			save_log();
+		} else if (iosched_class(rel) != IO_AUDIO) {
+			// Music is left to the scheduler's audio class, read whole here it would go at prefetch priority
+			uint32_t hash = path_hash(rel);
+			int i;
+			for (i = 0; i < num_recorded; i++) {
+				if (recorded_hash[i] == hash && !strcasecmp(recorded[i], rel))
+					break;
+			}
+			if (i == num_recorded) {
+				recorded[num_recorded] = strdup(rel);
+				recorded_image[num_recorded] = image;
+				recorded_hash[num_recorded++] = hash;
+			} else if (!image) {
+				recorded_image[i] = 0;
+			}
+		}
+	}
+	pthread_mutex_unlock(&prefetch_mtx);
+
+	// Outside the lock, so that the listeners never hold up the prefetch workers
+	if (changed)
+		level_changed(prev, level);
+}
+
+void prefetch_drop(const char *path) {
+	char rel[512];
+	if (!vfs_relpath(path, rel, sizeof(rel)))
+		return;
+
+	pthread_mutex_lock(&prefetch_mtx);
+	prefetch_entry *e = find_entry(rel);
+	if (e && (e->state == ENTRY_READY || e->state == ENTRY_DECODED)) {
+		free(e->buf);
+		SDL_FreeSurface_hook(e->surf);
+		e->buf = NULL;
+		e->surf = NULL;
+		cache_bytes -= e->size;
+		pthread_cond_broadcast(&state_cond);
+	}
+	if (e && e->state != ENTRY_TAKEN)
+		e->state = ENTRY_SKIPPED;
+	pthread_mutex_unlock(&prefetch_mtx);
+}
+
+static prefetch_entry *wait_entry(const char *rel) {
+	prefetch_entry *e;
+	while ((e = find_entry(rel)) && (e->state == ENTRY_LOADING || e->state == ENTRY_DECODING))
+		pthread_cond_wait(&state_cond, &prefetch_mtx);
+	return e;
+}
+
+// Hands the cached copy over to the caller, waiting for it if the worker is reading it right now
+static uint8_t *prefetch_take(const char *path, uint32_t *size) {
+	char rel[512];
+	if (!vfs_relpath(path, rel, sizeof(rel)))
+		return NULL;
+
+	uint8_t *buf = NULL;
+	pthread_mutex_lock(&prefetch_mtx);
+	if (cur_level[0]) {
+		stat_requests++;
+		prefetch_entry *e = wait_entry(rel);
+		if (e && e->state == ENTRY_DECODED) {
+			// Predicted as an image but opened as a plain file this time
+			SDL_FreeSurface_hook(e->surf);
+			e->surf = NULL;
+			e->state = ENTRY_SKIPPED;
+			cache_bytes -= e->size;
+			pthread_cond_broadcast(&state_cond);
+		} else if (e && e->state == ENTRY_READY) {
+			buf = e->buf;
+			*size = e->size;
+			e->buf = NULL;
+			e->state = ENTRY_TAKEN;
+			cache_bytes -= e->size;
+			stat_hits++;
+			stat_saved_us += e->load_us;
+			pthread_cond_broadcast(&state_cond);
+		} else if (e && e->state == ENTRY_QUEUED) {
+			e->state = ENTRY_SKIPPED;
+		}
+	}
+	pthread_mutex_unlock(&prefetch_mtx);
+	return buf;
+}
+
+// Returns the decoded image, decoding it right away if no decoder got to it yet
+SDL_Surface *prefetch_surface(const char *path) {
+	char rel[512];
+	if (!vfs_relpath(path, rel, sizeof(rel)))
+		return NULL;
+
+	SDL_Surface *surf = NULL;
+	uint8_t *buf = NULL;
+	uint32_t size;
+	int claimed = 0;
+	pthread_mutex_lock(&prefetch_mtx);
+	prefetch_entry *e = cur_level[0] ? wait_entry(rel) : NULL;
+	if (e && e->state == ENTRY_QUEUED) {
+		// The reader has not got to it yet, as on the first image of a level. Waiting would queue the game
+		// behind the file the reader is on, so the image is read here and the reader moves past it
+		stat_requests++;
+		stat_claimed++;
+		e->state = ENTRY_TAKEN;
+		claimed = 1;
+	} else if (e && (e->state == ENTRY_DECODED || e->state == ENTRY_READY)) {
+		stat_requests++;
+		stat_hits++;
+		stat_saved_us += e->load_us + e->decode_us;
+		surf = e->surf;
+		buf = e->buf;
+		size = e->size;
+		e->surf = NULL;
+		e->buf = NULL;
+		e->state = ENTRY_TAKEN;
+		cache_bytes -= e->size;
+		pthread_cond_broadcast(&state_cond);
+	}
+	pthread_mutex_unlock(&prefetch_mtx);
+
+	if (claimed) {
+		int is_dir = 0;
+		int res = lookup_file(path, &size, &is_dir);
+		if (res != VFS_MISSING && !is_dir)
+			buf = read_file(path, res, size, IO_TEXTURE);
+	}
+	if (buf) {
+		surf = decode_image(path, buf, size);
+		free(buf);
+	}
+	return surf;
+}
+
+static mem_stream *stream_open(const char *path) {
+	uint32_t size;
+	uint8_t *buf = prefetch_take(path, &size);
+	if (!buf)
+		return NULL;
+	mem_stream *s = malloc(sizeof(mem_stream));
+	if (!s) {
+		free(buf);
+		return NULL;
+	}
+	s->buf = buf;
+	s->size = size;
+	s->pos = 0;
+	return s;
+}
+
+static int stream_close(void *stream) {
+	mem_stream *s = (mem_stream *)stream;
+	free(s->buf);
+	free(s);
+	return 0;
+}
+
+static int stream_read(void *stream, void *dst, uint32_t size) {
+	mem_stream *s = (mem_stream *)stream;
+	if (s->pos >= s->size)
+		return 0;
+	if (size > s->size - s->pos)
+		size = s->size - s->pos;
+	memcpy(dst, s->buf + s->pos, size);
+	s->pos += size;
+	return size;
+}
+
+static int64_t stream_seek(void *stream, int64_t offset, int whence) {
+	mem_stream *s = (mem_stream *)stream;
+	int64_t pos;
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = s->pos + offset;
+		break;
+	case SEEK_END:
+		pos = s->size + offset;
+		break;
+	default:
+		return -1;
+	}
+	if (pos < 0)
+		return -1;
+	s->pos = pos;
+	return pos;
+}
+
+static int64_t stream_size(void *stream) {
+	return ((mem_stream *)stream)->size;
+}
+
+static const cookie_funcs funcs = {stream_read, NULL, stream_seek, stream_size, stream_close};
+
+FILE *prefetch_fopen(const char *path) {
+	mem_stream *s = stream_open(path);
+	if (!s)
+		return NULL;
+	FILE *f = cookie_fopen(s, &funcs, "r");
+	if (!f)
+		stream_close(s);
+	return f;
+}
+
+SDL_RWops *prefetch_rwops(const char *path) {
+	mem_stream *s = stream_open(path);
+	if (!s)
+		return NULL;
+	SDL_RWops *ctx = cookie_rwops(s, &funcs);
+	if (!ctx)
+		stream_close(s);
+	return ctx;
+}
@@ -0,0 +1,18 @@
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <stdio.h>
+
+struct SDL_RWops;
+struct SDL_Surface;
+
+void prefetch_init(void);
+
+void prefetch_access(const char *path, int image);
+void prefetch_drop(const char *path);
+
+FILE *prefetch_fopen(const char *path);
+struct SDL_RWops *prefetch_rwops(const char *path);
+struct SDL_Surface *prefetch_surface(const char *path);
+
+#endif
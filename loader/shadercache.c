@@ -0,0 +1,322 @@
+/* shadercache.c -- compiled shaders kept across boots
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "shadercache.h"
+#include "level.h"
+#include "sha1.h"
+
+/*
+ * Shaders are keyed by the SHA-1 of their source together with the compile options and the size and
+ * date of the runtime compiler module, so that sources compiled by another compiler never hit: their
+ * entries just stop being used and get evicted first. The whole index comes in with one read at boot,
+ * every binary is checked against its checksum when loaded, and the least recently used shaders make
+ * room for new ones past SHADER_CACHE_MB. New files are written next to the live ones and renamed in
+ * place, the old file stays around as .old until then, so that a crash at any point leaves a whole file.
+ */
+
+#define INDEX_PATH DATA_PATH "/" SHADERCACHE_INDEX
+#define INDEX_TMP_PATH DATA_PATH "/" SHADERCACHE_INDEX ".tmp"
+#define INDEX_OLD_PATH DATA_PATH "/" SHADERCACHE_INDEX ".old"
+#define DATA_FILE_PATH DATA_PATH "/" SHADERCACHE_DATA
+#define DATA_TMP_PATH DATA_PATH "/" SHADERCACHE_DATA ".tmp"
+#define DATA_OLD_PATH DATA_PATH "/" SHADERCACHE_DATA ".old"
+#define CACHE_LIMIT (SHADER_CACHE_MB * 1024 * 1024)
+
+// Options shaderpack.c and vitaGL compile with, part of every key
+#define COMPILE_OPTIONS "opt=default fastmath=0 fastprecision=0 fastint=0"
+
+static const char *compiler_paths[] = {"ur0:data/external/libshacccg.suprx", "ur0:data/libshacccg.suprx"};
+
+// Taken by the GL thread and the shaderpack thread alike
+static pthread_mutex_t cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+static shadercache_entry *entries = NULL;
+static uint32_t num_entries = 0, max_entries = 0;
+static uint32_t use_clock = 0, data_size = 0, used_bytes = 0;
+static SceUID data_fd = -1;
+static int dirty = 0;
+static char compiler[256];
+
+static uint32_t stat_hits, stat_misses, stat_damaged, stat_stored, stat_evicted;
+
+static void remove_entry(uint32_t i) {
+	used_bytes -= entries[i].size;
+	entries[i] = entries[--num_entries];
+	dirty = 1;
+}
+
+static int find_entry(const uint8_t *key) {
+	for (uint32_t i = 0; i < num_entries; i++) {
+		if (!memcmp(entries[i].key, key, SHADERCACHE_KEY_SIZE))
+			return i;
+	}
+	return -1;
+}
+
+// Renames can't go over an existing file, the live one is moved out of the way first
+static int replace_file(const char *tmp, const char *path, const char *old) {
+	sceIoRemove(old);
+	sceIoRename(path, old);
+	if (sceIoRename(tmp, path) < 0) {
+		sceIoRename(old, path);
+		sceIoRemove(tmp);
+		return 0;
+	}
+	sceIoRemove(old);
+	return 1;
+}
+
+// Brings the old file back when a crash came between the two renames
+static void restore_file(const char *path, const char *old) {
+	SceIoStat st;
+	if (sceIoGetstat(path, &st) < 0 && sceIoGetstat(old, &st) >= 0)
+		sceIoRename(old, path);
+}
+
+static int load_index(uint32_t *expected_size) {
+	SceUID fd = sceIoOpen(INDEX_PATH, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return 0;
+
+	// The whole index comes in with a single read
+	SceIoStat st;
+	uint8_t *blob = NULL;
+	if (sceIoGetstatByFd(fd, &st) < 0 || st.st_size < sizeof(shadercache_header) || !(blob = malloc(st.st_size))
+		|| sceIoRead(fd, blob, st.st_size) != st.st_size) {
+		sceIoClose(fd);
+		free(blob);
+		return 0;
+	}
+	sceIoClose(fd);
+
+	shadercache_header *hdr = (shadercache_header *)blob;
+	shadercache_entry *stored = (shadercache_entry *)(blob + sizeof(shadercache_header));
+	if (hdr->magic != SHADERCACHE_MAGIC || hdr->version != SHADERCACHE_VERSION
+		|| sizeof(shadercache_header) + (uint64_t)hdr->num_entries * sizeof(shadercache_entry) != st.st_size
+		|| shadercache_checksum(stored, hdr->num_entries * sizeof(shadercache_entry)) != hdr->checksum) {
+		free(blob);
+		return 0;
+	}
+	max_entries = hdr->num_entries > 64 ? hdr->num_entries : 64;
+	entries = malloc(max_entries * sizeof(shadercache_entry));
+	if (!entries) {
+		free(blob);
+		return 0;
+	}
+	memcpy(entries, stored, hdr->num_entries * sizeof(shadercache_entry));
+	num_entries = hdr->num_entries;
+	use_clock = hdr->clock;
+	*expected_size = hdr->data_size;
+	free(blob);
+	return 1;
+}
+
+static void write_index(void) {
+	SceUID fd = sceIoOpen(INDEX_TMP_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd < 0)
+		return;
+	shadercache_header hdr = {SHADERCACHE_MAGIC, SHADERCACHE_VERSION, num_entries,
+		shadercache_checksum(entries, num_entries * sizeof(shadercache_entry)), data_size, use_clock};
+	int ok = sceIoWrite(fd, &hdr, sizeof(hdr)) == sizeof(hdr);
+	ok = ok && sceIoWrite(fd, entries, num_entries * sizeof(shadercache_entry)) == num_entries * sizeof(shadercache_entry);
+	sceIoClose(fd);
+	if (!ok) {
+		sceIoRemove(INDEX_TMP_PATH);
+		return;
+	}
+	if (replace_file(INDEX_TMP_PATH, INDEX_PATH, INDEX_OLD_PATH))
+		dirty = 0;
+}
+
+// Moves the shaders still indexed to a new data file, dropping the bytes evicted ones left behind
+static void compact(void) {
+	SceUID fd = sceIoOpen(DATA_TMP_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd < 0)
+		return;
+	uint32_t offset = 0;
+	for (uint32_t i = 0; i < num_entries;) {
+		shadercache_entry *e = &entries[i];
+		void *buf = malloc(e->size);
+		int ok = buf && sceIoPread(data_fd, buf, e->size, e->offset) == e->size
+			&& sceIoWrite(fd, buf, e->size) == e->size;
+		free(buf);
+		if (!ok) {
+			remove_entry(i);
+			continue;
+		}
+		e->offset = offset;
+		offset += e->size;
+		i++;
+	}
+	sceIoClose(fd);
+	sceIoClose(data_fd);
+	if (!replace_file(DATA_TMP_PATH, DATA_FILE_PATH, DATA_OLD_PATH)) {
+		// The offsets are the compacted ones already, the old file can't be read with them
+		num_entries = used_bytes = offset = 0;
+		data_fd = sceIoOpen(DATA_FILE_PATH, SCE_O_RDWR | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	} else {
+		data_fd = sceIoOpen(DATA_FILE_PATH, SCE_O_RDWR | SCE_O_CREAT, 0777);
+	}
+	data_size = offset;
+	write_index();
+}
+
+static void level_ended(const char *level) {
+	shadercache_flush();
+}
+
+void shadercache_init(void) {
+	level_listen(LEVEL_END, shadercache_report);
+	level_listen(LEVEL_END_IDLE, level_ended);
+	strcpy(compiler, "no compiler");
+	for (size_t i = 0; i < sizeof(compiler_paths) / sizeof(*compiler_paths); i++) {
+		SceIoStat st;
+		if (sceIoGetstat(compiler_paths[i], &st) >= 0) {
+			snprintf(compiler, sizeof(compiler), "%s %lld %04u%02u%02u%02u%02u%02u", compiler_paths[i],
+				(long long)st.st_size, st.st_mtime.year, st.st_mtime.month, st.st_mtime.day, st.st_mtime.hour,
+				st.st_mtime.minute, st.st_mtime.second);
+			break;
+		}
+	}
+
+	restore_file(INDEX_PATH, INDEX_OLD_PATH);
+	restore_file(DATA_FILE_PATH, DATA_OLD_PATH);
+	uint32_t expected_size = 0;
+	int indexed = load_index(&expected_size);
+	data_fd = sceIoOpen(DATA_FILE_PATH, SCE_O_RDWR | SCE_O_CREAT | (indexed ? 0 : SCE_O_TRUNC), 0777);
+	if (data_fd < 0) {
+		free(entries);
+		entries = NULL;
+		num_entries = 0;
+		return;
+	}
+	SceOff size = sceIoLseek(data_fd, 0, SCE_SEEK_END);
+	data_size = size > 0 ? size : 0;
+	if (indexed && data_size < expected_size)
+		debugPrintf("shadercache: %s got cut short\n", DATA_FILE_PATH);
+	for (uint32_t i = 0; i < num_entries;) {
+		if ((uint64_t)entries[i].offset + entries[i].size > data_size) {
+			entries[i] = entries[--num_entries];
+			dirty = 1;
+			continue;
+		}
+		used_bytes += entries[i++].size;
+	}
+	if (data_size - used_bytes > CACHE_LIMIT / 2)
+		compact();
+	debugPrintf("shadercache: %u shaders (%u KB) for %s\n", num_entries, used_bytes / 1024, compiler);
+}
+
+void shadercache_key(int count, const char *const *strings, const int *lengths, uint8_t *key) {
+	SHA1_CTX ctx;
+	sha1_init(&ctx);
+	sha1_update(&ctx, (const BYTE *)compiler, strlen(compiler) + 1);
+	sha1_update(&ctx, (const BYTE *)COMPILE_OPTIONS, sizeof(COMPILE_OPTIONS));
+	size_t total = 0;
+	for (int i = 0; i < count; i++) {
+		size_t n = lengths && lengths[i] >= 0 ? (size_t)lengths[i] : strlen(strings[i]);
+		const BYTE *s = (const BYTE *)strings[i];
+		// The two characters glShaderSource_hook overwrites, whether it did already or not
+		for (; n && total < 2; n--, s++, total++)
+			sha1_update(&ctx, (const BYTE *)"/", 1);
+		sha1_update(&ctx, s, n);
+		total += n;
+	}
+	sha1_final(&ctx, key);
+}
+
+void *shadercache_load(const uint8_t *key, uint32_t *size) {
+	pthread_mutex_lock(&cache_mtx);
+	int i = data_fd >= 0 ? find_entry(key) : -1;
+	void *binary = NULL;
+	if (i < 0) {
+		stat_misses++;
+	} else {
+		shadercache_entry *e = &entries[i];
+		binary = malloc(e->size);
+		if (binary && sceIoPread(data_fd, binary, e->size, e->offset) == e->size
+			&& shadercache_checksum(binary, e->size) == e->checksum) {
+			*size = e->size;
+			e->last_used = ++use_clock;
+			dirty = 1;
+			stat_hits++;
+		} else {
+			free(binary);
+			binary = NULL;
+			remove_entry(i);
+			stat_damaged++;
+			stat_misses++;
+		}
+	}
+	pthread_mutex_unlock(&cache_mtx);
+	return binary;
+}
+
+void shadercache_store(const uint8_t *key, const void *binary, uint32_t size) {
+	pthread_mutex_lock(&cache_mtx);
+	if (data_fd < 0 || !size || size > CACHE_LIMIT / 4 || find_entry(key) >= 0) {
+		pthread_mutex_unlock(&cache_mtx);
+		return;
+	}
+	while (num_entries && used_bytes + size > CACHE_LIMIT) {
+		uint32_t oldest = 0;
+		for (uint32_t i = 1; i < num_entries; i++) {
+			if (entries[i].last_used < entries[oldest].last_used)
+				oldest = i;
+		}
+		remove_entry(oldest);
+		stat_evicted++;
+	}
+	if (num_entries == max_entries) {
+		uint32_t max = max_entries ? max_entries * 2 : 64;
+		shadercache_entry *grown = realloc(entries, max * sizeof(shadercache_entry));
+		if (!grown) {
+			pthread_mutex_unlock(&cache_mtx);
+			return;
+		}
+		entries = grown;
+		max_entries = max;
+	}
+	if (sceIoPwrite(data_fd, binary, size, data_size) == size) {
+		shadercache_entry *e = &entries[num_entries++];
+		memcpy(e->key, key, SHADERCACHE_KEY_SIZE);
+		e->offset = data_size;
+		e->size = size;
+		e->checksum = shadercache_checksum(binary, size);
+		e->last_used = ++use_clock;
+		data_size += size;
+		used_bytes += size;
+		dirty = 1;
+		stat_stored++;
+	}
+	pthread_mutex_unlock(&cache_mtx);
+}
+
+void shadercache_flush(void) {
+	pthread_mutex_lock(&cache_mtx);
+	if (dirty && data_fd >= 0)
+		write_index();
+	pthread_mutex_unlock(&cache_mtx);
+}
+
+void shadercache_report(const char *level) {
+	pthread_mutex_lock(&cache_mtx);
+	if (stat_hits || stat_misses) {
+		debugPrintf("shadercache: %s: %u hits, %u misses (%u damaged), %u stored, %u evicted, %u shaders (%u KB)\n",
+			level, stat_hits, stat_misses, stat_damaged, stat_stored, stat_evicted, num_entries, used_bytes / 1024);
+	}
+	stat_hits = stat_misses = stat_damaged = stat_stored = stat_evicted = 0;
+	pthread_mutex_unlock(&cache_mtx);
+}
@@ -0,0 +1,56 @@
+#ifndef __SHADERCACHE_H__
+#define __SHADERCACHE_H__
+
+#include <stdint.h>
+
+#define SHADERCACHE_MAGIC 0x43535652 // RVSC
+#define SHADERCACHE_VERSION 1
+#define SHADERCACHE_INDEX "shadercache.idx"
+#define SHADERCACHE_DATA "shadercache.bin"
+#define SHADERCACHE_KEY_SIZE 20 // SHA-1 of the source, the compile options and the compiler
+
+/*
+ * Compiled shaders, appended one after the other to the data file. The index file holds the header and
+ * num_entries entries, and is written whole, to a temporary file renamed over the old one. Entries of
+ * evicted shaders just leave their bytes behind in the data file until it gets compacted at boot.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_entries;
+	uint32_t checksum; // Of the entries
+	uint32_t data_size; // Of the data file when the index was written
+	uint32_t clock; // Last use stamp handed out
+} shadercache_header;
+
+typedef struct {
+	uint8_t key[SHADERCACHE_KEY_SIZE];
+	uint32_t offset;
+	uint32_t size;
+	uint32_t checksum; // Of the binary
+	uint32_t last_used;
+} shadercache_entry;
+
+static inline uint32_t shadercache_checksum(const void *data, uint32_t size) {
+	const uint8_t *p = (const uint8_t *)data;
+	uint32_t h = 2166136261u;
+	for (uint32_t i = 0; i < size; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+#ifdef __vita__
+void shadercache_init(void);
+// Key of the source as glShaderSource_hook leaves it, compiled with the current compiler
+void shadercache_key(int count, const char *const *strings, const int *lengths, uint8_t *key);
+// Copy of the binary, NULL when missing or damaged
+void *shadercache_load(const uint8_t *key, uint32_t *size);
+void shadercache_store(const uint8_t *key, const void *binary, uint32_t size);
+// Writes the index when it changed
+void shadercache_flush(void);
+void shadercache_report(const char *level);
+#endif
+
+#endif
@@ -0,0 +1,279 @@
+/* shaderpack.c -- compiles the shader variants of shaders.pack ahead of the game
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+#include <vitashark.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "shaderpack.h"
+#include "shadercache.h"
+#include "level.h"
+
+/*
+ * RVGL builds its shaders out of the sources in shaders/ with a #define block in front, one per feature
+ * combination, and compiles each the first time it needs it, in the middle of a race as often as not.
+ * shaders.pack lists the combinations it was seen asking for. Each variant gets compiled once with the
+ * runtime compiler, the way vitaGL would, between the frames of the menus. glCompileShader then loads the
+ * ready program into the shader instead of compiling. Sources the pack doesn't have and variants not
+ * compiled yet come out of shadercache.c when an earlier boot compiled them, and are compiled as usual and
+ * stored there otherwise.
+ *
+ * The runtime compiler keeps its output in globals and vitaGL calls it for its own fixed function shaders
+ * from within any GL call, so it never runs on another thread: the compiles the game doesn't wait for go
+ * on the GL thread from SDL_GL_SwapWindow, as many per frame as fit in SHADER_FRAME_MS. With glcmd.c
+ * recording, the swap runs on the render thread along with the rest of GL.
+ */
+
+#define SHADERPACK_PATH DATA_PATH "/" SHADERPACK_FILE
+#define MAX_SHADERS 256 // Power of two
+#define MAX_BINARY_SIZE (64 * 1024)
+
+enum {
+	VARIANT_PENDING,
+	VARIANT_READY,
+	VARIANT_FAILED,
+};
+
+typedef struct {
+	int state;
+	void *binary;
+	uint32_t size;
+} compiled_variant;
+
+// Everything is only touched by the GL thread
+static uint8_t *pack = NULL;
+static const shaderpack_source *sources;
+static const shaderpack_variant *variants;
+static uint32_t num_sources = 0, num_variants = 0, next_variant = 0;
+static compiled_variant *compiled = NULL;
+static uint64_t frame_us = 0, warm_us = 0;
+
+// Variant and cache key of the last source of every shader
+typedef struct {
+	GLuint shader;
+	int32_t variant;
+	int keyed;
+	uint8_t key[SHADERCACHE_KEY_SIZE];
+} pending_shader;
+
+static pending_shader pending[MAX_SHADERS];
+static uint8_t binary_buf[MAX_BINARY_SIZE];
+
+// Compile time is only counted here, shadercache.c just reports what got stored
+static uint32_t stat_loaded, stat_cached, stat_compiled, stat_between;
+static uint64_t stat_compile_us, stat_between_us;
+
+static int load_pack(void) {
+	SceUID fd = sceIoOpen(SHADERPACK_PATH, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return 0;
+
+	SceIoStat st;
+	if (sceIoGetstatByFd(fd, &st) < 0 || st.st_size < sizeof(shaderpack_header) || !(pack = malloc(st.st_size))
+		|| sceIoRead(fd, pack, st.st_size) != st.st_size) {
+		sceIoClose(fd);
+		free(pack);
+		pack = NULL;
+		return 0;
+	}
+	sceIoClose(fd);
+
+	const shaderpack_header *hdr = (const shaderpack_header *)pack;
+	uint64_t tables = sizeof(shaderpack_header) + (uint64_t)hdr->num_sources * sizeof(shaderpack_source)
+		+ (uint64_t)hdr->num_variants * sizeof(shaderpack_variant);
+	int ok = hdr->magic == SHADERPACK_MAGIC && hdr->version == SHADERPACK_VERSION && tables <= st.st_size;
+	if (ok) {
+		sources = (const shaderpack_source *)(pack + sizeof(shaderpack_header));
+		variants = (const shaderpack_variant *)(sources + hdr->num_sources);
+		for (uint32_t i = 0; ok && i < hdr->num_variants; i++) {
+			const shaderpack_variant *v = &variants[i];
+			ok = v->offset >= tables && (uint64_t)v->offset + v->size < st.st_size && !pack[v->offset + v->size];
+		}
+		for (uint32_t i = 0; ok && i < hdr->num_sources; i++)
+			ok = sources[i].variant < hdr->num_variants;
+	}
+	if (!ok || !(compiled = calloc(hdr->num_variants, sizeof(compiled_variant)))) {
+		debugPrintf("shaderpack: %s is damaged or out of date\n", SHADERPACK_PATH);
+		free(pack);
+		pack = NULL;
+		return 0;
+	}
+	num_sources = hdr->num_sources;
+	num_variants = hdr->num_variants;
+	return 1;
+}
+
+void *shaderpack_compile(const char *text, int type, uint32_t *size) {
+	uint64_t start = sceKernelGetProcessTimeWide();
+	uint8_t key[SHADERCACHE_KEY_SIZE];
+	shadercache_key(1, &text, NULL, key);
+	void *binary = shadercache_load(key, size);
+	if (binary) {
+		frame_us += sceKernelGetProcessTimeWide() - start;
+		return binary;
+	}
+
+	// Same options vitaGL compiles with when the game doesn't ask for others
+	SceGxmProgram *program = shark_compile_shader_extended(text, size,
+		type == SHADERPACK_VERTEX ? SHARK_VERTEX_SHADER : SHARK_FRAGMENT_SHADER, SHARK_OPT_DEFAULT, GL_FALSE, GL_FALSE, GL_FALSE);
+	uint64_t elapsed = sceKernelGetProcessTimeWide() - start;
+	if (program && (binary = malloc(*size))) {
+		memcpy(binary, program, *size);
+		shadercache_store(key, binary, *size);
+	}
+	shark_clear_output();
+	frame_us += elapsed;
+	stat_between++;
+	stat_between_us += elapsed;
+	return binary;
+}
+
+int shaderpack_frame_budget(void) {
+	return frame_us < SHADER_FRAME_MS * 1000;
+}
+
+static void compile_variant(uint32_t i) {
+	const shaderpack_variant *v = &variants[i];
+	compiled_variant *c = &compiled[i];
+	c->binary = shaderpack_compile((const char *)pack + v->offset, v->type, &c->size);
+	c->state = c->binary ? VARIANT_READY : VARIANT_FAILED;
+}
+
+void shaderpack_init(void) {
+	level_listen(LEVEL_END, shaderpack_report);
+	if (!load_pack())
+		return;
+	debugPrintf("shaderpack: %u sources, %u variants\n", num_sources, num_variants);
+}
+
+void shaderpack_frame(void) {
+	frame_us = 0;
+	if (next_variant == num_variants)
+		return;
+	uint64_t start = sceKernelGetProcessTimeWide();
+	for (; next_variant < num_variants && shaderpack_frame_budget(); next_variant++) {
+		if (compiled[next_variant].state == VARIANT_PENDING)
+			compile_variant(next_variant);
+	}
+	warm_us += sceKernelGetProcessTimeWide() - start;
+	if (next_variant < num_variants)
+		return;
+	uint32_t ready = 0;
+	for (uint32_t i = 0; i < num_variants; i++)
+		ready += compiled[i].state == VARIANT_READY;
+	debugPrintf("shaderpack: %u of %u variants ready after %llu ms of compiling between frames\n", ready,
+		num_variants, warm_us / 1000);
+	shadercache_flush();
+}
+
+static int32_t find_variant(uint64_t hash, uint32_t length) {
+	uint32_t lo = 0, hi = num_sources;
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (sources[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < num_sources && sources[lo].hash == hash; lo++) {
+		if (sources[lo].length == length)
+			return sources[lo].variant;
+	}
+	return -1;
+}
+
+static pending_shader *pending_slot(GLuint shader, int add) {
+	for (uint32_t i = shader * 2654435761u, n = 0; n < MAX_SHADERS; i++, n++) {
+		uint32_t s = i & (MAX_SHADERS - 1);
+		if (pending[s].shader == shader)
+			return &pending[s];
+		if (!pending[s].shader) {
+			if (!add)
+				return NULL;
+			pending[s].shader = shader;
+			return &pending[s];
+		}
+	}
+	return NULL;
+}
+
+void shaderpack_remember(GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length) {
+	if (!shader)
+		return;
+	// Slots stay with their shader, a later source just overwrites it
+	pending_shader *slot = pending_slot(shader, 1);
+	if (!slot)
+		return;
+	slot->variant = -1;
+	if (num_sources) {
+		uint32_t total;
+		uint64_t hash = shaderpack_hash(count, string, length, &total);
+		slot->variant = find_variant(hash, total);
+	}
+	shadercache_key(count, string, length, slot->key);
+	slot->keyed = 1;
+}
+
+void glCompileShader_hook(GLuint shader) {
+	pending_shader *slot = pending_slot(shader, 0);
+	int32_t variant = slot ? slot->variant : -1;
+	int keyed = slot && slot->keyed;
+	uint8_t key[SHADERCACHE_KEY_SIZE];
+	if (slot) {
+		memcpy(key, slot->key, sizeof(key));
+		slot->variant = -1;
+		slot->keyed = 0;
+	}
+
+	if (variant >= 0 && compiled[variant].state == VARIANT_READY) {
+		// vitaGL takes GXP programs whatever the format says
+		glShaderBinary(1, &shader, 0, compiled[variant].binary, compiled[variant].size);
+		stat_loaded++;
+		return;
+	}
+
+	uint32_t size;
+	void *binary = keyed ? shadercache_load(key, &size) : NULL;
+	if (binary) {
+		glShaderBinary(1, &shader, 0, binary, size);
+		free(binary);
+		stat_cached++;
+		return;
+	}
+
+	uint64_t start = sceKernelGetProcessTimeWide();
+	glCompileShader(shader);
+	uint64_t elapsed = sceKernelGetProcessTimeWide() - start;
+	frame_us += elapsed;
+	stat_compile_us += elapsed;
+	stat_compiled++;
+
+	GLint status = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (keyed && status) {
+		GLsizei length = 0;
+		vglGetShaderBinary(shader, sizeof(binary_buf), &length, binary_buf);
+		// A program filling the whole buffer may have been cut short
+		if (length > 0 && length < sizeof(binary_buf))
+			shadercache_store(key, binary_buf, length);
+	}
+}
+
+void shaderpack_report(const char *level) {
+	if (stat_loaded || stat_cached || stat_compiled || stat_between) {
+		debugPrintf("shaderpack: %s: %u shaders loaded precompiled, %u from the cache, %u compiled in place in %llu ms, %u compiled between frames in %llu ms\n",
+			level, stat_loaded, stat_cached, stat_compiled, stat_compile_us / 1000, stat_between, stat_between_us / 1000);
+	}
+	stat_loaded = stat_cached = stat_compiled = stat_between = 0;
+	stat_compile_us = stat_between_us = 0;
+}
@@ -0,0 +1,78 @@
+#ifndef __SHADERPACK_H__
+#define __SHADERPACK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define SHADERPACK_MAGIC 0x48535652 // RVSH
+#define SHADERPACK_VERSION 1
+#define SHADERPACK_FILE "shaders.pack"
+
+enum {
+	SHADERPACK_VERTEX,
+	SHADERPACK_FRAGMENT,
+};
+
+/*
+ * The shader variants the game compiles, built by tools/mkshaderpack.c out of GL captures.
+ * Layout: header, num_sources source entries sorted by hash, num_variants variant entries, variant texts.
+ * Every source the game was seen passing to glShaderSource points to the variant it preprocesses to, the
+ * variant texts are one of those sources each, NUL terminated.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_sources;
+	uint32_t num_variants;
+} shaderpack_header;
+
+typedef struct {
+	uint64_t hash; // shaderpack_hash of the strings
+	uint32_t length; // Of all the strings together
+	uint32_t variant;
+} shaderpack_source;
+
+typedef struct {
+	uint32_t offset; // From the start of the file
+	uint32_t size; // Without the NUL
+	uint32_t type;
+	uint32_t sources; // How many sources share it
+} shaderpack_variant;
+
+// FNV-1a over the strings as if joined. glShaderSource_hook comments out the first line by overwriting its
+// first two characters, those are left out so that sources hash the same before and after.
+static inline uint64_t shaderpack_hash(int count, const char *const *strings, const int *lengths, uint32_t *length) {
+	uint64_t h = 14695981039346656037ull;
+	uint32_t total = 0;
+	for (int i = 0; i < count; i++) {
+		size_t n = lengths && lengths[i] >= 0 ? (size_t)lengths[i] : strlen(strings[i]);
+		for (size_t j = 0; j < n; j++, total++) {
+			if (total < 2)
+				continue;
+			h ^= (uint8_t)strings[i][j];
+			h *= 1099511628211ull;
+		}
+	}
+	*length = total;
+	return h;
+}
+
+#ifdef __vita__
+#include <vitaGL.h>
+
+void shaderpack_init(void);
+// Remembers which variant the shader's source is and its cache key, before glShaderSource_hook patches it
+void shaderpack_remember(GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length);
+void glCompileShader_hook(GLuint shader);
+// Program for the text out of the shader cache or the runtime compiler, NULL when it doesn't compile.
+// GL thread only, the time it takes counts against the frame's SHADER_FRAME_MS.
+void *shaderpack_compile(const char *text, int type, uint32_t *size);
+// Whether the frame has time left for compiles the game doesn't wait for
+int shaderpack_frame_budget(void);
+// Compiles the next variants of the pack within the budget, once per frame
+void shaderpack_frame(void);
+void shaderpack_report(const char *level);
+#endif
+
+#endif
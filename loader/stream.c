@@ -0,0 +1,90 @@
+/* stream.c -- GPU visible ring buffer client array draws are copied into
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+
+#include "main.h"
+#include "stream.h"
+
+/*
+ * One buffer object split in three parts, one per frame. A fence goes in behind the draws of each part
+ * when the frame ends, and the part is only written again once its fence got signaled, so the GPU is
+ * never read from a part being overwritten however many frames vitaGL keeps in flight. With three parts
+ * the wait is normally over before it starts.
+ * The buffer is mapped once, vitaGL hands out its storage and never moves it.
+ */
+
+#define NUM_PARTS 3
+#define PART_SIZE ((STREAM_RING_KB * 1024 / NUM_PARTS) & ~15)
+
+// Only touched by the GL thread
+static GLuint ring_buffer = 0;
+static uint8_t *ring = NULL;
+static int ring_failed = 0;
+static int part = 0;
+static uint32_t used = 0;
+static GLsync fences[NUM_PARTS];
+
+static uint32_t stat_waits;
+static uint64_t stat_wait_us;
+
+static int ring_init(void) {
+	glGenBuffers(1, &ring_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, ring_buffer);
+	glBufferData(GL_ARRAY_BUFFER, PART_SIZE * NUM_PARTS, NULL, GL_DYNAMIC_DRAW);
+	ring = glMapBufferOES(GL_ARRAY_BUFFER, GL_WRITE_ONLY_OES);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if (!ring) {
+		debugPrintf("stream: could not map a %d KB ring, client arrays go through vitaGL\n", STREAM_RING_KB);
+		glDeleteBuffers(1, &ring_buffer);
+		ring_failed = 1;
+		return 0;
+	}
+	return 1;
+}
+
+uint8_t *stream_alloc(uint32_t size, GLuint *buffer, uint32_t *offset) {
+	if (ring_failed || (!ring && !ring_init()))
+		return NULL;
+	size = (size + 15) & ~15;
+	if (used + size > PART_SIZE)
+		return NULL;
+	if (fences[part]) {
+		if (glClientWaitSync(fences[part], 0, 0) == GL_TIMEOUT_EXPIRED) {
+			SceUInt64 start = sceKernelGetProcessTimeWide();
+			glClientWaitSync(fences[part], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			stat_waits++;
+			stat_wait_us += sceKernelGetProcessTimeWide() - start;
+		}
+		glDeleteSync(fences[part]);
+		fences[part] = 0;
+	}
+	*buffer = ring_buffer;
+	*offset = part * PART_SIZE + used;
+	used += size;
+	return ring + *offset;
+}
+
+void stream_frame(void) {
+	if (used)
+		fences[part] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	part = (part + 1) % NUM_PARTS;
+	used = 0;
+}
+
+void stream_report(uint32_t frames) {
+	if (stat_waits) {
+		debugPrintf("stream: waited for the GPU %u times (%llu us per frame)\n", stat_waits,
+			(unsigned long long)(stat_wait_us / frames));
+	}
+	stat_waits = 0;
+	stat_wait_us = 0;
+}
@@ -0,0 +1,12 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <vitaGL.h>
+
+// Space for size bytes in the ring, valid until the end of the frame. NULL when this frame's part is full.
+uint8_t *stream_alloc(uint32_t size, GLuint *buffer, uint32_t *offset);
+// Ends the frame of the current part, called on every swap and SDL_RenderPresent
+void stream_frame(void);
+void stream_report(uint32_t frames);
+
+#endif
@@ -0,0 +1,384 @@
+/* texcache.c -- decoded texture cache for IMG_Load
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+#include "main.h"
+#include "texcache.h"
+#include "blit.h"
+#include "fstream.h"
+#include "iosched.h"
+#include "level.h"
+#include "sha1.h"
+#include "vfs.h"
+
+#define TEXCACHE_PATH DATA_PATH "/" TEXCACHE_DIR
+#define MAX_HANDOUTS 64
+
+// Keys of the files in the cache folder, filled from the vfs index at boot and kept current by the stores
+static pthread_mutex_t keys_mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t (*keys)[TEXCACHE_KEY_SIZE] = NULL;
+static uint8_t *used = NULL;
+static uint32_t num_keys = 0, max_keys = 0;
+
+// Surfaces handed out and not freed yet, so that their conversion can be traced back to their entry
+typedef struct {
+	SDL_Surface *surf;
+	uint8_t key[TEXCACHE_KEY_SIZE];
+} handout;
+
+// Header fields learnt during the level, written by texcache_flush
+typedef struct {
+	uint8_t key[TEXCACHE_KEY_SIZE];
+	uint64_t source_mtime; // 0 when unchanged
+	uint32_t convert_to; // 0 when unchanged
+} header_update;
+
+static handout handouts[MAX_HANDOUTS];
+static uint32_t next_handout = 0;
+static header_update *updates = NULL;
+static uint32_t num_updates = 0, max_updates = 0;
+
+static int texcache_ready = 0;
+static uint32_t stat_hits, stat_misses, stat_verified, stat_stored, stat_rewritten;
+
+static uint32_t key_slot(const uint8_t *key) {
+	uint32_t mask = max_keys - 1;
+	uint32_t i;
+	memcpy(&i, key, sizeof(i));
+	for (i &= mask; used[i] && memcmp(keys[i], key, TEXCACHE_KEY_SIZE); i = (i + 1) & mask);
+	return i;
+}
+
+static void add_key(const uint8_t *key) {
+	if ((num_keys + 1) * 2 > max_keys) {
+		uint8_t (*old_keys)[TEXCACHE_KEY_SIZE] = keys;
+		uint8_t *old_used = used;
+		uint32_t old_max = max_keys;
+		max_keys = max_keys ? max_keys * 2 : 1024;
+		keys = malloc(max_keys * TEXCACHE_KEY_SIZE);
+		used = calloc(max_keys, 1);
+		for (uint32_t i = 0; i < old_max; i++) {
+			if (old_used[i]) {
+				uint32_t slot = key_slot(old_keys[i]);
+				memcpy(keys[slot], old_keys[i], TEXCACHE_KEY_SIZE);
+				used[slot] = 1;
+			}
+		}
+		free(old_keys);
+		free(old_used);
+	}
+	uint32_t slot = key_slot(key);
+	if (!used[slot]) {
+		memcpy(keys[slot], key, TEXCACHE_KEY_SIZE);
+		used[slot] = 1;
+		num_keys++;
+	}
+}
+
+static int has_key(const uint8_t *key) {
+	return num_keys && used[key_slot(key)];
+}
+
+static int parse_name(const char *name, uint8_t *key) {
+	if (strlen(name) != TEXCACHE_KEY_SIZE * 2 + strlen(TEXCACHE_EXT) || strcasecmp(name + TEXCACHE_KEY_SIZE * 2, TEXCACHE_EXT))
+		return 0;
+	for (int i = 0; i < TEXCACHE_KEY_SIZE * 2; i++) {
+		char c = name[i];
+		int v = c >= '0' && c <= '9' ? c - '0' : (c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1);
+		if (v < 0)
+			return 0;
+		key[i / 2] = (i & 1) ? key[i / 2] | v : v << 4;
+	}
+	return 1;
+}
+
+static void level_ended(const char *level) {
+	texcache_flush();
+}
+
+void texcache_init(void) {
+	int dir, cursor = -1, is_dir;
+	char name[256];
+	uint8_t key[TEXCACHE_KEY_SIZE];
+
+	level_listen(LEVEL_END, texcache_report);
+	level_listen(LEVEL_END_IDLE, level_ended);
+
+	if (vfs_lookup(TEXCACHE_PATH, NULL, &is_dir) != VFS_FOUND) {
+		sceIoMkdir(TEXCACHE_PATH, 0777);
+		vfs_refresh(TEXCACHE_PATH, 0);
+	}
+	if (vfs_opendir(TEXCACHE_PATH, &dir) == VFS_FOUND) {
+		while (vfs_readdir(dir, &cursor, name, &is_dir)) {
+			if (!is_dir && parse_name(name, key))
+				add_key(key);
+		}
+	}
+	texcache_ready = 1;
+	debugPrintf("texcache: %u cached textures\n", num_keys);
+}
+
+static void entry_path(const uint8_t *key, char *path) {
+	strcpy(path, TEXCACHE_PATH "/");
+	texcache_name(key, path + strlen(path));
+}
+
+// Called with keys_mtx held
+static void add_update(const uint8_t *key, uint64_t source_mtime, uint32_t convert_to) {
+	if (num_updates == max_updates) {
+		uint32_t max = max_updates ? max_updates * 2 : 64;
+		header_update *grown = realloc(updates, max * sizeof(header_update));
+		if (!grown)
+			return;
+		updates = grown;
+		max_updates = max;
+	}
+	header_update *u = &updates[num_updates++];
+	memcpy(u->key, key, TEXCACHE_KEY_SIZE);
+	u->source_mtime = source_mtime;
+	u->convert_to = convert_to;
+}
+
+static void track(SDL_Surface *surf, const uint8_t *key) {
+	if (surf->format->palette || SDL_GetColorKey(surf, NULL) == 0)
+		return;
+	pthread_mutex_lock(&keys_mtx);
+	handout *h = &handouts[next_handout++ % MAX_HANDOUTS];
+	h->surf = surf;
+	memcpy(h->key, key, TEXCACHE_KEY_SIZE);
+	pthread_mutex_unlock(&keys_mtx);
+}
+
+static int same_content(SDL_RWops *src, uint32_t size, const uint8_t *sha1) {
+	uint8_t digest[TEXCACHE_KEY_SIZE];
+	uint8_t *data = malloc(size ? size : 1);
+	int ok = data && SDL_RWread(src, data, size, 1) == 1;
+	if (ok) {
+		SHA1_CTX ctx;
+		sha1_init(&ctx);
+		sha1_update(&ctx, data, size);
+		sha1_final(&ctx, digest);
+		ok = !memcmp(digest, sha1, TEXCACHE_KEY_SIZE);
+	}
+	free(data);
+	SDL_RWseek(src, 0, RW_SEEK_SET);
+	return ok;
+}
+
+static SDL_Surface *load_cached(const char *path, SDL_RWops *src, uint32_t source_size, uint64_t source_mtime,
+	texcache_header *hdr) {
+	SDL_Surface *surf = NULL;
+
+	// The file may still be queued on the writer thread if the same image was loaded twice in a row
+	fstream_sync(path);
+	SceUID fd = sceIoOpen(path, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+	if (iosched_read(fd, hdr, sizeof(*hdr), 0, IO_TEXTURE) != sizeof(*hdr) || hdr->magic != TEXCACHE_MAGIC
+		|| hdr->version != TEXCACHE_VERSION || hdr->num_colors > 256)
+		goto fail;
+	// A stale entry is no failure, the source just got replaced
+	if (hdr->source_size != source_size || (hdr->source_mtime && hdr->source_mtime != source_mtime)
+		|| (!hdr->source_mtime && !same_content(src, source_size, hdr->source_sha1))) {
+		sceIoClose(fd);
+		return NULL;
+	}
+
+	surf = SDL_CreateRGBSurfaceWithFormat(0, hdr->width, hdr->height, SDL_BITSPERPIXEL(hdr->format), hdr->format);
+	if (!surf || surf->pitch != hdr->pitch)
+		goto fail;
+
+	uint64_t offset = sizeof(*hdr);
+	if (hdr->num_colors) {
+		SDL_Color colors[256];
+		uint32_t size = hdr->num_colors * sizeof(SDL_Color);
+		if (!surf->format->palette || iosched_read(fd, colors, size, offset, IO_TEXTURE) != size)
+			goto fail;
+		SDL_SetPaletteColors(surf->format->palette, colors, 0, hdr->num_colors);
+		offset += size;
+	}
+	uint32_t size = hdr->pitch * hdr->height;
+	if (iosched_read(fd, surf->pixels, size, offset, IO_TEXTURE) != size)
+		goto fail;
+	if (hdr->colorkey != TEXCACHE_NO_COLORKEY)
+		SDL_SetColorKey(surf, SDL_TRUE, hdr->colorkey);
+	SDL_SetSurfaceBlendMode(surf, hdr->blend);
+	sceIoClose(fd);
+	return surf;
+
+fail:
+	debugPrintf("texcache: %s is invalid\n", path);
+	SDL_FreeSurface(surf);
+	sceIoClose(fd);
+	return NULL;
+}
+
+// The file is written through a write-behind stream so that storing doesn't add to the load itself
+static int store(const char *path, SDL_Surface *surf, uint32_t source_size, uint64_t source_mtime) {
+	texcache_header hdr;
+	Uint32 colorkey;
+	SDL_BlendMode blend;
+	SDL_Palette *palette = surf->format->palette;
+
+	if (SDL_MUSTLOCK(surf))
+		return 0;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = TEXCACHE_MAGIC;
+	hdr.version = TEXCACHE_VERSION;
+	hdr.source_size = source_size;
+	hdr.source_mtime = source_mtime;
+	hdr.format = surf->format->format;
+	hdr.width = surf->w;
+	hdr.height = surf->h;
+	hdr.pitch = surf->pitch;
+	hdr.num_colors = palette ? palette->ncolors : 0;
+	hdr.colorkey = SDL_GetColorKey(surf, &colorkey) == 0 ? colorkey : TEXCACHE_NO_COLORKEY;
+	hdr.blend = SDL_GetSurfaceBlendMode(surf, &blend) == 0 ? blend : SDL_BLENDMODE_NONE;
+	if (hdr.num_colors > 256)
+		return 0;
+
+	FILE *f = fstream_fopen(path, "w", IO_PREFETCH);
+	if (!f)
+		return 0;
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	if (hdr.num_colors)
+		fwrite(palette->colors, sizeof(SDL_Color), hdr.num_colors, f);
+	fwrite(surf->pixels, hdr.pitch, hdr.height, f);
+	fclose(f);
+	return 1;
+}
+
+SDL_Surface *texcache_load(const char *path, SDL_RWops *src, const char *type) {
+	char rel[512], cpath[256];
+	uint8_t key[TEXCACHE_KEY_SIZE];
+	uint32_t source_size;
+	uint64_t source_mtime;
+	if (!texcache_ready || !vfs_relpath(path, rel, sizeof(rel)) || !vfs_stamp(path, &source_size, &source_mtime))
+		return IMG_LoadTyped_RW(src, 1, type);
+	texcache_key(rel, key);
+	entry_path(key, cpath);
+
+	// Loads may come from the game thread and the prefetch decoders at the same time
+	pthread_mutex_lock(&keys_mtx);
+	int cached = has_key(key);
+	pthread_mutex_unlock(&keys_mtx);
+
+	texcache_header hdr;
+	SDL_Surface *surf = cached ? load_cached(cpath, src, source_size, source_mtime, &hdr) : NULL;
+	if (surf) {
+		SDL_RWclose(src);
+		int verified = !hdr.source_mtime;
+		int rewritten = 0;
+		if (hdr.convert_to && hdr.convert_to != hdr.format) {
+			SDL_Surface *converted = SDL_ConvertSurfaceFormat_hook(surf, hdr.convert_to, 0);
+			if (converted) {
+				SDL_FreeSurface(surf);
+				surf = converted;
+				rewritten = store(cpath, surf, source_size, source_mtime);
+			}
+		}
+		pthread_mutex_lock(&keys_mtx);
+		stat_hits++;
+		stat_verified += verified;
+		stat_rewritten += rewritten;
+		if (verified && !rewritten)
+			add_update(key, source_mtime, 0);
+		pthread_mutex_unlock(&keys_mtx);
+	} else {
+		surf = IMG_LoadTyped_RW(src, 1, type);
+		int stored = surf && store(cpath, surf, source_size, source_mtime);
+		pthread_mutex_lock(&keys_mtx);
+		stat_misses++;
+		stat_stored += stored;
+		if (stored)
+			add_key(key);
+		pthread_mutex_unlock(&keys_mtx);
+	}
+	if (surf)
+		track(surf, key);
+	return surf;
+}
+
+void texcache_converted(SDL_Surface *src, SDL_Surface *dst) {
+	if (!src || !dst)
+		return;
+	pthread_mutex_lock(&keys_mtx);
+	for (uint32_t i = 0; i < MAX_HANDOUTS; i++) {
+		handout *h = &handouts[i];
+		if (h->surf != src)
+			continue;
+		// Only layouts that lose nothing, so the entry still holds what SDL_image decoded
+		Uint32 from = src->format->format, to = dst->format->format;
+		if (from != to && SDL_PIXELLAYOUT(to) == SDL_PACKEDLAYOUT_8888 && src->format->BytesPerPixel <= 4
+			&& SDL_PIXELLAYOUT(from) != SDL_PACKEDLAYOUT_2101010 && (SDL_ISPIXELFORMAT_ALPHA(to) || !SDL_ISPIXELFORMAT_ALPHA(from)))
+			add_update(h->key, 0, to);
+		h->surf = NULL;
+		break;
+	}
+	pthread_mutex_unlock(&keys_mtx);
+}
+
+void texcache_flush(void) {
+	pthread_mutex_lock(&keys_mtx);
+	header_update *pending = updates;
+	uint32_t count = num_updates;
+	updates = NULL;
+	num_updates = max_updates = 0;
+	pthread_mutex_unlock(&keys_mtx);
+
+	char path[256];
+	texcache_header hdr;
+	for (uint32_t i = 0; i < count; i++) {
+		entry_path(pending[i].key, path);
+		fstream_sync(path);
+		SceUID fd = sceIoOpen(path, SCE_O_RDWR, 0);
+		if (fd < 0)
+			continue;
+		if (sceIoPread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && hdr.magic == TEXCACHE_MAGIC
+			&& hdr.version == TEXCACHE_VERSION) {
+			if (pending[i].source_mtime && !hdr.source_mtime)
+				hdr.source_mtime = pending[i].source_mtime;
+			if (pending[i].convert_to)
+				hdr.convert_to = pending[i].convert_to;
+			sceIoPwrite(fd, &hdr, sizeof(hdr), 0);
+		}
+		sceIoClose(fd);
+	}
+	free(pending);
+}
+
+void texcache_report(const char *level) {
+	pthread_mutex_lock(&keys_mtx);
+	if (stat_hits || stat_misses) {
+		debugPrintf("texcache: %s: %u hits (%u checked by content), %u misses, %u stored, %u rewritten in the upload layout\n",
+			level, stat_hits, stat_verified, stat_misses, stat_stored, stat_rewritten);
+	}
+	stat_hits = stat_misses = stat_verified = stat_stored = stat_rewritten = 0;
+	pthread_mutex_unlock(&keys_mtx);
+}
+
+void SDL_FreeSurface_hook(SDL_Surface *surface) {
+	if (surface) {
+		pthread_mutex_lock(&keys_mtx);
+		for (uint32_t i = 0; i < MAX_HANDOUTS; i++) {
+			if (handouts[i].surf == surface)
+				handouts[i].surf = NULL;
+		}
+		pthread_mutex_unlock(&keys_mtx);
+	}
+	SDL_FreeSurface(surface);
+}
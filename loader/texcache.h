@@ -0,0 +1,93 @@
+#ifndef __TEXCACHE_H__
+#define __TEXCACHE_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "sha1.h"
+
+#define TEXCACHE_MAGIC 0x58545652 // RVTX
+#define TEXCACHE_VERSION 2
+#define TEXCACHE_DIR "texcache"
+#define TEXCACHE_EXT ".tex"
+#define TEXCACHE_KEY_SIZE 20 // SHA-1 of the lowercase source path, relative to DATA_PATH
+#define TEXCACHE_NO_COLORKEY 0xFFFFFFFF
+
+/*
+ * One file per source image, named after the hex SHA-1 of its path.
+ * Layout: header, num_colors SDL_Color palette entries, pitch * height bytes of pixels.
+ *
+ * An entry stands as long as the source keeps its size and modification time, so a lookup costs a stat
+ * and never a read of the source. Entries written by mktexcache can't know the time the file will have on
+ * the memory card: they carry 0 and the SHA-1 of the content instead, checked once on the first hit before
+ * the real time replaces it. A source replaced by one of the same size that keeps the old time is not noticed,
+ * the README tells to clear the cache after replacing assets.
+ *
+ * The surface is first stored as SDL_image decoded it. When the game converts it for its upload, the format
+ * it converts to is noted in convert_to, and the next load converts the surface itself and rewrites the
+ * entry in that layout, so from then on the game's conversion only has to copy. Only lossless conversions
+ * are followed, and paletted and color keyed surfaces always stay as decoded.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t source_size;
+	uint32_t convert_to; // SDL_PixelFormatEnum the game converts the surface to, 0 while not known
+	uint64_t source_mtime; // As vfs_stamp gives it, 0 when source_sha1 has to be checked
+	uint8_t source_sha1[TEXCACHE_KEY_SIZE];
+	uint32_t format; // SDL_PixelFormatEnum
+	uint32_t width;
+	uint32_t height;
+	uint32_t pitch;
+	uint32_t num_colors;
+	uint32_t colorkey;
+	uint32_t blend; // SDL_BlendMode
+	uint32_t reserved;
+} texcache_header;
+
+// Same case folding as the vfs lookups, so that every spelling of a path shares its entry
+static inline void texcache_key(const char *rel, uint8_t *key) {
+	BYTE lower[512];
+	size_t len = 0;
+	for (; *rel && len < sizeof(lower); rel++)
+		lower[len++] = *rel >= 'A' && *rel <= 'Z' ? *rel - 'A' + 'a' : *rel;
+	SHA1_CTX ctx;
+	sha1_init(&ctx);
+	sha1_update(&ctx, lower, len);
+	sha1_final(&ctx, key);
+}
+
+// Uncompressed formats decode as fast as the cache would load, only the others are worth caching
+static inline int texcache_wanted(const char *path) {
+	const char *dot = strrchr(path, '.');
+	return dot && (!strcasecmp(dot, ".png") || !strcasecmp(dot, ".jpg") || !strcasecmp(dot, ".jpeg"));
+}
+
+static inline void texcache_name(const uint8_t *key, char *name) {
+	static const char hex[] = "0123456789abcdef";
+	for (int i = 0; i < TEXCACHE_KEY_SIZE; i++) {
+		name[i * 2] = hex[key[i] >> 4];
+		name[i * 2 + 1] = hex[key[i] & 0xF];
+	}
+	strcpy(name + TEXCACHE_KEY_SIZE * 2, TEXCACHE_EXT);
+}
+
+#ifdef __vita__
+struct SDL_RWops;
+struct SDL_Surface;
+
+void texcache_init(void);
+
+// Takes over src, path is the absolute path it was opened from
+struct SDL_Surface *texcache_load(const char *path, struct SDL_RWops *src, const char *type);
+// Called with every surface the game converts, to learn the layout it uploads
+void texcache_converted(struct SDL_Surface *src, struct SDL_Surface *dst);
+// Writes the formats learnt since the last call into their entries
+void texcache_flush(void);
+void texcache_report(const char *level);
+
+void SDL_FreeSurface_hook(struct SDL_Surface *surface);
+#endif
+
+#endif
@@ -0,0 +1,249 @@
+/* texfmt.c -- 16-bit texture format reduction for uploaded textures
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "main.h"
+#include "texfmt.h"
+
+enum {
+	FMT_KEEP,
+	FMT_565,
+	FMT_5551,
+	FMT_4444,
+	NUM_FMTS,
+};
+
+static const struct {
+	GLint internalformat;
+	GLenum format;
+	GLenum type;
+	const char *name;
+} fmts[NUM_FMTS] = {
+	{0, 0, 0, "32-bit"},
+	{GL_RGB565, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, "RGB565"},
+	{GL_RGB5_A1, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, "RGBA5551"},
+	{GL_RGBA4, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, "RGBA4444"},
+};
+
+// Squared error of a channel value after a round trip through 1, 4, 5 and 6 bits
+static uint16_t err1[256], err4[256], err5[256], err6[256];
+static int tables_ready = 0;
+
+#define UNPACK_ALIGNMENT 4 // glPixelStorei is stubbed out, rows always start on 4 bytes
+
+// Format picked for level 0 of each texture name, so that mipmap levels get the same one
+static uint8_t *tex_fmts = NULL;
+static GLuint max_tex = 0;
+
+// 16-bit copy of the last reduced image, handed to glTexImage2D in place of the game's pixels
+static uint8_t *scratch = NULL;
+static uint32_t scratch_size = 0;
+
+static pthread_mutex_t stats_mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t stat_count[NUM_FMTS];
+static uint64_t stat_saved;
+
+// Rounded v * max / 255, the NEON path computes exactly the same
+static inline uint32_t quantize(uint32_t v, uint32_t max) {
+	uint32_t t = v * max + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+static void init_tables(void) {
+	for (int v = 0; v < 256; v++) {
+		int q4 = quantize(v, 15), q5 = quantize(v, 31), q6 = quantize(v, 63);
+		int e1 = v - (v >= 128 ? 255 : 0);
+		int e4 = v - q4 * 17;
+		int e5 = v - ((q5 << 3) | (q5 >> 2));
+		int e6 = v - ((q6 << 2) | (q6 >> 4));
+		err1[v] = e1 * e1;
+		err4[v] = e4 * e4;
+		err5[v] = e5 * e5;
+		err6[v] = e6 * e6;
+	}
+	tables_ready = 1;
+}
+
+// Picks the smallest format whose PSNR stays above TEXTURE_REDUCE_PSNR
+static int pick_format(const uint8_t *pixels, GLsizei width, GLsizei height, uint32_t pitch, int channels) {
+	uint64_t sse[NUM_FMTS] = {0};
+	int has_alpha = 0;
+	for (GLsizei y = 0; y < height; y++) {
+		const uint8_t *p = pixels + y * pitch;
+		for (GLsizei x = 0; x < width; x++, p += channels) {
+			uint8_t r = p[0], g = p[1], b = p[2];
+			sse[FMT_565] += err5[r] + err6[g] + err5[b];
+			if (channels == 4) {
+				uint8_t a = p[3];
+				has_alpha |= a != 255;
+				sse[FMT_5551] += err5[r] + err5[g] + err5[b] + err1[a];
+				sse[FMT_4444] += err4[r] + err4[g] + err4[b] + err4[a];
+			}
+		}
+	}
+	uint32_t n = width * height;
+
+	double max_mse = 255.0 * 255.0 / pow(10.0, TEXTURE_REDUCE_PSNR / 10.0);
+	if (!has_alpha)
+		return sse[FMT_565] <= max_mse * n * 3 ? FMT_565 : FMT_KEEP;
+	int best = sse[FMT_5551] <= sse[FMT_4444] ? FMT_5551 : FMT_4444;
+	return sse[best] <= max_mse * n * 4 ? best : FMT_KEEP;
+}
+
+#ifdef __ARM_NEON
+static inline uint16x8_t quantize_u8(uint8x8_t v, uint8_t max) {
+	uint16x8_t t = vaddq_u16(vmull_u8(v, vdup_n_u8(max)), vdupq_n_u16(128));
+	return vshrq_n_u16(vsraq_n_u16(t, t, 8), 8);
+}
+
+static inline uint16x8_t pack(int fmt, uint8x8_t r, uint8x8_t g, uint8x8_t b, uint8x8_t a) {
+	switch (fmt) {
+	case FMT_565:
+		return vorrq_u16(vorrq_u16(vshlq_n_u16(quantize_u8(r, 31), 11), vshlq_n_u16(quantize_u8(g, 63), 5)), quantize_u8(b, 31));
+	case FMT_5551:
+		return vorrq_u16(vorrq_u16(vshlq_n_u16(quantize_u8(r, 31), 11), vshlq_n_u16(quantize_u8(g, 31), 6)),
+			vorrq_u16(vshlq_n_u16(quantize_u8(b, 31), 1), vmovl_u8(vshr_n_u8(a, 7))));
+	default:
+		return vorrq_u16(vorrq_u16(vshlq_n_u16(quantize_u8(r, 15), 12), vshlq_n_u16(quantize_u8(g, 15), 8)),
+			vorrq_u16(vshlq_n_u16(quantize_u8(b, 15), 4), quantize_u8(a, 15)));
+	}
+}
+#endif
+
+static void convert(const uint8_t *p, uint16_t *dst, uint32_t n, int channels, int fmt) {
+	uint32_t i = 0;
+#ifdef __ARM_NEON
+	if (channels == 4) {
+		for (; i + 8 <= n; i += 8, p += 32, dst += 8) {
+			uint8x8x4_t px = vld4_u8(p);
+			vst1q_u16(dst, pack(fmt, px.val[0], px.val[1], px.val[2], px.val[3]));
+		}
+	} else {
+		for (; i + 8 <= n; i += 8, p += 24, dst += 8) {
+			uint8x8x3_t px = vld3_u8(p);
+			vst1q_u16(dst, pack(fmt, px.val[0], px.val[1], px.val[2], vdup_n_u8(255)));
+		}
+	}
+#endif
+	for (; i < n; i++, p += channels, dst++) {
+		uint8_t a = channels == 4 ? p[3] : 255;
+		switch (fmt) {
+		case FMT_565:
+			*dst = (quantize(p[0], 31) << 11) | (quantize(p[1], 63) << 5) | quantize(p[2], 31);
+			break;
+		case FMT_5551:
+			*dst = (quantize(p[0], 31) << 11) | (quantize(p[1], 31) << 6) | (quantize(p[2], 31) << 1) | (a >> 7);
+			break;
+		default:
+			*dst = (quantize(p[0], 15) << 12) | (quantize(p[1], 15) << 8) | (quantize(p[2], 15) << 4) | quantize(a, 15);
+			break;
+		}
+	}
+}
+
+static void set_tex_fmt(GLuint tex, int fmt) {
+	if (tex >= max_tex) {
+		GLuint size = max_tex ? max_tex : 1024;
+		while (size <= tex)
+			size *= 2;
+		uint8_t *grown = realloc(tex_fmts, size);
+		if (!grown)
+			return;
+		memset(grown + max_tex, FMT_KEEP, size - max_tex);
+		tex_fmts = grown;
+		max_tex = size;
+	}
+	tex_fmts[tex] = fmt;
+}
+
+static inline uint32_t row_pitch(GLsizei width, int bpp) {
+	return (width * bpp + UNPACK_ALIGNMENT - 1) & ~(UNPACK_ALIGNMENT - 1);
+}
+
+// Only 8-bit RGB and RGBA images are considered, everything else goes up as it is. Level 0 picks the format
+// and every other level of the texture follows it whatever its own error, down to the 1x1 one, so that the
+// levels never disagree. The game's pixels are converted straight into the scratch buffer, no copy of them is kept.
+const void *texfmt_reduce(GLuint tex, GLenum target, GLint level, GLint *internalformat, GLsizei width, GLsizei height,
+	GLenum *format, GLenum *type, const void *pixels) {
+	if (target != GL_TEXTURE_2D)
+		return pixels;
+	int channels = *format == GL_RGBA ? 4 : (*format == GL_RGB ? 3 : 0);
+	int eligible = *type == GL_UNSIGNED_BYTE && channels && width > 0 && height > 0
+		&& (*internalformat == *format || *internalformat == channels);
+
+	int fmt = FMT_KEEP;
+	if (level == 0) {
+		// Storage allocated without pixels is filled later by glTexSubImage2D in the game's own format
+		if (eligible && pixels) {
+			if (!tables_ready)
+				init_tables();
+			fmt = pick_format(pixels, width, height, row_pitch(width, channels), channels);
+			pthread_mutex_lock(&stats_mtx);
+			stat_count[fmt]++;
+			pthread_mutex_unlock(&stats_mtx);
+		}
+		set_tex_fmt(tex, fmt);
+	} else if (tex < max_tex) {
+		fmt = tex_fmts[tex];
+	}
+	if (fmt == FMT_KEEP || !eligible)
+		return pixels;
+
+	if (pixels) {
+		uint32_t src_pitch = row_pitch(width, channels), dst_pitch = row_pitch(width, 2);
+		if (dst_pitch * height > scratch_size) {
+			uint8_t *grown = realloc(scratch, dst_pitch * height);
+			if (!grown) {
+				// Going up as it is, level 0 takes the later levels along so that they still agree with it
+				if (level == 0)
+					set_tex_fmt(tex, FMT_KEEP);
+				return pixels;
+			}
+			scratch = grown;
+			scratch_size = dst_pitch * height;
+		}
+		for (GLsizei y = 0; y < height; y++)
+			convert((const uint8_t *)pixels + y * src_pitch, (uint16_t *)(scratch + y * dst_pitch), width, channels, fmt);
+		pixels = scratch;
+	}
+	*internalformat = fmts[fmt].internalformat;
+	*format = fmts[fmt].format;
+	*type = fmts[fmt].type;
+
+	pthread_mutex_lock(&stats_mtx);
+	stat_saved += width * height * (channels - 2);
+	pthread_mutex_unlock(&stats_mtx);
+	return pixels;
+}
+
+void texfmt_report(const char *level) {
+	pthread_mutex_lock(&stats_mtx);
+	uint32_t total = 0;
+	for (int i = 0; i < NUM_FMTS; i++)
+		total += stat_count[i];
+	if (total) {
+		debugPrintf("texfmt: %s: %u textures, %u %s, %u %s, %u %s, %u %s, %llu KB saved\n", level, total,
+			stat_count[FMT_565], fmts[FMT_565].name, stat_count[FMT_5551], fmts[FMT_5551].name,
+			stat_count[FMT_4444], fmts[FMT_4444].name, stat_count[FMT_KEEP], fmts[FMT_KEEP].name,
+			(unsigned long long)(stat_saved / 1024));
+	}
+	memset(stat_count, 0, sizeof(stat_count));
+	stat_saved = 0;
+	pthread_mutex_unlock(&stats_mtx);
+}
@@ -0,0 +1,13 @@
+#ifndef __TEXFMT_H__
+#define __TEXFMT_H__
+
+#include <vitaGL.h>
+
+// Not thread safe, all textures have to go through the GL thread. Returns the pixels to upload, either the
+// caller's or a 16-bit copy that stays valid until the next call.
+const void *texfmt_reduce(GLuint tex, GLenum target, GLint level, GLint *internalformat, GLsizei width, GLsizei height,
+	GLenum *format, GLenum *type, const void *pixels);
+
+void texfmt_report(const char *level);
+
+#endif
@@ -0,0 +1,134 @@
+/* texupload.c -- texture upload hooks, reducing images to 16-bit on their way to vitaGL
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "texupload.h"
+#include "texfmt.h"
+#include "glstate.h"
+#include "batch.h"
+
+#define UNPACK_ALIGNMENT 4 // glPixelStorei is stubbed out, so this never changes
+
+static uint32_t stat_uploads, stat_reduced;
+static uint64_t stat_bytes, stat_reduce_us, stat_upload_us;
+
+static uint32_t pixel_size(GLenum format, GLenum type) {
+	switch (type) {
+	case GL_UNSIGNED_BYTE:
+		switch (format) {
+		case GL_RGBA:
+			return 4;
+		case GL_RGB:
+			return 3;
+		case GL_LUMINANCE_ALPHA:
+			return 2;
+		case GL_LUMINANCE:
+		case GL_ALPHA:
+			return 1;
+		default:
+			return 0;
+		}
+	case GL_UNSIGNED_SHORT_5_6_5:
+	case GL_UNSIGNED_SHORT_4_4_4_4:
+	case GL_UNSIGNED_SHORT_5_5_5_1:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+// Bytes read from pixels, the last row is not padded to the unpack alignment
+static uint32_t image_size(GLsizei width, GLsizei height, GLenum format, GLenum type) {
+	uint32_t bpp = pixel_size(format, type);
+	if (!bpp || width <= 0 || height <= 0)
+		return 0;
+	uint32_t row = (width * bpp + UNPACK_ALIGNMENT - 1) & ~(UNPACK_ALIGNMENT - 1);
+	return row * (height - 1) + width * bpp;
+}
+
+void glTexImage2D_hook(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height,
+	GLint border, GLenum format, GLenum type, const void *pixels) {
+	batch_flush();
+	GLint tex = 0;
+	if (target == GL_TEXTURE_2D)
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &tex);
+
+	// vitaGL copies the pixels into its own layout right in the call and does not expose that layout, so there is
+	// nothing to prepare ahead of it. The reduction reads the game's pixels directly, without a copy in between.
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	GLenum orig_type = type;
+	pixels = texfmt_reduce(tex, target, level, &internalformat, width, height, &format, &type, pixels);
+	SceUInt64 reduced = sceKernelGetProcessTimeWide();
+	glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+	stat_uploads++;
+	stat_reduced += type != orig_type;
+	stat_bytes += image_size(width, height, format, type);
+	stat_reduce_us += reduced - start;
+	stat_upload_us += sceKernelGetProcessTimeWide() - reduced;
+}
+
+void glTexSubImage2D_hook(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+	GLenum format, GLenum type, const void *pixels) {
+	batch_flush();
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+	stat_uploads++;
+	stat_bytes += image_size(width, height, format, type);
+	stat_upload_us += sceKernelGetProcessTimeWide() - start;
+}
+
+void glDeleteTextures_hook(GLsizei n, const GLuint *textures) {
+	batch_flush();
+	glstate_forget_textures(n, textures);
+	glDeleteTextures(n, textures);
+}
+
+void glGenerateMipmap_hook(GLenum target) {
+	batch_flush();
+	glGenerateMipmap(target);
+}
+
+void glCopyTexImage2D_hook(GLenum target, GLint level, GLenum internalformat, GLint x, GLint y,
+	GLsizei width, GLsizei height, GLint border) {
+	batch_flush();
+	glCopyTexImage2D(target, level, internalformat, x, y, width, height, border);
+}
+
+void glCopyTexSubImage2D_hook(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint x, GLint y,
+	GLsizei width, GLsizei height) {
+	batch_flush();
+	glCopyTexSubImage2D(target, level, xoffset, yoffset, x, y, width, height);
+}
+
+void glCompressedTexImage2D_hook(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height,
+	GLint border, GLsizei imageSize, const void *data) {
+	batch_flush();
+	glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data);
+}
+
+void glFramebufferTexture2D_hook(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) {
+	batch_flush();
+	glFramebufferTexture2D(target, attachment, textarget, texture, level);
+}
+
+void texupload_report(const char *level) {
+	if (stat_uploads) {
+		debugPrintf("texupload: %s: %u uploads (%llu KB), %u reduced to 16-bit, %llu ms reducing, %llu ms in vitaGL\n",
+			level, stat_uploads, (unsigned long long)(stat_bytes / 1024), stat_reduced,
+			(unsigned long long)(stat_reduce_us / 1000), (unsigned long long)(stat_upload_us / 1000));
+	}
+	stat_uploads = stat_reduced = 0;
+	stat_bytes = stat_reduce_us = stat_upload_us = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef __TEXUPLOAD_H__
+#define __TEXUPLOAD_H__
+
+#include <vitaGL.h>
+
+void texupload_report(const char *level);
+
+void glTexImage2D_hook(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height,
+	GLint border, GLenum format, GLenum type, const void *pixels);
+void glTexSubImage2D_hook(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+	GLenum format, GLenum type, const void *pixels);
+void glDeleteTextures_hook(GLsizei n, const GLuint *textures);
+
+// Calls that read or replace texture contents, pending batched draws are flushed before them
+void glGenerateMipmap_hook(GLenum target);
+void glCopyTexImage2D_hook(GLenum target, GLint level, GLenum internalformat, GLint x, GLint y,
+	GLsizei width, GLsizei height, GLint border);
+void glCopyTexSubImage2D_hook(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint x, GLint y,
+	GLsizei width, GLsizei height);
+void glCompressedTexImage2D_hook(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height,
+	GLint border, GLsizei imageSize, const void *data);
+void glFramebufferTexture2D_hook(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+
+#endif
@@ -0,0 +1,317 @@
+/* trace.c -- file access tracer for the path hooks
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <SDL2/SDL.h>
+
+#include "main.h"
+#include "cookie.h"
+#include "trace.h"
+#include "hash.h"
+#include "vfs.h"
+
+#define TRACE_RING_SIZE 65536
+#define TRACE_MAX_PATHS 16384 // Must be a power of two
+#define TRACE_FLUSH_INTERVAL_US (10 * 1000000)
+#define TRACE_MAX_FDS 64
+
+static pthread_mutex_t trace_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int trace_ready = 0;
+
+static trace_record *ring = NULL;
+static uint32_t ring_count = 0; // Total records ever written
+static uint32_t flushed_count = 0;
+
+static int32_t path_buckets[TRACE_MAX_PATHS];
+static uint32_t *path_offsets = NULL;
+static uint32_t num_paths = 0;
+static char *pool = NULL;
+static uint32_t pool_size = 0, max_pool = 0;
+
+static uint32_t intern_path(const char *path) {
+	uint32_t hash = path_hash(path);
+	uint32_t mask = TRACE_MAX_PATHS - 1;
+	uint32_t i;
+	for (i = hash & mask; path_buckets[i] >= 0; i = (i + 1) & mask) {
+		if (!strcmp(pool + path_offsets[path_buckets[i]], path))
+			return path_buckets[i];
+	}
+
+	// Past this point every new path shares the last slot rather than growing without bounds
+	if (num_paths == TRACE_MAX_PATHS - 1)
+		return num_paths - 1;
+
+	size_t len = strlen(path) + 1;
+	if (pool_size + len > max_pool) {
+		max_pool = max_pool ? max_pool * 2 : 64 * 1024;
+		pool = realloc(pool, max_pool);
+	}
+	memcpy(pool + pool_size, path, len);
+	path_offsets[num_paths] = pool_size;
+	pool_size += len;
+	path_buckets[i] = num_paths;
+	return num_paths++;
+}
+
+// Records are copied out under the lock so hooks never wait on the memory card
+static void flush_trace(void) {
+	static trace_record *copy = NULL;
+	static char *pool_copy = NULL;
+	static uint32_t pool_copy_size = 0;
+
+	pthread_mutex_lock(&trace_mtx);
+	if (flushed_count == ring_count) {
+		pthread_mutex_unlock(&trace_mtx);
+		return;
+	}
+
+	trace_header hdr;
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.num_records = ring_count < TRACE_RING_SIZE ? ring_count : TRACE_RING_SIZE;
+	hdr.dropped = ring_count - hdr.num_records;
+	hdr.num_paths = num_paths;
+	hdr.paths_size = pool_size;
+
+	if (!copy)
+		copy = malloc(TRACE_RING_SIZE * sizeof(trace_record));
+	if (pool_copy_size < pool_size) {
+		pool_copy_size = max_pool;
+		pool_copy = realloc(pool_copy, pool_copy_size);
+	}
+	uint32_t first = ring_count > TRACE_RING_SIZE ? ring_count % TRACE_RING_SIZE : 0;
+	memcpy(copy, &ring[first], (hdr.num_records - first) * sizeof(trace_record));
+	memcpy(&copy[hdr.num_records - first], ring, first * sizeof(trace_record));
+	memcpy(pool_copy, pool, pool_size);
+	flushed_count = ring_count;
+	pthread_mutex_unlock(&trace_mtx);
+
+	SceUID fd = sceIoOpen(DATA_PATH "/" TRACE_NAME, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd < 0)
+		return;
+	sceIoWrite(fd, &hdr, sizeof(hdr));
+	sceIoWrite(fd, copy, hdr.num_records * sizeof(trace_record));
+	sceIoWrite(fd, pool_copy, hdr.paths_size);
+	sceIoClose(fd);
+	vfs_refresh(DATA_PATH "/" TRACE_NAME, 1);
+}
+
+static int trace_thread(SceSize args, void *argp) {
+	for (;;) {
+		sceKernelDelayThread(TRACE_FLUSH_INTERVAL_US);
+		flush_trace();
+	}
+	return 0;
+}
+
+void trace_init(void) {
+	ring = malloc(TRACE_RING_SIZE * sizeof(trace_record));
+	path_offsets = malloc(TRACE_MAX_PATHS * sizeof(uint32_t));
+	if (!ring || !path_offsets)
+		return;
+	memset(path_buckets, 0xFF, sizeof(path_buckets));
+
+	SceUID thid = sceKernelCreateThread("trace_flush", trace_thread, 0x10000100, 0x4000, 0, 0, NULL);
+	if (thid >= 0)
+		sceKernelStartThread(thid, 0, NULL);
+	trace_ready = 1;
+	debugPrintf("trace: recording file accesses to %s\n", DATA_PATH "/" TRACE_NAME);
+}
+
+uint64_t trace_begin(void) {
+	return sceKernelGetProcessTimeWide();
+}
+
+static void record(int op, const char *path, uint32_t bytes, int failed, uint64_t time_us, uint32_t duration_us) {
+	if (!trace_ready)
+		return;
+
+	pthread_mutex_lock(&trace_mtx);
+	trace_record *r = &ring[ring_count % TRACE_RING_SIZE];
+	r->time_us = time_us;
+	r->duration_us = duration_us;
+	r->bytes = bytes;
+	r->path = intern_path(path);
+	r->thread = sceKernelGetThreadId();
+	r->op = op;
+	r->failed = failed ? 1 : 0;
+	r->reserved = 0;
+	r->padding = 0;
+	ring_count++;
+	pthread_mutex_unlock(&trace_mtx);
+}
+
+void trace_end(int op, const char *path, uint32_t bytes, int failed, uint64_t start) {
+	record(op, path, bytes, failed, start, sceKernelGetProcessTimeWide() - start);
+}
+
+typedef struct {
+	FILE *f;
+	SDL_RWops *rw;
+	int fd;
+	uint32_t bytes;
+	uint64_t read_us;
+	char path[256];
+} traced_stream;
+
+static traced_stream *new_stream(const char *path) {
+	traced_stream *t = calloc(1, sizeof(traced_stream));
+	if (t) {
+		t->fd = -1;
+		strncpy(t->path, path, sizeof(t->path) - 1);
+	}
+	return t;
+}
+
+static void count_read(traced_stream *t, int bytes, uint64_t start) {
+	t->read_us += sceKernelGetProcessTimeWide() - start;
+	if (bytes > 0)
+		t->bytes += bytes;
+}
+
+static void close_record(traced_stream *t) {
+	record(TRACE_CLOSE, t->path, t->bytes, 0, sceKernelGetProcessTimeWide(), t->read_us);
+}
+
+static int file_read(void *stream, void *dst, uint32_t size) {
+	traced_stream *t = (traced_stream *)stream;
+	uint64_t start = sceKernelGetProcessTimeWide();
+	size_t r = fread(dst, 1, size, t->f);
+	count_read(t, r, start);
+	return r || !ferror(t->f) ? (int)r : -1;
+}
+
+static int64_t file_seek(void *stream, int64_t offset, int whence) {
+	traced_stream *t = (traced_stream *)stream;
+	if (fseek(t->f, offset, whence))
+		return -1;
+	return ftell(t->f);
+}
+
+static int64_t file_size(void *stream) {
+	traced_stream *t = (traced_stream *)stream;
+	long pos = ftell(t->f);
+	fseek(t->f, 0, SEEK_END);
+	long size = ftell(t->f);
+	fseek(t->f, pos, SEEK_SET);
+	return size;
+}
+
+static int file_close(void *stream) {
+	traced_stream *t = (traced_stream *)stream;
+	int r = fclose(t->f);
+	close_record(t);
+	free(t);
+	return r;
+}
+
+static int rw_read(void *stream, void *dst, uint32_t size) {
+	traced_stream *t = (traced_stream *)stream;
+	uint64_t start = sceKernelGetProcessTimeWide();
+	size_t r = SDL_RWread(t->rw, dst, 1, size);
+	count_read(t, r, start);
+	return r;
+}
+
+static int64_t rw_seek(void *stream, int64_t offset, int whence) {
+	return SDL_RWseek(((traced_stream *)stream)->rw, offset, whence);
+}
+
+static int64_t rw_size(void *stream) {
+	return SDL_RWsize(((traced_stream *)stream)->rw);
+}
+
+static int rw_close(void *stream) {
+	traced_stream *t = (traced_stream *)stream;
+	int r = SDL_RWclose(t->rw);
+	close_record(t);
+	free(t);
+	return r;
+}
+
+static const cookie_funcs file_funcs = {file_read, NULL, file_seek, file_size, file_close};
+static const cookie_funcs rw_funcs = {rw_read, NULL, rw_seek, rw_size, rw_close};
+
+FILE *trace_wrap_file(FILE *f, const char *path) {
+	traced_stream *t = trace_ready && f ? new_stream(path) : NULL;
+	if (!t)
+		return f;
+	t->f = f;
+	FILE *wrapped = cookie_fopen(t, &file_funcs, "r");
+	if (!wrapped) {
+		free(t);
+		return f;
+	}
+	// Every read of the game reaches the count as it is, the stream underneath has its own buffer
+	setvbuf(wrapped, NULL, _IONBF, 0);
+	return wrapped;
+}
+
+SDL_RWops *trace_wrap_rwops(SDL_RWops *rw, const char *path) {
+	traced_stream *t = trace_ready && rw ? new_stream(path) : NULL;
+	if (!t)
+		return rw;
+	t->rw = rw;
+	SDL_RWops *wrapped = cookie_rwops(t, &rw_funcs);
+	if (!wrapped) {
+		free(t);
+		return rw;
+	}
+	return wrapped;
+}
+
+// Descriptors are few, open ones get looked up by a scan
+static traced_stream *fds[TRACE_MAX_FDS];
+
+void trace_fd_open(int fd, const char *path) {
+	if (!trace_ready || fd < 0)
+		return;
+	pthread_mutex_lock(&trace_mtx);
+	for (int i = 0; i < TRACE_MAX_FDS; i++) {
+		if (!fds[i]) {
+			if ((fds[i] = new_stream(path)))
+				fds[i]->fd = fd;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&trace_mtx);
+}
+
+void trace_fd_read(int fd, int bytes, uint64_t start) {
+	pthread_mutex_lock(&trace_mtx);
+	for (int i = 0; i < TRACE_MAX_FDS; i++) {
+		if (fds[i] && fds[i]->fd == fd) {
+			count_read(fds[i], bytes, start);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&trace_mtx);
+}
+
+void trace_fd_close(int fd) {
+	traced_stream *t = NULL;
+	pthread_mutex_lock(&trace_mtx);
+	for (int i = 0; i < TRACE_MAX_FDS; i++) {
+		if (fds[i] && fds[i]->fd == fd) {
+			t = fds[i];
+			fds[i] = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&trace_mtx);
+	if (t) {
+		close_record(t);
+		free(t);
+	}
+}
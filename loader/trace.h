@@ -0,0 +1,68 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_MAGIC 0x52545652 // RVTR
+#define TRACE_VERSION 2
+#define TRACE_NAME "trace.bin"
+
+enum {
+	TRACE_FOPEN,
+	TRACE_RWOPS,
+	TRACE_IMG_LOAD,
+	TRACE_EXISTS,
+	TRACE_STAT,
+	TRACE_OPENDIR,
+	TRACE_OPEN, // open() of a file descriptor
+	TRACE_CLOSE, // Closing a stream or descriptor opened for reading
+	TRACE_NUM_OPS,
+};
+
+/*
+ * Layout: header, records from oldest to newest, path table.
+ * Paths are stored once, null terminated, in the order they were first seen. Streams and descriptors
+ * opened for reading count what the game reads out of them, and get a TRACE_CLOSE record with the bytes
+ * read and the time spent reading when closed.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_records;
+	uint32_t dropped; // Records overwritten after the ring wrapped
+	uint32_t num_paths;
+	uint32_t paths_size;
+} trace_header;
+
+typedef struct {
+	uint64_t time_us; // Since boot
+	uint32_t duration_us;
+	uint32_t bytes; // File size for opens and stats, decoded size for images, bytes read for closes
+	uint32_t path;
+	uint32_t thread;
+	uint8_t op;
+	uint8_t failed;
+	uint16_t reserved;
+	uint32_t padding; // time_us aligns records to 8 bytes, so they take 32 bytes and not 28
+} trace_record;
+
+_Static_assert(sizeof(trace_record) == 32, "trace.bin records are 32 bytes");
+
+#ifdef __vita__
+void trace_init(void);
+
+uint64_t trace_begin(void);
+void trace_end(int op, const char *path, uint32_t bytes, int failed, uint64_t start);
+
+struct SDL_RWops;
+
+// Read streams handed to the game go through these, which count the bytes read until the stream is closed
+FILE *trace_wrap_file(FILE *f, const char *path);
+struct SDL_RWops *trace_wrap_rwops(struct SDL_RWops *rw, const char *path);
+void trace_fd_open(int fd, const char *path);
+void trace_fd_read(int fd, int bytes, uint64_t start);
+void trace_fd_close(int fd);
+#endif
+
+#endif
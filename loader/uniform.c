@@ -0,0 +1,394 @@
+/* uniform.c -- per program uniform value cache, uploads of unchanged values are skipped
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "uniform.h"
+#include "glstate.h"
+#include "lightvar.h"
+#include "batch.h"
+
+#define MAX_ENTRIES 8192 // Power of two, programs * uniforms stays well below it, light variants included
+
+enum {
+	SHAPE_1F = 1,
+	SHAPE_2F,
+	SHAPE_3F,
+	SHAPE_4F,
+	SHAPE_1I,
+	SHAPE_2I,
+	SHAPE_3I,
+	SHAPE_4I,
+	SHAPE_1FV,
+	SHAPE_2FV,
+	SHAPE_3FV,
+	SHAPE_4FV,
+	SHAPE_1IV,
+	SHAPE_2IV,
+	SHAPE_3IV,
+	SHAPE_4IV,
+	SHAPE_MAT2,
+	SHAPE_MAT3,
+	SHAPE_MAT4,
+};
+
+typedef struct {
+	GLuint program; // 0 for free slots
+	GLint location;
+	uint32_t shape; // Entry point, count and transpose of the last upload, 0 until there is one
+	uint32_t size;
+	uint32_t capacity;
+	uint8_t *data;
+	int partial; // Location of an array element past the first one, overlaps another entry
+} uniform_entry;
+
+// Only touched by the GL thread
+static uniform_entry entries[MAX_ENTRIES];
+static int num_entries = 0;
+
+static uint64_t stat_bytes, stat_uploaded;
+
+static inline uint32_t home_slot(GLuint program, GLint location) {
+	return ((program * 2654435761u) ^ (location * 40503u)) & (MAX_ENTRIES - 1);
+}
+
+static uniform_entry *find_entry(GLuint program, GLint location) {
+	for (uint32_t i = home_slot(program, location);; i++) {
+		uniform_entry *e = &entries[i & (MAX_ENTRIES - 1)];
+		if (e->program == program && e->location == location)
+			return e;
+		if (!e->program) {
+			if (num_entries >= MAX_ENTRIES * 3 / 4)
+				return NULL;
+			num_entries++;
+			e->program = program;
+			e->location = location;
+			return e;
+		}
+	}
+}
+
+// Values known for the program are dropped, the partial marks stay as they belong to the locations
+static void forget_values(GLuint program) {
+	for (int i = 0; i < MAX_ENTRIES; i++) {
+		if (entries[i].program == program)
+			entries[i].shape = 0;
+	}
+}
+
+void uniform_forget_program(GLuint program) {
+	for (int i = 0; i < MAX_ENTRIES; i++) {
+		if (entries[i].program == program) {
+			entries[i].shape = 0;
+			entries[i].partial = 0;
+		}
+	}
+}
+
+// Entries further along the probe sequence move back into the hole, so that lookups never stop short of them
+static void remove_entry(uint32_t hole) {
+	free(entries[hole].data);
+	for (uint32_t j = hole;;) {
+		j = (j + 1) & (MAX_ENTRIES - 1);
+		uniform_entry *e = &entries[j];
+		if (!e->program)
+			break;
+		// It can go to the hole when the hole is on its way from its home slot
+		uint32_t home = home_slot(e->program, e->location);
+		if (((j - home) & (MAX_ENTRIES - 1)) >= ((j - hole) & (MAX_ENTRIES - 1))) {
+			entries[hole] = *e;
+			hole = j;
+		}
+	}
+	memset(&entries[hole], 0, sizeof(uniform_entry));
+	num_entries--;
+}
+
+void uniform_delete_program(GLuint program) {
+	for (uint32_t i = 0; i < MAX_ENTRIES;) {
+		// The slot is looked at again, another entry may have moved in
+		if (entries[i].program == program)
+			remove_entry(i);
+		else
+			i++;
+	}
+}
+
+// Locations of name[i] with i > 0 alias the tail of the name[0] entry, uploads through them drop the program's cache
+GLint glGetUniformLocation_hook(GLuint program, const GLchar *name) {
+	GLint location = glGetUniformLocation(program, name);
+	if (location >= 0)
+		lightvar_location(program, name, location);
+	const char *idx = strchr(name, '[');
+	if (location >= 0 && idx && atoi(idx + 1) > 0) {
+		uniform_entry *e = find_entry(program, location);
+		if (e)
+			e->partial = 1;
+	}
+	return location;
+}
+
+// Returns 1 when the values have to be uploaded, remembering them for the next call
+static int changed_in(GLuint program, uint32_t shape, GLint location, const void *value, uint32_t size) {
+	uniform_entry *e = location >= 0 && program ? find_entry(program, location) : NULL;
+	if (e && e->partial) {
+		forget_values(program);
+		e = NULL;
+	}
+	if (!e) {
+		stat_uploaded += size;
+		return 1;
+	}
+	if (e->shape == shape && e->size == size && !memcmp(e->data, value, size))
+		return 0;
+
+	if (size > e->capacity) {
+		uint8_t *data = realloc(e->data, size);
+		if (!data) {
+			e->shape = 0;
+			stat_uploaded += size;
+			return 1;
+		}
+		e->data = data;
+		e->capacity = size;
+	}
+	memcpy(e->data, value, size);
+	e->shape = shape;
+	e->size = size;
+	stat_uploaded += size;
+	return 1;
+}
+
+static int changed(uint32_t shape, GLint location, const void *value, uint32_t size) {
+	batch_flush();
+	stat_bytes += size;
+	GLuint program = glstate_program();
+	// Light uniforms of lit programs get uploaded at draw time, culled
+	if (lightvar_uniform(program, location, value, size))
+		return 0;
+	return changed_in(program, shape, location, value, size);
+}
+
+static inline uint32_t vec_shape(uint32_t kind, GLsizei count) {
+	return kind | (count << 8);
+}
+
+static inline uint32_t mat_shape(uint32_t kind, GLsizei count, GLboolean transpose) {
+	return kind | (count << 8) | (transpose ? 0x80 : 0);
+}
+
+void glUniform1f_hook(GLint location, GLfloat v0) {
+	GLfloat v[1] = {v0};
+	if (changed(SHAPE_1F, location, v, sizeof(v)))
+		glUniform1f(location, v0);
+}
+
+void glUniform2f_hook(GLint location, GLfloat v0, GLfloat v1) {
+	GLfloat v[2] = {v0, v1};
+	if (changed(SHAPE_2F, location, v, sizeof(v)))
+		glUniform2f(location, v0, v1);
+}
+
+void glUniform3f_hook(GLint location, GLfloat v0, GLfloat v1, GLfloat v2) {
+	GLfloat v[3] = {v0, v1, v2};
+	if (changed(SHAPE_3F, location, v, sizeof(v)))
+		glUniform3f(location, v0, v1, v2);
+}
+
+void glUniform4f_hook(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) {
+	GLfloat v[4] = {v0, v1, v2, v3};
+	if (changed(SHAPE_4F, location, v, sizeof(v)))
+		glUniform4f(location, v0, v1, v2, v3);
+}
+
+void glUniform1i_hook(GLint location, GLint v0) {
+	GLint v[1] = {v0};
+	if (changed(SHAPE_1I, location, v, sizeof(v)))
+		glUniform1i(location, v0);
+}
+
+void glUniform2i_hook(GLint location, GLint v0, GLint v1) {
+	GLint v[2] = {v0, v1};
+	if (changed(SHAPE_2I, location, v, sizeof(v)))
+		glUniform2i(location, v0, v1);
+}
+
+void glUniform3i_hook(GLint location, GLint v0, GLint v1, GLint v2) {
+	GLint v[3] = {v0, v1, v2};
+	if (changed(SHAPE_3I, location, v, sizeof(v)))
+		glUniform3i(location, v0, v1, v2);
+}
+
+void glUniform4i_hook(GLint location, GLint v0, GLint v1, GLint v2, GLint v3) {
+	GLint v[4] = {v0, v1, v2, v3};
+	if (changed(SHAPE_4I, location, v, sizeof(v)))
+		glUniform4i(location, v0, v1, v2, v3);
+}
+
+void glUniform1fv_hook(GLint location, GLsizei count, const GLfloat *value) {
+	if (changed(vec_shape(SHAPE_1FV, count), location, value, count * sizeof(GLfloat)))
+		glUniform1fv(location, count, value);
+}
+
+void glUniform2fv_hook(GLint location, GLsizei count, const GLfloat *value) {
+	if (changed(vec_shape(SHAPE_2FV, count), location, value, count * 2 * sizeof(GLfloat)))
+		glUniform2fv(location, count, value);
+}
+
+void glUniform3fv_hook(GLint location, GLsizei count, const GLfloat *value) {
+	if (changed(vec_shape(SHAPE_3FV, count), location, value, count * 3 * sizeof(GLfloat)))
+		glUniform3fv(location, count, value);
+}
+
+void glUniform4fv_hook(GLint location, GLsizei count, const GLfloat *value) {
+	if (changed(vec_shape(SHAPE_4FV, count), location, value, count * 4 * sizeof(GLfloat)))
+		glUniform4fv(location, count, value);
+}
+
+void glUniform1iv_hook(GLint location, GLsizei count, const GLint *value) {
+	if (changed(vec_shape(SHAPE_1IV, count), location, value, count * sizeof(GLint)))
+		glUniform1iv(location, count, value);
+}
+
+void glUniform2iv_hook(GLint location, GLsizei count, const GLint *value) {
+	if (changed(vec_shape(SHAPE_2IV, count), location, value, count * 2 * sizeof(GLint)))
+		glUniform2iv(location, count, value);
+}
+
+void glUniform3iv_hook(GLint location, GLsizei count, const GLint *value) {
+	if (changed(vec_shape(SHAPE_3IV, count), location, value, count * 3 * sizeof(GLint)))
+		glUniform3iv(location, count, value);
+}
+
+void glUniform4iv_hook(GLint location, GLsizei count, const GLint *value) {
+	if (changed(vec_shape(SHAPE_4IV, count), location, value, count * 4 * sizeof(GLint)))
+		glUniform4iv(location, count, value);
+}
+
+void glUniformMatrix2fv_hook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+	if (changed(mat_shape(SHAPE_MAT2, count, transpose), location, value, count * 4 * sizeof(GLfloat)))
+		glUniformMatrix2fv(location, count, transpose, value);
+}
+
+void glUniformMatrix3fv_hook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+	if (changed(mat_shape(SHAPE_MAT3, count, transpose), location, value, count * 9 * sizeof(GLfloat)))
+		glUniformMatrix3fv(location, count, transpose, value);
+}
+
+void glUniformMatrix4fv_hook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+	if (changed(mat_shape(SHAPE_MAT4, count, transpose), location, value, count * 16 * sizeof(GLfloat)))
+		glUniformMatrix4fv(location, count, transpose, value);
+}
+
+// Calls the entry point of the shape with the values, for the program bound in GL
+static void upload(uint32_t shape, GLint location, const void *value) {
+	const GLfloat *f = (const GLfloat *)value;
+	const GLint *i = (const GLint *)value;
+	GLsizei count = shape >> 8;
+	GLboolean transpose = (shape & 0x80) ? GL_TRUE : GL_FALSE;
+	switch (shape & 0x7F) {
+	case SHAPE_1F:
+		glUniform1f(location, f[0]);
+		break;
+	case SHAPE_2F:
+		glUniform2f(location, f[0], f[1]);
+		break;
+	case SHAPE_3F:
+		glUniform3f(location, f[0], f[1], f[2]);
+		break;
+	case SHAPE_4F:
+		glUniform4f(location, f[0], f[1], f[2], f[3]);
+		break;
+	case SHAPE_1I:
+		glUniform1i(location, i[0]);
+		break;
+	case SHAPE_2I:
+		glUniform2i(location, i[0], i[1]);
+		break;
+	case SHAPE_3I:
+		glUniform3i(location, i[0], i[1], i[2]);
+		break;
+	case SHAPE_4I:
+		glUniform4i(location, i[0], i[1], i[2], i[3]);
+		break;
+	case SHAPE_1FV:
+		glUniform1fv(location, count, f);
+		break;
+	case SHAPE_2FV:
+		glUniform2fv(location, count, f);
+		break;
+	case SHAPE_3FV:
+		glUniform3fv(location, count, f);
+		break;
+	case SHAPE_4FV:
+		glUniform4fv(location, count, f);
+		break;
+	case SHAPE_1IV:
+		glUniform1iv(location, count, i);
+		break;
+	case SHAPE_2IV:
+		glUniform2iv(location, count, i);
+		break;
+	case SHAPE_3IV:
+		glUniform3iv(location, count, i);
+		break;
+	case SHAPE_4IV:
+		glUniform4iv(location, count, i);
+		break;
+	case SHAPE_MAT2:
+		glUniformMatrix2fv(location, count, transpose, f);
+		break;
+	case SHAPE_MAT3:
+		glUniformMatrix3fv(location, count, transpose, f);
+		break;
+	case SHAPE_MAT4:
+		glUniformMatrix4fv(location, count, transpose, f);
+		break;
+	}
+}
+
+int uniform_replay(GLuint from, GLint location, GLuint to, GLint target) {
+	uniform_entry *e = find_entry(from, location);
+	if (!e || e->partial)
+		return 0;
+	// Never uploaded, both programs still have the default
+	if (!e->shape)
+		return 1;
+	if (changed_in(to, e->shape, target, e->data, e->size))
+		upload(e->shape, target, e->data);
+	return 1;
+}
+
+void uniform_set_1i(GLuint program, GLint location, GLint v0) {
+	if (changed_in(program, SHAPE_1I, location, &v0, sizeof(v0)))
+		glUniform1i(location, v0);
+}
+
+void uniform_set_4fv(GLuint program, GLint location, GLsizei count, const GLfloat *value) {
+	if (changed_in(program, vec_shape(SHAPE_4FV, count), location, value, count * 4 * sizeof(GLfloat)))
+		glUniform4fv(location, count, value);
+}
+
+void uniform_set_matrix3fv(GLuint program, GLint location, GLsizei count, const GLfloat *value) {
+	if (changed_in(program, mat_shape(SHAPE_MAT3, count, GL_FALSE), location, value, count * 9 * sizeof(GLfloat)))
+		glUniformMatrix3fv(location, count, GL_FALSE, value);
+}
+
+void uniform_report(uint32_t frames) {
+	if (stat_bytes) {
+		debugPrintf("uniform: %llu bytes per frame, %llu uploaded\n", (unsigned long long)(stat_bytes / frames),
+			(unsigned long long)(stat_uploaded / frames));
+	}
+	stat_bytes = stat_uploaded = 0;
+}
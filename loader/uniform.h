@@ -0,0 +1,42 @@
+#ifndef __UNIFORM_H__
+#define __UNIFORM_H__
+
+#include <vitaGL.h>
+
+// The program got linked again, its values and partial marks are dropped
+void uniform_forget_program(GLuint program);
+// The program got deleted, its entries are freed for others
+void uniform_delete_program(GLuint program);
+void uniform_report(uint32_t frames);
+
+// Uploads the value from last got at location to target of to, which has to be bound in GL, unless to has it
+// already. Returns 0 when the value isn't known.
+int uniform_replay(GLuint from, GLint location, GLuint to, GLint target);
+// Uploads through the cache of program, which has to be bound in GL
+void uniform_set_1i(GLuint program, GLint location, GLint v0);
+void uniform_set_4fv(GLuint program, GLint location, GLsizei count, const GLfloat *value);
+void uniform_set_matrix3fv(GLuint program, GLint location, GLsizei count, const GLfloat *value);
+
+GLint glGetUniformLocation_hook(GLuint program, const GLchar *name);
+
+void glUniform1f_hook(GLint location, GLfloat v0);
+void glUniform2f_hook(GLint location, GLfloat v0, GLfloat v1);
+void glUniform3f_hook(GLint location, GLfloat v0, GLfloat v1, GLfloat v2);
+void glUniform4f_hook(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
+void glUniform1i_hook(GLint location, GLint v0);
+void glUniform2i_hook(GLint location, GLint v0, GLint v1);
+void glUniform3i_hook(GLint location, GLint v0, GLint v1, GLint v2);
+void glUniform4i_hook(GLint location, GLint v0, GLint v1, GLint v2, GLint v3);
+void glUniform1fv_hook(GLint location, GLsizei count, const GLfloat *value);
+void glUniform2fv_hook(GLint location, GLsizei count, const GLfloat *value);
+void glUniform3fv_hook(GLint location, GLsizei count, const GLfloat *value);
+void glUniform4fv_hook(GLint location, GLsizei count, const GLfloat *value);
+void glUniform1iv_hook(GLint location, GLsizei count, const GLint *value);
+void glUniform2iv_hook(GLint location, GLsizei count, const GLint *value);
+void glUniform3iv_hook(GLint location, GLsizei count, const GLint *value);
+void glUniform4iv_hook(GLint location, GLsizei count, const GLint *value);
+void glUniformMatrix2fv_hook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+void glUniformMatrix3fv_hook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+void glUniformMatrix4fv_hook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+
+#endif
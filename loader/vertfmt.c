@@ -0,0 +1,619 @@
+/* vertfmt.c -- packs the float attributes of static vertex buffers into smaller formats
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __vita__
+#include <vitasdk.h>
+#include <vitaGL.h>
+#include "main.h"
+#include "glstate.h"
+#include "batch.h"
+#else
+#include <GL/gl.h>
+#endif
+
+#include "vertfmt.h"
+
+#ifndef GL_HALF_FLOAT_OES
+#define GL_HALF_FLOAT_OES 0x8D61
+#endif
+
+/*
+ * The world and model shaders take every attribute as floats: float4 inPosition, float4 inColor,
+ * float2 inTexCoord, float inFogCoord and float3 inNormal, up to 56 bytes per vertex. Colors, normals
+ * and fog coordinates only need 8 bits and texture coordinates 16. Static vertex buffers are kept until
+ * their first draw with a program tells how their vertices are laid out, then get a packed copy the
+ * draws read from instead, with the attribute pointers set up for the packed formats. The shaders see
+ * the same floats: normalized formats and halves get converted by the vertex fetch. The original stays
+ * for the draws with other layouts, so the packed copies cost memory to save fetch bandwidth.
+ */
+
+// In the order glLinkProgram_hook binds them
+static const struct {
+	const char *name;
+	float tolerance;
+} attrib_info[VERTFMT_ATTRIBS] = {
+	{"inPosition", 0.0f}, // Always kept as floats
+	{"inColor", 1.0f / 256}, // Under a step of 8 bits, colors that came from bytes come back exactly
+	{"inTexCoord", 1.0f / 2048}, // An eighth of a texel on 256x256 textures
+	{"inFogCoord", 1.0f / 256},
+	{"inNormal", 1.0f / 200}, // About a third of a degree
+};
+
+const char *vertfmt_attrib_name(int location) {
+	return location >= 0 && location < VERTFMT_ATTRIBS ? attrib_info[location].name : NULL;
+}
+
+float vertfmt_tolerance(int location) {
+	return location >= 0 && location < VERTFMT_ATTRIBS ? attrib_info[location].tolerance : 0.0f;
+}
+
+static uint32_t type_size(uint32_t type) {
+	switch (type) {
+	case GL_FLOAT:
+		return 4;
+	case GL_HALF_FLOAT_OES:
+	case GL_SHORT:
+	case GL_UNSIGNED_SHORT:
+		return 2;
+	case GL_BYTE:
+	case GL_UNSIGNED_BYTE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static uint32_t format_size(int format) {
+	switch (format) {
+	case VERTFMT_FLOAT:
+		return 4;
+	case VERTFMT_UNORM16:
+	case VERTFMT_SNORM16:
+	case VERTFMT_HALF:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+uint32_t vertfmt_size(int format, int size, uint32_t type) {
+	uint32_t bytes = size * (format == VERTFMT_RAW ? type_size(type) : format_size(format));
+	return (bytes + 3) & ~3;
+}
+
+static uint16_t to_half(float f) {
+	union {
+		float f;
+		uint32_t u;
+	} c = {f};
+	uint32_t sign = (c.u >> 16) & 0x8000;
+	int32_t exp = (int32_t)((c.u >> 23) & 0xFF) - 127 + 15;
+	uint32_t mant = c.u & 0x7FFFFF;
+	if (exp >= 31)
+		return sign | 0x7C00; // Infinity, never within a tolerance
+	if (exp <= 0) {
+		if (exp < -10)
+			return sign;
+		mant |= 0x800000;
+		uint32_t shift = 14 - exp;
+		uint32_t h = mant >> shift;
+		if ((mant >> (shift - 1)) & 1)
+			h++;
+		return sign | h;
+	}
+	uint32_t h = sign | (exp << 10) | (mant >> 13);
+	if (mant & 0x1000)
+		h++; // Carries into the exponent when it has to
+	return h;
+}
+
+static float from_half(uint16_t h) {
+	uint32_t exp = (h >> 10) & 0x1F, mant = h & 0x3FF;
+	float f;
+	if (!exp)
+		f = ldexpf(mant, -24);
+	else if (exp == 31)
+		f = INFINITY;
+	else
+		f = ldexpf(mant | 0x400, exp - 25);
+	return h & 0x8000 ? -f : f;
+}
+
+static inline long quantize(float f, float scale, long lo, long hi) {
+	long v = lroundf(f * scale);
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void pack_component(float f, int format, uint8_t *p) {
+	switch (format) {
+	case VERTFMT_FLOAT:
+		memcpy(p, &f, 4);
+		break;
+	case VERTFMT_UNORM8:
+		*p = quantize(f, 255.0f, 0, 255);
+		break;
+	case VERTFMT_SNORM8:
+		*(int8_t *)p = quantize(f, 127.0f, -127, 127);
+		break;
+	case VERTFMT_UNORM16: {
+		uint16_t v = quantize(f, 65535.0f, 0, 65535);
+		memcpy(p, &v, 2);
+		break;
+	}
+	case VERTFMT_SNORM16: {
+		int16_t v = quantize(f, 32767.0f, -32767, 32767);
+		memcpy(p, &v, 2);
+		break;
+	}
+	case VERTFMT_HALF: {
+		uint16_t v = to_half(f);
+		memcpy(p, &v, 2);
+		break;
+	}
+	}
+}
+
+float vertfmt_decode(const uint8_t *p, int format, int comp) {
+	p += comp * format_size(format);
+	switch (format) {
+	case VERTFMT_FLOAT: {
+		float f;
+		memcpy(&f, p, 4);
+		return f;
+	}
+	case VERTFMT_UNORM8:
+		return *p / 255.0f;
+	case VERTFMT_SNORM8:
+		return fmaxf(*(const int8_t *)p / 127.0f, -1.0f);
+	case VERTFMT_UNORM16: {
+		uint16_t v;
+		memcpy(&v, p, 2);
+		return v / 65535.0f;
+	}
+	case VERTFMT_SNORM16: {
+		int16_t v;
+		memcpy(&v, p, 2);
+		return fmaxf(v / 32767.0f, -1.0f);
+	}
+	case VERTFMT_HALF: {
+		uint16_t v;
+		memcpy(&v, p, 2);
+		return from_half(v);
+	}
+	default:
+		return 0.0f;
+	}
+}
+
+static inline float source_component(const uint8_t *data, uint32_t v, uint32_t stride, const vertfmt_attrib *a, int comp) {
+	float f;
+	memcpy(&f, data + v * stride + a->offset + comp * 4, 4);
+	return f;
+}
+
+// Largest difference the format makes over the data, NaN and infinities never fit
+static float format_error(const uint8_t *data, uint32_t verts, uint32_t stride, const vertfmt_attrib *a, int format) {
+	float error = 0.0f;
+	uint8_t p[4];
+	for (uint32_t v = 0; v < verts; v++) {
+		for (int c = 0; c < a->size; c++) {
+			float f = source_component(data, v, stride, a, c);
+			pack_component(f, format, p);
+			float e = fabsf(vertfmt_decode(p, format, 0) - f);
+			if (!(e <= error)) {
+				if (!isfinite(e))
+					return INFINITY;
+				error = e;
+			}
+		}
+	}
+	return error;
+}
+
+static int pick_format(const uint8_t *data, uint32_t verts, uint32_t stride, vertfmt_attrib *a) {
+	a->error = 0.0f;
+	if (a->type != GL_FLOAT)
+		return VERTFMT_RAW;
+	float tolerance = vertfmt_tolerance(a->location);
+	if (tolerance <= 0.0f)
+		return VERTFMT_FLOAT;
+
+	float lo = INFINITY, hi = -INFINITY;
+	for (uint32_t v = 0; v < verts; v++) {
+		for (int c = 0; c < a->size; c++) {
+			float f = source_component(data, v, stride, a, c);
+			if (!isfinite(f))
+				return VERTFMT_FLOAT;
+			lo = fminf(lo, f);
+			hi = fmaxf(hi, f);
+		}
+	}
+
+	// Smallest first, the formats that can't hold the range are skipped
+	static const int candidates[] = {VERTFMT_UNORM8, VERTFMT_SNORM8, VERTFMT_UNORM16, VERTFMT_SNORM16, VERTFMT_HALF};
+	for (size_t i = 0; i < sizeof(candidates) / sizeof(*candidates); i++) {
+		int format = candidates[i];
+		if ((format == VERTFMT_UNORM8 || format == VERTFMT_UNORM16) && (lo < 0.0f || hi > 1.0f))
+			continue;
+		if ((format == VERTFMT_SNORM8 || format == VERTFMT_SNORM16) && (lo < -1.0f || hi > 1.0f))
+			continue;
+		float error = format_error(data, verts, stride, a, format);
+		if (error <= tolerance) {
+			a->error = error;
+			return format;
+		}
+	}
+	return VERTFMT_FLOAT;
+}
+
+uint32_t vertfmt_layout(const uint8_t *data, uint32_t verts, uint32_t stride, vertfmt_attrib *attribs, int n) {
+	uint32_t packed_stride = 0;
+	for (int i = 0; i < n; i++) {
+		vertfmt_attrib *a = &attribs[i];
+		a->format = pick_format(data, verts, stride, a);
+		a->packed_offset = packed_stride;
+		packed_stride += vertfmt_size(a->format, a->size, a->type);
+	}
+	return packed_stride;
+}
+
+void vertfmt_pack(const uint8_t *data, uint32_t verts, uint32_t stride, const vertfmt_attrib *attribs, int n,
+	uint32_t packed_stride, uint8_t *out) {
+	memset(out, 0, verts * packed_stride);
+	for (int i = 0; i < n; i++) {
+		const vertfmt_attrib *a = &attribs[i];
+		uint32_t csize = format_size(a->format);
+		for (uint32_t v = 0; v < verts; v++) {
+			uint8_t *dst = out + v * packed_stride + a->packed_offset;
+			if (a->format == VERTFMT_RAW) {
+				memcpy(dst, data + v * stride + a->offset, a->size * type_size(a->type));
+				continue;
+			}
+			for (int c = 0; c < a->size; c++)
+				pack_component(source_component(data, v, stride, a, c), a->format, dst + c * csize);
+		}
+	}
+}
+
+uint32_t vertfmt_gl_type(const vertfmt_attrib *a, int *normalized) {
+	*normalized = a->format != VERTFMT_FLOAT && a->format != VERTFMT_HALF;
+	switch (a->format) {
+	case VERTFMT_FLOAT:
+		return GL_FLOAT;
+	case VERTFMT_UNORM8:
+		return GL_UNSIGNED_BYTE;
+	case VERTFMT_SNORM8:
+		return GL_BYTE;
+	case VERTFMT_UNORM16:
+		return GL_UNSIGNED_SHORT;
+	case VERTFMT_SNORM16:
+		return GL_SHORT;
+	case VERTFMT_HALF:
+		return GL_HALF_FLOAT_OES;
+	default:
+		*normalized = a->normalized;
+		return a->type;
+	}
+}
+
+#ifdef __vita__
+
+#define MAX_ATTRIBS 16
+#define MAX_BUFFERS 1024 // Power of two
+
+enum {
+	BUFFER_FREE,
+	BUFFER_KEPT, // Waiting for its first draw
+	BUFFER_PACKED,
+	BUFFER_LEFT, // Nothing to gain, or a layout that can't be packed
+};
+
+typedef struct {
+	GLint size;
+	GLenum type;
+	GLboolean normalized;
+	GLsizei stride;
+	const void *pointer;
+	GLuint buffer;
+} pointer_spec;
+
+typedef struct {
+	GLuint name; // 0 for free slots, slots stay with their name once taken
+	int state;
+	uint32_t size;
+	uint8_t *data; // Only while kept
+	GLuint packed;
+	uint32_t stride, packed_stride;
+	vertfmt_attrib attribs[VERTFMT_ATTRIBS];
+	int num_attribs;
+	int bounded;
+	uint32_t bounds_offset; // Of the positions the bounds are for
+	float bounds[6]; // Min and max
+} vertex_buffer;
+
+// Only touched by the GL thread. Pointers are specified to GL at draw time, current is what GL has.
+static pointer_spec game[MAX_ATTRIBS], current[MAX_ATTRIBS];
+static uint32_t enabled = 0, current_valid = 0;
+static vertex_buffer buffers[MAX_BUFFERS];
+static int num_buffers = 0;
+static uint32_t kept_bytes = 0, frame_bytes = 0;
+
+static uint32_t stat_draws, stat_packed_draws;
+static uint64_t stat_saved_bytes;
+static uint32_t stat_buffers, stat_original_bytes, stat_packed_bytes;
+
+void vertfmt_bind_attribs(GLuint program) {
+	for (int i = 0; i < VERTFMT_ATTRIBS; i++)
+		glBindAttribLocation(program, i, attrib_info[i].name);
+}
+
+void glVertexAttribPointer_hook(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer) {
+	if (index >= MAX_ATTRIBS) {
+		glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+		return;
+	}
+	game[index] = (pointer_spec){size, type, normalized, stride, pointer, batch_array_buffer()};
+}
+
+void glEnableVertexAttribArray_hook(GLuint index) {
+	if (index < MAX_ATTRIBS)
+		enabled |= 1 << index;
+	glEnableVertexAttribArray(index);
+}
+
+void glDisableVertexAttribArray_hook(GLuint index) {
+	if (index < MAX_ATTRIBS)
+		enabled &= ~(1 << index);
+	glDisableVertexAttribArray(index);
+}
+
+static vertex_buffer *find_buffer(GLuint name, int add) {
+	for (uint32_t i = name * 2654435761u;; i++) {
+		vertex_buffer *b = &buffers[i & (MAX_BUFFERS - 1)];
+		if (b->name == name)
+			return b;
+		if (!b->name) {
+			if (!add || num_buffers >= MAX_BUFFERS * 3 / 4)
+				return NULL;
+			num_buffers++;
+			b->name = name;
+			return b;
+		}
+	}
+}
+
+void vertfmt_forget(GLuint name) {
+	// The name can come back as a new buffer, GL has to be told the pointers again even if they look the same
+	for (int i = 0; i < MAX_ATTRIBS; i++) {
+		if (current[i].buffer == name)
+			current_valid &= ~(1 << i);
+	}
+	vertex_buffer *b = find_buffer(name, 0);
+	if (!b || b->state == BUFFER_FREE)
+		return;
+	if (b->state == BUFFER_PACKED) {
+		for (int i = 0; i < MAX_ATTRIBS; i++) {
+			if (current[i].buffer == b->packed)
+				current_valid &= ~(1 << i);
+		}
+		glDeleteBuffers(1, &b->packed);
+		stat_buffers--;
+		stat_original_bytes -= b->size;
+		stat_packed_bytes -= b->size / b->stride * b->packed_stride;
+	}
+	if (b->data) {
+		kept_bytes -= b->size;
+		free(b->data);
+		b->data = NULL;
+	}
+	b->state = BUFFER_FREE;
+}
+
+void vertfmt_invalidate(void) {
+	current_valid = 0;
+}
+
+void vertfmt_buffer_data(GLuint name, GLsizeiptr size, const void *data, GLenum usage) {
+	vertfmt_forget(name);
+	if (!name || !data || usage != GL_STATIC_DRAW || size <= 0 || kept_bytes + size > VERTFMT_KEEP_KB * 1024)
+		return;
+	vertex_buffer *b = find_buffer(name, 1);
+	if (b && (b->data = malloc(size))) {
+		memcpy(b->data, data, size);
+		b->size = size;
+		b->state = BUFFER_KEPT;
+		kept_bytes += size;
+	}
+}
+
+static void pack(vertex_buffer *b, GLsizei stride) {
+	b->state = BUFFER_LEFT;
+	b->num_attribs = 0;
+	uint32_t end = 0;
+	for (int i = 0; i < VERTFMT_ATTRIBS; i++) {
+		if (!(enabled & (1 << i)))
+			continue;
+		vertfmt_attrib *a = &b->attribs[b->num_attribs++];
+		memset(a, 0, sizeof(*a));
+		a->offset = (uintptr_t)game[i].pointer;
+		a->size = game[i].size;
+		a->type = game[i].type;
+		a->normalized = game[i].normalized;
+		a->location = i;
+		if (a->offset + a->size * type_size(a->type) > end)
+			end = a->offset + a->size * type_size(a->type);
+	}
+
+	uint8_t *out = NULL;
+	b->bounded = 0;
+	if (end <= b->size) {
+		uint32_t verts = (b->size - end) / stride + 1;
+		const pointer_spec *p = &game[0];
+		if ((enabled & 1) && p->type == GL_FLOAT && p->size >= 3) {
+			const uint8_t *v = b->data + (uintptr_t)p->pointer;
+			float *bounds = b->bounds;
+			memcpy(bounds, v, 3 * sizeof(float));
+			memcpy(bounds + 3, v, 3 * sizeof(float));
+			for (uint32_t i = 1; i < verts; i++) {
+				float pos[3];
+				memcpy(pos, v + i * stride, sizeof(pos));
+				for (int k = 0; k < 3; k++) {
+					if (pos[k] < bounds[k])
+						bounds[k] = pos[k];
+					if (pos[k] > bounds[k + 3])
+						bounds[k + 3] = pos[k];
+				}
+			}
+			b->bounds_offset = (uintptr_t)p->pointer;
+			b->stride = stride;
+			b->bounded = 1;
+		}
+		uint32_t packed_stride = vertfmt_layout(b->data, verts, stride, b->attribs, b->num_attribs);
+		if (packed_stride < (uint32_t)stride && (out = malloc(verts * packed_stride))) {
+			vertfmt_pack(b->data, verts, stride, b->attribs, b->num_attribs, packed_stride, out);
+			glGenBuffers(1, &b->packed);
+			glBindBuffer(GL_ARRAY_BUFFER, b->packed);
+			glBufferData(GL_ARRAY_BUFFER, verts * packed_stride, out, GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, batch_array_buffer());
+			b->stride = stride;
+			b->packed_stride = packed_stride;
+			b->state = BUFFER_PACKED;
+			stat_buffers++;
+			stat_original_bytes += b->size;
+			stat_packed_bytes += b->size / stride * packed_stride;
+			free(out);
+		}
+	}
+	// Other layouts over the same buffer draw from the original
+	kept_bytes -= b->size;
+	free(b->data);
+	b->data = NULL;
+}
+
+// The buffer every enabled attribute of the draw reads from when it has a packed copy holding them all
+static vertex_buffer *packed_buffer(void) {
+	if (!enabled || (enabled >> VERTFMT_ATTRIBS) || !glstate_program())
+		return NULL;
+	GLuint buffer = 0;
+	GLsizei stride = 0;
+	for (int i = 0; i < VERTFMT_ATTRIBS; i++) {
+		if (!(enabled & (1 << i)))
+			continue;
+		const pointer_spec *s = &game[i];
+		uint32_t bytes = s->size * type_size(s->type);
+		// Interleaved in one buffer, tightly packed arrays can't share one
+		if (!s->buffer || !s->stride || !bytes || (uintptr_t)s->pointer + bytes > (uint32_t)s->stride)
+			return NULL;
+		if (buffer && (s->buffer != buffer || s->stride != stride))
+			return NULL;
+		buffer = s->buffer;
+		stride = s->stride;
+	}
+
+	vertex_buffer *b = find_buffer(buffer, 0);
+	if (!b)
+		return NULL;
+	if (b->state == BUFFER_KEPT) {
+		if (frame_bytes && frame_bytes + b->size > VERTFMT_FRAME_KB * 1024)
+			return NULL;
+		frame_bytes += b->size;
+		pack(b, stride);
+	}
+	if (b->state != BUFFER_PACKED || b->stride != (uint32_t)stride)
+		return NULL;
+	for (int i = 0; i < VERTFMT_ATTRIBS; i++) {
+		if (!(enabled & (1 << i)))
+			continue;
+		int j;
+		for (j = 0; j < b->num_attribs; j++) {
+			const vertfmt_attrib *a = &b->attribs[j];
+			if (a->location == i && a->offset == (uintptr_t)game[i].pointer && a->size == game[i].size
+				&& a->type == game[i].type && a->normalized == game[i].normalized)
+				break;
+		}
+		if (j == b->num_attribs)
+			return NULL;
+	}
+	return b;
+}
+
+int vertfmt_bounds(float *bounds) {
+	const pointer_spec *p = &game[0];
+	if (!(enabled & 1) || !p->buffer || p->type != GL_FLOAT || p->size < 3)
+		return 0;
+	vertex_buffer *b = find_buffer(p->buffer, 0);
+	if (!b || (b->state != BUFFER_PACKED && b->state != BUFFER_LEFT) || !b->bounded
+		|| b->bounds_offset != (uintptr_t)p->pointer || b->stride != (uint32_t)p->stride)
+		return 0;
+	memcpy(bounds, b->bounds, sizeof(b->bounds));
+	return 1;
+}
+
+static int same_spec(const pointer_spec *a, const pointer_spec *b) {
+	return a->size == b->size && a->type == b->type && a->normalized == b->normalized && a->stride == b->stride
+		&& a->pointer == b->pointer && a->buffer == b->buffer;
+}
+
+void vertfmt_apply(uint32_t vertices) {
+	if (!enabled)
+		return;
+	pointer_spec packed[VERTFMT_ATTRIBS];
+	vertex_buffer *b = packed_buffer();
+	if (b) {
+		for (int j = 0; j < b->num_attribs; j++) {
+			const vertfmt_attrib *a = &b->attribs[j];
+			int normalized;
+			GLenum type = vertfmt_gl_type(a, &normalized);
+			packed[a->location] = (pointer_spec){a->size, type, normalized, b->packed_stride,
+				(const void *)(uintptr_t)a->packed_offset, b->packed};
+		}
+		stat_packed_draws++;
+		stat_saved_bytes += (uint64_t)(b->stride - b->packed_stride) * vertices;
+	}
+	if (glstate_program())
+		stat_draws++;
+
+	GLuint bound = batch_array_buffer();
+	for (int i = 0; i < MAX_ATTRIBS; i++) {
+		if (!(enabled & (1 << i)))
+			continue;
+		const pointer_spec *s = b && i < VERTFMT_ATTRIBS ? &packed[i] : &game[i];
+		if ((current_valid & (1 << i)) && same_spec(&current[i], s))
+			continue;
+		if (s->buffer != bound) {
+			glBindBuffer(GL_ARRAY_BUFFER, s->buffer);
+			bound = s->buffer;
+		}
+		glVertexAttribPointer(i, s->size, s->type, s->normalized, s->stride, s->pointer);
+		current[i] = *s;
+		current_valid |= 1 << i;
+	}
+	if (bound != batch_array_buffer())
+		glBindBuffer(GL_ARRAY_BUFFER, batch_array_buffer());
+}
+
+void vertfmt_frame(void) {
+	frame_bytes = 0;
+}
+
+void vertfmt_report(uint32_t frames) {
+	if (stat_draws) {
+		debugPrintf("vertfmt: %u of %u draws per frame packed, %u buffers with %u KB of packed copies kept beside %u KB of originals, up to %llu KB less vertex data fetched per frame\n",
+			stat_packed_draws / frames, stat_draws / frames, stat_buffers, stat_packed_bytes / 1024,
+			stat_original_bytes / 1024, (unsigned long long)(stat_saved_bytes / frames / 1024));
+	}
+	stat_draws = stat_packed_draws = 0;
+	stat_saved_bytes = 0;
+}
+
+#endif
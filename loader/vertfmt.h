@@ -0,0 +1,68 @@
+#ifndef __VERTFMT_H__
+#define __VERTFMT_H__
+
+#include <stdint.h>
+
+#define VERTFMT_ATTRIBS 5 // Locations glLinkProgram_hook binds, see vertfmt_bind_attribs
+
+enum {
+	VERTFMT_RAW, // Copied as it is, not a float attribute
+	VERTFMT_FLOAT,
+	VERTFMT_UNORM8,
+	VERTFMT_SNORM8,
+	VERTFMT_UNORM16,
+	VERTFMT_SNORM16,
+	VERTFMT_HALF,
+};
+
+typedef struct {
+	uint32_t offset; // In the source vertex
+	int size; // Components
+	uint32_t type; // GL type in the source
+	int normalized;
+	int location;
+	int format; // Picked by vertfmt_layout
+	uint32_t packed_offset;
+	float error; // Largest difference the packed format makes on the data
+} vertfmt_attrib;
+
+/*
+ * Packing of float vertex attributes into smaller formats. Every attribute gets the smallest format
+ * whose error over the actual data stays under the tolerance of its location, positions stay floats.
+ */
+
+const char *vertfmt_attrib_name(int location);
+float vertfmt_tolerance(int location);
+// Bytes of one packed attribute, padded to 4
+uint32_t vertfmt_size(int format, int size, uint32_t type);
+// Picks formats and packed offsets for attribs over verts vertices of data, returns the packed stride
+uint32_t vertfmt_layout(const uint8_t *data, uint32_t verts, uint32_t stride, vertfmt_attrib *attribs, int n);
+void vertfmt_pack(const uint8_t *data, uint32_t verts, uint32_t stride, const vertfmt_attrib *attribs, int n,
+	uint32_t packed_stride, uint8_t *out);
+// Component comp of a packed float attribute as the GPU reads it
+float vertfmt_decode(const uint8_t *p, int format, int comp);
+// GL type and normalized flag the packed attribute is specified with
+uint32_t vertfmt_gl_type(const vertfmt_attrib *a, int *normalized);
+
+#ifdef __vita__
+#include <vitaGL.h>
+
+void vertfmt_bind_attribs(GLuint program);
+void glVertexAttribPointer_hook(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer);
+void glEnableVertexAttribArray_hook(GLuint index);
+void glDisableVertexAttribArray_hook(GLuint index);
+
+// Static vertex buffers are kept until their first draw gives them a layout to pack
+void vertfmt_buffer_data(GLuint name, GLsizeiptr size, const void *data, GLenum usage);
+void vertfmt_forget(GLuint name);
+// Forces every attribute pointer through on the next draw, after GL got used behind the hooks
+void vertfmt_invalidate(void);
+// Specifies the attribute pointers for the draw, packed ones when there are, before every draw
+void vertfmt_apply(uint32_t vertices);
+// Box around every position in the buffer the draw reads its positions from, when known
+int vertfmt_bounds(float *bounds);
+void vertfmt_frame(void);
+void vertfmt_report(uint32_t frames);
+#endif
+
+#endif
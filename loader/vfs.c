@@ -0,0 +1,494 @@
+/* vfs.c -- in-memory metadata index of the data folder
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "vfs.h"
+#include "hash.h"
+#include "archive.h"
+
+#define VFS_MAGIC 0x53465652 // RVFS
+#define VFS_VERSION 1
+#define VFS_SNAPSHOT DATA_PATH "/vfs.bin"
+
+#define VFS_DIR      0x1
+#define VFS_DELETED  0x2
+#define VFS_VOLATILE 0x4 // Written by the game, its size must be asked to the filesystem
+#define VFS_ARCHIVE  0x8 // Only available inside the assets archive
+
+#define VFS_PATH_MAX 512
+
+typedef struct {
+	uint32_t hash;
+	uint32_t path; // Offset in the string pool, relative to DATA_PATH
+	uint32_t flags;
+	uint32_t size;
+	uint64_t mtime; // Only tracked for directories
+	int32_t parent;
+	int32_t first_child;
+	int32_t last_child;
+	int32_t next_sibling;
+} vfs_node;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_nodes;
+	uint32_t pool_size;
+} vfs_header;
+
+static pthread_mutex_t vfs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int vfs_ready = 0;
+
+static vfs_node *nodes = NULL;
+static uint32_t num_nodes = 0, max_nodes = 0;
+static char *pool = NULL;
+static uint32_t pool_size = 0, max_pool = 0;
+static int32_t *buckets = NULL;
+static uint32_t num_buckets = 0;
+
+static uint64_t pack_time(const SceDateTime *t) {
+	return ((uint64_t)t->year << 52) | ((uint64_t)t->month << 48) | ((uint64_t)t->day << 43) |
+		((uint64_t)t->hour << 38) | ((uint64_t)t->minute << 32) | ((uint64_t)t->second << 26) |
+		(uint64_t)t->microsecond;
+}
+
+// Turns an absolute path into its location relative to DATA_PATH
+int vfs_relpath(const char *path, char *out, size_t out_size) {
+	if (strncasecmp(path, "ux0:", 4))
+		return 0;
+	path += 4;
+
+	size_t len = 0;
+	while (*path) {
+		while (*path == '/' || *path == '\\')
+			path++;
+		if (!*path)
+			break;
+		const char *seg = path;
+		while (*path && *path != '/' && *path != '\\')
+			path++;
+		size_t seg_len = path - seg;
+
+		if (seg_len == 1 && seg[0] == '.')
+			continue;
+		if (seg_len == 2 && seg[0] == '.' && seg[1] == '.') {
+			while (len > 0 && out[len - 1] != '/')
+				len--;
+			if (len > 0)
+				len--;
+			continue;
+		}
+
+		if (len + seg_len + 2 > out_size)
+			return 0;
+		if (len)
+			out[len++] = '/';
+		memcpy(out + len, seg, seg_len);
+		len += seg_len;
+	}
+	out[len] = 0;
+
+	const char *root = DATA_PATH + 4;
+	size_t root_len = strlen(root);
+	if (strncasecmp(out, root, root_len) || (out[root_len] && out[root_len] != '/'))
+		return 0;
+	if (out[root_len])
+		root_len++;
+	memmove(out, out + root_len, len - root_len + 1);
+	return 1;
+}
+
+static int32_t find_node(const char *rel, uint32_t hash) {
+	if (!num_buckets)
+		return -1;
+	uint32_t mask = num_buckets - 1;
+	for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+		int32_t n = buckets[i];
+		if (n < 0)
+			return -1;
+		if (nodes[n].hash == hash && !strcasecmp(pool + nodes[n].path, rel))
+			return n;
+	}
+}
+
+static void insert_bucket(int32_t n) {
+	uint32_t mask = num_buckets - 1;
+	uint32_t i = nodes[n].hash & mask;
+	while (buckets[i] >= 0)
+		i = (i + 1) & mask;
+	buckets[i] = n;
+}
+
+static void rehash(uint32_t count) {
+	uint32_t size = 1024;
+	while (size < count * 2)
+		size <<= 1;
+	if (size <= num_buckets)
+		return;
+
+	free(buckets);
+	buckets = malloc(size * sizeof(int32_t));
+	num_buckets = size;
+	memset(buckets, 0xFF, size * sizeof(int32_t));
+	for (uint32_t i = 0; i < num_nodes; i++)
+		insert_bucket(i);
+}
+
+static int32_t new_node(const char *rel, int32_t parent, uint32_t flags, uint32_t size, uint64_t mtime) {
+	size_t len = strlen(rel) + 1;
+	if (num_nodes == max_nodes) {
+		max_nodes = max_nodes ? max_nodes * 2 : 4096;
+		nodes = realloc(nodes, max_nodes * sizeof(vfs_node));
+	}
+	while (pool_size + len > max_pool) {
+		max_pool = max_pool ? max_pool * 2 : 128 * 1024;
+		pool = realloc(pool, max_pool);
+	}
+
+	int32_t n = num_nodes++;
+	vfs_node *node = &nodes[n];
+	node->hash = path_hash(rel);
+	node->path = pool_size;
+	node->flags = flags;
+	node->size = size;
+	node->mtime = mtime;
+	node->parent = parent;
+	node->first_child = node->last_child = node->next_sibling = -1;
+	memcpy(pool + pool_size, rel, len);
+	pool_size += len;
+
+	if (parent >= 0) {
+		if (nodes[parent].last_child >= 0)
+			nodes[nodes[parent].last_child].next_sibling = n;
+		else
+			nodes[parent].first_child = n;
+		nodes[parent].last_child = n;
+	}
+
+	if (num_nodes * 2 > num_buckets)
+		rehash(num_nodes);
+	else
+		insert_bucket(n);
+	return n;
+}
+
+static void scan_dir(int32_t dir, const char *abs, const char *rel) {
+	char child_abs[VFS_PATH_MAX], child_rel[VFS_PATH_MAX];
+	SceIoStat stat;
+	if (sceIoGetstat(abs, &stat) >= 0)
+		nodes[dir].mtime = pack_time(&stat.st_mtime);
+
+	SceUID d = sceIoDopen(abs);
+	if (d < 0)
+		return;
+	SceIoDirent entry;
+	while (sceIoDread(d, &entry) > 0) {
+		if (snprintf(child_rel, sizeof(child_rel), rel[0] ? "%s/%s" : "%s%s", rel, entry.d_name) >= sizeof(child_rel))
+			continue;
+		int is_dir = SCE_S_ISDIR(entry.d_stat.st_mode);
+		new_node(child_rel, dir, is_dir ? VFS_DIR : 0, is_dir ? 0 : (uint32_t)entry.d_stat.st_size, 0);
+	}
+	sceIoDclose(d);
+
+	// Recurse only after closing the handle so that we never keep more than one directory open
+	for (int32_t n = nodes[dir].first_child; n >= 0; n = nodes[n].next_sibling) {
+		if (nodes[n].flags & VFS_DIR) {
+			snprintf(child_rel, sizeof(child_rel), "%s", pool + nodes[n].path);
+			snprintf(child_abs, sizeof(child_abs), "%s/%s", DATA_PATH, child_rel);
+			scan_dir(n, child_abs, child_rel);
+		}
+	}
+}
+
+static void save_snapshot(void) {
+	SceUID fd = sceIoOpen(VFS_SNAPSHOT, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd < 0)
+		return;
+	vfs_header hdr = {VFS_MAGIC, VFS_VERSION, num_nodes, pool_size};
+	sceIoWrite(fd, &hdr, sizeof(hdr));
+	sceIoWrite(fd, nodes, num_nodes * sizeof(vfs_node));
+	sceIoWrite(fd, pool, pool_size);
+	sceIoClose(fd);
+
+	// Writing the snapshot may have touched the root folder timestamp
+	SceIoStat stat;
+	if (sceIoGetstat(DATA_PATH, &stat) >= 0 && nodes[0].mtime != pack_time(&stat.st_mtime)) {
+		nodes[0].mtime = pack_time(&stat.st_mtime);
+		fd = sceIoOpen(VFS_SNAPSHOT, SCE_O_WRONLY, 0777);
+		if (fd >= 0) {
+			sceIoPwrite(fd, &nodes[0], sizeof(vfs_node), sizeof(hdr));
+			sceIoClose(fd);
+		}
+	}
+}
+
+static int load_snapshot(void) {
+	SceUID fd = sceIoOpen(VFS_SNAPSHOT, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return 0;
+	SceOff size = sceIoLseek(fd, 0, SCE_SEEK_END);
+	sceIoLseek(fd, 0, SCE_SEEK_SET);
+	if (size < sizeof(vfs_header)) {
+		sceIoClose(fd);
+		return 0;
+	}
+	uint8_t *buf = malloc(size);
+	int read_size = sceIoRead(fd, buf, size);
+	sceIoClose(fd);
+
+	vfs_header *hdr = (vfs_header *)buf;
+	if (read_size != size || hdr->magic != VFS_MAGIC || hdr->version != VFS_VERSION || hdr->num_nodes == 0 ||
+		size != sizeof(vfs_header) + hdr->num_nodes * sizeof(vfs_node) + hdr->pool_size) {
+		free(buf);
+		return 0;
+	}
+
+	num_nodes = max_nodes = hdr->num_nodes;
+	pool_size = max_pool = hdr->pool_size;
+	nodes = malloc(num_nodes * sizeof(vfs_node));
+	pool = malloc(pool_size);
+	memcpy(nodes, buf + sizeof(vfs_header), num_nodes * sizeof(vfs_node));
+	memcpy(pool, buf + sizeof(vfs_header) + num_nodes * sizeof(vfs_node), pool_size);
+	free(buf);
+
+	// Any file added, removed or renamed outside of the game changes its folder timestamp
+	char abs[VFS_PATH_MAX];
+	SceIoStat stat;
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		// Archived entries get mounted again after loading, the archive may have changed meanwhile
+		if (nodes[i].flags & VFS_ARCHIVE)
+			nodes[i].flags |= VFS_DELETED;
+		if ((nodes[i].flags & (VFS_DIR | VFS_DELETED)) != VFS_DIR)
+			continue;
+		snprintf(abs, sizeof(abs), i ? "%s/%s" : "%s%s", DATA_PATH, pool + nodes[i].path);
+		if (sceIoGetstat(abs, &stat) < 0 || pack_time(&stat.st_mtime) != nodes[i].mtime) {
+			debugPrintf("vfs: snapshot outdated at %s\n", abs);
+			free(nodes);
+			free(pool);
+			nodes = NULL;
+			pool = NULL;
+			num_nodes = max_nodes = pool_size = max_pool = 0;
+			return 0;
+		}
+	}
+
+	rehash(num_nodes);
+	return 1;
+}
+
+static int32_t add_archived(const char *rel, int is_dir, uint32_t size) {
+	char parent_rel[VFS_PATH_MAX];
+	int32_t n = find_node(rel, path_hash(rel));
+	if (n >= 0) {
+		// Loose files always take precedence over archived ones
+		if (nodes[n].flags & VFS_DELETED) {
+			nodes[n].flags = VFS_ARCHIVE | (is_dir ? VFS_DIR : 0);
+			nodes[n].size = size;
+		}
+		return n;
+	}
+
+	const char *slash = strrchr(rel, '/');
+	size_t len = slash ? slash - rel : 0;
+	memcpy(parent_rel, rel, len);
+	parent_rel[len] = 0;
+	int32_t parent = add_archived(parent_rel, 1, 0);
+	return new_node(rel, parent, VFS_ARCHIVE | (is_dir ? VFS_DIR : 0), size, 0);
+}
+
+void vfs_init(void) {
+	pthread_mutex_lock(&vfs_mutex);
+	if (!load_snapshot()) {
+		rehash(0);
+		new_node("", -1, VFS_DIR, 0, 0);
+		scan_dir(0, DATA_PATH, "");
+		save_snapshot();
+	}
+	for (int i = 0; i < archive_count(); i++) {
+		uint32_t size;
+		const char *name = archive_entry_name(i, &size);
+		if (strlen(name) < VFS_PATH_MAX)
+			add_archived(name, 0, size);
+	}
+	debugPrintf("vfs: indexed %u entries\n", num_nodes);
+	vfs_ready = 1;
+	pthread_mutex_unlock(&vfs_mutex);
+}
+
+int vfs_lookup(const char *path, uint32_t *size, int *is_dir) {
+	char rel[VFS_PATH_MAX];
+	if (!vfs_ready || !vfs_relpath(path, rel, sizeof(rel)))
+		return VFS_UNKNOWN;
+
+	int res = VFS_MISSING;
+	pthread_mutex_lock(&vfs_mutex);
+	int32_t n = find_node(rel, path_hash(rel));
+	if (n >= 0 && !(nodes[n].flags & VFS_DELETED)) {
+		if ((nodes[n].flags & VFS_VOLATILE) && size) {
+			res = VFS_UNKNOWN;
+		} else {
+			if (size)
+				*size = nodes[n].size;
+			if (is_dir)
+				*is_dir = (nodes[n].flags & VFS_DIR) ? 1 : 0;
+			res = (nodes[n].flags & (VFS_ARCHIVE | VFS_DIR)) == VFS_ARCHIVE ? VFS_ARCHIVED : VFS_FOUND;
+		}
+	}
+	pthread_mutex_unlock(&vfs_mutex);
+	return res;
+}
+
+uint64_t vfs_dir_mtime(const char *path) {
+	char rel[VFS_PATH_MAX];
+	if (!vfs_ready || !vfs_relpath(path, rel, sizeof(rel)))
+		return 0;
+
+	uint64_t mtime = 0;
+	pthread_mutex_lock(&vfs_mutex);
+	int32_t n = find_node(rel, path_hash(rel));
+	if (n >= 0 && (nodes[n].flags & (VFS_DIR | VFS_DELETED)) == VFS_DIR)
+		mtime = nodes[n].mtime;
+	pthread_mutex_unlock(&vfs_mutex);
+	return mtime;
+}
+
+int vfs_stamp(const char *path, uint32_t *size, uint64_t *mtime) {
+	static uint64_t archive_mtime = 0;
+	SceIoStat stat;
+	switch (vfs_lookup(path, size, NULL)) {
+	case VFS_ARCHIVED:
+		if (!archive_mtime && sceIoGetstat(DATA_PATH "/" ARCHIVE_NAME, &stat) >= 0)
+			archive_mtime = pack_time(&stat.st_mtime);
+		*mtime = archive_mtime;
+		return archive_mtime != 0;
+	case VFS_MISSING:
+		return 0;
+	default:
+		if (sceIoGetstat(path, &stat) < 0 || SCE_S_ISDIR(stat.st_mode))
+			return 0;
+		*size = stat.st_size;
+		*mtime = pack_time(&stat.st_mtime);
+		return 1;
+	}
+}
+
+int vfs_opendir(const char *path, int *dir) {
+	int is_dir;
+	char rel[VFS_PATH_MAX];
+	if (!vfs_ready || !vfs_relpath(path, rel, sizeof(rel)))
+		return VFS_UNKNOWN;
+
+	pthread_mutex_lock(&vfs_mutex);
+	int32_t n = find_node(rel, path_hash(rel));
+	is_dir = n >= 0 && (nodes[n].flags & (VFS_DIR | VFS_DELETED)) == VFS_DIR;
+	pthread_mutex_unlock(&vfs_mutex);
+
+	if (!is_dir)
+		return VFS_MISSING;
+	*dir = n;
+	return VFS_FOUND;
+}
+
+int vfs_readdir(int dir, int *cursor, char *name, int *is_dir) {
+	if (*cursor == -2)
+		return 0;
+
+	pthread_mutex_lock(&vfs_mutex);
+	int32_t n = *cursor == -1 ? nodes[dir].first_child : nodes[*cursor].next_sibling;
+	while (n >= 0 && (nodes[n].flags & VFS_DELETED))
+		n = nodes[n].next_sibling;
+	if (n < 0) {
+		*cursor = -2;
+		pthread_mutex_unlock(&vfs_mutex);
+		return 0;
+	}
+
+	const char *path = pool + nodes[n].path;
+	const char *base = strrchr(path, '/');
+	strncpy(name, base ? base + 1 : path, 255);
+	name[255] = 0;
+	*is_dir = (nodes[n].flags & VFS_DIR) ? 1 : 0;
+	*cursor = n;
+	pthread_mutex_unlock(&vfs_mutex);
+	return 1;
+}
+
+// Makes the index entry of a path (and its parents) match the filesystem, returns 1 if the tree layout changed
+static int refresh_node(const char *rel, int written) {
+	char abs[VFS_PATH_MAX], parent_rel[VFS_PATH_MAX];
+	snprintf(abs, sizeof(abs), rel[0] ? "%s/%s" : "%s%s", DATA_PATH, rel);
+
+	SceIoStat stat;
+	int exists = sceIoGetstat(abs, &stat) >= 0;
+	int32_t n = find_node(rel, path_hash(rel));
+	int changed = 0;
+
+	if (!exists) {
+		if (n >= 0 && !(nodes[n].flags & (VFS_DELETED | VFS_ARCHIVE))) {
+			// Removing a loose file makes its archived copy visible again
+			int entry = archive_lookup(abs);
+			if (entry >= 0) {
+				nodes[n].flags = VFS_ARCHIVE;
+				archive_entry_name(entry, &nodes[n].size);
+			} else {
+				nodes[n].flags |= VFS_DELETED;
+			}
+			changed = 1;
+		}
+	} else {
+		int is_dir = SCE_S_ISDIR(stat.st_mode);
+		if (n < 0) {
+			const char *slash = strrchr(rel, '/');
+			size_t len = slash ? slash - rel : 0;
+			memcpy(parent_rel, rel, len);
+			parent_rel[len] = 0;
+			refresh_node(parent_rel, 0);
+			int32_t parent = find_node(parent_rel, path_hash(parent_rel));
+			if (parent < 0)
+				return 0;
+			n = new_node(rel, parent, 0, 0, 0);
+			changed = 1;
+		} else if (nodes[n].flags & (VFS_DELETED | VFS_ARCHIVE)) {
+			changed = 1;
+		}
+		nodes[n].flags = (is_dir ? VFS_DIR : 0) | ((written || (nodes[n].flags & VFS_VOLATILE)) ? VFS_VOLATILE : 0);
+		nodes[n].size = is_dir ? 0 : (uint32_t)stat.st_size;
+		if (is_dir)
+			nodes[n].mtime = pack_time(&stat.st_mtime);
+	}
+
+	// Keep the parent timestamp in sync or the snapshot would be discarded at next boot, saves put in
+	// place by a rename touch it too
+	if ((changed || written) && n > 0) {
+		int32_t parent = nodes[n].parent;
+		snprintf(abs, sizeof(abs), parent ? "%s/%s" : "%s%s", DATA_PATH, pool + nodes[parent].path);
+		if (sceIoGetstat(abs, &stat) >= 0)
+			nodes[parent].mtime = pack_time(&stat.st_mtime);
+	}
+
+	return changed;
+}
+
+void vfs_refresh(const char *path, int written) {
+	char rel[VFS_PATH_MAX];
+	if (!vfs_ready || !vfs_relpath(path, rel, sizeof(rel)))
+		return;
+
+	pthread_mutex_lock(&vfs_mutex);
+	if (refresh_node(rel, written))
+		save_snapshot();
+	pthread_mutex_unlock(&vfs_mutex);
+}
@@ -0,0 +1,28 @@
+#ifndef __VFS_H__
+#define __VFS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+	VFS_UNKNOWN = -1, // Path is not covered by the index, ask the filesystem
+	VFS_MISSING = 0,
+	VFS_FOUND = 1,
+	VFS_ARCHIVED = 2, // Only available inside the assets archive
+};
+
+void vfs_init(void);
+
+int vfs_relpath(const char *path, char *out, size_t out_size);
+
+int vfs_lookup(const char *path, uint32_t *size, int *is_dir);
+uint64_t vfs_dir_mtime(const char *path);
+// Size and modification time of a file, archived files take the time of the archive
+int vfs_stamp(const char *path, uint32_t *size, uint64_t *mtime);
+
+int vfs_opendir(const char *path, int *dir);
+int vfs_readdir(int dir, int *cursor, char *name, int *is_dir);
+
+void vfs_refresh(const char *path, int written);
+
+#endif
@@ -65,8 +65,15 @@ int ProcessShadow(int i, float4 inPosition)
 }
 #endif  // SHADOW_BOX
 
+// LIGHT_COUNT and SHADOW_COUNT are defined by the loader for the variants it builds for exactly
+// that many lights and shadow boxes, with the loops unrolled
 float4 ProcessLights(float4 varColor, float4 inPosition, float3 inNormal)
 {
+  #ifdef LIGHT_COUNT
+  for (int i = 0; i < LIGHT_COUNT; ++i) {
+    varColor = ProcessLight(i, varColor, inPosition, inNormal);
+  }
+  #else
   for (int i = 0; i < MAX_LIGHTS; ++i) {
     if (i < numLights) {
       varColor = ProcessLight(i, varColor, inPosition, inNormal);
@@ -74,9 +81,15 @@ float4 ProcessLights(float4 varColor, float4 inPosition, float3 inNormal)
       break;
     }
   }
+  #endif  // LIGHT_COUNT
 
   #ifdef SHADOW_BOX
   int shadowFlag = 0;
+  #ifdef SHADOW_COUNT
+  for (int i = 0; i < SHADOW_COUNT; ++i) {
+    shadowFlag += ProcessShadow(i, inPosition);
+  }
+  #else
   for (int i = 0; i < MAX_SHADOWS; ++i) {
     if (i < numShadows) {
       shadowFlag += ProcessShadow(i, inPosition);
@@ -84,6 +97,7 @@ float4 ProcessLights(float4 varColor, float4 inPosition, float3 inNormal)
       break;
     }
   }
+  #endif  // SHADOW_COUNT
   if (shadowFlag > 0) {
     varColor.rgb += shadowColor;
   }
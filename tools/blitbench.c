@@ -0,0 +1,137 @@
+/* blitbench.c -- compares the loader pixel conversion kernels against SDL's blitters
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O3 -I../loader blitbench.c -o blitbench $(sdl2-config --cflags --libs)
+ * Usage: blitbench [size] [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <SDL.h>
+
+#include "pixconv.h"
+
+enum {
+	KERNEL_24TO32,
+	KERNEL_32TO32,
+	KERNEL_8TO32,
+	KERNEL_BLEND32,
+};
+
+static int size = 512, iterations = 50;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static SDL_Surface *random_surface(Uint32 format) {
+	SDL_Surface *s = SDL_CreateRGBSurfaceWithFormat(0, size, size, SDL_BITSPERPIXEL(format), format);
+	uint8_t *p = s->pixels;
+	for (int i = 0; i < s->pitch * s->h; i++)
+		p[i] = rand();
+	if (s->format->palette) {
+		SDL_Color colors[256];
+		for (int i = 0; i < 256; i++) {
+			colors[i].r = rand();
+			colors[i].g = rand();
+			colors[i].b = rand();
+			colors[i].a = 255;
+		}
+		SDL_SetPaletteColors(s->format->palette, colors, 0, 256);
+	}
+	return s;
+}
+
+// Runs the kernel over every row of src into dst
+static void run_kernel(int kernel, SDL_Surface *src, SDL_Surface *dst, int swap) {
+	uint32_t lut[256];
+	if (src->format->palette) {
+		for (int i = 0; i < 256; i++) {
+			SDL_Color *c = &src->format->palette->colors[i];
+			lut[i] = SDL_MapRGBA(dst->format, c->r, c->g, c->b, c->a);
+		}
+	}
+	for (int y = 0; y < size; y++) {
+		const uint8_t *s = (const uint8_t *)src->pixels + y * src->pitch;
+		uint8_t *d = (uint8_t *)dst->pixels + y * dst->pitch;
+		switch (kernel) {
+		case KERNEL_24TO32:
+			pixconv_24to32(s, d, size, swap);
+			break;
+		case KERNEL_32TO32:
+			pixconv_32to32(s, d, size, swap, 0);
+			break;
+		case KERNEL_8TO32:
+			pixconv_8to32(s, (uint32_t *)d, size, lut);
+			break;
+		default:
+			pixconv_blend32(s, d, size, swap);
+			break;
+		}
+	}
+}
+
+static void bench(const char *name, int kernel, Uint32 src_format, Uint32 dst_format, int swap, int blend) {
+	SDL_Surface *src = random_surface(src_format);
+	SDL_Surface *dst = random_surface(dst_format);
+	SDL_SetSurfaceBlendMode(src, blend ? SDL_BLENDMODE_BLEND : SDL_BLENDMODE_NONE);
+
+	double start = now();
+	for (int i = 0; i < iterations; i++) {
+		if (blend) {
+			SDL_BlitSurface(src, NULL, dst, NULL);
+		} else {
+			SDL_Surface *conv = SDL_ConvertSurfaceFormat(src, dst_format, 0);
+			SDL_FreeSurface(conv);
+		}
+	}
+	double sdl = now() - start;
+
+	start = now();
+	for (int i = 0; i < iterations; i++) {
+		if (blend) {
+			run_kernel(kernel, src, dst, swap);
+		} else {
+			SDL_Surface *conv = SDL_CreateRGBSurfaceWithFormat(0, size, size, 32, dst_format);
+			run_kernel(kernel, src, conv, swap);
+			SDL_FreeSurface(conv);
+		}
+	}
+	double fast = now() - start;
+
+	double mpix = (double)size * size * iterations / 1e6;
+	printf("%-24s SDL %8.1f Mpix/s   loader %8.1f Mpix/s   %.2fx\n", name, mpix / sdl, mpix / fast, sdl / fast);
+	SDL_FreeSurface(src);
+	SDL_FreeSurface(dst);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		size = atoi(argv[1]);
+	if (argc > 2)
+		iterations = atoi(argv[2]);
+	if (size < 1 || iterations < 1) {
+		printf("Usage: %s [size] [iterations]\n", argv[0]);
+		return 1;
+	}
+	SDL_Init(0);
+
+	printf("%dx%d surfaces, %d iterations\n", size, size, iterations);
+	bench("RGB24 -> ABGR8888", KERNEL_24TO32, SDL_PIXELFORMAT_RGB24, SDL_PIXELFORMAT_ABGR8888, 0, 0);
+	bench("BGR24 -> ABGR8888", KERNEL_24TO32, SDL_PIXELFORMAT_BGR24, SDL_PIXELFORMAT_ABGR8888, 1, 0);
+	bench("ARGB8888 -> ABGR8888", KERNEL_32TO32, SDL_PIXELFORMAT_ARGB8888, SDL_PIXELFORMAT_ABGR8888, 1, 0);
+	bench("INDEX8 -> ABGR8888", KERNEL_8TO32, SDL_PIXELFORMAT_INDEX8, SDL_PIXELFORMAT_ABGR8888, 0, 0);
+	bench("ARGB8888 blend ARGB8888", KERNEL_BLEND32, SDL_PIXELFORMAT_ARGB8888, SDL_PIXELFORMAT_ARGB8888, 0, 1);
+	bench("ABGR8888 blend ARGB8888", KERNEL_BLEND32, SDL_PIXELFORMAT_ABGR8888, SDL_PIXELFORMAT_ARGB8888, 1, 1);
+
+	SDL_Quit();
+	return 0;
+}
@@ -0,0 +1,147 @@
+/* decodebench.c -- measures serial against parallel image decoding over an assets folder
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 decodebench.c -o decodebench $(sdl2-config --cflags --libs) -lSDL2_image -lpthread
+ * Usage: decodebench <assets folder> [decoder threads]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <SDL.h>
+#include <SDL_image.h>
+
+typedef struct {
+	char *path; // Relative to the assets folder
+	uint8_t *data;
+	uint32_t size;
+} image_file;
+
+static image_file *files = NULL;
+static int num_files = 0, max_files = 0;
+static uint64_t total_bytes = 0;
+
+static pthread_mutex_t next_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int next_file;
+
+static int is_image(const char *name) {
+	const char *dot = strrchr(name, '.');
+	return dot && (!strcasecmp(dot, ".bmp") || !strcasecmp(dot, ".png") || !strcasecmp(dot, ".jpg") || !strcasecmp(dot, ".jpeg"));
+}
+
+// Images are read up front so that only decoding gets timed, as it is with prefetched files
+static void scan(const char *root, const char *rel) {
+	char abs[2048], child[1024];
+	snprintf(abs, sizeof(abs), rel[0] ? "%s/%s" : "%s%s", root, rel);
+	DIR *d = opendir(abs);
+	if (!d)
+		return;
+
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		snprintf(child, sizeof(child), rel[0] ? "%s/%s" : "%s%s", rel, de->d_name);
+		snprintf(abs, sizeof(abs), "%s/%s", root, child);
+
+		struct stat st;
+		if (stat(abs, &st) < 0)
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			scan(root, child);
+			continue;
+		}
+		if (!S_ISREG(st.st_mode) || !is_image(child))
+			continue;
+
+		FILE *f = fopen(abs, "rb");
+		if (!f)
+			continue;
+		if (num_files == max_files) {
+			max_files = max_files ? max_files * 2 : 1024;
+			files = realloc(files, max_files * sizeof(image_file));
+		}
+		image_file *img = &files[num_files];
+		img->size = st.st_size;
+		img->data = malloc(img->size ? img->size : 1);
+		if (fread(img->data, 1, img->size, f) == img->size) {
+			img->path = strdup(child);
+			total_bytes += img->size;
+			num_files++;
+		} else {
+			free(img->data);
+		}
+		fclose(f);
+	}
+	closedir(d);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void decode(image_file *img) {
+	const char *ext = strrchr(img->path, '.');
+	SDL_Surface *surf = IMG_LoadTyped_RW(SDL_RWFromConstMem(img->data, img->size), 1, ext + 1);
+	if (!surf)
+		printf("Cannot decode %s: %s\n", img->path, IMG_GetError());
+	SDL_FreeSurface(surf);
+}
+
+static void *decode_thread(void *arg) {
+	for (;;) {
+		pthread_mutex_lock(&next_mtx);
+		int i = next_file++;
+		pthread_mutex_unlock(&next_mtx);
+		if (i >= num_files)
+			return NULL;
+		decode(&files[i]);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("Usage: %s <assets folder> [decoder threads]\n", argv[0]);
+		return 1;
+	}
+	int num_threads = argc > 2 ? atoi(argv[2]) : 2;
+	if (num_threads < 1)
+		num_threads = 1;
+
+	IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG);
+	scan(argv[1], "");
+	printf("%d images, %.1f MB\n", num_files, total_bytes / (1024.0 * 1024.0));
+
+	double start = now();
+	for (int i = 0; i < num_files; i++)
+		decode(&files[i]);
+	double serial = now() - start;
+	printf("serial:    %8.3f s\n", serial);
+
+	// The game thread decodes alongside the pool, whatever the pool didn't get to yet
+	pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+	next_file = 0;
+	start = now();
+	for (int i = 0; i < num_threads; i++)
+		pthread_create(&threads[i], NULL, decode_thread, NULL);
+	decode_thread(NULL);
+	for (int i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	double parallel = now() - start;
+	printf("%d+1 threads: %8.3f s, %.2fx\n", num_threads, parallel, serial / parallel);
+
+	IMG_Quit();
+	return 0;
+}
@@ -0,0 +1,515 @@
+/* glcmdbench.c -- checks and times the split-thread renderer against a null GL backend
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -Iloader tools/glcmdbench.c loader/glcmd.c -o glcmdbench -lpthread
+ * Usage: glcmdbench [frames] [draws per frame] [backend us per draw] [game us per frame] [capture file]
+ *
+ * With a capture file, the frames after the first one of the split run get written there for glreplay.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "glcmd.h"
+
+/*
+ * The same pseudo random frames are played once straight into the null backend and once through
+ * glcmd. The backend hashes every call it gets along with the memory it reads, client arrays included,
+ * while the game side scribbles over that memory right after each call: a frame only hashes the same
+ * both ways when the calls arrived in order, with the data they had when they were made.
+ */
+
+#define MAX_ATTRIBS 4
+#define MAX_BUFFERS 8
+#define NUM_VERTICES 256
+#define TEX_SIZE 32
+
+enum {
+	ARRAY_VERTEX,
+	ARRAY_COLOR,
+	ARRAY_TEXCOORD,
+	NUM_FIXED,
+	NUM_ARRAYS = NUM_FIXED + MAX_ATTRIBS,
+};
+
+typedef struct {
+	GLint size;
+	GLenum type;
+	GLsizei stride;
+	const void *pointer;
+	GLuint buffer; // GL_ARRAY_BUFFER bound when the pointer was set
+	int enabled;
+} null_array;
+
+static int frames = 200, draws = 200, backend_us = 0, game_us = 0;
+
+// Null backend, only ever entered by one thread at a time
+static null_array arrays[NUM_ARRAYS];
+static GLuint array_buffer = 0;
+static uint8_t *buffers[MAX_BUFFERS];
+static uint64_t hash, *frame_hashes;
+static uint32_t executed, bad_syncs;
+
+// Game side
+static uint32_t issued, rng = 1;
+static int uploaded[MAX_BUFFERS];
+static float vertices[NUM_VERTICES * 4];
+static uint8_t colors[NUM_VERTICES * 4];
+static int16_t texcoords[NUM_VERTICES * 3]; // Strided, one short of padding
+static uint16_t indices[NUM_VERTICES * 3];
+static uint8_t pixels[TEX_SIZE * TEX_SIZE * 4];
+static float matrix[16];
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void spin(int us) {
+	double end = now() + us / 1e6;
+	while (now() < end)
+		;
+}
+
+static uint32_t next(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static void scribble(void *p, size_t size) {
+	uint8_t *b = p;
+	for (size_t i = 0; i < size; i++)
+		b[i] = next();
+}
+
+static void feed(uint32_t id, const void *data, size_t size) {
+	const uint8_t *b = data;
+	hash = (hash ^ id) * 1099511628211ull;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ b[i]) * 1099511628211ull;
+	executed++;
+}
+
+static int type_size(GLenum type) {
+	return type == GL_FLOAT ? 4 : type == GL_SHORT ? 2 : 1;
+}
+
+static void draw_vertex(uint32_t idx) {
+	for (int i = 0; i < NUM_ARRAYS; i++) {
+		null_array *a = &arrays[i];
+		if (!a->enabled)
+			continue;
+		int elem = a->size * type_size(a->type);
+		const uint8_t *base = a->buffer ? buffers[a->buffer] + (uintptr_t)a->pointer : a->pointer;
+		const uint8_t *v = base + idx * (a->stride ? a->stride : elem);
+		for (int j = 0; j < elem; j++)
+			hash = (hash ^ v[j]) * 1099511628211ull;
+	}
+}
+
+static void null_pointer(int i, GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	arrays[i].size = size;
+	arrays[i].type = type;
+	arrays[i].stride = stride;
+	arrays[i].pointer = pointer;
+	arrays[i].buffer = array_buffer;
+}
+
+static void null_glVertexPointer(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	null_pointer(ARRAY_VERTEX, size, type, stride, pointer);
+}
+
+static void null_glColorPointer(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	null_pointer(ARRAY_COLOR, size, type, stride, pointer);
+}
+
+static void null_glTexCoordPointer(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	null_pointer(ARRAY_TEXCOORD, size, type, stride, pointer);
+}
+
+static void null_glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride,
+	const void *pointer) {
+	null_pointer(NUM_FIXED + index, size, type, stride, pointer);
+}
+
+static void null_glEnableClientState(GLenum array) {
+	arrays[array == GL_VERTEX_ARRAY ? ARRAY_VERTEX : array == GL_COLOR_ARRAY ? ARRAY_COLOR : ARRAY_TEXCOORD].enabled = 1;
+}
+
+static void null_glDisableClientState(GLenum array) {
+	arrays[array == GL_VERTEX_ARRAY ? ARRAY_VERTEX : array == GL_COLOR_ARRAY ? ARRAY_COLOR : ARRAY_TEXCOORD].enabled = 0;
+}
+
+static void null_glEnableVertexAttribArray(GLuint index) {
+	arrays[NUM_FIXED + index].enabled = 1;
+}
+
+static void null_glDisableVertexAttribArray(GLuint index) {
+	arrays[NUM_FIXED + index].enabled = 0;
+}
+
+static void null_glBindBuffer(GLenum target, GLuint buffer) {
+	if (target == GL_ARRAY_BUFFER)
+		array_buffer = buffer;
+}
+
+static void null_glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage) {
+	buffers[array_buffer] = realloc(buffers[array_buffer], size);
+	memcpy(buffers[array_buffer], data, size);
+	feed(1, data, size);
+}
+
+static void null_glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *idx) {
+	feed(2, idx, count * sizeof(uint16_t));
+	for (GLsizei i = 0; i < count; i++)
+		draw_vertex(((const uint16_t *)idx)[i]);
+	spin(backend_us);
+}
+
+static void null_glDrawArrays(GLenum mode, GLint first, GLsizei count) {
+	uint32_t args[2] = {first, count};
+	feed(3, args, sizeof(args));
+	for (GLsizei i = 0; i < count; i++)
+		draw_vertex(first + i);
+	spin(backend_us);
+}
+
+static void null_glEnable(GLenum cap) {
+	feed(4, &cap, sizeof(cap));
+}
+
+static void null_glBindTexture(GLenum target, GLuint texture) {
+	feed(5, &texture, sizeof(texture));
+}
+
+static void null_glColor4f(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+	float c[4] = {r, g, b, a};
+	feed(6, c, sizeof(c));
+}
+
+static void null_glOrthof(GLfloat l, GLfloat r, GLfloat b, GLfloat t, GLfloat n, GLfloat f) {
+	float m[6] = {l, r, b, t, n, f};
+	feed(7, m, sizeof(m));
+}
+
+static void null_glUniform1f(GLint location, GLfloat v0) {
+	feed(8, &location, sizeof(location));
+	feed(8, &v0, sizeof(v0));
+}
+
+static void null_glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+	feed(9, value, count * 16 * sizeof(GLfloat));
+}
+
+static void null_glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height,
+	GLint border, GLenum format, GLenum type, const void *data) {
+	feed(10, data, width * height * 4);
+}
+
+static void null_glShaderSource(GLuint shader, GLsizei count, GLchar **string, const GLint *length) {
+	string[0][0] = string[0][1] = '/';
+	for (GLsizei i = 0; i < count; i++)
+		feed(11, string[i], strlen(string[i]));
+}
+
+// Everything issued before has to be through by now
+static GLenum null_glGetError(void) {
+	if (executed != issued)
+		bad_syncs++;
+	return GL_NO_ERROR;
+}
+
+static void null_SDL_GL_SwapWindow(void *window) {
+	feed(12, &window, sizeof(window));
+	frame_hashes[(uintptr_t)window] = hash;
+}
+
+static struct {
+	const char *symbol;
+	uintptr_t func;
+} backend[] = {
+	{"glVertexPointer", (uintptr_t)&null_glVertexPointer},
+	{"glColorPointer", (uintptr_t)&null_glColorPointer},
+	{"glTexCoordPointer", (uintptr_t)&null_glTexCoordPointer},
+	{"glVertexAttribPointer", (uintptr_t)&null_glVertexAttribPointer},
+	{"glEnableClientState", (uintptr_t)&null_glEnableClientState},
+	{"glDisableClientState", (uintptr_t)&null_glDisableClientState},
+	{"glEnableVertexAttribArray", (uintptr_t)&null_glEnableVertexAttribArray},
+	{"glDisableVertexAttribArray", (uintptr_t)&null_glDisableVertexAttribArray},
+	{"glBindBuffer", (uintptr_t)&null_glBindBuffer},
+	{"glBufferData", (uintptr_t)&null_glBufferData},
+	{"glDrawElements", (uintptr_t)&null_glDrawElements},
+	{"glDrawArrays", (uintptr_t)&null_glDrawArrays},
+	{"glEnable", (uintptr_t)&null_glEnable},
+	{"glBindTexture", (uintptr_t)&null_glBindTexture},
+	{"glColor4f", (uintptr_t)&null_glColor4f},
+	{"glOrthof", (uintptr_t)&null_glOrthof},
+	{"glUniform1f", (uintptr_t)&null_glUniform1f},
+	{"glUniformMatrix4fv", (uintptr_t)&null_glUniformMatrix4fv},
+	{"glTexImage2D", (uintptr_t)&null_glTexImage2D},
+	{"glShaderSource", (uintptr_t)&null_glShaderSource},
+	{"glGetError", (uintptr_t)&null_glGetError},
+	{"SDL_GL_SwapWindow", (uintptr_t)&null_SDL_GL_SwapWindow},
+};
+
+// Entry points as the game sees them
+static struct {
+	void (*VertexPointer)(GLint, GLenum, GLsizei, const void *);
+	void (*ColorPointer)(GLint, GLenum, GLsizei, const void *);
+	void (*TexCoordPointer)(GLint, GLenum, GLsizei, const void *);
+	void (*VertexAttribPointer)(GLuint, GLint, GLenum, GLboolean, GLsizei, const void *);
+	void (*EnableClientState)(GLenum);
+	void (*DisableClientState)(GLenum);
+	void (*EnableVertexAttribArray)(GLuint);
+	void (*DisableVertexAttribArray)(GLuint);
+	void (*BindBuffer)(GLenum, GLuint);
+	void (*BufferData)(GLenum, GLsizeiptr, const void *, GLenum);
+	void (*DrawElements)(GLenum, GLsizei, GLenum, const void *);
+	void (*DrawArrays)(GLenum, GLint, GLsizei);
+	void (*Enable)(GLenum);
+	void (*BindTexture)(GLenum, GLuint);
+	void (*Color4f)(GLfloat, GLfloat, GLfloat, GLfloat);
+	void (*Orthof)(GLfloat, GLfloat, GLfloat, GLfloat, GLfloat, GLfloat);
+	void (*Uniform1f)(GLint, GLfloat);
+	void (*UniformMatrix4fv)(GLint, GLsizei, GLboolean, const GLfloat *);
+	void (*TexImage2D)(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void *);
+	void (*ShaderSource)(GLuint, GLsizei, GLchar **, const GLint *);
+	GLenum (*GetError)(void);
+	void (*SwapWindow)(void *);
+} gl;
+
+static void *lookup(const char *symbol, int split) {
+	for (size_t i = 0; i < sizeof(backend) / sizeof(*backend); i++) {
+		if (!strcmp(symbol, backend[i].symbol))
+			return (void *)(split ? glcmd_wrap(symbol, backend[i].func) : backend[i].func);
+	}
+	return NULL;
+}
+
+static void setup(int split) {
+	gl.VertexPointer = lookup("glVertexPointer", split);
+	gl.ColorPointer = lookup("glColorPointer", split);
+	gl.TexCoordPointer = lookup("glTexCoordPointer", split);
+	gl.VertexAttribPointer = lookup("glVertexAttribPointer", split);
+	gl.EnableClientState = lookup("glEnableClientState", split);
+	gl.DisableClientState = lookup("glDisableClientState", split);
+	gl.EnableVertexAttribArray = lookup("glEnableVertexAttribArray", split);
+	gl.DisableVertexAttribArray = lookup("glDisableVertexAttribArray", split);
+	gl.BindBuffer = lookup("glBindBuffer", split);
+	gl.BufferData = lookup("glBufferData", split);
+	gl.DrawElements = lookup("glDrawElements", split);
+	gl.DrawArrays = lookup("glDrawArrays", split);
+	gl.Enable = lookup("glEnable", split);
+	gl.BindTexture = lookup("glBindTexture", split);
+	gl.Color4f = lookup("glColor4f", split);
+	gl.Orthof = lookup("glOrthof", split);
+	gl.Uniform1f = lookup("glUniform1f", split);
+	gl.UniformMatrix4fv = lookup("glUniformMatrix4fv", split);
+	gl.TexImage2D = lookup("glTexImage2D", split);
+	gl.ShaderSource = lookup("glShaderSource", split);
+	gl.GetError = lookup("glGetError", split);
+	gl.SwapWindow = lookup("SDL_GL_SwapWindow", split);
+}
+
+static void counted(void) {
+	issued++;
+}
+
+// A HUD style fixed function draw or a shader draw mixing a buffer with client attributes
+static void draw(void) {
+	uint32_t first = next() % (NUM_VERTICES / 2), count = 3 + next() % (NUM_VERTICES / 2 - 3);
+	for (uint32_t i = 0; i < count; i++)
+		indices[i] = first + next() % count;
+
+	if (next() & 1) {
+		gl.BindBuffer(GL_ARRAY_BUFFER, 0);
+		gl.EnableClientState(GL_VERTEX_ARRAY);
+		gl.EnableClientState(GL_COLOR_ARRAY);
+		gl.VertexPointer(2 + next() % 3, GL_FLOAT, 0, vertices);
+		gl.ColorPointer(4, GL_UNSIGNED_BYTE, 0, colors);
+		if (next() & 1) {
+			gl.EnableClientState(GL_TEXTURE_COORD_ARRAY);
+			gl.TexCoordPointer(2, GL_SHORT, 6, texcoords);
+		} else {
+			gl.DisableClientState(GL_TEXTURE_COORD_ARRAY);
+		}
+	} else {
+		gl.DisableClientState(GL_VERTEX_ARRAY);
+		gl.DisableClientState(GL_COLOR_ARRAY);
+		gl.DisableClientState(GL_TEXTURE_COORD_ARRAY);
+		GLuint vbo = 1 + next() % (MAX_BUFFERS - 1);
+		gl.BindBuffer(GL_ARRAY_BUFFER, vbo);
+		if (!uploaded[vbo] || !(next() % 8)) {
+			uploaded[vbo] = 1;
+			counted();
+			gl.BufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+		}
+		gl.VertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, (void *)0);
+		gl.BindBuffer(GL_ARRAY_BUFFER, next() & 1 ? 0 : vbo);
+		gl.EnableVertexAttribArray(0);
+		if (next() & 1) {
+			// Set while the buffer may still be bound, these two only count as client memory when it isn't
+			gl.BindBuffer(GL_ARRAY_BUFFER, 0);
+			gl.VertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, colors);
+			gl.VertexAttribPointer(2, 3, GL_SHORT, GL_FALSE, 0, texcoords);
+			gl.EnableVertexAttribArray(1);
+			gl.EnableVertexAttribArray(2);
+			gl.BindBuffer(GL_ARRAY_BUFFER, vbo);
+		} else {
+			gl.DisableVertexAttribArray(1);
+			gl.DisableVertexAttribArray(2);
+		}
+	}
+
+	counted();
+	if (next() % 4)
+		gl.DrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, indices);
+	else
+		gl.DrawArrays(GL_TRIANGLES, first, count);
+	scribble(vertices, sizeof(vertices));
+	scribble(colors, sizeof(colors));
+	scribble(texcoords, sizeof(texcoords));
+	scribble(indices, sizeof(indices));
+}
+
+static void state(void) {
+	switch (next() % 9) {
+	case 0:
+		counted();
+		gl.Enable(GL_BLEND);
+		break;
+	case 1:
+		counted();
+		gl.BindTexture(GL_TEXTURE_2D, next() % 64);
+		break;
+	case 2:
+		counted();
+		gl.Color4f(next() / 1e9f, next() / 1e9f, next() / 1e9f, next() / 1e9f);
+		break;
+	case 3:
+		counted();
+		gl.Orthof(0.0f, 960.0f, 544.0f, 0.0f, -1.0f, next() / 1e9f);
+		break;
+	case 4:
+		issued += 2;
+		gl.Uniform1f(next() % 16, next() / 1e9f);
+		break;
+	case 5:
+		counted();
+		gl.UniformMatrix4fv(0, 1, GL_FALSE, matrix);
+		scribble(matrix, sizeof(matrix));
+		break;
+	case 6:
+		if (!(next() % 16)) {
+			counted();
+			gl.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TEX_SIZE, TEX_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+			scribble(pixels, sizeof(pixels));
+		}
+		break;
+	case 7:
+		if (!(next() % 16)) {
+			char a[] = "#version 100\nvoid main() {}\n", b[] = "// more\n";
+			GLchar *sources[2] = {a, b};
+			issued += 2;
+			gl.ShaderSource(next() % 8, 2, sources, NULL);
+			a[2] = b[3] = 'x';
+		}
+		break;
+	default:
+		if (!(next() % 32))
+			gl.GetError();
+		break;
+	}
+}
+
+static void run(int split, uint64_t *hashes, double *elapsed) {
+	memset(arrays, 0, sizeof(arrays));
+	for (int i = 0; i < MAX_BUFFERS; i++) {
+		free(buffers[i]);
+		buffers[i] = NULL;
+	}
+	array_buffer = 0;
+	hash = 14695981039346656037ull;
+	executed = issued = bad_syncs = 0;
+	rng = 1;
+	memset(vertices, 0, sizeof(vertices));
+	memset(colors, 0, sizeof(colors));
+	memset(texcoords, 0, sizeof(texcoords));
+	memset(pixels, 0, sizeof(pixels));
+	memset(matrix, 0, sizeof(matrix));
+	memset(uploaded, 0, sizeof(uploaded));
+	frame_hashes = hashes;
+	setup(split);
+
+	double start = now();
+	for (int f = 0; f < frames; f++) {
+		for (int d = 0; d < draws; d++) {
+			for (int s = next() % 4; s > 0; s--)
+				state();
+			draw();
+		}
+		spin(game_us);
+		counted();
+		gl.SwapWindow((void *)(uintptr_t)f);
+	}
+	if (split)
+		glcmd_sync();
+	*elapsed = now() - start;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		frames = atoi(argv[1]);
+	if (argc > 2)
+		draws = atoi(argv[2]);
+	if (argc > 3)
+		backend_us = atoi(argv[3]);
+	if (argc > 4)
+		game_us = atoi(argv[4]);
+	if (frames < 1 || draws < 1 || backend_us < 0 || game_us < 0) {
+		printf("Usage: %s [frames] [draws per frame] [backend us per draw] [game us per frame] [capture file]\n",
+			argv[0]);
+		return 1;
+	}
+	if (!glcmd_init(1)) {
+		printf("Could not start the render thread\n");
+		return 1;
+	}
+
+	uint64_t *direct = malloc(frames * sizeof(uint64_t)), *split = malloc(frames * sizeof(uint64_t));
+	double direct_time, split_time;
+	run(0, direct, &direct_time);
+	if (argc > 5 && frames > 1)
+		glcmd_capture(argv[5], frames - 1);
+	run(1, split, &split_time);
+
+	int mismatch = -1;
+	for (int f = 0; f < frames && mismatch < 0; f++) {
+		if (direct[f] != split[f])
+			mismatch = f;
+	}
+	printf("%d frames of %d draws, %d us per draw in the backend, %d us of game work per frame\n", frames, draws,
+		backend_us, game_us);
+	printf("direct   %8.3f ms per frame\n", direct_time * 1000 / frames);
+	printf("split    %8.3f ms per frame, %.2fx\n", split_time * 1000 / frames, direct_time / split_time);
+	if (mismatch >= 0)
+		printf("FAIL: frame %d replayed differently\n", mismatch);
+	if (bad_syncs)
+		printf("FAIL: %u syncs ran ahead of the render thread\n", bad_syncs);
+	if (mismatch < 0 && !bad_syncs)
+		printf("OK: every frame replayed identically\n");
+	return mismatch >= 0 || bad_syncs;
+}
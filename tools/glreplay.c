@@ -0,0 +1,436 @@
+/* glreplay.c -- replays a GL capture into a null backend and reports what every frame asked of the GPU
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -Iloader tools/glreplay.c -o glreplay
+ * Usage: glreplay <capture.bin> [symbols per ranking]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "glcmd.h"
+
+/*
+ * The capture gets decoded back into calls, each with its arguments and the memory it read, and handed to
+ * a backend. The null backend below only keeps a shadow of the state the calls set: a call setting what
+ * is already set is redundant, the kind of call the glstate and uniform filters drop on the device. Calls
+ * glcmd issued itself around client array draws don't count as state changes, their data counts as
+ * client array traffic.
+ */
+
+#define MAX_SYMBOLS 65536
+#define SHADOW_SIZE (1 << 16) // Entries in the shadow state, a power of two
+#define MAX_UNITS 16
+
+typedef struct {
+	const char *symbol;
+	int sym; // Symbol id
+	int kind;
+	int flags;
+	int sync; // Ran in place, the return value follows the arguments
+	const uint32_t *args;
+	int nargs;
+	int ptr; // Argument that is an offset into data, CAPTURE_NO_PTR for none
+	const uint8_t *data;
+	uint32_t size;
+} replay_call;
+
+typedef struct {
+	void (*call)(const replay_call *c);
+	void (*frame)(void);
+	void (*report)(void);
+} replay_backend;
+
+typedef struct {
+	uint32_t draws;
+	uint32_t state; // Calls changing state, draws, uploads and internal calls aside
+	uint32_t redundant; // Of those, the ones setting what was already set
+	uint32_t syncs;
+	uint64_t uploaded; // Texture, buffer and shader source bytes
+	uint64_t arrays; // Client array and index bytes copied along with the draws
+} frame_stats;
+
+typedef struct {
+	uint32_t calls;
+	uint32_t redundant;
+} symbol_stats;
+
+static char *symbols[MAX_SYMBOLS];
+static symbol_stats sym_stats[MAX_SYMBOLS];
+static int ranking_size = 10;
+
+static frame_stats cur, total;
+static int num_frames = 0;
+
+typedef struct {
+	uint64_t key, value;
+} shadow_entry;
+
+static shadow_entry shadow[SHADOW_SIZE], uploaded[SHADOW_SIZE]; // State set and names given contents
+static uint32_t shadow_used = 0, uploaded_used = 0;
+
+static int active_unit = 0;
+static uint32_t bound_textures[MAX_UNITS], array_buffer = 0, element_buffer = 0;
+static uint32_t program = 0;
+static uint32_t stat_textures = 0, stat_buffers = 0, stat_sources = 0, stat_preamble = 0;
+static uint32_t stat_unknown_textures = 0, stat_unknown_buffers = 0;
+
+static uint64_t fnv(uint64_t h, const void *data, size_t size) {
+	const uint8_t *p = data;
+	for (size_t i = 0; i < size; i++)
+		h = (h ^ p[i]) * 1099511628211ull;
+	return h;
+}
+
+static uint64_t key_of(const char *group, const uint32_t *keys, int n) {
+	uint64_t h = fnv(14695981039346656037ull, group, strlen(group));
+	h = fnv(h, keys, n * sizeof(uint32_t));
+	return h ? h : 1;
+}
+
+// Stores value for key, returns 1 when it was there already
+static int table_set(shadow_entry *table, uint32_t *used, uint64_t key, uint64_t value) {
+	uint32_t i = key & (SHADOW_SIZE - 1);
+	while (table[i].key && table[i].key != key)
+		i = (i + 1) & (SHADOW_SIZE - 1);
+	if (table[i].key == key && table[i].value == value)
+		return 1;
+	if (!table[i].key) {
+		if (*used == SHADOW_SIZE / 2)
+			return 0; // Full enough, nothing new gets tracked anymore
+		(*used)++;
+	}
+	table[i].key = key;
+	table[i].value = value;
+	return 0;
+}
+
+static int shadow_set(uint64_t key, uint64_t value) {
+	return table_set(shadow, &shadow_used, key, value);
+}
+
+// SDL's renderer and everything else running in place may have set anything
+static void shadow_forget(void) {
+	memset(shadow, 0, sizeof(shadow));
+	shadow_used = 0;
+}
+
+static uint64_t value_of(const replay_call *c, int first) {
+	uint64_t h = fnv(14695981039346656037ull, &c->sym, sizeof(c->sym));
+	for (int i = first; i < c->nargs; i++) {
+		if (i != c->ptr)
+			h = fnv(h, &c->args[i], sizeof(uint32_t));
+	}
+	return fnv(h, c->data, c->size);
+}
+
+static int starts_with(const char *s, const char *prefix) {
+	return !strncmp(s, prefix, strlen(prefix));
+}
+
+// Setters whose first keys arguments say which state they set and the rest what to
+static const struct {
+	const char *symbol;
+	const char *group;
+	int keys;
+} setters[] = {
+	{"glActiveTexture", "glActiveTexture", 0},
+	{"glMatrixMode", "glMatrixMode", 0},
+	{"glDepthFunc", "glDepthFunc", 0},
+	{"glDepthMask", "glDepthMask", 0},
+	{"glCullFace", "glCullFace", 0},
+	{"glFrontFace", "glFrontFace", 0},
+	{"glBlendEquation", "glBlendEquation", 0},
+	{"glBlendFunc", "blend", 0},
+	{"glBlendFuncSeparate", "blend", 0},
+	{"glScissor", "glScissor", 0},
+	{"glViewport", "glViewport", 0},
+	{"glColorMask", "glColorMask", 0},
+	{"glColor4ub", "color", 0},
+	{"glColor4f", "color", 0},
+	{"glLineWidth", "glLineWidth", 0},
+	{"glClearDepthf", "glClearDepthf", 0},
+	{"glClearColor", "glClearColor", 0},
+	{"glPolygonOffset", "glPolygonOffset", 0},
+	{"glDepthRangef", "glDepthRangef", 0},
+	{"glAlphaFunc", "glAlphaFunc", 0},
+	{"glUseProgram", "glUseProgram", 0},
+	{"glBindFramebuffer", "glBindFramebuffer", 1},
+	{"glBindBuffer", "glBindBuffer", 1},
+	{"glVertexPointer", "glVertexPointer", 0},
+	{"glColorPointer", "glColorPointer", 0},
+	{"glTexCoordPointer", "glTexCoordPointer", 0},
+	{"glVertexAttribPointer", "glVertexAttribPointer", 1},
+};
+
+// Returns 1 when the call set what was already set
+static int redundant(const replay_call *c) {
+	const char *s = c->symbol;
+	uint32_t keys[3];
+	if (!strcmp(s, "glEnable") || !strcmp(s, "glDisable")) {
+		keys[0] = c->args[0];
+		return shadow_set(key_of("cap", keys, 1), s[2] == 'E');
+	}
+	if (!strcmp(s, "glEnableClientState") || !strcmp(s, "glDisableClientState")) {
+		keys[0] = c->args[0];
+		return shadow_set(key_of("client", keys, 1), s[2] == 'E');
+	}
+	if (!strcmp(s, "glEnableVertexAttribArray") || !strcmp(s, "glDisableVertexAttribArray")) {
+		keys[0] = c->args[0];
+		return shadow_set(key_of("attrib", keys, 1), s[2] == 'E');
+	}
+	if (!strcmp(s, "glBindTexture")) {
+		keys[0] = active_unit;
+		keys[1] = c->args[0];
+		return shadow_set(key_of(s, keys, 2), value_of(c, 1));
+	}
+	if (!strcmp(s, "glTexParameteri") || !strcmp(s, "glTexParameterf")) {
+		keys[0] = bound_textures[active_unit];
+		keys[1] = c->args[0];
+		keys[2] = c->args[1];
+		return shadow_set(key_of("glTexParameter", keys, 3), value_of(c, 2));
+	}
+	if (!strcmp(s, "glTexEnvi")) {
+		keys[0] = active_unit;
+		keys[1] = c->args[0];
+		keys[2] = c->args[1];
+		return shadow_set(key_of(s, keys, 3), value_of(c, 2));
+	}
+	if (starts_with(s, "glUniform")) {
+		keys[0] = program;
+		keys[1] = c->args[0];
+		return shadow_set(key_of(s, keys, 2), value_of(c, 1));
+	}
+	for (size_t i = 0; i < sizeof(setters) / sizeof(*setters); i++) {
+		if (!strcmp(s, setters[i].symbol))
+			return shadow_set(key_of(setters[i].group, c->args, setters[i].keys), value_of(c, setters[i].keys));
+	}
+	return 0;
+}
+
+// Counts the names used without their contents in the capture, they got uploaded before it started
+static void check_uploaded(const char *group, uint32_t name, uint32_t *unknown) {
+	uint32_t keys[1] = {name};
+	if (name && !table_set(uploaded, &uploaded_used, key_of(group, keys, 1), 0))
+		(*unknown)++;
+}
+
+static void mark_uploaded(const char *group, uint32_t name) {
+	uint32_t keys[1] = {name};
+	table_set(uploaded, &uploaded_used, key_of(group, keys, 1), 0);
+}
+
+static void null_call(const replay_call *c) {
+	const char *s = c->symbol;
+	sym_stats[c->sym].calls++;
+	if (c->sync) {
+		cur.syncs++;
+		if (starts_with(s, "SDL_"))
+			shadow_forget();
+		return;
+	}
+	if (c->flags & CAPTURE_INTERNAL) {
+		cur.arrays += c->size;
+		return;
+	}
+
+	if (!strcmp(s, "glDrawElements") || !strcmp(s, "glDrawArrays")) {
+		cur.draws++;
+		cur.arrays += c->size;
+		return;
+	}
+	if (!strcmp(s, "glShaderSource")) {
+		cur.uploaded += c->size;
+		if (c->flags & CAPTURE_PREAMBLE)
+			stat_preamble++;
+		else
+			stat_sources++;
+		return;
+	}
+	if (!strcmp(s, "glTexImage2D") || !strcmp(s, "glCompressedTexImage2D") || !strcmp(s, "glTexSubImage2D")) {
+		cur.uploaded += c->size;
+		if (strcmp(s, "glTexSubImage2D")) {
+			mark_uploaded("texture", bound_textures[active_unit]);
+			stat_textures++;
+		}
+		return;
+	}
+	if (!strcmp(s, "glBufferData") || !strcmp(s, "glBufferSubData")) {
+		cur.uploaded += c->size;
+		if (!strcmp(s, "glBufferData")) {
+			mark_uploaded("buffer", c->args[0] == GL_ELEMENT_ARRAY_BUFFER ? element_buffer : array_buffer);
+			stat_buffers++;
+		}
+		return;
+	}
+	if (!strcmp(s, "SDL_GL_SwapWindow"))
+		return;
+
+	cur.state++;
+	if (redundant(c)) {
+		cur.redundant++;
+		sym_stats[c->sym].redundant++;
+	}
+	if (!strcmp(s, "glActiveTexture")) {
+		active_unit = c->args[0] - GL_TEXTURE0;
+		if (active_unit < 0 || active_unit >= MAX_UNITS)
+			active_unit = 0;
+	} else if (!strcmp(s, "glBindTexture")) {
+		bound_textures[active_unit] = c->args[1];
+		check_uploaded("texture", c->args[1], &stat_unknown_textures);
+	} else if (!strcmp(s, "glUseProgram")) {
+		program = c->args[0];
+	} else if (!strcmp(s, "glBindBuffer")) {
+		if (c->args[0] == GL_ELEMENT_ARRAY_BUFFER)
+			element_buffer = c->args[1];
+		else if (c->args[0] == GL_ARRAY_BUFFER)
+			array_buffer = c->args[1];
+		check_uploaded("buffer", c->args[1], &stat_unknown_buffers);
+	}
+}
+
+static void add_stats(frame_stats *to, const frame_stats *from) {
+	to->draws += from->draws;
+	to->state += from->state;
+	to->redundant += from->redundant;
+	to->syncs += from->syncs;
+	to->uploaded += from->uploaded;
+	to->arrays += from->arrays;
+}
+
+static void print_stats(const char *label, const frame_stats *f, int frames) {
+	printf("%-8s %7u %7u %7u %7u %10.1f %10.1f\n", label, f->draws / frames, f->state / frames,
+		f->redundant / frames, f->syncs / frames, f->uploaded / 1024.0 / frames, f->arrays / 1024.0 / frames);
+}
+
+static void null_frame(void) {
+	char label[16];
+	if (!num_frames)
+		printf("%-8s %7s %7s %7s %7s %10s %10s\n", "frame", "draws", "state", "redund.", "syncs", "upload KB",
+			"arrays KB");
+	snprintf(label, sizeof(label), "%d", num_frames);
+	print_stats(label, &cur, 1);
+	add_stats(&total, &cur);
+	memset(&cur, 0, sizeof(cur));
+	num_frames++;
+}
+
+static int by_redundant(const void *a, const void *b) {
+	uint32_t ra = sym_stats[*(const int *)a].redundant, rb = sym_stats[*(const int *)b].redundant;
+	return ra < rb ? 1 : ra > rb ? -1 : 0;
+}
+
+static void null_report(void) {
+	if (!num_frames) {
+		printf("No complete frame in the capture\n");
+		return;
+	}
+	printf("\n");
+	print_stats("average", &total, num_frames);
+	printf("\n%u redundant calls out of %u state changes (%.1f%%)\n", total.redundant, total.state,
+		total.state ? total.redundant * 100.0 / total.state : 0.0);
+	printf("%u textures and %u buffers uploaded, %u textures and %u buffers used from before the capture\n",
+		stat_textures, stat_buffers, stat_unknown_textures, stat_unknown_buffers);
+	printf("%u shader sources, %u from before the capture\n", stat_sources + stat_preamble, stat_preamble);
+
+	int order[MAX_SYMBOLS], n = 0;
+	for (int i = 0; i < MAX_SYMBOLS; i++) {
+		if (sym_stats[i].redundant)
+			order[n++] = i;
+	}
+	qsort(order, n, sizeof(int), by_redundant);
+	if (n)
+		printf("\nMost redundant calls, per frame:\n");
+	for (int i = 0; i < n && i < ranking_size; i++) {
+		symbol_stats *st = &sym_stats[order[i]];
+		printf("  %-28s %7u calls %7u redundant\n", symbols[order[i]], st->calls / num_frames,
+			st->redundant / num_frames);
+	}
+}
+
+static const replay_backend null_backend = {null_call, null_frame, null_report};
+
+static int replay(const uint8_t *buf, size_t size, const replay_backend *backend) {
+	const capture_header *h = (const capture_header *)buf;
+	if (size < sizeof(*h) || h->magic != CAPTURE_MAGIC || h->version != CAPTURE_VERSION) {
+		printf("Not a capture this version of glreplay can read\n");
+		return 0;
+	}
+	size_t pos = sizeof(*h);
+	while (pos + sizeof(capture_record) <= size) {
+		capture_record r;
+		memcpy(&r, buf + pos, sizeof(r));
+		pos += sizeof(r);
+		if (pos + r.nargs * sizeof(uint32_t) + ((r.size + 3) & ~3) > size) {
+			printf("The capture is cut short, it stops in the middle of a record\n");
+			break;
+		}
+		const uint32_t *args = (const uint32_t *)(buf + pos);
+		pos += r.nargs * sizeof(uint32_t);
+		const uint8_t *data = buf + pos;
+		pos += (r.size + 3) & ~3;
+
+		switch (r.type) {
+		case CAPTURE_SYMBOL:
+			free(symbols[r.symbol]);
+			symbols[r.symbol] = strndup((const char *)data, r.size);
+			break;
+		case CAPTURE_CALL:
+		case CAPTURE_SYNC: {
+			if (!symbols[r.symbol]) {
+				printf("The capture uses symbol %u before naming it\n", r.symbol);
+				return 0;
+			}
+			replay_call c = {symbols[r.symbol], r.symbol, r.kind, r.flags, r.type == CAPTURE_SYNC, args,
+				r.type == CAPTURE_SYNC ? r.nargs - 1 : r.nargs, r.ptr, data, r.size};
+			backend->call(&c);
+			break;
+		}
+		case CAPTURE_FRAME:
+			backend->frame();
+			break;
+		default:
+			printf("Unknown record type %u\n", r.type);
+			return 0;
+		}
+	}
+	backend->report();
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("Usage: %s <capture.bin> [symbols per ranking]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2)
+		ranking_size = atoi(argv[2]);
+
+	FILE *f = fopen(argv[1], "rb");
+	if (!f) {
+		printf("Could not open %s\n", argv[1]);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	size_t size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *buf = malloc(size);
+	if (!buf || fread(buf, 1, size, f) != size) {
+		printf("Could not read %s\n", argv[1]);
+		return 1;
+	}
+	fclose(f);
+
+	int ok = replay(buf, size, &null_backend);
+	free(buf);
+	return !ok;
+}
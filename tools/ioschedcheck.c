@@ -0,0 +1,218 @@
+/* ioschedcheck.c -- exercises the I/O scheduler over POSIX reads
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -Iloader tools/ioschedcheck.c loader/iosched.c -o ioschedcheck -lpthread -Wl,--wrap=pread
+ * Usage: ioschedcheck [scratch file] [threads] [reads per thread]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "iosched.h"
+
+/*
+ * Runs the host build of iosched.c against a scratch file whose every byte can be told from its offset.
+ * pread is wrapped at link time so each read the scheduler issues can be slowed down like a memory card
+ * would, and counted. Three checks run in turn, any failing one fails the run:
+ *  - many threads read random ranges in random classes and every byte they get back is checked,
+ *  - an audio read queued behind a large texture read has to be served within a few slices and before
+ *    the texture read ends,
+ *  - adjacent reads queued while the scheduler is busy have to reach pread as fewer, merged reads.
+ * The per-class latency histograms are printed at the end.
+ */
+
+#define FILE_SIZE (16 * 1024 * 1024)
+#define SLOW_READ_US 2000
+#define SLICE (64 * 1024)
+#define ADJACENT_READS 8
+#define ADJACENT_SIZE (16 * 1024)
+
+ssize_t __real_pread(int fd, void *buf, size_t count, off_t offset);
+
+static volatile int slow_reads = 0;
+static volatile int pread_calls = 0;
+
+ssize_t __wrap_pread(int fd, void *buf, size_t count, off_t offset) {
+	__sync_fetch_and_add(&pread_calls, 1);
+	if (slow_reads)
+		usleep(SLOW_READ_US);
+	return __real_pread(fd, buf, count, offset);
+}
+
+static int fd;
+static int reads_per_thread = 2000;
+static volatile int failures = 0;
+
+static inline uint8_t pattern(uint64_t offset) {
+	return (uint8_t)(offset * 2654435761u >> 13);
+}
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int check(const uint8_t *buf, uint64_t offset, uint32_t size) {
+	for (uint32_t i = 0; i < size; i++) {
+		if (buf[i] != pattern(offset + i))
+			return 0;
+	}
+	return 1;
+}
+
+static void *random_reads(void *arg) {
+	uint32_t seed = (uint32_t)(uintptr_t)arg * 7919 + 1;
+	uint8_t *buf = malloc(4 * SLICE + 1);
+	for (int i = 0; i < reads_per_thread; i++) {
+		seed = seed * 1103515245 + 12345;
+		uint32_t size = 1 + (seed >> 8) % (4 * SLICE);
+		seed = seed * 1103515245 + 12345;
+		uint64_t offset = (seed >> 4) % FILE_SIZE;
+		int cls = (seed >> 28) % IO_NUM_CLASSES;
+		int r = iosched_read(fd, buf, size, offset, cls);
+		uint32_t expected = offset + size > FILE_SIZE ? FILE_SIZE - offset : size;
+		if (r != expected || !check(buf, offset, expected)) {
+			printf("FAIL: %u bytes at %llu in class %d came back as %d bytes%s\n", size, (unsigned long long)offset,
+				cls, r, r == expected ? " with the wrong data" : "");
+			__sync_fetch_and_add(&failures, 1);
+			break;
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+typedef struct {
+	uint64_t offset;
+	uint32_t size;
+	int cls;
+	uint64_t done_us;
+	int ok;
+} timed_read;
+
+static void *timed(void *arg) {
+	timed_read *t = (timed_read *)arg;
+	uint8_t *buf = malloc(t->size);
+	int r = iosched_read(fd, buf, t->size, t->offset, t->cls);
+	t->ok = r == t->size && check(buf, t->offset, t->size);
+	t->done_us = now_us();
+	free(buf);
+	return NULL;
+}
+
+static int priority_check(void) {
+	timed_read texture = {0, 32 * SLICE, IO_TEXTURE, 0, 0};
+	timed_read audio = {FILE_SIZE / 2, 4096, IO_AUDIO, 0, 0};
+	pthread_t t, a;
+	slow_reads = 1;
+	pthread_create(&t, NULL, timed, &texture);
+	usleep(4 * SLOW_READ_US);
+	uint64_t start = now_us();
+	pthread_create(&a, NULL, timed, &audio);
+	pthread_join(a, NULL);
+	pthread_join(t, NULL);
+	slow_reads = 0;
+
+	uint64_t waited = audio.done_us - start;
+	printf("priority: audio read served in %llu us behind a %u KB texture read\n", (unsigned long long)waited,
+		texture.size / 1024);
+	if (!texture.ok || !audio.ok) {
+		printf("FAIL: wrong data under contention\n");
+		return 0;
+	}
+	if (audio.done_us >= texture.done_us || waited > 3 * SLOW_READ_US) {
+		printf("FAIL: the audio read waited for the texture read\n");
+		return 0;
+	}
+	return 1;
+}
+
+static int coalesce_check(void) {
+	timed_read blocker = {FILE_SIZE - SLICE, SLICE, IO_CRITICAL, 0, 0};
+	timed_read adjacent[ADJACENT_READS];
+	pthread_t b, t[ADJACENT_READS];
+	slow_reads = 1;
+	pthread_create(&b, NULL, timed, &blocker);
+	usleep(SLOW_READ_US / 4);
+	int calls = pread_calls;
+	for (int i = 0; i < ADJACENT_READS; i++) {
+		timed_read r = {(uint64_t)i * ADJACENT_SIZE, ADJACENT_SIZE, IO_TEXTURE, 0, 0};
+		adjacent[i] = r;
+	}
+	for (int i = 0; i < ADJACENT_READS; i++)
+		pthread_create(&t[i], NULL, timed, &adjacent[i]);
+	for (int i = 0; i < ADJACENT_READS; i++)
+		pthread_join(t[i], NULL);
+	pthread_join(b, NULL);
+	slow_reads = 0;
+
+	int issued = pread_calls - calls;
+	printf("coalescing: %d adjacent reads reached pread as %d reads\n", ADJACENT_READS, issued);
+	for (int i = 0; i < ADJACENT_READS; i++) {
+		if (!adjacent[i].ok) {
+			printf("FAIL: wrong data out of a merged read\n");
+			return 0;
+		}
+	}
+	if (issued >= ADJACENT_READS) {
+		printf("FAIL: no read got merged\n");
+		return 0;
+	}
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = argc > 1 ? argv[1] : "ioschedcheck.bin";
+	int threads = argc > 2 ? atoi(argv[2]) : 8;
+	if (argc > 3)
+		reads_per_thread = atoi(argv[3]);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Cannot create %s\n", path);
+		return 1;
+	}
+	uint8_t *block = malloc(SLICE);
+	for (uint64_t pos = 0; pos < FILE_SIZE; pos += SLICE) {
+		for (uint32_t i = 0; i < SLICE; i++)
+			block[i] = pattern(pos + i);
+		if (write(fd, block, SLICE) != SLICE) {
+			printf("Cannot write %s\n", path);
+			return 1;
+		}
+	}
+	free(block);
+
+	iosched_init();
+
+	pthread_t *t = malloc(threads * sizeof(pthread_t));
+	uint64_t start = now_us();
+	for (int i = 0; i < threads; i++)
+		pthread_create(&t[i], NULL, random_reads, (void *)(uintptr_t)i);
+	for (int i = 0; i < threads; i++)
+		pthread_join(t[i], NULL);
+	printf("random: %d threads, %d reads each in %llu ms\n", threads, reads_per_thread,
+		(unsigned long long)(now_us() - start) / 1000);
+	free(t);
+
+	int ok = !failures;
+	ok = priority_check() && ok;
+	ok = coalesce_check() && ok;
+	iosched_report();
+
+	close(fd);
+	unlink(path);
+	printf("%s\n", ok ? "OK" : "FAIL");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,312 @@
+/* meshreport.c -- measures the vertex cache and fetch gains of reordering the static index ranges of captures
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -Iloader tools/meshreport.c loader/meshopt.c -o meshreport -lm
+ * Usage: meshreport [-c cache size] [-s vertex stride] <capture.bin>...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "glcmd.h"
+#include "meshopt.h"
+
+/*
+ * Every capture holds a level's index buffers as they got uploaded and the draws made from them. Each
+ * triangle range drawn from a GL_STATIC_DRAW index buffer goes through the same reordering the loader
+ * does, then through a vertex fetch reordering on top, which the loader can't do on its own since vertex
+ * buffers are shared between ranges. Vertex fetches are measured in 64 byte lines through a small LRU,
+ * the vertex stride comes from the position attribute unless given.
+ */
+
+#define MAX_SYMBOLS 65536
+#define MAX_BUFFERS 4096
+#define FETCH_LINE 64
+#define FETCH_LINES 8
+
+typedef struct {
+	uint32_t name;
+	uint32_t size;
+	uint8_t *data;
+} index_buffer;
+
+typedef struct {
+	uint32_t buffer, offset, count, type;
+} range_key;
+
+typedef struct {
+	uint32_t ranges, skipped;
+	uint64_t triangles;
+	uint64_t misses[2]; // Post-transform cache misses before and after
+	uint64_t lines[3]; // Fetched lines before, after, after with the vertices renumbered
+	double seconds;
+} totals;
+
+static char *symbols[MAX_SYMBOLS];
+static index_buffer buffers[MAX_BUFFERS];
+static int num_buffers = 0;
+static range_key *seen = NULL;
+static int num_seen = 0, max_seen = 0;
+static uint32_t element_buffer = 0, array_buffer = 0;
+static uint32_t position_stride = 0;
+
+static uint32_t cache_size = 16, forced_stride = 0;
+
+static index_buffer *find_buffer(uint32_t name, int add) {
+	for (int i = 0; i < num_buffers; i++) {
+		if (buffers[i].name == name)
+			return &buffers[i];
+	}
+	if (!add || num_buffers == MAX_BUFFERS)
+		return NULL;
+	buffers[num_buffers].name = name;
+	return &buffers[num_buffers++];
+}
+
+static int seen_before(const range_key *k) {
+	for (int i = 0; i < num_seen; i++) {
+		if (!memcmp(&seen[i], k, sizeof(*k)))
+			return 1;
+	}
+	if (num_seen == max_seen) {
+		max_seen = max_seen ? max_seen * 2 : 256;
+		seen = realloc(seen, max_seen * sizeof(*seen));
+	}
+	seen[num_seen++] = *k;
+	return 0;
+}
+
+static uint32_t index_size(uint32_t type) {
+	return type == GL_UNSIGNED_INT ? 4 : type == GL_UNSIGNED_SHORT ? 2 : type == GL_UNSIGNED_BYTE ? 1 : 0;
+}
+
+// Lines fetched for the vertices the post-transform cache misses, through a small LRU
+static uint64_t fetched_lines(const uint32_t *indices, uint32_t count, uint32_t verts, uint32_t stride) {
+	uint32_t *loaded = calloc(verts, sizeof(uint32_t));
+	uint64_t lru[FETCH_LINES];
+	int num_lines = 0;
+	uint32_t misses = 0;
+	uint64_t lines = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t v = indices[i];
+		if (loaded[v] && misses - loaded[v] + 1 <= cache_size)
+			continue;
+		loaded[v] = ++misses;
+		uint64_t first = (uint64_t)v * stride / FETCH_LINE, last = ((uint64_t)v * stride + stride - 1) / FETCH_LINE;
+		for (uint64_t line = first; line <= last; line++) {
+			int j;
+			for (j = 0; j < num_lines && lru[j] != line; j++);
+			if (j == num_lines) {
+				lines++;
+				if (num_lines < FETCH_LINES)
+					num_lines++;
+				j = num_lines - 1;
+			}
+			memmove(&lru[1], &lru[0], j * sizeof(uint64_t));
+			lru[0] = line;
+		}
+	}
+	free(loaded);
+	return lines;
+}
+
+static void measure(const index_buffer *b, const range_key *k, totals *t) {
+	uint32_t isize = index_size(k->type);
+	const uint8_t *src = b->data + k->offset;
+	uint32_t *local = malloc(k->count * 3 * sizeof(uint32_t));
+	uint32_t *reordered = local + k->count, *renumbered = reordered + k->count;
+
+	uint32_t lo = 0xFFFFFFFF, hi = 0;
+	for (uint32_t i = 0; i < k->count; i++) {
+		uint32_t idx = isize == 4 ? ((const uint32_t *)src)[i] : isize == 2 ? ((const uint16_t *)src)[i] : src[i];
+		local[i] = idx;
+		if (idx < lo)
+			lo = idx;
+		if (idx > hi)
+			hi = idx;
+	}
+	uint32_t verts = hi - lo + 1;
+	for (uint32_t i = 0; i < k->count; i++)
+		local[i] -= lo;
+
+	clock_t start = clock();
+	meshopt_reorder(local, k->count, verts, reordered);
+	uint32_t *remap = malloc(verts * sizeof(uint32_t));
+	meshopt_fetch_remap(reordered, k->count, verts, remap);
+	for (uint32_t i = 0; i < k->count; i++)
+		renumbered[i] = remap[reordered[i]];
+	t->seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	uint32_t stride = forced_stride ? forced_stride : position_stride ? position_stride : 32;
+	uint32_t before = meshopt_misses(local, k->count, verts, cache_size);
+	uint32_t after = meshopt_misses(reordered, k->count, verts, cache_size);
+	t->ranges++;
+	t->triangles += k->count / 3;
+	t->misses[0] += before;
+	t->misses[1] += after < before ? after : before;
+	t->lines[0] += fetched_lines(local, k->count, verts, stride);
+	t->lines[1] += fetched_lines(after < before ? reordered : local, k->count, verts, stride);
+	t->lines[2] += fetched_lines(renumbered, k->count, verts, stride);
+	free(remap);
+	free(local);
+}
+
+static void call(const char *s, const capture_record *r, const uint32_t *a, const uint8_t *data, totals *t) {
+	if (r->flags & CAPTURE_INTERNAL)
+		return;
+	if (!strcmp(s, "glBindBuffer")) {
+		if (a[0] == GL_ELEMENT_ARRAY_BUFFER)
+			element_buffer = a[1];
+		else if (a[0] == GL_ARRAY_BUFFER)
+			array_buffer = a[1];
+	} else if (!strcmp(s, "glBufferData") && a[0] == GL_ELEMENT_ARRAY_BUFFER && element_buffer) {
+		index_buffer *b = find_buffer(element_buffer, 1);
+		if (!b)
+			return;
+		free(b->data);
+		b->data = NULL;
+		if (a[3] == GL_STATIC_DRAW && r->size >= a[1] && (b->data = malloc(a[1]))) {
+			memcpy(b->data, data, a[1]);
+			b->size = a[1];
+		}
+	} else if (!strcmp(s, "glBufferSubData") && a[0] == GL_ELEMENT_ARRAY_BUFFER) {
+		index_buffer *b = find_buffer(element_buffer, 0);
+		if (b && b->data && a[1] + a[2] <= b->size && r->size >= a[2])
+			memcpy(b->data + a[1], data, a[2]);
+	} else if ((!strcmp(s, "glVertexAttribPointer") && a[0] == 0) || !strcmp(s, "glVertexPointer")) {
+		uint32_t stride = s[8] == 'A' ? a[4] : a[2];
+		uint32_t size = s[8] == 'A' ? a[1] : a[0];
+		uint32_t type = s[8] == 'A' ? a[2] : a[1];
+		if (array_buffer)
+			position_stride = stride ? stride : size * (type == GL_FLOAT ? 4 : type == GL_SHORT ? 2 : 1);
+	} else if (!strcmp(s, "glDrawElements") && a[0] == GL_TRIANGLES && element_buffer) {
+		index_buffer *b = find_buffer(element_buffer, 0);
+		range_key k = {element_buffer, a[3], a[1], a[2]};
+		uint32_t isize = index_size(k.type);
+		if (!b || !b->data || seen_before(&k))
+			return;
+		if (!isize || k.count < 3 || k.count % 3 || k.offset % isize || k.offset + k.count * isize > b->size) {
+			t->skipped++;
+			return;
+		}
+		measure(b, &k, t);
+	}
+}
+
+static int report(const char *path, totals *t) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		printf("Could not open %s\n", path);
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	size_t size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *buf = malloc(size);
+	if (!buf || fread(buf, 1, size, f) != size) {
+		printf("Could not read %s\n", path);
+		fclose(f);
+		free(buf);
+		return 0;
+	}
+	fclose(f);
+
+	const capture_header *h = (const capture_header *)buf;
+	if (size < sizeof(*h) || h->magic != CAPTURE_MAGIC || h->version != CAPTURE_VERSION) {
+		printf("%s: not a capture this version of meshreport can read\n", path);
+		free(buf);
+		return 0;
+	}
+	size_t pos = sizeof(*h);
+	while (pos + sizeof(capture_record) <= size) {
+		capture_record r;
+		memcpy(&r, buf + pos, sizeof(r));
+		pos += sizeof(r);
+		if (pos + r.nargs * sizeof(uint32_t) + ((r.size + 3) & ~3) > size)
+			break;
+		const uint32_t *args = (const uint32_t *)(buf + pos);
+		pos += r.nargs * sizeof(uint32_t);
+		const uint8_t *data = buf + pos;
+		pos += (r.size + 3) & ~3;
+		if (r.type == CAPTURE_SYMBOL) {
+			free(symbols[r.symbol]);
+			symbols[r.symbol] = strndup((const char *)data, r.size);
+		} else if (r.type == CAPTURE_CALL && symbols[r.symbol]) {
+			call(symbols[r.symbol], &r, args, data, t);
+		}
+	}
+	free(buf);
+
+	for (int i = 0; i < num_buffers; i++) {
+		free(buffers[i].data);
+		buffers[i].data = NULL;
+	}
+	num_buffers = num_seen = 0;
+	element_buffer = array_buffer = position_stride = 0;
+	for (int i = 0; i < MAX_SYMBOLS; i++) {
+		free(symbols[i]);
+		symbols[i] = NULL;
+	}
+	return 1;
+}
+
+static void print_totals(const char *label, const totals *t) {
+	if (!t->triangles) {
+		printf("%-24s no static triangle ranges drawn\n", label);
+		return;
+	}
+	double tris = t->triangles;
+	printf("%-24s %6u %8llu  %.3f -> %.3f   %.3f -> %.3f -> %.3f  %7.1f ms\n", label, t->ranges,
+		(unsigned long long)t->triangles, t->misses[0] / tris, t->misses[1] / tris, t->lines[0] / tris,
+		t->lines[1] / tris, t->lines[2] / tris, t->seconds * 1000);
+}
+
+int main(int argc, char *argv[]) {
+	int first = 1;
+	for (; first + 1 < argc && argv[first][0] == '-'; first += 2) {
+		if (!strcmp(argv[first], "-c"))
+			cache_size = atoi(argv[first + 1]);
+		else if (!strcmp(argv[first], "-s"))
+			forced_stride = atoi(argv[first + 1]);
+	}
+	if (first >= argc || !cache_size) {
+		printf("Usage: %s [-c cache size] [-s vertex stride] <capture.bin>...\n", argv[0]);
+		return 1;
+	}
+
+	printf("%-24s %6s %8s  %-14s   %-22s  %s\n", "capture", "ranges", "tris", "ACMR", "lines per triangle",
+		"reorder time");
+	totals all;
+	memset(&all, 0, sizeof(all));
+	for (int i = first; i < argc; i++) {
+		totals t;
+		memset(&t, 0, sizeof(t));
+		if (!report(argv[i], &t))
+			continue;
+		const char *name = strrchr(argv[i], '/');
+		print_totals(name ? name + 1 : argv[i], &t);
+		if (t.skipped)
+			printf("%-24s %u ranges skipped, not a plain triangle list inside the buffer\n", "", t.skipped);
+		all.ranges += t.ranges;
+		all.triangles += t.triangles;
+		all.seconds += t.seconds;
+		for (int j = 0; j < 2; j++)
+			all.misses[j] += t.misses[j];
+		for (int j = 0; j < 3; j++)
+			all.lines[j] += t.lines[j];
+	}
+	if (argc - first > 1)
+		print_totals("all", &all);
+	free(seen);
+	return 0;
+}
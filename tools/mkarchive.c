@@ -0,0 +1,211 @@
+/* mkarchive.c -- builds the packed assets archive from an extracted APK assets folder
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -I../loader mkarchive.c -o mkarchive -lz
+ * Usage: mkarchive [-z] <assets folder> <output archive>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "archive.h"
+#include "hash.h"
+
+typedef struct {
+	char *path; // Relative to the assets folder
+	uint32_t size;
+	archive_entry entry;
+} file_info;
+
+static file_info *files = NULL;
+static int num_files = 0, max_files = 0;
+static int compress_files = 0;
+
+static void scan(const char *root, const char *rel) {
+	char abs[2048], child[1024];
+	snprintf(abs, sizeof(abs), rel[0] ? "%s/%s" : "%s%s", root, rel);
+	DIR *d = opendir(abs);
+	if (!d)
+		return;
+
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		snprintf(child, sizeof(child), rel[0] ? "%s/%s" : "%s%s", rel, de->d_name);
+		snprintf(abs, sizeof(abs), "%s/%s", root, child);
+
+		struct stat st;
+		if (stat(abs, &st) < 0)
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			scan(root, child);
+		} else if (S_ISREG(st.st_mode) && strcasecmp(child, ARCHIVE_NAME)) {
+			if (num_files == max_files) {
+				max_files = max_files ? max_files * 2 : 4096;
+				files = realloc(files, max_files * sizeof(file_info));
+			}
+			files[num_files].path = strdup(child);
+			files[num_files].size = st.st_size;
+			num_files++;
+		}
+	}
+	closedir(d);
+}
+
+// Files get sorted by path so that every level and car folder ends up stored contiguously
+static int cmp_path(const void *a, const void *b) {
+	return strcasecmp(((const file_info *)a)->path, ((const file_info *)b)->path);
+}
+
+static int cmp_hash(const void *a, const void *b) {
+	const archive_entry *ea = (const archive_entry *)a, *eb = (const archive_entry *)b;
+	if (ea->hash != eb->hash)
+		return ea->hash < eb->hash ? -1 : 1;
+	return ea->offset < eb->offset ? -1 : 1;
+}
+
+// Splits a file into independently compressed chunks preceded by their offsets table
+static uint8_t *compress_chunks(const uint8_t *src, uint32_t size, uint32_t *out_size) {
+	uint32_t num_chunks = (size + ARCHIVE_CHUNK_SIZE - 1) / ARCHIVE_CHUNK_SIZE;
+	uint32_t index_size = (num_chunks + 1) * sizeof(uint32_t);
+	uint8_t *out = malloc(index_size + size);
+	uint32_t *index = (uint32_t *)out;
+	uint8_t *tmp = malloc(compressBound(ARCHIVE_CHUNK_SIZE));
+
+	uint32_t pos = index_size;
+	for (uint32_t i = 0; i < num_chunks; i++) {
+		uint32_t raw_len = size - i * ARCHIVE_CHUNK_SIZE;
+		if (raw_len > ARCHIVE_CHUNK_SIZE)
+			raw_len = ARCHIVE_CHUNK_SIZE;
+		uLongf len = compressBound(ARCHIVE_CHUNK_SIZE);
+		index[i] = pos;
+		if (compress2(tmp, &len, src + i * ARCHIVE_CHUNK_SIZE, raw_len, Z_BEST_COMPRESSION) == Z_OK && len < raw_len) {
+			memcpy(out + pos, tmp, len);
+			pos += len;
+		} else {
+			memcpy(out + pos, src + i * ARCHIVE_CHUNK_SIZE, raw_len);
+			pos += raw_len;
+		}
+	}
+	index[num_chunks] = pos;
+	free(tmp);
+	*out_size = pos;
+	return out;
+}
+
+int main(int argc, char *argv[]) {
+	int arg = 1;
+	if (argc > 1 && !strcmp(argv[1], "-z")) {
+		compress_files = 1;
+		arg++;
+	}
+	if (argc - arg < 2) {
+		printf("Usage: %s [-z] <assets folder> <output archive>\n", argv[0]);
+		return 1;
+	}
+	const char *src_path = argv[arg], *out_path = argv[arg + 1];
+
+	scan(src_path, "");
+	if (!num_files) {
+		printf("No files found in %s\n", src_path);
+		return 1;
+	}
+	qsort(files, num_files, sizeof(file_info), cmp_path);
+
+	FILE *out = fopen(out_path, "wb");
+	if (!out) {
+		printf("Cannot open %s\n", out_path);
+		return 1;
+	}
+
+	archive_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	fwrite(&hdr, sizeof(hdr), 1, out);
+
+	uint32_t names_size = 0;
+	uint64_t data_size = 0, stored_size = 0;
+	uint8_t zero[ARCHIVE_ALIGN] = {0};
+	char abs[1024];
+	for (int i = 0; i < num_files; i++) {
+		long pos = ftell(out);
+		if (pos % ARCHIVE_ALIGN) {
+			fwrite(zero, ARCHIVE_ALIGN - pos % ARCHIVE_ALIGN, 1, out);
+			pos = ftell(out);
+		}
+
+		snprintf(abs, sizeof(abs), "%s/%s", src_path, files[i].path);
+		FILE *f = fopen(abs, "rb");
+		if (!f) {
+			printf("Cannot read %s\n", abs);
+			return 1;
+		}
+		uint8_t *buf = malloc(files[i].size ? files[i].size : 1);
+		if (fread(buf, 1, files[i].size, f) != files[i].size) {
+			printf("Short read on %s\n", abs);
+			return 1;
+		}
+		fclose(f);
+
+		archive_entry *e = &files[i].entry;
+		e->hash = path_hash(files[i].path);
+		e->name = names_size;
+		e->offset = pos;
+		e->size = e->stored_size = files[i].size;
+		e->flags = 0;
+
+		// Only keep the compressed copy when it saves at least an eighth of the file
+		uint32_t packed_size;
+		uint8_t *packed = compress_files && files[i].size ? compress_chunks(buf, files[i].size, &packed_size) : NULL;
+		if (packed && packed_size < files[i].size - files[i].size / 8) {
+			fwrite(packed, 1, packed_size, out);
+			e->stored_size = packed_size;
+			e->flags |= ARCHIVE_COMPRESSED;
+		} else {
+			fwrite(buf, 1, files[i].size, out);
+		}
+		free(packed);
+		free(buf);
+
+		names_size += strlen(files[i].path) + 1;
+		data_size += files[i].size;
+		stored_size += e->stored_size;
+	}
+
+	if (ftell(out) > 0xFFFFFFFFL) {
+		printf("Archive exceeds 4 GB\n");
+		return 1;
+	}
+
+	archive_entry *dir = malloc(num_files * sizeof(archive_entry));
+	for (int i = 0; i < num_files; i++)
+		dir[i] = files[i].entry;
+	qsort(dir, num_files, sizeof(archive_entry), cmp_hash);
+
+	// Entries reference names by offset so the names table can stay in path order
+	hdr.magic = ARCHIVE_MAGIC;
+	hdr.version = ARCHIVE_VERSION;
+	hdr.num_entries = num_files;
+	hdr.dir_offset = ftell(out);
+	hdr.names_size = names_size;
+	fwrite(dir, sizeof(archive_entry), num_files, out);
+	for (int i = 0; i < num_files; i++)
+		fwrite(files[i].path, 1, strlen(files[i].path) + 1, out);
+
+	fseek(out, 0, SEEK_SET);
+	fwrite(&hdr, sizeof(hdr), 1, out);
+	fclose(out);
+
+	printf("Packed %d files (%llu bytes, %llu stored) into %s\n", num_files,
+		(unsigned long long)data_size, (unsigned long long)stored_size, out_path);
+	return 0;
+}
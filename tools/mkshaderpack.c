@@ -0,0 +1,665 @@
+/* mkshaderpack.c -- collects the shader variants RVGL compiles out of GL captures into shaders.pack
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -Iloader tools/mkshaderpack.c -o mkshaderpack
+ * Usage: mkshaderpack <shaders.pack> <capture.bin>...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "glcmd.h"
+#include "shaderpack.h"
+
+/*
+ * Every capture starts with the sources of the shaders alive at that point and holds the ones compiled
+ * while it ran. Each distinct source gets preprocessed: conditionals resolved against the #define block
+ * RVGL puts in front, comments and blank space dropped, defines nothing uses anymore left out. Sources
+ * that come out the same are the same variant, whatever flags they were built with, and get compiled
+ * once. The variant keeps the text of the first source seen for it, so the loader compiles exactly what
+ * the game would have.
+ */
+
+#define MAX_SYMBOLS 65536
+#define MAX_SHADER_TYPES 4096
+#define MAX_DEPTH 32 // Nested conditionals and macro expansions
+
+typedef struct {
+	uint64_t hash;
+	uint32_t length;
+	char *text; // The strings joined
+	char *flags; // Empty defines in effect, for the report
+	int type;
+	uint32_t variant;
+} source;
+
+typedef struct {
+	char *canonical;
+	int type;
+	uint32_t first; // Source the text comes from
+	uint32_t sources;
+} variant;
+
+typedef struct {
+	char *name;
+	char *body;
+	int function;
+} macro;
+
+static char *symbols[MAX_SYMBOLS];
+static struct {
+	uint32_t shader;
+	int type;
+} shader_types[MAX_SHADER_TYPES];
+static int num_shader_types = 0;
+
+static source *sources = NULL;
+static uint32_t num_sources = 0, max_sources = 0;
+static variant *variants = NULL;
+static uint32_t num_variants = 0, max_variants = 0;
+static uint32_t calls = 0;
+
+static macro *macros = NULL;
+static int num_macros = 0, max_macros = 0;
+
+static int is_ident(char c) {
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+static const char *skip_spaces(const char *p) {
+	while (*p == ' ' || *p == '\t' || *p == '\r')
+		p++;
+	return p;
+}
+
+static size_t ident_length(const char *p) {
+	size_t n = 0;
+	if (isalpha((unsigned char)*p) || *p == '_') {
+		while (is_ident(p[n]))
+			n++;
+	}
+	return n;
+}
+
+static macro *find_macro(const char *name, size_t len) {
+	for (int i = 0; i < num_macros; i++) {
+		if (strlen(macros[i].name) == len && !strncmp(macros[i].name, name, len))
+			return &macros[i];
+	}
+	return NULL;
+}
+
+static void undefine(const char *name, size_t len) {
+	macro *m = find_macro(name, len);
+	if (m) {
+		free(m->name);
+		free(m->body);
+		*m = macros[--num_macros];
+	}
+}
+
+static void define(const char *name, size_t len, const char *body, int function) {
+	undefine(name, len);
+	if (num_macros == max_macros) {
+		max_macros = max_macros ? max_macros * 2 : 64;
+		macros = realloc(macros, max_macros * sizeof(macro));
+	}
+	macros[num_macros++] = (macro){strndup(name, len), strdup(body), function};
+}
+
+static void clear_macros(void) {
+	for (int i = 0; i < num_macros; i++) {
+		free(macros[i].name);
+		free(macros[i].body);
+	}
+	num_macros = 0;
+}
+
+// #if expressions, identifiers that aren't numeric macros count as 0 like in cpp
+typedef struct {
+	const char *p;
+	int depth;
+} expr;
+
+static long eval_or(expr *e);
+
+static long eval_primary(expr *e) {
+	e->p = skip_spaces(e->p);
+	if (*e->p == '(') {
+		e->p++;
+		long v = eval_or(e);
+		e->p = skip_spaces(e->p);
+		if (*e->p == ')')
+			e->p++;
+		return v;
+	}
+	if (isdigit((unsigned char)*e->p)) {
+		char *end;
+		long v = strtol(e->p, &end, 0);
+		e->p = end;
+		while (*e->p == 'u' || *e->p == 'U' || *e->p == 'l' || *e->p == 'L')
+			e->p++;
+		return v;
+	}
+	size_t len = ident_length(e->p);
+	if (!len) {
+		if (*e->p)
+			e->p++;
+		return 0;
+	}
+	const char *name = e->p;
+	e->p += len;
+	if (len == 7 && !strncmp(name, "defined", 7)) {
+		e->p = skip_spaces(e->p);
+		int paren = *e->p == '(';
+		if (paren)
+			e->p = skip_spaces(e->p + 1);
+		size_t n = ident_length(e->p);
+		long v = n && find_macro(e->p, n);
+		e->p = skip_spaces(e->p + n);
+		if (paren && *e->p == ')')
+			e->p++;
+		return v;
+	}
+	macro *m = find_macro(name, len);
+	if (!m || m->function || e->depth >= MAX_DEPTH)
+		return 0;
+	expr sub = {m->body, e->depth + 1};
+	return eval_or(&sub);
+}
+
+static long eval_unary(expr *e) {
+	e->p = skip_spaces(e->p);
+	switch (*e->p) {
+	case '!':
+		e->p++;
+		return !eval_unary(e);
+	case '-':
+		e->p++;
+		return -eval_unary(e);
+	case '+':
+		e->p++;
+		return eval_unary(e);
+	case '~':
+		e->p++;
+		return ~eval_unary(e);
+	default:
+		return eval_primary(e);
+	}
+}
+
+static long eval_mul(expr *e) {
+	long v = eval_unary(e);
+	for (;;) {
+		e->p = skip_spaces(e->p);
+		char op = *e->p;
+		if (op != '*' && op != '/' && op != '%')
+			return v;
+		e->p++;
+		long r = eval_unary(e);
+		v = op == '*' ? v * r : !r ? 0 : op == '/' ? v / r : v % r;
+	}
+}
+
+static long eval_add(expr *e) {
+	long v = eval_mul(e);
+	for (;;) {
+		e->p = skip_spaces(e->p);
+		if (*e->p != '+' && *e->p != '-')
+			return v;
+		char op = *e->p++;
+		long r = eval_mul(e);
+		v = op == '+' ? v + r : v - r;
+	}
+}
+
+static long eval_rel(expr *e) {
+	long v = eval_add(e);
+	for (;;) {
+		e->p = skip_spaces(e->p);
+		if ((*e->p != '<' && *e->p != '>') || e->p[1] == e->p[0])
+			return v;
+		char op = *e->p++;
+		int eq = *e->p == '=';
+		e->p += eq;
+		long r = eval_add(e);
+		v = op == '<' ? (eq ? v <= r : v < r) : (eq ? v >= r : v > r);
+	}
+}
+
+static long eval_eq(expr *e) {
+	long v = eval_rel(e);
+	for (;;) {
+		e->p = skip_spaces(e->p);
+		if ((*e->p != '=' && *e->p != '!') || e->p[1] != '=')
+			return v;
+		char op = *e->p;
+		e->p += 2;
+		long r = eval_rel(e);
+		v = op == '=' ? v == r : v != r;
+	}
+}
+
+static long eval_and(expr *e) {
+	long v = eval_eq(e);
+	for (;;) {
+		e->p = skip_spaces(e->p);
+		if (e->p[0] != '&' || e->p[1] != '&')
+			return v;
+		e->p += 2;
+		long r = eval_eq(e);
+		v = v && r;
+	}
+}
+
+static long eval_or(expr *e) {
+	long v = eval_and(e);
+	for (;;) {
+		e->p = skip_spaces(e->p);
+		if (e->p[0] != '|' || e->p[1] != '|')
+			return v;
+		e->p += 2;
+		long r = eval_and(e);
+		v = v || r;
+	}
+}
+
+// Comments become spaces, line continuations get joined
+static char *strip_comments(const char *s) {
+	char *out = malloc(strlen(s) + 1), *o = out;
+	while (*s) {
+		if (s[0] == '\\' && s[1] == '\n') {
+			s += 2;
+		} else if (s[0] == '/' && s[1] == '/') {
+			while (*s && *s != '\n')
+				s++;
+		} else if (s[0] == '/' && s[1] == '*') {
+			s += 2;
+			while (*s && !(s[0] == '*' && s[1] == '/')) {
+				if (*s == '\n')
+					*o++ = '\n';
+				s++;
+			}
+			if (*s)
+				s += 2;
+			*o++ = ' ';
+		} else {
+			*o++ = *s++;
+		}
+	}
+	*o = 0;
+	return out;
+}
+
+typedef struct {
+	char *data;
+	size_t size, max;
+} text;
+
+static void append(text *t, const char *s, size_t n) {
+	if (t->size + n + 1 > t->max) {
+		t->max = (t->size + n + 1) * 2;
+		t->data = realloc(t->data, t->max);
+	}
+	memcpy(t->data + t->size, s, n);
+	t->size += n;
+	t->data[t->size] = 0;
+}
+
+// Whitespace runs become single spaces, none at the ends
+static void append_normalized(text *t, const char *s, size_t n) {
+	int space = 0, any = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (isspace((unsigned char)s[i])) {
+			space = 1;
+			continue;
+		}
+		if (space && any)
+			append(t, " ", 1);
+		append(t, &s[i], 1);
+		space = 0;
+		any = 1;
+	}
+	append(t, "\n", 1);
+}
+
+static int uses_ident(const char *code, const char *name) {
+	size_t len = strlen(name);
+	for (const char *p = strstr(code, name); p; p = strstr(p + 1, name)) {
+		if ((p == code || !is_ident(p[-1])) && !is_ident(p[len]))
+			return 1;
+	}
+	return 0;
+}
+
+// Canonical text of the source, flags gets the defines without a body in effect
+static char *preprocess(const char *src, text *flags) {
+	char *s = strip_comments(src);
+	text code = {0}, directives = {0}, out = {0};
+	append(&code, "", 0);
+	append(&directives, "", 0);
+	struct {
+		int parent, taken, active;
+	} stack[MAX_DEPTH];
+	int depth = 0, active = 1;
+
+	for (char *line = s; line;) {
+		char *next = strchr(line, '\n');
+		size_t n = next ? (size_t)(next - line) : strlen(line);
+		const char *p = skip_spaces(line);
+		if (*p != '#') {
+			if (active && (size_t)(p - line) < n) {
+				append(&out, "", 0);
+				size_t start = out.size;
+				append_normalized(&out, p, n - (p - line));
+				if (out.size - start > 1)
+					append(&code, out.data + start, out.size - start);
+				else
+					out.size = start;
+			}
+			line = next ? next + 1 : NULL;
+			continue;
+		}
+		p = skip_spaces(p + 1);
+		size_t dlen = ident_length(p);
+		char directive[16] = {0};
+		memcpy(directive, p, dlen < sizeof(directive) - 1 ? dlen : sizeof(directive) - 1);
+		char *rest = strndup(p + dlen, n - (p + dlen - line));
+		const char *r = skip_spaces(rest);
+		size_t nlen = ident_length(r);
+
+		if (!strcmp(directive, "if") || !strcmp(directive, "ifdef") || !strcmp(directive, "ifndef")) {
+			long cond = 0;
+			if (active) {
+				if (directive[2] == 0) {
+					expr e = {r, 0};
+					cond = eval_or(&e);
+				} else {
+					cond = nlen && find_macro(r, nlen);
+					if (directive[2] == 'n')
+						cond = !cond;
+				}
+			}
+			if (depth < MAX_DEPTH) {
+				stack[depth].parent = active;
+				stack[depth].active = stack[depth].taken = active && cond;
+				active = stack[depth++].active;
+			}
+		} else if (!strcmp(directive, "elif") && depth) {
+			long cond = 0;
+			if (stack[depth - 1].parent && !stack[depth - 1].taken) {
+				expr e = {r, 0};
+				cond = eval_or(&e);
+			}
+			stack[depth - 1].active = cond != 0;
+			stack[depth - 1].taken |= cond != 0;
+			active = stack[depth - 1].active;
+		} else if (!strcmp(directive, "else") && depth) {
+			stack[depth - 1].active = stack[depth - 1].parent && !stack[depth - 1].taken;
+			stack[depth - 1].taken = 1;
+			active = stack[depth - 1].active;
+		} else if (!strcmp(directive, "endif") && depth) {
+			active = stack[--depth].parent;
+		} else if (active) {
+			if (!strcmp(directive, "define") && nlen) {
+				int function = r[nlen] == '(';
+				const char *body = skip_spaces(r + nlen);
+				if (function)
+					body = strchr(r, ')') ? skip_spaces(strchr(r, ')') + 1) : "";
+				define(r, nlen, body, function);
+				if (!*body && !function) {
+					append(flags, r, nlen);
+					append(flags, " ", 1);
+				}
+			} else if (!strcmp(directive, "undef") && nlen) {
+				undefine(r, nlen);
+			}
+			// Kept apart, whether defines stay depends on the code that is left
+			append(&directives, "#", 1);
+			append(&directives, directive, strlen(directive));
+			append(&directives, " ", 1);
+			append(&directives, "\x01", 1);
+			append_normalized(&directives, r, strlen(r));
+		}
+		free(rest);
+		line = next ? next + 1 : NULL;
+	}
+
+	// Directives go in front in the order they came, defines only when something still uses them
+	text result = {0};
+	append(&result, "", 0);
+	for (char *d = directives.data; *d;) {
+		char *end = strchr(d, '\n');
+		char *arg = strchr(d, '\x01');
+		int keep = 1;
+		if (!strncmp(d, "#define ", 8) || !strncmp(d, "#undef ", 7)) {
+			char *name = strndup(arg + 1, ident_length(arg + 1));
+			keep = uses_ident(code.data, name);
+			free(name);
+		}
+		if (keep) {
+			append(&result, d, arg - d);
+			append(&result, arg + 1, end - arg);
+		}
+		d = end + 1;
+	}
+	append(&result, out.data ? out.data : "", out.size);
+	free(s);
+	free(code.data);
+	free(directives.data);
+	free(out.data);
+	clear_macros();
+	return result.data;
+}
+
+static int shader_type(uint32_t shader, const char *src) {
+	for (int i = 0; i < num_shader_types; i++) {
+		if (shader_types[i].shader == shader)
+			return shader_types[i].type;
+	}
+	// Shaders created before the capture started, only vertex shaders write a position
+	return strstr(src, "POSITION") ? SHADERPACK_VERTEX : SHADERPACK_FRAGMENT;
+}
+
+static void add_source(uint32_t shader, uint32_t count, const uint8_t *data, uint32_t size) {
+	const char *strings[64];
+	int lengths[64];
+	uint32_t pos = 0;
+	calls++;
+	if (count > 64)
+		return;
+	for (uint32_t i = 0; i < count; i++) {
+		const char *s = (const char *)data + pos;
+		size_t n = strnlen(s, size - pos);
+		if (pos + n >= size)
+			return;
+		strings[i] = s;
+		lengths[i] = n;
+		pos += n + 1;
+	}
+	uint32_t length;
+	uint64_t hash = shaderpack_hash(count, strings, lengths, &length);
+	for (uint32_t i = 0; i < num_sources; i++) {
+		if (sources[i].hash == hash && sources[i].length == length)
+			return;
+	}
+
+	source s = {hash, length, malloc(length + 1), NULL, 0, 0};
+	char *o = s.text;
+	for (uint32_t i = 0; i < count; i++) {
+		memcpy(o, strings[i], lengths[i]);
+		o += lengths[i];
+	}
+	*o = 0;
+	// What glShaderSource_hook does to it
+	if (length >= 2)
+		s.text[0] = s.text[1] = '/';
+	s.type = shader_type(shader, s.text);
+
+	text flags = {0};
+	append(&flags, "", 0);
+	char *canonical = preprocess(s.text, &flags);
+	s.flags = flags.data;
+	uint32_t v;
+	for (v = 0; v < num_variants; v++) {
+		if (variants[v].type == s.type && !strcmp(variants[v].canonical, canonical))
+			break;
+	}
+	if (v == num_variants) {
+		if (num_variants == max_variants) {
+			max_variants = max_variants ? max_variants * 2 : 64;
+			variants = realloc(variants, max_variants * sizeof(variant));
+		}
+		variants[num_variants++] = (variant){canonical, s.type, num_sources, 0};
+	} else {
+		free(canonical);
+	}
+	variants[v].sources++;
+	s.variant = v;
+	if (num_sources == max_sources) {
+		max_sources = max_sources ? max_sources * 2 : 64;
+		sources = realloc(sources, max_sources * sizeof(source));
+	}
+	sources[num_sources++] = s;
+}
+
+static int read_capture(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		printf("Could not open %s\n", path);
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	size_t size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *buf = malloc(size);
+	if (!buf || fread(buf, 1, size, f) != size) {
+		printf("Could not read %s\n", path);
+		fclose(f);
+		free(buf);
+		return 0;
+	}
+	fclose(f);
+
+	const capture_header *h = (const capture_header *)buf;
+	if (size < sizeof(*h) || h->magic != CAPTURE_MAGIC || h->version != CAPTURE_VERSION) {
+		printf("%s: not a capture this version of mkshaderpack can read\n", path);
+		free(buf);
+		return 0;
+	}
+	size_t pos = sizeof(*h);
+	while (pos + sizeof(capture_record) <= size) {
+		capture_record r;
+		memcpy(&r, buf + pos, sizeof(r));
+		pos += sizeof(r);
+		if (pos + r.nargs * sizeof(uint32_t) + ((r.size + 3) & ~3) > size)
+			break;
+		const uint32_t *args = (const uint32_t *)(buf + pos);
+		pos += r.nargs * sizeof(uint32_t);
+		const uint8_t *data = buf + pos;
+		pos += (r.size + 3) & ~3;
+		if (r.type == CAPTURE_SYMBOL) {
+			free(symbols[r.symbol]);
+			symbols[r.symbol] = strndup((const char *)data, r.size);
+		} else if (r.type == CAPTURE_SYNC && symbols[r.symbol] && !strcmp(symbols[r.symbol], "glCreateShader")
+			&& r.nargs >= 2 && num_shader_types < MAX_SHADER_TYPES) {
+			shader_types[num_shader_types].shader = args[r.nargs - 1];
+			shader_types[num_shader_types++].type = args[0] == GL_VERTEX_SHADER ? SHADERPACK_VERTEX : SHADERPACK_FRAGMENT;
+		} else if (r.type == CAPTURE_CALL && symbols[r.symbol] && !strcmp(symbols[r.symbol], "glShaderSource")
+			&& r.nargs >= 2 && r.size) {
+			add_source(args[0], args[1], data, r.size);
+		}
+	}
+	free(buf);
+	num_shader_types = 0;
+	for (int i = 0; i < MAX_SYMBOLS; i++) {
+		free(symbols[i]);
+		symbols[i] = NULL;
+	}
+	return 1;
+}
+
+static int compare_sources(const void *a, const void *b) {
+	uint64_t x = ((const source *)a)->hash, y = ((const source *)b)->hash;
+	return x < y ? -1 : x > y;
+}
+
+static int write_pack(const char *path) {
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		printf("Could not write %s\n", path);
+		return 0;
+	}
+	// The variants keep the text of their first source, taken before the sort moves them
+	char **texts = malloc(num_variants * sizeof(char *));
+	for (uint32_t v = 0; v < num_variants; v++)
+		texts[v] = sources[variants[v].first].text;
+	qsort(sources, num_sources, sizeof(source), compare_sources);
+
+	shaderpack_header h = {SHADERPACK_MAGIC, SHADERPACK_VERSION, num_sources, num_variants};
+	fwrite(&h, sizeof(h), 1, f);
+	for (uint32_t i = 0; i < num_sources; i++) {
+		shaderpack_source s = {sources[i].hash, sources[i].length, sources[i].variant};
+		fwrite(&s, sizeof(s), 1, f);
+	}
+	uint32_t offset = sizeof(h) + num_sources * sizeof(shaderpack_source) + num_variants * sizeof(shaderpack_variant);
+	for (uint32_t v = 0; v < num_variants; v++) {
+		uint32_t size = strlen(texts[v]);
+		shaderpack_variant e = {offset, size, variants[v].type, variants[v].sources};
+		fwrite(&e, sizeof(e), 1, f);
+		offset += size + 1;
+	}
+	for (uint32_t v = 0; v < num_variants; v++)
+		fwrite(texts[v], strlen(texts[v]) + 1, 1, f);
+	free(texts);
+	fclose(f);
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3) {
+		printf("Usage: %s <shaders.pack> <capture.bin>...\n", argv[0]);
+		return 1;
+	}
+	for (int i = 2; i < argc; i++)
+		read_capture(argv[i]);
+	if (!num_sources) {
+		printf("No shader sources in the captures\n");
+		return 1;
+	}
+
+	uint64_t source_bytes = 0, variant_bytes = 0;
+	for (uint32_t i = 0; i < num_sources; i++)
+		source_bytes += sources[i].length;
+	printf("%-7s %-8s %7s %7s  %s\n", "variant", "type", "sources", "bytes", "defines of the first source");
+	for (uint32_t v = 0; v < num_variants; v++) {
+		const source *s = &sources[variants[v].first];
+		variant_bytes += s->length;
+		printf("%-7u %-8s %7u %7u  %s\n", v, variants[v].type == SHADERPACK_VERTEX ? "vertex" : "fragment",
+			variants[v].sources, s->length, s->flags);
+	}
+	printf("%u glShaderSource calls, %u distinct sources (%llu KB), %u variants to compile (%llu KB)\n", calls,
+		num_sources, (unsigned long long)(source_bytes / 1024), num_variants, (unsigned long long)(variant_bytes / 1024));
+
+	int ok = write_pack(argv[1]);
+	for (uint32_t i = 0; i < num_sources; i++) {
+		free(sources[i].text);
+		free(sources[i].flags);
+	}
+	for (uint32_t v = 0; v < num_variants; v++)
+		free(variants[v].canonical);
+	free(sources);
+	free(variants);
+	free(macros);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+/* mktexcache.c -- pre-populates the decoded texture cache from an extracted APK assets folder
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -I../loader mktexcache.c ../loader/sha1.c -o mktexcache $(sdl2-config --cflags --libs) -lSDL2_image
+ * Usage: mktexcache <assets folder> <output texcache folder>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <SDL.h>
+#include <SDL_image.h>
+
+#include "sha1.h"
+#include "texcache.h"
+
+static const char *out_dir;
+static int num_stored = 0, num_failed = 0;
+static uint64_t in_bytes = 0, out_bytes = 0;
+
+static uint8_t *read_file(const char *path, uint32_t *size) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *data = malloc(*size ? *size : 1);
+	if (data && fread(data, 1, *size, f) != *size) {
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	return data;
+}
+
+// Mirrors the store in loader/texcache.c, with the content in place of the time the file will have on the Vita
+static int store(const char *path, SDL_Surface *surf, const uint8_t *data, uint32_t size) {
+	texcache_header hdr;
+	Uint32 colorkey;
+	SDL_BlendMode blend;
+	SDL_Palette *palette = surf->format->palette;
+	SHA1_CTX ctx;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = TEXCACHE_MAGIC;
+	hdr.version = TEXCACHE_VERSION;
+	hdr.source_size = size;
+	sha1_init(&ctx);
+	sha1_update(&ctx, data, size);
+	sha1_final(&ctx, hdr.source_sha1);
+	hdr.format = surf->format->format;
+	hdr.width = surf->w;
+	hdr.height = surf->h;
+	hdr.pitch = surf->pitch;
+	hdr.num_colors = palette ? palette->ncolors : 0;
+	hdr.colorkey = SDL_GetColorKey(surf, &colorkey) == 0 ? colorkey : TEXCACHE_NO_COLORKEY;
+	hdr.blend = SDL_GetSurfaceBlendMode(surf, &blend) == 0 ? blend : SDL_BLENDMODE_NONE;
+	if (SDL_MUSTLOCK(surf) || hdr.num_colors > 256)
+		return 0;
+
+	FILE *f = fopen(path, "wb");
+	if (!f)
+		return 0;
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	if (hdr.num_colors)
+		fwrite(palette->colors, sizeof(SDL_Color), hdr.num_colors, f);
+	fwrite(surf->pixels, hdr.pitch, hdr.height, f);
+	out_bytes += ftell(f);
+	fclose(f);
+	return 1;
+}
+
+static void process(const char *abs, const char *rel) {
+	uint32_t size;
+	uint8_t *data = read_file(abs, &size);
+	if (!data) {
+		printf("Cannot read %s\n", rel);
+		num_failed++;
+		return;
+	}
+
+	// Keys are relative to ux0:data/rvgl, where the assets folder lives
+	uint8_t key[TEXCACHE_KEY_SIZE];
+	char name[64], path[2048];
+	snprintf(path, sizeof(path), "assets/%s", rel);
+	texcache_key(path, key);
+	texcache_name(key, name);
+	snprintf(path, sizeof(path), "%s/%s", out_dir, name);
+
+	const char *ext = strrchr(rel, '.');
+	SDL_Surface *surf = IMG_LoadTyped_RW(SDL_RWFromConstMem(data, size), 1, ext + 1);
+	if (surf && store(path, surf, data, size)) {
+		in_bytes += size;
+		num_stored++;
+	} else {
+		printf("Cannot convert %s: %s\n", rel, SDL_GetError());
+		num_failed++;
+	}
+	SDL_FreeSurface(surf);
+	free(data);
+}
+
+static void scan(const char *root, const char *rel) {
+	char abs[2048], child[1024];
+	snprintf(abs, sizeof(abs), rel[0] ? "%s/%s" : "%s%s", root, rel);
+	DIR *d = opendir(abs);
+	if (!d)
+		return;
+
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		snprintf(child, sizeof(child), rel[0] ? "%s/%s" : "%s%s", rel, de->d_name);
+		snprintf(abs, sizeof(abs), "%s/%s", root, child);
+
+		struct stat st;
+		if (stat(abs, &st) < 0)
+			continue;
+		if (S_ISDIR(st.st_mode))
+			scan(root, child);
+		else if (S_ISREG(st.st_mode) && texcache_wanted(child))
+			process(abs, child);
+	}
+	closedir(d);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3) {
+		printf("Usage: %s <assets folder> <output texcache folder>\n", argv[0]);
+		return 1;
+	}
+	out_dir = argv[2];
+	mkdir(out_dir, 0777);
+
+	IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG);
+	scan(argv[1], "");
+	IMG_Quit();
+
+	printf("Cached %d textures (%.1f MB of images, %.1f MB of cache), %d failed\n",
+		num_stored, in_bytes / (1024.0 * 1024.0), out_bytes / (1024.0 * 1024.0), num_failed);
+	return num_failed ? 1 : 0;
+}
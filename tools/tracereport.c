@@ -0,0 +1,206 @@
+/* tracereport.c -- turns a file access trace into per phase reports
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -I../loader tracereport.c -o tracereport
+ * Usage: tracereport <trace.bin> [files per ranking]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "trace.h"
+
+#define RACE_GAP_US 1000000 // A level load is over once file accesses stop for this long
+
+enum {
+	PHASE_BOOT,
+	PHASE_MENU,
+	PHASE_LOAD,
+	PHASE_RACE,
+	NUM_PHASES,
+};
+
+static const char *phase_names[NUM_PHASES] = {"boot", "menu", "level load", "race"};
+static const char *op_names[TRACE_NUM_OPS] = {"fopen", "SDL_RWFromFile", "IMG_Load", "CheckFileExists", "stat", "opendir", "open", "close"};
+
+typedef struct {
+	uint32_t count;
+	uint32_t reads;
+	uint64_t total_us;
+	uint64_t read_bytes;
+} path_stats;
+
+static path_stats *stats[NUM_PHASES];
+static uint32_t *order;
+static char **paths;
+static int ranking_size = 15;
+
+// Returns the level name of a path inside levels/, or NULL
+static const char *level_of(const char *path, char *level, size_t size) {
+	const char *p = path;
+	for (; *p; p++) {
+		if (!strncasecmp(p, "levels/", 7) && (p == path || p[-1] == '/'))
+			break;
+	}
+	if (!*p)
+		return NULL;
+	p += 7;
+	const char *end = strchr(p, '/');
+	if (!end || end == p || end - p >= size)
+		return NULL;
+	memcpy(level, p, end - p);
+	level[end - p] = 0;
+	return level;
+}
+
+static int is_read(const trace_record *r) {
+	return !r->failed && (r->op == TRACE_FOPEN || r->op == TRACE_RWOPS || r->op == TRACE_OPEN || r->op == TRACE_IMG_LOAD);
+}
+
+// Streams tell what was read out of them when closed, images decoded by SDL_image are counted whole
+static int counts_bytes(const trace_record *r) {
+	return r->op == TRACE_CLOSE || (r->op == TRACE_IMG_LOAD && !r->failed);
+}
+
+static path_stats *sort_stats;
+
+static int cmp_time(const void *a, const void *b) {
+	uint64_t ta = sort_stats[*(const uint32_t *)a].total_us, tb = sort_stats[*(const uint32_t *)b].total_us;
+	return ta < tb ? 1 : (ta > tb ? -1 : 0);
+}
+
+static uint64_t wasted_bytes(const path_stats *s) {
+	return s->reads > 1 ? s->read_bytes - s->read_bytes / s->reads : 0;
+}
+
+static int cmp_wasted(const void *a, const void *b) {
+	uint64_t wa = wasted_bytes(&sort_stats[*(const uint32_t *)a]), wb = wasted_bytes(&sort_stats[*(const uint32_t *)b]);
+	return wa < wb ? 1 : (wa > wb ? -1 : 0);
+}
+
+static void report_phase(int phase, uint32_t num_paths, uint32_t events, uint64_t span_us) {
+	path_stats *s = stats[phase];
+	uint64_t total_us = 0, bytes = 0;
+	for (uint32_t i = 0; i < num_paths; i++) {
+		total_us += s[i].total_us;
+		bytes += s[i].read_bytes;
+		order[i] = i;
+	}
+	printf("== %s: %u accesses over %.2f s, %.2f s spent in file hooks, %.1f KB read\n",
+		phase_names[phase], events, span_us / 1e6, total_us / 1e6, bytes / 1024.0);
+	if (!events)
+		return;
+
+	sort_stats = s;
+	qsort(order, num_paths, sizeof(uint32_t), cmp_time);
+	printf("  most expensive files:\n");
+	for (int i = 0; i < ranking_size && i < num_paths && s[order[i]].count; i++) {
+		path_stats *p = &s[order[i]];
+		printf("  %10.2f ms %6u x %10.1f KB  %s\n", p->total_us / 1000.0, p->count, p->read_bytes / 1024.0, paths[order[i]]);
+	}
+
+	qsort(order, num_paths, sizeof(uint32_t), cmp_wasted);
+	if (num_paths && wasted_bytes(&s[order[0]])) {
+		printf("  duplicate reads:\n");
+		for (int i = 0; i < ranking_size && i < num_paths && wasted_bytes(&s[order[i]]); i++) {
+			path_stats *p = &s[order[i]];
+			printf("  %6u reads, %10.1f KB redundant  %s\n", p->reads, wasted_bytes(p) / 1024.0, paths[order[i]]);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("Usage: %s <trace.bin> [files per ranking]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2)
+		ranking_size = atoi(argv[2]);
+
+	FILE *f = fopen(argv[1], "rb");
+	if (!f) {
+		printf("Cannot open %s\n", argv[1]);
+		return 1;
+	}
+	trace_header hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != TRACE_MAGIC || hdr.version != TRACE_VERSION) {
+		printf("%s is not a trace file\n", argv[1]);
+		return 1;
+	}
+	trace_record *records = malloc(hdr.num_records * sizeof(trace_record) + 1);
+	char *pool = malloc(hdr.paths_size + 1);
+	if (fread(records, sizeof(trace_record), hdr.num_records, f) != hdr.num_records
+		|| fread(pool, 1, hdr.paths_size, f) != hdr.paths_size) {
+		printf("%s is truncated\n", argv[1]);
+		return 1;
+	}
+	fclose(f);
+
+	paths = malloc(hdr.num_paths * sizeof(char *) + 1);
+	order = malloc(hdr.num_paths * sizeof(uint32_t) + 1);
+	for (uint32_t i = 0, pos = 0; i < hdr.num_paths; i++) {
+		paths[i] = pool + pos;
+		pos += strlen(pool + pos) + 1;
+	}
+	for (int i = 0; i < NUM_PHASES; i++)
+		stats[i] = calloc(hdr.num_paths + 1, sizeof(path_stats));
+
+	printf("%u records", hdr.num_records);
+	if (hdr.dropped)
+		printf(" (%u older records were overwritten, the boot phase is incomplete)", hdr.dropped);
+	printf("\n");
+
+	// The menus run inside the frontend level, every other level goes through a load and then a race
+	int phase = PHASE_BOOT;
+	uint32_t events[NUM_PHASES] = {0};
+	uint64_t span_us[NUM_PHASES] = {0};
+	uint64_t prev_us = hdr.num_records ? records[0].time_us : 0;
+	char level[64], cur_level[64] = "";
+	for (uint32_t i = 0; i < hdr.num_records; i++) {
+		trace_record *r = &records[i];
+		if (r->path >= hdr.num_paths)
+			continue;
+		if (level_of(paths[r->path], level, sizeof(level)) && strcasecmp(level, cur_level)) {
+			strcpy(cur_level, level);
+			phase = strcasecmp(level, "frontend") ? PHASE_LOAD : PHASE_MENU;
+		} else if (phase == PHASE_LOAD && r->time_us - prev_us > RACE_GAP_US) {
+			phase = PHASE_RACE;
+		}
+		if (r->time_us > prev_us)
+			span_us[phase] += r->time_us - prev_us;
+		prev_us = r->time_us;
+
+		path_stats *s = &stats[phase][r->path];
+		s->total_us += r->duration_us;
+		if (counts_bytes(r))
+			s->read_bytes += r->bytes;
+		if (r->op == TRACE_CLOSE)
+			continue;
+		s->count++;
+		if (is_read(r))
+			s->reads++;
+		events[phase]++;
+	}
+
+	for (int i = 0; i < NUM_PHASES; i++)
+		report_phase(i, hdr.num_paths, events[i], span_us[i]);
+
+	uint32_t per_op[TRACE_NUM_OPS] = {0};
+	uint64_t op_us[TRACE_NUM_OPS] = {0};
+	for (uint32_t i = 0; i < hdr.num_records; i++) {
+		if (records[i].op < TRACE_NUM_OPS) {
+			per_op[records[i].op]++;
+			op_us[records[i].op] += records[i].duration_us;
+		}
+	}
+	printf("== per operation:\n");
+	for (int i = 0; i < TRACE_NUM_OPS; i++)
+		printf("  %-16s %8u calls %10.2f ms\n", op_names[i], per_op[i], op_us[i] / 1000.0);
+	return 0;
+}
@@ -0,0 +1,420 @@
+/* vertfmtcheck.c -- checks the precision of the packed vertex formats and measures what they save on captures
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -Iloader tools/vertfmtcheck.c loader/vertfmt.c -o vertfmtcheck -lm
+ * Usage: vertfmtcheck [capture.bin]...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "glcmd.h"
+#include "vertfmt.h"
+
+/*
+ * Without arguments, packs synthetic vertices shaped like the ones the world and model shaders take and
+ * checks every component the GPU would read back against the tolerance of its attribute, failing the
+ * run when one is over. With captures, every static vertex buffer drawn with a program gets packed with
+ * the layout of its first draw the same way the loader does it, checked the same way, and the memory
+ * and per frame vertex fetches saved get reported.
+ */
+
+#define MAX_SYMBOLS 65536
+#define MAX_BUFFERS 4096
+#define MAX_ATTRIBS 16
+#define SYNTHETIC_VERTS 4096
+
+static const char *format_names[] = {"raw", "float", "unorm8", "snorm8", "unorm16", "snorm16", "half"};
+
+typedef struct {
+	uint32_t name;
+	uint32_t size;
+	uint8_t *data;
+	int state; // 0 waiting for a draw, 1 packed, 2 left as it is
+	uint32_t stride, packed_stride;
+} vertex_buffer;
+
+typedef struct {
+	uint32_t size, type, normalized, stride, offset, buffer;
+} pointer_spec;
+
+typedef struct {
+	uint32_t buffers, frames, draws, packed_draws;
+	uint64_t bytes_before, bytes_after, saved_fetch;
+	float error[VERTFMT_ATTRIBS];
+	uint32_t formats[VERTFMT_ATTRIBS][7];
+	int failed;
+} totals;
+
+static char *symbols[MAX_SYMBOLS];
+static vertex_buffer buffers[MAX_BUFFERS];
+static int num_buffers = 0;
+static pointer_spec pointers[MAX_ATTRIBS];
+static uint32_t enabled = 0, array_buffer = 0, program = 0;
+
+static uint32_t type_size(uint32_t type) {
+	return type == GL_FLOAT ? 4 : type == GL_SHORT || type == GL_UNSIGNED_SHORT || type == 0x8D61 ? 2
+		: type == GL_BYTE || type == GL_UNSIGNED_BYTE ? 1 : 0;
+}
+
+// Reads every packed component back and compares it with the source, returns the attributes over tolerance
+static int check(const uint8_t *data, uint32_t verts, uint32_t stride, const vertfmt_attrib *attribs, int n,
+	uint32_t packed_stride, const uint8_t *packed, totals *t) {
+	int failed = 0;
+	for (int i = 0; i < n; i++) {
+		const vertfmt_attrib *a = &attribs[i];
+		float error = 0.0f;
+		for (uint32_t v = 0; v < verts; v++) {
+			const uint8_t *src = data + v * stride + a->offset, *dst = packed + v * packed_stride + a->packed_offset;
+			if (a->format == VERTFMT_RAW) {
+				if (memcmp(src, dst, a->size * type_size(a->type)))
+					error = INFINITY;
+				continue;
+			}
+			for (int c = 0; c < a->size; c++) {
+				float f;
+				memcpy(&f, src + c * 4, 4);
+				float e = fabsf(vertfmt_decode(dst, a->format, c) - f);
+				if (isnan(f) ? !isnan(vertfmt_decode(dst, a->format, c)) : !(e <= error))
+					error = isnan(f) ? INFINITY : e;
+			}
+		}
+		float tolerance = a->format == VERTFMT_FLOAT || a->format == VERTFMT_RAW ? 0.0f : vertfmt_tolerance(a->location);
+		if (!(error <= tolerance)) {
+			const char *name = vertfmt_attrib_name(a->location);
+			printf("  %s as %s: error %g over the tolerance %g\n", name ? name : "attribute", format_names[a->format],
+				error, tolerance);
+			failed++;
+		}
+		if (a->location < VERTFMT_ATTRIBS) {
+			if (error > t->error[a->location])
+				t->error[a->location] = error;
+			t->formats[a->location][a->format]++;
+		}
+	}
+	return failed;
+}
+
+static uint32_t pack_and_check(const uint8_t *data, uint32_t verts, uint32_t stride, vertfmt_attrib *attribs, int n,
+	totals *t) {
+	uint32_t packed_stride = vertfmt_layout(data, verts, stride, attribs, n);
+	uint8_t *packed = malloc(verts * packed_stride);
+	vertfmt_pack(data, verts, stride, attribs, n, packed_stride, packed);
+	t->failed += check(data, verts, stride, attribs, n, packed_stride, packed, t);
+	free(packed);
+	return packed_stride;
+}
+
+static float randf(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+typedef struct {
+	const char *label;
+	float lo, hi;
+	int bytes; // Values that came from bytes
+	int unit; // Unit vectors
+	int expected; // Format the case has to end up with
+} synthetic_case;
+
+static const synthetic_case cases[VERTFMT_ATTRIBS][3] = {
+	{{"world positions", -20000.0f, 20000.0f, 0, 0, VERTFMT_FLOAT}},
+	{{"colors from bytes", 0.0f, 1.0f, 1, 0, VERTFMT_UNORM8}, {"colors", 0.0f, 1.0f, 0, 0, VERTFMT_UNORM8},
+		{"overbright colors", 0.0f, 2.0f, 0, 0, VERTFMT_HALF}},
+	{{"texcoords", 0.0f, 1.0f, 0, 0, VERTFMT_UNORM16}, {"mirrored texcoords", -1.0f, 1.0f, 0, 0, VERTFMT_SNORM16},
+		{"tiled texcoords", -16.0f, 16.0f, 0, 0, VERTFMT_FLOAT}},
+	{{"fog coords", 0.0f, 1.0f, 0, 0, VERTFMT_UNORM8}},
+	{{"normals", -1.0f, 1.0f, 0, 1, VERTFMT_SNORM8}},
+};
+
+static const int sizes[VERTFMT_ATTRIBS] = {4, 4, 2, 1, 3};
+
+static int synthetic(void) {
+	totals t;
+	memset(&t, 0, sizeof(t));
+	printf("%-22s %-8s %-12s %s\n", "attribute", "format", "max error", "tolerance");
+	for (int loc = 0; loc < VERTFMT_ATTRIBS; loc++) {
+		for (int k = 0; k < 3 && cases[loc][k].label; k++) {
+			const synthetic_case *c = &cases[loc][k];
+			uint32_t stride = sizes[loc] * 4;
+			float *data = malloc(SYNTHETIC_VERTS * stride);
+			for (int v = 0; v < SYNTHETIC_VERTS; v++) {
+				float *p = &data[v * sizes[loc]], len = 0.0f;
+				for (int i = 0; i < sizes[loc]; i++) {
+					p[i] = c->bytes ? (rand() & 0xFF) / 255.0f : randf(c->lo, c->hi);
+					len += p[i] * p[i];
+				}
+				for (int i = 0; c->unit && i < sizes[loc]; i++)
+					p[i] /= sqrtf(len);
+			}
+			// The range ends have to be in there
+			if (!c->unit) {
+				data[0] = c->lo;
+				data[1] = c->hi;
+			}
+			vertfmt_attrib a = {.size = sizes[loc], .type = GL_FLOAT, .location = loc};
+			int failed = t.failed;
+			pack_and_check((const uint8_t *)data, SYNTHETIC_VERTS, stride, &a, 1, &t);
+			if (a.format != c->expected) {
+				printf("  %s packed as %s instead of %s\n", c->label, format_names[a.format], format_names[c->expected]);
+				t.failed++;
+			}
+			printf("%-22s %-8s %-12g %g%s\n", c->label, format_names[a.format], a.error, vertfmt_tolerance(loc),
+				t.failed > failed ? "  FAIL" : "");
+			free(data);
+		}
+	}
+
+	// Whole vertices the way the shaders take them, NaNs and non float attributes have to go through untouched
+	uint32_t stride = 0;
+	vertfmt_attrib attribs[VERTFMT_ATTRIBS + 1];
+	for (int loc = 0; loc < VERTFMT_ATTRIBS; loc++) {
+		attribs[loc] = (vertfmt_attrib){.offset = stride, .size = sizes[loc], .type = GL_FLOAT, .location = loc};
+		stride += sizes[loc] * 4;
+	}
+	attribs[VERTFMT_ATTRIBS] = (vertfmt_attrib){.offset = stride, .size = 4, .type = GL_UNSIGNED_BYTE,
+		.normalized = 1, .location = VERTFMT_ATTRIBS};
+	stride += 4;
+	uint8_t *data = malloc(SYNTHETIC_VERTS * stride);
+	for (int v = 0; v < SYNTHETIC_VERTS; v++) {
+		float *p = (float *)(data + v * stride);
+		for (int i = 0; i < 4; i++)
+			p[i] = i < 3 ? randf(-100.0f, 100.0f) : 1.0f;
+		for (int i = 4; i < 8; i++)
+			p[i] = (rand() & 0xFF) / 255.0f;
+		p[8] = randf(0.0f, 1.0f);
+		p[9] = randf(0.0f, 1.0f);
+		p[10] = v == 7 ? NAN : randf(0.0f, 1.0f);
+		float n[3] = {randf(-1.0f, 1.0f), randf(-1.0f, 1.0f), randf(-1.0f, 1.0f)};
+		float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		for (int i = 0; i < 3; i++)
+			p[11 + i] = n[i] / len;
+		memset(&p[14], v & 0xFF, 4);
+	}
+	uint32_t packed_stride = pack_and_check(data, SYNTHETIC_VERTS, stride, attribs, VERTFMT_ATTRIBS + 1, &t);
+	printf("%-22s %u -> %u bytes per vertex, fog coords with a NaN left as %s\n", "whole vertices", stride,
+		packed_stride, format_names[attribs[3].format]);
+	if (attribs[3].format != VERTFMT_FLOAT || packed_stride != 16 + 4 + 4 + 4 + 4 + 4) {
+		printf("  unexpected packed layout\n");
+		t.failed++;
+	}
+	free(data);
+
+	printf(t.failed ? "FAIL: %d checks failed\n" : "OK\n", t.failed);
+	return t.failed ? 1 : 0;
+}
+
+static vertex_buffer *find_buffer(uint32_t name, int add) {
+	for (int i = 0; i < num_buffers; i++) {
+		if (buffers[i].name == name)
+			return &buffers[i];
+	}
+	if (!add || num_buffers == MAX_BUFFERS)
+		return NULL;
+	memset(&buffers[num_buffers], 0, sizeof(*buffers));
+	buffers[num_buffers].name = name;
+	return &buffers[num_buffers++];
+}
+
+// Same rules as packed_buffer in loader/vertfmt.c
+static void draw(uint32_t count, totals *t) {
+	if (!program || !enabled || (enabled >> VERTFMT_ATTRIBS))
+		return;
+	t->draws++;
+	uint32_t buffer = 0, stride = 0, end = 0;
+	for (int i = 0; i < VERTFMT_ATTRIBS; i++) {
+		if (!(enabled & (1 << i)))
+			continue;
+		const pointer_spec *s = &pointers[i];
+		uint32_t bytes = s->size * type_size(s->type);
+		if (!s->buffer || !s->stride || !bytes || s->offset + bytes > s->stride)
+			return;
+		if (buffer && (s->buffer != buffer || s->stride != stride))
+			return;
+		buffer = s->buffer;
+		stride = s->stride;
+		if (s->offset + bytes > end)
+			end = s->offset + bytes;
+	}
+	vertex_buffer *b = find_buffer(buffer, 0);
+	if (!b || (!b->data && b->state == 0))
+		return;
+	if (b->state == 0) {
+		b->state = 2;
+		vertfmt_attrib attribs[VERTFMT_ATTRIBS];
+		int n = 0;
+		for (int i = 0; i < VERTFMT_ATTRIBS; i++) {
+			const pointer_spec *s = &pointers[i];
+			if (enabled & (1 << i))
+				attribs[n++] = (vertfmt_attrib){.offset = s->offset, .size = s->size, .type = s->type,
+					.normalized = s->normalized, .location = i};
+		}
+		if (end <= b->size) {
+			uint32_t verts = (b->size - end) / stride + 1;
+			uint32_t packed_stride = pack_and_check(b->data, verts, stride, attribs, n, t);
+			if (packed_stride < stride) {
+				b->state = 1;
+				b->stride = stride;
+				b->packed_stride = packed_stride;
+				t->buffers++;
+				t->bytes_before += b->size;
+				t->bytes_after += b->size / stride * packed_stride;
+			}
+		}
+		free(b->data);
+		b->data = NULL;
+	}
+	// Later draws with other layouts would need the loader's attribute match, close enough on the stride
+	if (b->state == 1 && b->stride == stride) {
+		t->packed_draws++;
+		t->saved_fetch += (uint64_t)(b->stride - b->packed_stride) * count;
+	}
+}
+
+static void call(const char *s, const capture_record *r, const uint32_t *a, const uint8_t *data, totals *t) {
+	if (r->flags & CAPTURE_INTERNAL)
+		return;
+	if (!strcmp(s, "glBindBuffer")) {
+		if (a[0] == GL_ARRAY_BUFFER)
+			array_buffer = a[1];
+	} else if (!strcmp(s, "glUseProgram")) {
+		program = a[0];
+	} else if (!strcmp(s, "glBufferData") && a[0] == GL_ARRAY_BUFFER && array_buffer) {
+		vertex_buffer *b = find_buffer(array_buffer, 1);
+		if (!b)
+			return;
+		free(b->data);
+		b->data = NULL;
+		b->state = 2;
+		if (a[3] == GL_STATIC_DRAW && r->size >= a[1] && a[1] && (b->data = malloc(a[1]))) {
+			memcpy(b->data, data, a[1]);
+			b->size = a[1];
+			b->state = 0;
+		}
+	} else if (!strcmp(s, "glBufferSubData") && a[0] == GL_ARRAY_BUFFER) {
+		vertex_buffer *b = find_buffer(array_buffer, 0);
+		if (b) {
+			free(b->data);
+			b->data = NULL;
+			b->state = 2;
+		}
+	} else if (!strcmp(s, "glVertexAttribPointer") && a[0] < MAX_ATTRIBS) {
+		pointers[a[0]] = (pointer_spec){a[1], a[2], a[3], a[4], a[5], array_buffer};
+	} else if (!strcmp(s, "glEnableVertexAttribArray") && a[0] < MAX_ATTRIBS) {
+		enabled |= 1 << a[0];
+	} else if (!strcmp(s, "glDisableVertexAttribArray") && a[0] < MAX_ATTRIBS) {
+		enabled &= ~(1 << a[0]);
+	} else if (!strcmp(s, "glDrawElements")) {
+		draw(a[1], t);
+	} else if (!strcmp(s, "glDrawArrays")) {
+		draw(a[2], t);
+	}
+}
+
+static int report(const char *path, totals *t) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		printf("Could not open %s\n", path);
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	size_t size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *buf = malloc(size);
+	if (!buf || fread(buf, 1, size, f) != size) {
+		printf("Could not read %s\n", path);
+		fclose(f);
+		free(buf);
+		return 0;
+	}
+	fclose(f);
+
+	const capture_header *h = (const capture_header *)buf;
+	if (size < sizeof(*h) || h->magic != CAPTURE_MAGIC || h->version != CAPTURE_VERSION) {
+		printf("%s: not a capture this version of vertfmtcheck can read\n", path);
+		free(buf);
+		return 0;
+	}
+	size_t pos = sizeof(*h);
+	while (pos + sizeof(capture_record) <= size) {
+		capture_record r;
+		memcpy(&r, buf + pos, sizeof(r));
+		pos += sizeof(r);
+		if (pos + r.nargs * sizeof(uint32_t) + ((r.size + 3) & ~3) > size)
+			break;
+		const uint32_t *args = (const uint32_t *)(buf + pos);
+		pos += r.nargs * sizeof(uint32_t);
+		const uint8_t *data = buf + pos;
+		pos += (r.size + 3) & ~3;
+		if (r.type == CAPTURE_SYMBOL) {
+			free(symbols[r.symbol]);
+			symbols[r.symbol] = strndup((const char *)data, r.size);
+		} else if (r.type == CAPTURE_CALL && symbols[r.symbol]) {
+			call(symbols[r.symbol], &r, args, data, t);
+		} else if (r.type == CAPTURE_FRAME) {
+			t->frames++;
+		}
+	}
+	free(buf);
+
+	for (int i = 0; i < num_buffers; i++) {
+		free(buffers[i].data);
+		buffers[i].data = NULL;
+	}
+	num_buffers = 0;
+	enabled = array_buffer = program = 0;
+	for (int i = 0; i < MAX_SYMBOLS; i++) {
+		free(symbols[i]);
+		symbols[i] = NULL;
+	}
+	return 1;
+}
+
+static void print_totals(const char *label, const totals *t) {
+	uint32_t frames = t->frames ? t->frames : 1;
+	printf("%-24s %7u %6u/%-6u %8.1f + %-8.1f %10.1f\n", label, t->buffers, t->packed_draws / frames,
+		t->draws / frames, t->bytes_before / 1024.0, t->bytes_after / 1024.0, t->saved_fetch / 1024.0 / frames);
+	for (int loc = 1; loc < VERTFMT_ATTRIBS; loc++) {
+		uint32_t total = 0;
+		for (int f = 0; f < 7; f++)
+			total += t->formats[loc][f];
+		if (!total)
+			continue;
+		printf("%-24s %-11s max error %-10g", "", vertfmt_attrib_name(loc), t->error[loc]);
+		for (int f = 0; f < 7; f++) {
+			if (t->formats[loc][f])
+				printf(" %s %u", format_names[f], t->formats[loc][f]);
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2)
+		return synthetic();
+
+	printf("%-24s %7s %-13s %-20s %s\n", "capture", "buffers", "packed draws", "KB original + packed", "KB fetched less per frame");
+	int failed = 0;
+	for (int i = 1; i < argc; i++) {
+		totals t;
+		memset(&t, 0, sizeof(t));
+		if (!report(argv[i], &t))
+			continue;
+		const char *name = strrchr(argv[i], '/');
+		print_totals(name ? name + 1 : argv[i], &t);
+		failed += t.failed;
+	}
+	if (failed)
+		printf("FAIL: %d attributes over their tolerance\n", failed);
+	return failed ? 1 : 0;
+}